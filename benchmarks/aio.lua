@@ -0,0 +1,98 @@
+#!/usr/bin/env lua
+
+--[[
+
+ Random read IOPS benchmark of the asynchronous I/O engines of the Lua/APR
+ binding (see apr.aio()). A data file is read in random 4 KB blocks using
+ file:seek() + file:read() and using the io_uring and thread pool engines at a
+ few queue depths. Use a data file that's larger than RAM (or drop the page
+ cache between runs) to measure the disk instead of the page cache:
+
+   lua benchmarks/aio.lua [DATAFILE [SIZE_IN_MB]]
+
+--]]
+
+local apr = require 'apr'
+
+local function msg(...)
+  io.stderr:write(string.format(...), '\n')
+end
+
+local BLOCKSIZE = 4096
+local READS = 50000
+
+local datafile = arg[1] or os.tmpname()
+local size = (tonumber(arg[2]) or 256) * 1024 * 1024
+local blocks = math.floor(size / BLOCKSIZE)
+
+if apr.stat(datafile, 'size') ~= blocks * BLOCKSIZE then
+  local handle = assert(apr.file_open(datafile, 'wb'))
+  local block = string.rep('x', BLOCKSIZE)
+  for i = 1, blocks do assert(handle:write(block)) end
+  assert(handle:close())
+end
+
+-- Use the same offsets for all runs.
+local offsets = {}
+for i = 1, READS do
+  offsets[i] = math.random(0, blocks - 1) * BLOCKSIZE
+end
+
+local function timeit(func)
+  local best
+  for i = 1, 3 do
+    local start = apr.time_now()
+    func()
+    local total = apr.time_now() - start
+    best = best and best < total and best or total
+  end
+  return best
+end
+
+local function report(label, time)
+  msg('%32s: %i reads of %s in %.2fs (%i IOPS, %s/s)', label, READS,
+      apr.strfsize(BLOCKSIZE), time, READS / time,
+      apr.strfsize(READS * BLOCKSIZE / time))
+end
+
+report("file:seek() + file:read()", timeit(function()
+  local handle = assert(apr.file_open(datafile, 'rb'))
+  for i = 1, READS do
+    assert(handle:seek('set', offsets[i]))
+    assert(#handle:read(BLOCKSIZE) == BLOCKSIZE)
+  end
+  assert(handle:close())
+end))
+
+local function randomreads(engine, depth)
+  return function()
+    local handle = assert(apr.file_open(datafile, 'rb'))
+    local queued, done = 0, 0
+    while done < READS do
+      -- Keep the queue filled up to the given depth.
+      while queued < READS and queued - done < depth do
+        queued = queued + 1
+        engine:read(handle, offsets[queued], BLOCKSIZE)
+      end
+      for _, completion in ipairs(assert(engine:completions(1))) do
+        assert(#completion.result == BLOCKSIZE)
+        done = done + 1
+      end
+    end
+    assert(handle:close())
+  end
+end
+
+for _, backend in ipairs { 'io_uring', 'threads' } do
+  for _, depth in ipairs { 1, 8, 32, 128 } do
+    local engine, errmsg = apr.aio { backend = backend, entries = depth, threads = math.min(depth, 32) }
+    if not engine then
+      msg('%32s: %s', backend, errmsg)
+      break
+    end
+    report(string.format('%s (queue depth %i)', backend, depth), timeit(randomreads(engine, depth)))
+    assert(engine:close())
+  end
+end
+
+if not arg[1] then os.remove(datafile) end
@@ -0,0 +1,112 @@
+#!/usr/bin/env lua
+
+--[[
+
+ Throughput benchmarks of the compression filters of the Lua/APR binding
+ (see file:filter()). For every available format a log file like data set is
+ compressed at a few levels and decompressed again, both using file:read('*l')
+ and file:read('*a'). Reading the same data uncompressed and through a
+ `gzip -dc` pipe are included for reference.
+
+--]]
+
+local apr = require 'apr'
+
+local function msg(...)
+  io.stderr:write(string.format(...), '\n')
+end
+
+local function generate(size)
+  -- Generate log lines with some repetition, like real log files.
+  local lines, total = {}, 0
+  local random = math.random
+  local paths = { '/', '/index.html', '/images/logo.png', '/api/v1/items', '/login' }
+  while total < size do
+    local line = string.format('10.0.%i.%i - - [18/Oct/2026:%02i:%02i:%02i +0000] "GET %s HTTP/1.1" %i %i',
+        random(0, 255), random(0, 255), random(0, 23), random(0, 59), random(0, 59),
+        paths[random(#paths)], random() < 0.9 and 200 or 404, random(100, 100000))
+    lines[#lines + 1] = line
+    total = total + #line + 1
+  end
+  return table.concat(lines, '\n') .. '\n'
+end
+
+local function timeit(func)
+  local best
+  for i = 1, 3 do
+    local start = apr.time_now()
+    func()
+    local total = apr.time_now() - start
+    best = best and best < total and best or total
+  end
+  return best
+end
+
+local function readall(handle, format)
+  repeat
+    local result = handle:read(format)
+  until format == '*a' and result == '' or not result
+end
+
+local plainfile = os.tmpname()
+local packedfile = os.tmpname()
+local data = generate(1024 * 1024 * 25)
+local size = #data
+
+local handle = assert(apr.file_open(plainfile, 'wb'))
+assert(handle:write(data))
+assert(handle:close())
+
+for _, format in ipairs { '*l', '*a' } do
+  local time = timeit(function()
+    local handle = assert(apr.file_open(plainfile, 'rb'))
+    readall(handle, format)
+    assert(handle:close())
+  end)
+  msg('%22s: read %s with file:read(%s) at %s/s', "Uncompressed",
+      apr.strfsize(size), format, apr.strfsize(size / time))
+end
+
+for _, format in ipairs { 'gzip', 'deflate', 'zstd', 'lz4' } do
+  for _, level in ipairs { 1, 6, 9 } do
+    local label = format .. ' level ' .. level
+    local handle = assert(apr.file_open(packedfile, 'wb'))
+    local status, errmsg, errcode = handle:filter(format, level)
+    assert(handle:close())
+    if not status then
+      msg('%22s: %s', format, errmsg)
+      break
+    end
+    local time = timeit(function()
+      local handle = assert(apr.file_open(packedfile, 'wb'))
+      assert(handle:filter(format, level))
+      assert(handle:write(data))
+      assert(handle:close())
+    end)
+    local packed = assert(apr.stat(packedfile, 'size'))
+    msg('%22s: compressed %s to %s at %s/s', label, apr.strfsize(size),
+        apr.strfsize(packed), apr.strfsize(size / time))
+    for _, readformat in ipairs { '*l', '*a' } do
+      time = timeit(function()
+        local handle = assert(apr.file_open(packedfile, 'rb'))
+        assert(handle:filter(format))
+        readall(handle, readformat)
+        assert(handle:close())
+      end)
+      msg('%22s: read %s with file:read(%s) at %s/s', label,
+          apr.strfsize(size), readformat, apr.strfsize(size / time))
+    end
+    if format == 'gzip' then
+      time = timeit(function()
+        local handle = io.popen('gzip -dc "' .. packedfile .. '"')
+        readall(handle, '*l')
+        handle:close()
+      end)
+      msg('%22s: read %s with gzip -dc | file:read(*l) at %s/s', label,
+          apr.strfsize(size), apr.strfsize(size / time))
+    end
+  end
+end
+
+os.remove(plainfile)
+os.remove(packedfile)
@@ -0,0 +1,75 @@
+#!/usr/bin/env lua
+
+--[[
+
+ Benchmark of the CR LF to LF translation performed by file:read() and the
+ LF to CR LF expansion performed by file:write() in text mode, compared to
+ the same operations in binary mode. The files used have Windows style line
+ endings and lines of varying length.
+
+--]]
+
+local apr = require 'apr'
+
+local function msg(...)
+  io.stderr:write(string.format(...), '\n')
+end
+
+local function generate(size, linelength)
+  local line = {}
+  local char = string.char
+  local random = math.random
+  for i = 1, linelength do line[#line + 1] = char(random(0x20, 0x7E)) end
+  line = table.concat(line) .. '\r\n'
+  return line:rep(math.ceil(size / #line)):sub(1, size)
+end
+
+local function benchread(path, mode, format, size, label)
+  local best
+  for i = 1, 3 do
+    local start = apr.time_now()
+    local handle = assert(apr.file_open(path, mode))
+    repeat
+      local result = handle:read(format)
+    until format == '*a' and result == '' or not result
+    handle:close()
+    local total = apr.time_now() - start
+    best = best and best < total and best or total
+  end
+  msg('%22s: read %s with file:read(%s) at %s/s',
+      label, apr.strfsize(size), format, apr.strfsize(size / best))
+end
+
+local function benchwrite(path, mode, data, label)
+  local best
+  for i = 1, 3 do
+    local start = apr.time_now()
+    local handle = assert(apr.file_open(path, mode))
+    assert(handle:write(data))
+    assert(handle:close())
+    local total = apr.time_now() - start
+    best = best and best < total and best or total
+  end
+  msg('%22s: wrote %s with file:write() at %s/s',
+      label, apr.strfsize(#data), apr.strfsize(#data / best))
+end
+
+local datafile = os.tmpname() .. '.txt'
+local size = 1024 * 1024 * 25
+
+for _, linelength in ipairs { 10, 80, 1000 } do
+  msg('Lines of %i characters:', linelength)
+  local data = generate(size, linelength)
+  local handle = io.open(datafile, 'wb')
+  handle:write(data)
+  handle:close()
+  for _, format in ipairs { '*a', '*l', 4096 } do
+    benchread(datafile, 'rb', format, size, "Binary mode")
+    benchread(datafile, 'rt', format, size, "Text mode")
+  end
+  data = data:gsub('\r\n', '\n')
+  benchwrite(datafile, 'wb', data, "Binary mode")
+  benchwrite(datafile, 'wt', data, "Text mode")
+end
+
+os.remove(datafile)
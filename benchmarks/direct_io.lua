@@ -0,0 +1,74 @@
+#!/usr/bin/env lua
+
+--[[
+
+ Sequential throughput benchmark of buffered versus direct I/O in the Lua/APR
+ binding (see the 'd' flag of apr.file_open()). A large file is written and
+ read back in 1 MB chunks, once through the page cache and once bypassing it.
+ The data file should be on a file system that supports direct I/O (tmpfs
+ doesn't). Note that buffered writes may only reach the page cache, use a size
+ larger than RAM to measure the disk in both modes:
+
+   lua benchmarks/direct_io.lua [DATAFILE [SIZE_IN_MB]]
+
+--]]
+
+local apr = require 'apr'
+
+local function msg(...)
+  io.stderr:write(string.format(...), '\n')
+end
+
+local CHUNKSIZE = 1024 * 1024
+
+local datafile = arg[1] or 'direct_io.dat'
+local chunks = tonumber(arg[2]) or 512
+local chunk = string.rep('x', CHUNKSIZE)
+
+local function timeit(func)
+  local best
+  for i = 1, 3 do
+    local start = apr.time_now()
+    func()
+    local total = apr.time_now() - start
+    best = best and best < total and best or total
+  end
+  return best
+end
+
+local function report(label, time)
+  msg('%24s: %s in %.2fs (%s/s)', label, apr.strfsize(chunks * CHUNKSIZE),
+      time, apr.strfsize(chunks * CHUNKSIZE / time))
+end
+
+local function write_test(mode)
+  return timeit(function()
+    local handle = assert(apr.file_open(datafile, mode))
+    for i = 1, chunks do assert(handle:write(chunk)) end
+    assert(handle:close())
+  end)
+end
+
+local function read_test(mode)
+  return timeit(function()
+    local handle = assert(apr.file_open(datafile, mode))
+    while handle:read(CHUNKSIZE) do end
+    assert(handle:close())
+  end)
+end
+
+local handle, message = apr.file_open(datafile, 'wbd')
+if not handle then
+  msg("Direct I/O not supported for %s: %s", datafile, message)
+  os.exit(1)
+end
+assert(handle:close())
+
+report("buffered writes", write_test 'wb')
+report("direct writes", write_test 'wbd')
+-- Reads of the buffered file are mostly served by the page cache when the
+-- file fits in RAM; that's the point of comparing them with direct reads.
+report("buffered reads", read_test 'rb')
+report("direct reads", read_test 'rbd')
+
+os.remove(datafile)
@@ -0,0 +1,63 @@
+#!/usr/bin/env lua
+
+--[[
+
+ Benchmark of the HTTP header and query string parsers of the Lua/APR binding.
+ The apreq2 based parsers (which create a new table on every call) are
+ compared to the built-in parsers that fill a reusable table, using requests
+ like the ones sent by web browsers.
+
+--]]
+
+local apr = require 'apr'
+
+local function msg(...)
+  io.stderr:write(string.format(...), '\n')
+end
+
+if not apr.parse_headers then
+  msg "HTTP request parsing module not available!"
+  return
+end
+
+local headers = table.concat({
+  'Host: www.example.com',
+  'User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:102.0) Gecko/20100101 Firefox/102.0',
+  'Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8',
+  'Accept-Language: en-US,en;q=0.5',
+  'Accept-Encoding: gzip, deflate, br',
+  'Referer: https://www.example.com/search?q=lua+apr',
+  'Connection: keep-alive',
+  'Cookie: session=4f1e7a2bd0c2499a8a3f; theme=dark; lang=en',
+  'Upgrade-Insecure-Requests: 1',
+  'Sec-Fetch-Dest: document',
+  'Sec-Fetch-Mode: navigate',
+  'Sec-Fetch-Site: same-origin',
+  'Cache-Control: max-age=0',
+  '', '',
+}, '\r\n')
+
+local query = 'q=lua+apr&lang=en&page=2&sort=date%20desc&filter=type%3Dsource&filter=license%3Dmit&utf8=%E2%9C%93&empty'
+
+local function timeit(count, func)
+  local best
+  for i = 1, 3 do
+    local start = apr.time_now()
+    for j = 1, count do func() end
+    local total = apr.time_now() - start
+    best = best and best < total and best or total
+  end
+  return count / best
+end
+
+local count = 100000
+local reused = {}
+
+msg('%30s: %i requests/s', "apr.parse_headers(s)",
+    timeit(count, function() assert(apr.parse_headers(headers)) end))
+msg('%30s: %i requests/s', "apr.parse_headers(s, table)",
+    timeit(count, function() assert(apr.parse_headers(headers, reused)) end))
+msg('%30s: %i queries/s', "apr.parse_query_string(s)",
+    timeit(count, function() assert(apr.parse_query_string(query)) end))
+msg('%30s: %i queries/s', "apr.parse_query_string(s, table)",
+    timeit(count, function() assert(apr.parse_query_string(query, reused)) end))
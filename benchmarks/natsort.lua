@@ -0,0 +1,53 @@
+#!/usr/bin/env lua
+
+--[[
+
+ Benchmark of apr.natsort() against table.sort() with apr.strnatcmp() as the
+ comparison function, on arrays of file names like "photo-123.jpg".
+
+--]]
+
+local apr = require 'apr'
+
+local function msg(...)
+  io.stderr:write(string.format(...), '\n')
+end
+
+local function generate(count)
+  local list = {}
+  local random = math.random
+  local prefixes = { 'photo-', 'IMG_', 'rfc', 'chapter ', 'track' }
+  for i = 1, count do
+    list[i] = prefixes[random(#prefixes)] .. random(1, count) .. '.' .. (random() < 0.5 and 'jpg' or 'txt')
+  end
+  return list
+end
+
+local function copy(list)
+  local result = {}
+  for i = 1, #list do result[i] = list[i] end
+  return result
+end
+
+local function timeit(label, count, func)
+  local start = apr.time_now()
+  func()
+  local total = apr.time_now() - start
+  msg('%40s: sorted %i strings in %.2f seconds', label, count, total)
+end
+
+for _, count in ipairs { 1000, 10000, 100000, 1000000 } do
+  local list = generate(count)
+  for _, casefold in ipairs { false, true } do
+    local comparator = casefold and apr.strnatcasecmp or apr.strnatcmp
+    local name = casefold and 'apr.strnatcasecmp' or 'apr.strnatcmp'
+    local input = copy(list)
+    timeit('table.sort(list, ' .. name .. ')', count, function()
+      table.sort(input, comparator)
+    end)
+    input = copy(list)
+    timeit('apr.natsort(list, ' .. tostring(casefold) .. ')', count, function()
+      apr.natsort(input, casefold)
+    end)
+  end
+end
@@ -0,0 +1,105 @@
+#!/usr/bin/env lua
+
+--[[
+
+ Benchmark of file:read_records() in the Lua/APR binding compared to reading
+ a TSV file with file:lines() and splitting each line in Lua using
+ string.gmatch(), both for all columns and for a few selected columns
+ converted to numbers.
+
+--]]
+
+local apr = require 'apr'
+
+local function msg(...)
+  io.stderr:write(string.format(...), '\n')
+end
+
+local function generate(path, size)
+  -- Generate rows that look like a database export.
+  local handle = assert(apr.file_open(path, 'wb'))
+  local random = math.random
+  local total, rows = 0, 0
+  local names = { 'alpha', 'bravo', 'charlie', 'delta', 'echo', 'foxtrot' }
+  while total < size do
+    local line = string.format('%i\t%s\t%i\t%.2f\t2026-10-%02i\t%s\n',
+        rows + 1, names[random(#names)], random(1, 100000), random() * 1000,
+        random(1, 31), string.rep('x', random(5, 40)))
+    assert(handle:write(line))
+    total = total + #line
+    rows = rows + 1
+  end
+  assert(handle:close())
+  return total, rows
+end
+
+local function timeit(func)
+  local best
+  for i = 1, 3 do
+    local start = apr.time_now()
+    func()
+    local total = apr.time_now() - start
+    best = best and best < total and best or total
+  end
+  return best
+end
+
+local datafile = os.tmpname()
+local size, count = generate(datafile, 1024 * 1024 * 50)
+
+local function report(label, time)
+  msg('%38s: %s at %s/s (%i rows/s)', label, apr.strfsize(size),
+      apr.strfsize(size / time), count / time)
+end
+
+report("file:lines() + gmatch()", timeit(function()
+  local handle = assert(apr.file_open(datafile, 'rb'))
+  local n = 0
+  for line in handle:lines() do
+    local row = {}
+    for field in line:gmatch '[^\t]*' do row[#row + 1] = field end
+    n = n + 1
+  end
+  assert(handle:close())
+  assert(n == count)
+end))
+
+report("file:lines() + gmatch() + tonumber()", timeit(function()
+  local handle = assert(apr.file_open(datafile, 'rb'))
+  local n = 0
+  for line in handle:lines() do
+    local id, _, amount, price = line:match '^([^\t]*)\t([^\t]*)\t([^\t]*)\t([^\t]*)'
+    local row = { tonumber(id), tonumber(amount), tonumber(price) }
+    n = n + 1
+  end
+  assert(handle:close())
+  assert(n == count)
+end))
+
+local function readrecords(options)
+  return function()
+    local handle = assert(apr.file_open(datafile, 'rb'))
+    local n = 0
+    while true do
+      local rows = handle:read_records(options)
+      if not rows then break end
+      n = n + #rows
+    end
+    assert(handle:close())
+    assert(n == count)
+  end
+end
+
+report("file:read_records()", timeit(readrecords {
+  sep = '\t', quote = false,
+}))
+
+report("file:read_records() + fields/numbers", timeit(readrecords {
+  sep = '\t', quote = false, fields = { 1, 3, 4 }, numbers = true,
+}))
+
+report("file:read_records() with quoting", timeit(readrecords {
+  sep = '\t',
+}))
+
+os.remove(datafile)
@@ -0,0 +1,54 @@
+#!/usr/bin/env lua
+
+--[[
+
+ Durable appends per second benchmark of the write-ahead logs of the Lua/APR
+ binding (see apr.wal()). A number of threads append small records to one log
+ and every append waits until its record is on disk. With one thread every
+ record costs one fdatasync(), with more threads group commit writes the
+ records of all waiting threads using one fdatasync(). Run this on the file
+ system you care about, fsync() latency differs a lot between devices:
+
+   lua benchmarks/wal.lua [LOGFILE [RECORDS_PER_THREAD]]
+
+--]]
+
+local apr = require 'apr'
+
+local function msg(...)
+  io.stderr:write(string.format(...), '\n')
+end
+
+local logfile = arg[1] or 'wal_benchmark.log'
+local records = tonumber(arg[2]) or 1000
+
+local function run(nthreads)
+  os.remove(logfile)
+  local wal = assert(apr.wal(logfile))
+  local threads = {}
+  local start = apr.time_now()
+  for i = 1, nthreads do
+    threads[i] = assert(apr.thread(function()
+      local apr = require 'apr'
+      local record = string.rep('x', 100)
+      for j = 1, records do
+        assert(wal:append(record))
+      end
+    end))
+  end
+  for i = 1, nthreads do
+    assert(threads[i]:join())
+  end
+  local total = apr.time_now() - start
+  local stats = wal:stats()
+  assert(wal:close())
+  return total, stats
+end
+
+for _, nthreads in ipairs { 1, 2, 4, 8, 16, 32 } do
+  local time, stats = run(nthreads)
+  msg('%2i threads: %6i durable appends/s, %5.1f records per fdatasync()',
+      nthreads, stats.records / time, stats.records / stats.commits)
+end
+
+os.remove(logfile)
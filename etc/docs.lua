@@ -12,7 +12,10 @@
 -- Files containing documentation fragments (the individual lines enable
 -- automatic rebasing between git feature branches and the master branch).
 local SOURCES = [[
+  aio.c
   base64.c
+  blob.c
+  bytebuf.c
   crypt.c
   date.c
   dbd.c
@@ -28,17 +31,20 @@ local SOURCES = [[
   memcache.c
   getopt.c
   http.c
+  http_response.c
   pollset.c
   proc.c
   shm.c
   signal.c
   str.c
+  struct.c
   thread.c
   thread_queue.c
   time.c
   uri.c
   user.c
   uuid.c
+  wal.c
   xlate.c
   xml.c
   serialize.c
@@ -473,7 +479,8 @@ end
 
 local custom_sorting = {
   ['crypt.c'] = [[ apr.md5 apr.md5_encode apr.password_validate
-    apr.password_get apr.md5_init md5_context:update md5_context:digest
+    apr.password_get apr.password_validate_async apr.password_hash_async
+    password_job:ready password_job:wait apr.md5_init md5_context:update md5_context:digest
     md5_context:reset apr.sha1 apr.sha1_init sha1_context:update
     sha1_context:digest sha1_context:reset ]],
   ['thread.c'] = [[ apr.thread apr.thread_yield thread:status thread:join ]],
@@ -481,8 +488,8 @@ local custom_sorting = {
   ['io_file.c'] = [[ apr.file_link apr.file_copy apr.file_append
     apr.file_rename apr.file_remove apr.file_truncate apr.file_mtime_set
     apr.file_attrs_set apr.file_perms_set apr.stat apr.file_open file:stat
-    file:lines file:truncate file:read file:write file:seek file:flush
-    file:lock file:unlock pipe:timeout_get pipe:timeout_set file:fd_get
+    file:lines file:truncate file:allocate file:punch_hole file:text_mode file:filter file:read file:read_into file:read_until file:read_frame file:read_struct file:read_records file:write file:write_struct file:seek file:flush
+    file:lock file:unlock file:lock_range file:unlock_range pipe:timeout_get pipe:timeout_set file:fd_get
     file:inherit_set file:inherit_unset file:close ]],
 }
 
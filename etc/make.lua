@@ -118,6 +118,21 @@ local function mergeflags(flags, command)
   end
 end
 
+-- haspackage() -- Check whether pkg-config knows about a package. {{{2
+
+local function haspackage(name)
+  return os.execute('pkg-config --exists ' .. name .. ' >/dev/null 2>&1') == 0
+end
+
+-- Optional libraries used by the compression filters (see src/filter.c) and
+-- the asynchronous I/O engine (see src/aio.c).
+local optional_libraries = {
+  { package = 'zlib', define = 'LUA_APR_HAVE_ZLIB', feature = 'gzip/deflate filters' },
+  { package = 'libzstd', define = 'LUA_APR_HAVE_ZSTD', feature = 'zstd filters' },
+  { package = 'liblz4', define = 'LUA_APR_HAVE_LZ4', feature = 'lz4 filters' },
+  { package = 'liburing', define = 'LUA_APR_HAVE_IO_URING', feature = 'io_uring I/O engine' },
+}
+
 -- getcflags() -- Get the compiler flags needed to build the Lua/APR binding. {{{1
 
 local function getcflags()
@@ -152,6 +167,16 @@ local function getcflags()
   end
   -- Let the C source code know whether libapreq2 is available.
   flags[#flags + 1] = '-DLUA_APR_HAVE_APREQ=' .. (have_apreq and 1 or 0)
+  -- Compiler flags for the optional libraries.
+  for _, library in ipairs(optional_libraries) do
+    local available = haspackage(library.package)
+    if available then
+      mergeflags(flags, 'pkg-config --cflags ' .. library.package)
+    elseif DEBUG then
+      message("Warning: Failed to find %s, disabling %s.", library.package, library.feature)
+    end
+    flags[#flags + 1] = '-D' .. library.define .. '=' .. (available and 1 or 0)
+  end
   return table.concat(flags, ' ')
 end
 
@@ -178,6 +203,12 @@ local function getlflags()
   if DEBUG and #flags == 0 then
     message "Warning: Failed to determine apreq2 linker flags."
   end
+  -- Linker flags for the optional libraries.
+  for _, library in ipairs(optional_libraries) do
+    if haspackage(library.package) then
+      mergeflags(flags, 'pkg-config --libs ' .. library.package)
+    end
+  end
   return table.concat(flags, ' ')
 end
 
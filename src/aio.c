@@ -0,0 +1,1101 @@
+/* Asynchronous file I/O module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * The methods of file objects are synchronous: every `file:read()` call
+ * blocks until the data is available, so a Lua script that reads from many
+ * files at once only ever has one request outstanding. An asynchronous I/O
+ * engine created with `apr.aio()` accepts batches of positional reads, writes,
+ * fsyncs and opens, executes them concurrently and reports the results in
+ * batches. It works as follows:
+ *
+ *  1. Queue one or more requests using `engine:read()`, `engine:write()`,
+ *     `engine:fsync()` and `engine:open()`; each returns a request id
+ *  2. Call `engine:submit()` to start all queued requests at once
+ *  3. Call `engine:completions()` to get the results of finished requests
+ *
+ * On Linux the engine uses [io_uring] [io_uring] when Lua/APR was built with
+ * liburing and the kernel supports it; one system call submits a whole batch
+ * of requests and another one harvests a batch of completions. Elsewhere (or
+ * when io_uring is unavailable at runtime, for example because it's disabled
+ * by a seccomp policy) a pool of threads executes the requests using blocking
+ * system calls. Both implementations behave the same from Lua, use
+ * `engine:backend()` to find out which one you got.
+ *
+ * Engines can be added to a pollset (see `apr.pollset()`) which reports them
+ * as readable when completions are waiting, so an event loop doesn't have to
+ * block in `engine:completions()`:
+ *
+ *     > engine = assert(apr.aio())
+ *     > handle = assert(apr.file_open('/etc/passwd'))
+ *     > id = engine:read(handle, 0, 4096)
+ *     > = engine:submit()
+ *     1
+ *     > for _, completion in ipairs(engine:completions(1)) do
+ *     >>  print(completion.id, completion.op, #completion.result)
+ *     >> end
+ *     1       read    2419
+ *
+ * Requests operate on the file descriptor of a file object and bypass the
+ * buffers of the file object, so mixing them with buffered reads and writes
+ * on the same file object is a bad idea. Don't close a file object while it
+ * has requests in flight. Files opened for direct I/O (the `d` mode of
+ * `apr.file_open()`) can't be read or written using an engine. An engine can
+ * only be used from the Lua state that created it: it can't be passed to
+ * `apr.ref()` or to other threads (create one engine per thread instead).
+ *
+ * [io_uring]: http://en.wikipedia.org/wiki/Io_uring
+ */
+
+#include "lua_apr.h"
+#include <apr_portable.h>
+
+#if APR_HAS_THREADS
+
+#include <apr_thread_cond.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_pool.h>
+
+#ifndef LUA_APR_HAVE_IO_URING
+# define LUA_APR_HAVE_IO_URING 0
+#endif
+
+#if LUA_APR_HAVE_IO_URING
+# include <liburing.h>
+# include <sys/eventfd.h>
+# include <fcntl.h>
+#endif
+
+#if !defined(WIN32)
+# include <unistd.h>
+#endif
+
+/* The default size of the submission queue of an io_uring engine. */
+#define LUA_APR_AIO_ENTRIES 64
+
+/* The default maximum number of threads of a thread pool engine. */
+#define LUA_APR_AIO_THREADS 4
+
+/* Internal functions. {{{1 */
+
+typedef enum { AIO_READ, AIO_WRITE, AIO_FSYNC, AIO_OPEN } lua_apr_aio_op;
+
+static const char *const aio_op_names[] = { "read", "write", "fsync", "open", NULL };
+
+typedef struct lua_apr_aio_engine lua_apr_aio_engine;
+typedef struct lua_apr_aio_request lua_apr_aio_request;
+
+/* A request is allocated with malloc() (together with its read buffer or
+ * pathname) when it's queued and freed after its completion has been reported
+ * to Lua. Between submission and completion it belongs to the kernel or to a
+ * worker thread. */
+struct lua_apr_aio_request {
+  lua_apr_aio_request *next;  /* next request in queued or completed list    */
+  lua_apr_aio_engine *engine; /* engine that executes the request            */
+  lua_apr_aio_op op;          /* type of request                             */
+  lua_Integer id;             /* identifier returned to Lua                  */
+  apr_os_file_t fd;           /* native file descriptor (not for AIO_OPEN)   */
+  apr_off_t offset;           /* file offset of read/write                   */
+  apr_size_t length;          /* number of bytes to read/write               */
+  apr_size_t done;            /* number of bytes read/written                */
+  char *data;                 /* read buffer or data to write                */
+  int datasync;               /* fsync() only the data, not the metadata?    */
+  char *path;                 /* pathname of AIO_OPEN                        */
+  char mode[8];               /* mode string of AIO_OPEN                     */
+  apr_int32_t flags;          /* flags of AIO_OPEN parsed from mode string   */
+  apr_fileperms_t perms;      /* permissions of AIO_OPEN                     */
+  lua_apr_pool *refpool;      /* memory pool of file opened by worker thread */
+  apr_file_t *handle;         /* file opened by worker thread                */
+  apr_status_t status;        /* result of request                           */
+};
+
+/* The state of an engine lives in its own memory pool so that the Lua object
+ * only contains a pointer (objects can be copied by apr.ref()). */
+struct lua_apr_aio_engine {
+  apr_pool_t *pool;                  /* memory pool of engine                 */
+  int uring;                         /* using io_uring (else thread pool)?    */
+# if LUA_APR_HAVE_IO_URING
+  struct io_uring ring;              /* submission and completion queues      */
+  unsigned int capacity;             /* maximum number of requests in flight  */
+# endif
+  apr_thread_pool_t *threads;        /* worker threads (thread pool engine)   */
+  apr_thread_mutex_t *mutex;         /* protects completed list               */
+  apr_thread_cond_t *cond;           /* signals completions to Lua thread     */
+  apr_file_t *readable;              /* completion descriptor for pollsets    */
+  apr_file_t *writable;              /* write end of pipe (thread pool)       */
+  lua_apr_aio_request *queued;       /* requests waiting for engine:submit()  */
+  lua_apr_aio_request **queued_tail; /* where to append the next request      */
+  lua_apr_aio_request *completed;    /* requests waiting to be reported       */
+  lua_apr_aio_request **completed_tail;
+  int nqueued;                       /* number of queued requests             */
+  int inflight;                      /* submitted and not yet reported        */
+  int ncompleted;                    /* number of completed requests          */
+  lua_Integer last_id;               /* id of the last queued request         */
+};
+
+typedef struct {
+  lua_apr_refobj header;
+  lua_apr_aio_engine *engine;
+} lua_apr_aio_object;
+
+/* check_engine() {{{2 */
+
+static lua_apr_aio_engine *check_engine(lua_State *L, int idx)
+{
+  lua_apr_aio_object *object = check_object(L, idx, &lua_apr_aio_type);
+  if (object->engine == NULL)
+    luaL_error(L, "attempt to use a closed I/O engine");
+  return object->engine;
+}
+
+/* keep_value() {{{2
+ *
+ * Store the value at the top of the stack in the environment of the engine
+ * object (at stack index 1) under the given key, or remove the key when the
+ * value is nil. This keeps file objects and data alive while a request is in
+ * flight.
+ */
+
+static void keep_value(lua_State *L, lua_Integer key)
+{
+  object_env_private(L, 1);
+  lua_pushnumber(L, (lua_Number) key);
+  lua_pushvalue(L, -3);
+  lua_rawset(L, -3);
+  lua_pop(L, 2);
+}
+
+/* check_buffered_file() {{{2
+ *
+ * Raise an error when the file at stack index @idx was opened for direct I/O:
+ * requests read into and write from unaligned buffers, which O_DIRECT file
+ * descriptors reject.
+ */
+
+static void check_buffered_file(lua_State *L, int idx)
+{
+  if (file_check(L, idx, 1)->direct != NULL)
+    luaL_argerror(L, idx, "files opened for direct I/O can't be used with I/O engines");
+}
+
+/* new_request() {{{2
+ *
+ * Allocate a request with @extra bytes of storage for its read buffer or
+ * pathname and append it to the queue of the engine. For requests on the file
+ * at stack index @idx (zero for opens) the file object is kept alive until the
+ * request completes.
+ */
+
+static lua_apr_aio_request *new_request(lua_State *L, lua_apr_aio_engine *engine, lua_apr_aio_op op, int idx, size_t extra)
+{
+  lua_apr_aio_request *request;
+  apr_os_file_t fd;
+
+  if (idx > 0)
+    apr_os_file_get(&fd, file_check(L, idx, 1)->handle);
+  request = calloc(1, sizeof *request + extra);
+  if (request == NULL)
+    raise_error_memory(L);
+  request->engine = engine;
+  request->op = op;
+  request->id = ++engine->last_id;
+  if (extra > 0)
+    request->data = (char*) (request + 1);
+  if (idx > 0) {
+    request->fd = fd;
+    lua_pushvalue(L, idx);
+    keep_value(L, request->id);
+  }
+  *engine->queued_tail = request;
+  engine->queued_tail = &request->next;
+  engine->nqueued++;
+
+  return request;
+}
+
+/* free_request() {{{2 */
+
+static void free_request(lua_apr_aio_request *request)
+{
+  if (request->handle != NULL)
+    apr_file_close(request->handle);
+  if (request->refpool != NULL)
+    apr_pool_destroy(request->refpool->ptr);
+  free(request);
+}
+
+/* aio_pread() and aio_pwrite() {{{2
+ *
+ * Positional reads and writes for the thread pool engine. APR doesn't have
+ * these so they're implemented using the native API of the platform.
+ */
+
+static apr_status_t aio_pread(lua_apr_aio_request *request)
+{
+# if defined(WIN32)
+  OVERLAPPED overlapped = { 0 };
+  DWORD result;
+  overlapped.Offset = (DWORD) request->offset;
+  overlapped.OffsetHigh = (DWORD) (request->offset >> 32);
+  if (!ReadFile(request->fd, request->data, (DWORD) request->length, &result, &overlapped))
+    return GetLastError() == ERROR_HANDLE_EOF ? APR_SUCCESS : apr_get_os_error();
+# else
+  ssize_t result = pread(request->fd, request->data, request->length, request->offset);
+  if (result < 0)
+    return apr_get_os_error();
+# endif
+  request->done = result;
+  return APR_SUCCESS;
+}
+
+static apr_status_t aio_pwrite(lua_apr_aio_request *request)
+{
+# if defined(WIN32)
+  OVERLAPPED overlapped = { 0 };
+  DWORD result;
+  overlapped.Offset = (DWORD) request->offset;
+  overlapped.OffsetHigh = (DWORD) (request->offset >> 32);
+  if (!WriteFile(request->fd, request->data, (DWORD) request->length, &result, &overlapped))
+    return apr_get_os_error();
+# else
+  ssize_t result = pwrite(request->fd, request->data, request->length, request->offset);
+  if (result < 0)
+    return apr_get_os_error();
+# endif
+  request->done = result;
+  return APR_SUCCESS;
+}
+
+/* aio_fsync() {{{2 */
+
+static apr_status_t aio_fsync(lua_apr_aio_request *request)
+{
+# if defined(WIN32)
+  if (!FlushFileBuffers(request->fd))
+    return apr_get_os_error();
+# elif defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+  if ((request->datasync ? fdatasync(request->fd) : fsync(request->fd)) != 0)
+    return apr_get_os_error();
+# else
+  if (fsync(request->fd) != 0)
+    return apr_get_os_error();
+# endif
+  return APR_SUCCESS;
+}
+
+/* aio_worker() {{{2
+ *
+ * Runs on one of the threads of a thread pool engine: Execute the request,
+ * append it to the list of completed requests and wake up the Lua thread.
+ * The completion descriptor becomes readable when the list stops being empty.
+ */
+
+static void * APR_THREAD_FUNC aio_worker(apr_thread_t *thread, void *data)
+{
+  lua_apr_aio_request *request = data;
+  lua_apr_aio_engine *engine = request->engine;
+
+  switch (request->op) {
+    case AIO_READ:
+      request->status = aio_pread(request);
+      break;
+    case AIO_WRITE:
+      request->status = aio_pwrite(request);
+      break;
+    case AIO_FSYNC:
+      request->status = aio_fsync(request);
+      break;
+    case AIO_OPEN:
+      request->status = apr_file_open(&request->handle, request->path,
+          request->flags, request->perms, request->refpool->ptr);
+      if (request->status != APR_SUCCESS)
+        request->handle = NULL;
+      break;
+  }
+
+  apr_thread_mutex_lock(engine->mutex);
+  request->next = NULL;
+  *engine->completed_tail = request;
+  engine->completed_tail = &request->next;
+  if (engine->ncompleted++ == 0)
+    apr_file_putc('!', engine->writable);
+  apr_thread_cond_signal(engine->cond);
+  apr_thread_mutex_unlock(engine->mutex);
+
+  return NULL;
+}
+
+#if LUA_APR_HAVE_IO_URING
+
+/* uring_open_flags() {{{2
+ *
+ * Convert APR file open flags to the flags of open(2). APR sets the close on
+ * exec flag on all descriptors it opens so we do the same.
+ */
+
+static int uring_open_flags(apr_int32_t flags)
+{
+  int oflags = O_CLOEXEC;
+  if ((flags & APR_FOPEN_READ) && (flags & APR_FOPEN_WRITE))
+    oflags |= O_RDWR;
+  else if (flags & APR_FOPEN_WRITE)
+    oflags |= O_WRONLY;
+  else
+    oflags |= O_RDONLY;
+  if (flags & APR_FOPEN_CREATE) oflags |= O_CREAT;
+  if (flags & APR_FOPEN_EXCL) oflags |= O_EXCL;
+  if (flags & APR_FOPEN_APPEND) oflags |= O_APPEND;
+  if (flags & APR_FOPEN_TRUNCATE) oflags |= O_TRUNC;
+  return oflags;
+}
+
+/* uring_open_mode() {{{2
+ *
+ * Convert APR file permissions to the mode argument of open(2).
+ */
+
+static mode_t uring_open_mode(apr_fileperms_t perms)
+{
+  mode_t mode = 0;
+  if (perms == APR_FPROT_OS_DEFAULT)
+    return 0666;
+  if (perms & APR_FPROT_USETID) mode |= S_ISUID;
+  if (perms & APR_FPROT_UREAD) mode |= S_IRUSR;
+  if (perms & APR_FPROT_UWRITE) mode |= S_IWUSR;
+  if (perms & APR_FPROT_UEXECUTE) mode |= S_IXUSR;
+  if (perms & APR_FPROT_GSETID) mode |= S_ISGID;
+  if (perms & APR_FPROT_GREAD) mode |= S_IRGRP;
+  if (perms & APR_FPROT_GWRITE) mode |= S_IWGRP;
+  if (perms & APR_FPROT_GEXECUTE) mode |= S_IXGRP;
+  if (perms & APR_FPROT_WSTICKY) mode |= S_ISVTX;
+  if (perms & APR_FPROT_WREAD) mode |= S_IROTH;
+  if (perms & APR_FPROT_WWRITE) mode |= S_IWOTH;
+  if (perms & APR_FPROT_WEXECUTE) mode |= S_IXOTH;
+  return mode;
+}
+
+/* uring_prepare() {{{2 */
+
+static void uring_prepare(struct io_uring_sqe *sqe, lua_apr_aio_request *request)
+{
+  switch (request->op) {
+    case AIO_READ:
+      io_uring_prep_read(sqe, request->fd, request->data, request->length, request->offset);
+      break;
+    case AIO_WRITE:
+      io_uring_prep_write(sqe, request->fd, request->data, request->length, request->offset);
+      break;
+    case AIO_FSYNC:
+      io_uring_prep_fsync(sqe, request->fd, request->datasync ? IORING_FSYNC_DATASYNC : 0);
+      break;
+    case AIO_OPEN:
+      io_uring_prep_openat(sqe, AT_FDCWD, request->path,
+          uring_open_flags(request->flags), uring_open_mode(request->perms));
+      break;
+  }
+  io_uring_sqe_set_data(sqe, request);
+}
+
+/* uring_reap() {{{2
+ *
+ * Move the available completion queue entries to the list of completed
+ * requests. The eventfd is reset before the queue is checked so that a
+ * completion that arrives in between makes it readable again.
+ */
+
+static void uring_reap(lua_apr_aio_engine *engine)
+{
+  struct io_uring_cqe *cqe;
+  lua_apr_aio_request *request;
+  eventfd_t counter;
+  apr_os_file_t fd;
+
+  apr_os_file_get(&fd, engine->readable);
+  eventfd_read(fd, &counter);
+  while (io_uring_peek_cqe(&engine->ring, &cqe) == 0) {
+    request = io_uring_cqe_get_data(cqe);
+    if (cqe->res < 0) {
+      request->status = APR_FROM_OS_ERROR(-cqe->res);
+    } else {
+      request->status = APR_SUCCESS;
+      if (request->op == AIO_OPEN)
+        request->fd = cqe->res;
+      else
+        request->done = cqe->res;
+    }
+    io_uring_cqe_seen(&engine->ring, cqe);
+    request->next = NULL;
+    *engine->completed_tail = request;
+    engine->completed_tail = &request->next;
+    engine->ncompleted++;
+  }
+}
+
+#endif
+
+/* submit_requests() {{{2
+ *
+ * Hand all queued requests to the kernel or the thread pool. An io_uring
+ * engine keeps requests queued while the completion queue could overflow;
+ * they're submitted by a later call after completions have been harvested.
+ * Returns the number of submitted requests or a negative APR status code.
+ */
+
+static int submit_requests(lua_apr_aio_engine *engine, apr_status_t *status)
+{
+  lua_apr_aio_request *request;
+  int count = 0;
+
+  *status = APR_SUCCESS;
+# if LUA_APR_HAVE_IO_URING
+  if (engine->uring) {
+    struct io_uring_sqe *sqe;
+    int result;
+    while ((request = engine->queued) != NULL
+        && engine->inflight < (int) engine->capacity) {
+      sqe = io_uring_get_sqe(&engine->ring);
+      if (sqe == NULL) {
+        /* The submission queue is full; flush it and try again. */
+        result = io_uring_submit(&engine->ring);
+        if (result < 0) {
+          *status = APR_FROM_OS_ERROR(-result);
+          break;
+        }
+        continue;
+      }
+      uring_prepare(sqe, request);
+      engine->queued = request->next;
+      engine->nqueued--;
+      engine->inflight++;
+      count++;
+    }
+    if (engine->queued == NULL)
+      engine->queued_tail = &engine->queued;
+    result = io_uring_submit(&engine->ring);
+    if (result < 0 && *status == APR_SUCCESS)
+      *status = APR_FROM_OS_ERROR(-result);
+    return count;
+  }
+# endif
+  while ((request = engine->queued) != NULL) {
+    *status = apr_thread_pool_push(engine->threads, aio_worker, request,
+        APR_THREAD_TASK_PRIORITY_NORMAL, NULL);
+    if (*status != APR_SUCCESS)
+      break;
+    engine->queued = request->next;
+    engine->nqueued--;
+    engine->inflight++;
+    count++;
+  }
+  if (engine->queued == NULL)
+    engine->queued_tail = &engine->queued;
+  return count;
+}
+
+/* wait_for_completions() {{{2
+ *
+ * Wait until at least @min requests have completed or the @timeout (in
+ * microseconds, negative means forever) expires. Returns the list of completed
+ * requests and resets the completion descriptor.
+ */
+
+static lua_apr_aio_request *wait_for_completions(lua_apr_aio_engine *engine, int min, apr_interval_time_t timeout)
+{
+  lua_apr_aio_request *list;
+  apr_time_t deadline;
+  char buffer[64];
+  apr_size_t length;
+
+  if (min > engine->inflight)
+    min = engine->inflight;
+  deadline = apr_time_now() + timeout;
+
+# if LUA_APR_HAVE_IO_URING
+  if (engine->uring) {
+    struct __kernel_timespec ts, *tsp = NULL;
+    struct io_uring_cqe *cqe;
+    uring_reap(engine);
+    if (engine->ncompleted < min) {
+      if (timeout >= 0) {
+        ts.tv_sec = timeout / APR_USEC_PER_SEC;
+        ts.tv_nsec = (timeout % APR_USEC_PER_SEC) * 1000;
+        tsp = &ts;
+      }
+      /* The result is ignored: on timeout we report what we've got. */
+      io_uring_wait_cqes(&engine->ring, &cqe, min - engine->ncompleted, tsp, NULL);
+      uring_reap(engine);
+    }
+    list = engine->completed;
+    engine->completed = NULL;
+    engine->completed_tail = &engine->completed;
+    engine->inflight -= engine->ncompleted;
+    engine->ncompleted = 0;
+    return list;
+  }
+# endif
+
+  apr_thread_mutex_lock(engine->mutex);
+  while (engine->ncompleted < min) {
+    if (timeout < 0) {
+      apr_thread_cond_wait(engine->cond, engine->mutex);
+    } else {
+      timeout = deadline - apr_time_now();
+      if (timeout <= 0 || apr_thread_cond_timedwait(engine->cond,
+            engine->mutex, timeout) == APR_TIMEUP)
+        break;
+    }
+  }
+  list = engine->completed;
+  engine->completed = NULL;
+  engine->completed_tail = &engine->completed;
+  engine->inflight -= engine->ncompleted;
+  engine->ncompleted = 0;
+  /* Drain the pipe while holding the lock (the read end is non-blocking). */
+  do length = sizeof buffer;
+  while (apr_file_read(engine->readable, buffer, &length) == APR_SUCCESS);
+  apr_thread_mutex_unlock(engine->mutex);
+
+  return list;
+}
+
+/* push_completion() {{{2
+ *
+ * Push a table describing a completed request on the Lua stack. The engine
+ * object must be at stack index 1.
+ */
+
+static void push_completion(lua_State *L, lua_apr_aio_request *request)
+{
+  char message[LUA_APR_MSGSIZE];
+  lua_apr_file *file;
+
+  lua_createtable(L, 0, 4);
+  lua_pushnumber(L, (lua_Number) request->id);
+  lua_setfield(L, -2, "id");
+  lua_pushstring(L, aio_op_names[request->op]);
+  lua_setfield(L, -2, "op");
+
+  /* Move the file object from the environment to the completion. */
+  object_env_private(L, 1);
+  lua_pushnumber(L, (lua_Number) request->id);
+  lua_rawget(L, -2);
+  lua_setfield(L, -3, "file");
+  lua_pop(L, 1);
+  lua_pushnil(L);
+  keep_value(L, request->id);
+  lua_pushnil(L);
+  keep_value(L, -request->id);
+
+  if (request->status != APR_SUCCESS) {
+    apr_strerror(request->status, message, count(message));
+    if (request->path != NULL)
+      lua_pushfstring(L, "%s: %s", request->path, message);
+    else
+      lua_pushstring(L, message);
+    lua_setfield(L, -2, "error");
+    status_to_name(L, request->status);
+    lua_setfield(L, -2, "code");
+    return;
+  }
+
+  switch (request->op) {
+    case AIO_READ:
+      lua_pushlstring(L, request->data, request->done);
+      break;
+    case AIO_WRITE:
+      lua_pushinteger(L, request->done);
+      break;
+    case AIO_FSYNC:
+      lua_pushboolean(L, 1);
+      break;
+    case AIO_OPEN:
+      if (request->handle != NULL) {
+        /* Opened by a worker thread in a memory pool we allocated. */
+        file = file_alloc(L, request->path, request->refpool);
+        file->handle = request->handle;
+        request->handle = NULL;
+        request->refpool = NULL;
+      } else {
+        /* Opened by io_uring, the descriptor still needs an apr_file_t. */
+        file = file_alloc(L, request->path, NULL);
+        apr_os_file_put(&file->handle, &request->fd, request->flags, file->pool->ptr);
+      }
+      file_init_mode(L, file, request->mode, request->flags);
+      break;
+  }
+  lua_setfield(L, -2, "result");
+}
+
+/* destroy_engine() {{{2
+ *
+ * Discard the queued requests, wait for the requests in flight to finish and
+ * release all resources of the engine.
+ */
+
+static void destroy_engine(lua_apr_aio_engine *engine)
+{
+  lua_apr_aio_request *request, *next;
+
+  for (request = engine->queued; request != NULL; request = next) {
+    next = request->next;
+    free_request(request);
+  }
+  engine->queued = NULL;
+  while (engine->inflight > 0 || engine->ncompleted > 0) {
+    for (request = wait_for_completions(engine, engine->inflight, -1); request != NULL; request = next) {
+      next = request->next;
+#     if LUA_APR_HAVE_IO_URING
+      if (engine->uring && request->op == AIO_OPEN && request->status == APR_SUCCESS)
+        close(request->fd);
+#     endif
+      free_request(request);
+    }
+  }
+# if LUA_APR_HAVE_IO_URING
+  if (engine->uring)
+    io_uring_queue_exit(&engine->ring);
+# endif
+  if (engine->threads != NULL)
+    apr_thread_pool_destroy(engine->threads);
+  if (engine->readable != NULL)
+    apr_file_close(engine->readable);
+  if (engine->writable != NULL)
+    apr_file_close(engine->writable);
+  apr_pool_destroy(engine->pool);
+}
+
+#if LUA_APR_HAVE_IO_URING
+
+/* uring_init() {{{2
+ *
+ * Try to initialize an io_uring engine and register an eventfd that serves as
+ * the completion descriptor.
+ */
+
+static apr_status_t uring_init(lua_apr_aio_engine *engine, unsigned int entries)
+{
+  apr_status_t status;
+  apr_os_file_t fd;
+  int result;
+
+  result = io_uring_queue_init(entries, &engine->ring, 0);
+  if (result < 0)
+    return APR_FROM_OS_ERROR(-result);
+  fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (fd < 0) {
+    status = apr_get_os_error();
+    io_uring_queue_exit(&engine->ring);
+    return status;
+  }
+  status = apr_os_file_put(&engine->readable, &fd, APR_FOPEN_READ, engine->pool);
+  if (status == APR_SUCCESS) {
+    result = io_uring_register_eventfd(&engine->ring, fd);
+    if (result < 0)
+      status = APR_FROM_OS_ERROR(-result);
+  }
+  if (status != APR_SUCCESS) {
+    close(fd);
+    engine->readable = NULL;
+    io_uring_queue_exit(&engine->ring);
+    return status;
+  }
+  engine->uring = 1;
+  engine->capacity = engine->ring.cq.ring_entries;
+  return APR_SUCCESS;
+}
+
+#endif
+
+/* threads_init() {{{2 */
+
+static apr_status_t threads_init(lua_apr_aio_engine *engine, apr_size_t threads)
+{
+  apr_status_t status;
+
+  status = apr_thread_pool_create(&engine->threads, 0, threads, engine->pool);
+  if (status == APR_SUCCESS)
+    status = apr_thread_mutex_create(&engine->mutex, APR_THREAD_MUTEX_DEFAULT, engine->pool);
+  if (status == APR_SUCCESS)
+    status = apr_thread_cond_create(&engine->cond, engine->pool);
+  if (status == APR_SUCCESS)
+    status = apr_file_pipe_create(&engine->readable, &engine->writable, engine->pool);
+  if (status == APR_SUCCESS)
+    status = apr_file_pipe_timeout_set(engine->readable, 0);
+  return status;
+}
+
+/* aio_engine_file() {{{2
+ *
+ * Get the completion descriptor of an I/O engine (used to add engines to
+ * pollsets).
+ */
+
+apr_file_t *aio_engine_file(lua_State *L, int idx, apr_pool_t **pool)
+{
+  lua_apr_aio_engine *engine = check_engine(L, idx);
+  *pool = engine->pool;
+  return engine->readable;
+}
+
+/* apr.aio([options]) -> engine {{{1
+ *
+ * Create an asynchronous I/O engine. The optional @options table supports the
+ * following fields:
+ *
+ *  - `entries`: the size of the io_uring submission queue (defaults to 64),
+ *    the number of requests in flight is limited to the size of the
+ *    completion queue (usually twice this number)
+ *  - `threads`: the maximum number of worker threads of the thread pool
+ *    engine (defaults to 4)
+ *  - `backend`: the string `'threads'` to use the thread pool engine even
+ *    when io_uring is available, or `'io_uring'` to fail when io_uring isn't
+ *    available instead of falling back to the thread pool engine
+ *
+ * On success the engine is returned, otherwise a nil followed by an error
+ * message is returned.
+ */
+
+int lua_apr_aio(lua_State *L)
+{
+  lua_apr_aio_object *object;
+  lua_apr_aio_engine *engine;
+  lua_Integer entries = LUA_APR_AIO_ENTRIES;
+  lua_Integer threads = LUA_APR_AIO_THREADS;
+  const char *backends[] = { "io_uring", "threads", NULL };
+  int backend = -1;
+  apr_status_t status;
+  apr_pool_t *pool;
+
+  if (!lua_isnoneornil(L, 1)) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_getfield(L, 1, "entries");
+    entries = luaL_optinteger(L, -1, entries);
+    lua_getfield(L, 1, "threads");
+    threads = luaL_optinteger(L, -1, threads);
+    lua_getfield(L, 1, "backend");
+    if (!lua_isnil(L, -1))
+      backend = luaL_checkoption(L, -1, NULL, backends);
+    lua_pop(L, 3);
+    luaL_argcheck(L, entries > 0 && threads > 0, 1, "entries and threads must be positive");
+  }
+  lua_settop(L, 1);
+
+  status = apr_pool_create(&pool, NULL);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  engine = apr_pcalloc(pool, sizeof *engine);
+  engine->pool = pool;
+  engine->queued_tail = &engine->queued;
+  engine->completed_tail = &engine->completed;
+
+  status = APR_ENOTIMPL;
+# if LUA_APR_HAVE_IO_URING
+  if (backend != 1)
+    status = uring_init(engine, (unsigned int) entries);
+# endif
+  if (status != APR_SUCCESS && backend != 0)
+    status = threads_init(engine, (apr_size_t) threads);
+  if (status != APR_SUCCESS) {
+    destroy_engine(engine);
+    return push_error_status(L, status);
+  }
+
+  object = new_object(L, &lua_apr_aio_type);
+  object->engine = engine;
+  return 1;
+}
+
+/* engine:backend() -> name {{{1
+ *
+ * Get the name of the implementation used by the engine: The string
+ * `'io_uring'` or `'threads'`.
+ */
+
+static int engine_backend(lua_State *L)
+{
+  lua_apr_aio_engine *engine = check_engine(L, 1);
+  lua_pushstring(L, engine->uring ? "io_uring" : "threads");
+  return 1;
+}
+
+/* engine:read(file, offset, length) -> id {{{1
+ *
+ * Queue a request to read up to @length bytes from @file starting at byte
+ * @offset. The result of the completion is a string, which is shorter than
+ * @length when the end of the file is reached (and empty at the end of the
+ * file). Returns the id of the request.
+ */
+
+static int engine_read(lua_State *L)
+{
+  lua_apr_aio_engine *engine;
+  lua_apr_aio_request *request;
+  lua_Integer offset, length;
+
+  engine = check_engine(L, 1);
+  offset = luaL_checkinteger(L, 3);
+  length = luaL_checkinteger(L, 4);
+  luaL_argcheck(L, offset >= 0, 3, "offset can't be negative");
+  luaL_argcheck(L, length >= 0, 4, "length can't be negative");
+  check_buffered_file(L, 2);
+  request = new_request(L, engine, AIO_READ, 2, (size_t) length + 1);
+  request->offset = (apr_off_t) offset;
+  request->length = (apr_size_t) length;
+  lua_pushnumber(L, (lua_Number) request->id);
+
+  return 1;
+}
+
+/* engine:write(file, offset, data) -> id {{{1
+ *
+ * Queue a request to write @data (a string, blob or byte buffer) to @file
+ * starting at byte @offset. The result of the completion is the number of
+ * bytes written. Strings and blobs are referenced until the request completes
+ * while byte buffers are copied (because they can change in the mean time).
+ * Returns the id of the request.
+ */
+
+static int engine_write(lua_State *L)
+{
+  lua_apr_aio_engine *engine;
+  lua_apr_aio_request *request;
+  lua_Integer offset;
+  const char *data;
+  size_t length;
+
+  engine = check_engine(L, 1);
+  offset = luaL_checkinteger(L, 3);
+  luaL_argcheck(L, offset >= 0, 3, "offset can't be negative");
+  check_buffered_file(L, 2);
+  data = check_bytes(L, 4, &length);
+  if (object_has_type(L, 4, &lua_apr_bytebuf_type, 1)) {
+    request = new_request(L, engine, AIO_WRITE, 2, length + 1);
+    memcpy(request->data, data, length);
+  } else {
+    /* Keep the value alive under the negated request id. */
+    request = new_request(L, engine, AIO_WRITE, 2, 0);
+    request->data = (char*) data;
+    lua_pushvalue(L, 4);
+    keep_value(L, -request->id);
+  }
+  request->offset = (apr_off_t) offset;
+  request->length = length;
+  lua_pushnumber(L, (lua_Number) request->id);
+
+  return 1;
+}
+
+/* engine:fsync(file [, datasync]) -> id {{{1
+ *
+ * Queue a request to flush the data of @file to disk. When @datasync is true
+ * only the data is flushed, not the metadata of the file (this is a hint that
+ * is ignored on platforms without `fdatasync()`). The result of the
+ * completion is true. Returns the id of the request.
+ */
+
+static int engine_fsync(lua_State *L)
+{
+  lua_apr_aio_engine *engine;
+  lua_apr_aio_request *request;
+
+  engine = check_engine(L, 1);
+  request = new_request(L, engine, AIO_FSYNC, 2, 0);
+  request->datasync = lua_toboolean(L, 3);
+  lua_pushnumber(L, (lua_Number) request->id);
+
+  return 1;
+}
+
+/* engine:open(path [, mode [, permissions]]) -> id {{{1
+ *
+ * Queue a request to open the file @path. The @mode and @permissions
+ * arguments are the same as for `apr.file_open()`. The result of the
+ * completion is a file object. Returns the id of the request.
+ */
+
+static int engine_open(lua_State *L)
+{
+  lua_apr_aio_engine *engine;
+  lua_apr_aio_request *request;
+  lua_apr_pool *refpool = NULL;
+  const char *path, *mode;
+  apr_fileperms_t perms;
+  size_t length;
+
+  engine = check_engine(L, 1);
+  path = luaL_checklstring(L, 2, &length);
+  mode = luaL_optstring(L, 3, "r");
+  perms = check_permissions(L, 4, 0);
+  luaL_argcheck(L, strlen(mode) < sizeof request->mode, 3, "invalid mode string");
+  luaL_argcheck(L, strchr(mode, 'd') == NULL, 3, "I/O engines don't support direct I/O");
+  /* Worker threads open the file in the memory pool of the new file object. */
+  if (!engine->uring)
+    refpool = refpool_alloc(L);
+  request = new_request(L, engine, AIO_OPEN, 0, length + 1);
+  request->path = request->data;
+  memcpy(request->path, path, length + 1);
+  strcpy(request->mode, mode);
+  request->flags = parse_mode_str(mode);
+  request->perms = perms;
+  request->refpool = refpool;
+  lua_pushnumber(L, (lua_Number) request->id);
+
+  return 1;
+}
+
+/* engine:submit() -> count {{{1
+ *
+ * Start all queued requests. Returns the number of requests submitted, or a
+ * nil followed by an error message. An io_uring engine limits the number of
+ * requests in flight to the size of its completion queue; the remaining
+ * requests stay queued and are submitted by later calls.
+ */
+
+static int engine_submit(lua_State *L)
+{
+  lua_apr_aio_engine *engine;
+  apr_status_t status;
+  int count;
+
+  engine = check_engine(L, 1);
+  count = submit_requests(engine, &status);
+  if (count == 0 && status != APR_SUCCESS)
+    return push_error_status(L, status);
+  lua_pushinteger(L, count);
+
+  return 1;
+}
+
+/* engine:completions([min [, timeout]]) -> list {{{1
+ *
+ * Submit the queued requests and get a list of completed requests. Each
+ * completion is a table with the fields `id` (the id of the request), `op`
+ * (one of the strings `'read'`, `'write'`, `'fsync'` or `'open'`) and `file`
+ * (the file object of the request, except for opens). When the request
+ * succeeded the field `result` contains its result, otherwise the fields
+ * `error` and `code` contain an error message and code.
+ *
+ * When @min (a number, defaults to zero) is given the method waits until at
+ * least that many requests have completed. If @timeout (a number of seconds)
+ * is given and expires first the available completions are returned.
+ */
+
+static int engine_completions(lua_State *L)
+{
+  lua_apr_aio_engine *engine;
+  lua_apr_aio_request *request, *next;
+  apr_interval_time_t timeout;
+  apr_status_t status;
+  int min, i = 0;
+
+  engine = check_engine(L, 1);
+  min = luaL_optint(L, 2, 0);
+  timeout = lua_isnoneornil(L, 3) ? -1 : time_get(L, 3);
+  lua_settop(L, 1);
+  submit_requests(engine, &status);
+
+  request = wait_for_completions(engine, min, timeout);
+  lua_newtable(L);
+  for (; request != NULL; request = next) {
+    next = request->next;
+    push_completion(L, request);
+    lua_rawseti(L, 2, ++i);
+    free_request(request);
+  }
+
+  return 1;
+}
+
+/* engine:pending() -> count {{{1
+ *
+ * Get the number of requests that have been queued or submitted but whose
+ * completions haven't been returned by `engine:completions()` yet.
+ */
+
+static int engine_pending(lua_State *L)
+{
+  lua_apr_aio_engine *engine = check_engine(L, 1);
+  lua_pushinteger(L, engine->nqueued + engine->inflight);
+  return 1;
+}
+
+/* engine:close() -> status {{{1
+ *
+ * Discard queued requests, wait for the requests in flight to finish and
+ * destroy the engine. The completions of the requests are lost. Returns true.
+ */
+
+static int engine_close(lua_State *L)
+{
+  lua_apr_aio_object *object;
+
+  check_engine(L, 1);
+  object = check_object(L, 1, &lua_apr_aio_type);
+  destroy_engine(object->engine);
+  object->engine = NULL;
+  lua_pushboolean(L, 1);
+
+  return 1;
+}
+
+/* engine:__tostring() {{{1 */
+
+static int engine_tostring(lua_State *L)
+{
+  lua_apr_aio_object *object = check_object(L, 1, &lua_apr_aio_type);
+  if (object->engine != NULL)
+    lua_pushfstring(L, "%s (%p)", lua_apr_aio_type.friendlyname, object->engine);
+  else
+    lua_pushfstring(L, "%s (closed)", lua_apr_aio_type.friendlyname);
+  return 1;
+}
+
+/* engine:__gc() {{{1 */
+
+static int engine_gc(lua_State *L)
+{
+  lua_apr_aio_object *object = check_object(L, 1, &lua_apr_aio_type);
+  if (object_collectable((lua_apr_refobj*)object) && object->engine != NULL) {
+    destroy_engine(object->engine);
+    object->engine = NULL;
+  }
+  release_object((lua_apr_refobj*)object);
+  return 0;
+}
+
+/* }}}1 */
+
+static luaL_reg engine_methods[] = {
+  { "backend", engine_backend },
+  { "read", engine_read },
+  { "write", engine_write },
+  { "fsync", engine_fsync },
+  { "open", engine_open },
+  { "submit", engine_submit },
+  { "completions", engine_completions },
+  { "pending", engine_pending },
+  { "close", engine_close },
+  { NULL, NULL },
+};
+
+static luaL_reg engine_metamethods[] = {
+  { "__tostring", engine_tostring },
+  { "__eq", objects_equal },
+  { "__gc", engine_gc },
+  { NULL, NULL },
+};
+
+lua_apr_objtype lua_apr_aio_type = {
+  "lua_apr_aio_object*",      /* metatable name in registry */
+  "I/O engine",               /* friendly object name */
+  sizeof(lua_apr_aio_object), /* structure size */
+  engine_methods,             /* methods table */
+  engine_metamethods          /* metamethods table */
+};
+
+#endif
+
+/* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
@@ -0,0 +1,193 @@
+/* Immutable byte blobs module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * Passing a large string to another thread using `queue:push()` serializes
+ * the string into Lua source code which is then parsed again by the receiving
+ * Lua state, copying the payload several times. A blob is an immutable byte
+ * buffer with an atomic reference count that lives outside of the Lua heap.
+ * Blobs are passed between threads by reference (like other Lua/APR objects,
+ * see `apr.ref()`) so the payload itself is never copied. Blobs can be written
+ * to files, pipes and sockets directly (they're accepted by `file:write()`,
+ * `socket:write()` and `response:write()`) and they're only converted to a
+ * Lua string when you ask for one using `blob:tostring()`:
+ *
+ *     > blob = apr.blob(string.rep('x', 1024 * 1024))
+ *     > = #blob
+ *     1048576
+ *     > = blob:tostring(1, 5)
+ *     'xxxxx'
+ */
+
+#include "lua_apr.h"
+
+/* Internal functions. {{{1 */
+
+typedef struct {
+  lua_apr_refobj header;
+  size_t size;
+  char *data;
+} lua_apr_blob_object;
+
+/* check_blob() {{{2 */
+
+static lua_apr_blob_object *check_blob(lua_State *L, int idx)
+{
+  return check_object(L, idx, &lua_apr_blob_type);
+}
+
+/* check_bytes() {{{2
+ *
+ * Get the bytes of the string, number, blob or byte buffer at the given stack
+ * index. This is used by the write methods so that they accept blobs and byte
+ * buffers in place of strings. Note that the bytes of a byte buffer are only
+ * valid until the buffer is changed.
+ */
+
+const char *check_bytes(lua_State *L, int idx, size_t *length)
+{
+  lua_apr_blob_object *blob;
+  lua_apr_bytebuf_object *bytebuf;
+
+  if (lua_type(L, idx) != LUA_TUSERDATA) {
+    if (!lua_isstring(L, idx))
+      luaL_typerror(L, idx, "string, blob or buffer");
+    return lua_tolstring(L, idx, length);
+  } else if (object_has_type(L, idx, &lua_apr_bytebuf_type, 1)) {
+    bytebuf = check_object(L, idx, &lua_apr_bytebuf_type);
+    *length = bytebuf->buffer.limit - bytebuf->buffer.index;
+    return bytebuf->buffer.data + bytebuf->buffer.index;
+  } else {
+    blob = check_blob(L, idx);
+    *length = blob->size;
+    return blob->data;
+  }
+}
+
+/* apr.blob(string) -> blob {{{1
+ *
+ * Copy @string into a new immutable blob and return the blob. This is the
+ * only time the bytes are copied; the blob can be passed to other threads and
+ * written to files and sockets without copying the bytes again.
+ */
+
+int lua_apr_blob(lua_State *L)
+{
+  lua_apr_blob_object *blob;
+  const char *data;
+  size_t length;
+
+  data = luaL_checklstring(L, 1, &length);
+  blob = new_object(L, &lua_apr_blob_type);
+  /* Always allocate a terminating NUL byte (this also avoids malloc(0)). */
+  blob->data = malloc(length + 1);
+  if (blob->data == NULL)
+    raise_error_memory(L);
+  memcpy(blob->data, data, length);
+  blob->data[length] = '\0';
+  blob->size = length;
+
+  return 1;
+}
+
+/* blob:size() -> bytes {{{1
+ *
+ * Get the size of the blob in bytes. You can also use the `#` operator.
+ */
+
+static int blob_size(lua_State *L)
+{
+  lua_apr_blob_object *blob = check_blob(L, 1);
+  lua_pushinteger(L, blob->size);
+  return 1;
+}
+
+/* blob:tostring([i [, j]]) -> string {{{1
+ *
+ * Convert the blob to a Lua string. The optional arguments @i and @j select a
+ * range of bytes and have the same meaning as for `string.sub()`, so that only
+ * the selected bytes are copied into the string.
+ */
+
+static int blob_tostring_range(lua_State *L)
+{
+  lua_apr_blob_object *blob;
+  lua_Integer i, j, size;
+
+  blob = check_blob(L, 1);
+  size = (lua_Integer) blob->size;
+  i = luaL_optinteger(L, 2, 1);
+  j = luaL_optinteger(L, 3, -1);
+  if (i < 0) i = size + i + 1;
+  if (j < 0) j = size + j + 1;
+  if (i < 1) i = 1;
+  if (j > size) j = size;
+  if (i <= j)
+    lua_pushlstring(L, blob->data + i - 1, (size_t) (j - i + 1));
+  else
+    lua_pushliteral(L, "");
+
+  return 1;
+}
+
+/* blob:__len() {{{1 */
+
+static int blob_len(lua_State *L)
+{
+  return blob_size(L);
+}
+
+/* blob:__tostring() {{{1 */
+
+static int blob_tostring(lua_State *L)
+{
+  lua_apr_blob_object *blob = check_blob(L, 1);
+  lua_pushfstring(L, "%s (%p)", lua_apr_blob_type.friendlyname, blob);
+  return 1;
+}
+
+/* blob:__gc() {{{1 */
+
+static int blob_gc(lua_State *L)
+{
+  lua_apr_blob_object *blob = check_blob(L, 1);
+  /* Blobs are shared between threads and never change, so instead of
+   * object_collectable() followed by release_object() the reference count is
+   * decremented once and whoever drops the last reference frees the bytes. */
+  if (object_decref((lua_apr_refobj*)blob)) {
+    free(blob->data);
+    blob->data = NULL;
+    if (blob->header.unmanaged)
+      free(blob);
+  }
+  return 0;
+}
+
+/* }}} */
+
+static luaL_reg blob_methods[] = {
+  { "size", blob_size },
+  { "tostring", blob_tostring_range },
+  { NULL, NULL },
+};
+
+static luaL_reg blob_metamethods[] = {
+  { "__len", blob_len },
+  { "__tostring", blob_tostring },
+  { "__eq", objects_equal },
+  { "__gc", blob_gc },
+  { NULL, NULL },
+};
+
+lua_apr_objtype lua_apr_blob_type = {
+  "lua_apr_blob_object*",      /* metatable name in registry */
+  "blob",                      /* friendly object name */
+  sizeof(lua_apr_blob_object), /* structure size */
+  blob_methods,                /* methods table */
+  blob_metamethods             /* metamethods table */
+};
+
+/* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
@@ -33,6 +33,12 @@
 /* Subtract a from b without producing negative values. */
 #define SAFE_SUB(a, b) ((a) <= (b) ? (b) - (a) : 0)
 
+/* The minimum size of the read buffer used by buffer_read_records(). */
+#define LUA_APR_RECORDS_BUFSIZE (1024 * 64)
+
+/* The maximum number of bytes read by one call to read_into(). */
+#define LUA_APR_READINTO_MAX (1024 * 1024 * 64)
+
 /* The size of the static buffer used to convert strings to numbers. */
 #define LUA_APR_MAXSTR2NUM (LUAI_MAXNUMBER2STR * 2)
 
@@ -49,38 +55,88 @@
 
 /* Internal functions. {{{1 */
 
-/* find_win32_eol() {{{2 */
+/* find_win32_eol() {{{2
+ *
+ * Find the next CR LF pair between @p and @end. Returns a pointer to the CR
+ * or @end when there is no (complete) pair in the given range. The scan is
+ * done by memchr() which most C libraries implement using SIMD instructions.
+ */
 
-static int find_win32_eol(lua_apr_buffer *B, size_t offset, size_t *result)
+static char *find_win32_eol(char *p, char *end)
 {
-  char *match, *cursor = CURSOR(B) + offset;
-  size_t avail = AVAIL(B) - offset;
-
-  match = memchr(cursor, '\r', avail);
-  if (match != NULL) {
-    size_t test = match - cursor;
-    if (test < avail && *(match + 1) == '\n') {
-      *result = test;
-      return 1;
-    }
+  while (p < end && (p = memchr(p, '\r', end - p)) != NULL) {
+    if (p + 1 < end && *(p + 1) == '\n')
+      return p;
+    p++;
   }
-  return 0;
+  return end;
 }
 
-/* binary_to_text() {{{2 */
+/* binary_to_text() {{{2
+ *
+ * Translate CR LF pairs in the input buffer to LF in a single pass over the
+ * data: Runs of bytes between pairs are moved down at most once. Data that
+ * was already translated by a previous call is skipped (otherwise "\r\r\n"
+ * would first turn into "\r\n" and then into "\n") except for a trailing CR
+ * whose LF may still arrive in the next read.
+ */
 
-static void binary_to_text(lua_apr_buffer *B)
+static void binary_to_text(lua_apr_readbuf *input)
 {
-  size_t offset = 0, test;
+  lua_apr_buffer *B = &input->buffer;
+  char *src, *dst, *end, *match;
+  size_t size;
+
+  if (AVAIL(B) == 0)
+    return;
+  src = &B->data[B->index > input->translated ? B->index : input->translated];
+  end = &B->data[B->limit];
+  match = find_win32_eol(src, end);
+  dst = match;
+  while (match < end) {
+    src = match + 1; /* drop the CR, keep the LF */
+    match = find_win32_eol(src + 1, end);
+    size = match - src;
+    memmove(dst, src, size);
+    dst += size;
+  }
+  B->limit = dst - B->data;
+  input->translated = B->limit;
+  if (B->limit > B->index && B->data[B->limit - 1] == '\r')
+    input->translated--;
+}
+
+/* text_to_binary() {{{2
+ *
+ * Copy as much of @data into the output buffer as fits while expanding LF to
+ * CR LF. Returns the number of bytes consumed from @data.
+ */
 
-  while (find_win32_eol(B, offset, &test)) {
-    /* TODO binary_to_text() is very inefficient */
-    size_t i = B->index + offset + test;
-    char *p = &B->data[i];
-    memmove(p, p + 1, B->limit - i);
-    offset += test;
-    B->limit--;
+static size_t text_to_binary(lua_apr_buffer *B, const char *data, size_t length)
+{
+  const char *src = data, *end = data + length, *match;
+  size_t size;
+
+  while (src < end && SPACE(B) > 0) {
+    size = end - src;
+    if (size > SPACE(B))
+      size = SPACE(B);
+    match = memchr(src, '\n', size);
+    if (match != NULL)
+      size = match - src;
+    memcpy(&B->data[B->limit], src, size);
+    B->limit += size;
+    src += size;
+    if (match == NULL)
+      continue;
+    if (SPACE(B) < 2) /* not enough room for the EOL sequence */
+      break;
+    memcpy(&B->data[B->limit], "\r\n", 2);
+    B->limit += 2;
+    src++;
   }
+
+  return src - data;
 }
 
 /* shift_buffer() {{{2 */
@@ -136,6 +192,7 @@ static apr_status_t fill_buffer(lua_apr_readbuf *input, apr_size_t len)
     return status;
 
   /* Shift the buffer's contents down? */
+  input->translated = SAFE_SUB(B->index, input->translated);
   shift_buffer(B);
 
   /* Try to grow the buffer? */
@@ -192,6 +249,217 @@ static apr_status_t read_line(lua_State *L, lua_apr_readbuf *input)
   return status;
 }
 
+/* find_bytes() {{{2
+ *
+ * Find the first occurrence of the @length bytes at @needle in the @size bytes
+ * at @p. Candidate positions are located using memchr() (which most C
+ * libraries implement using SIMD instructions) before comparing the rest.
+ */
+
+static const char *find_bytes(const char *p, size_t size, const char *needle, size_t length)
+{
+  const char *end;
+
+  if (length > size)
+    return NULL;
+  end = p + size - length;
+  while (p <= end) {
+    p = memchr(p, needle[0], end - p + 1);
+    if (p == NULL)
+      return NULL;
+    if (memcmp(p + 1, needle + 1, length - 1) == 0)
+      return p;
+    p++;
+  }
+
+  return NULL;
+}
+
+/* read_until() {{{2
+ *
+ * Read up to the next occurrence of a (multi byte) delimiter. Sets *overflow
+ * and pushes nothing when @max is nonzero and the delimiter isn't found within
+ * the first @max bytes.
+ */
+
+static apr_status_t read_until(lua_State *L, lua_apr_readbuf *input,
+    const char *delim, size_t dlen, size_t max, int *overflow)
+{
+  lua_apr_buffer *B = &input->buffer;
+  apr_status_t status = APR_SUCCESS;
+  size_t offset = 0, length;
+  const char *match;
+
+  do {
+    /* Scan the buffered input that hasn't been scanned yet. */
+    match = find_bytes(CURSOR(B) + offset, AVAIL(B) - offset, delim, dlen);
+    if (match != NULL) {
+      length = match - CURSOR(B);
+      if (max > 0 && length > max) {
+        *overflow = 1;
+      } else {
+        lua_pushlstring(L, CURSOR(B), length);
+        B->index += length + dlen;
+      }
+      break;
+    } else if (max > 0 && AVAIL(B) >= max + dlen) {
+      *overflow = 1;
+      break;
+    } else if (CHECK_FOR_EOF(B, status)) {
+      /* Got EOF while searching for the delimiter? */
+      if (AVAIL(B) >= 1) {
+        lua_pushlstring(L, CURSOR(B), AVAIL(B));
+        B->index += AVAIL(B);
+      } else
+        lua_pushnil(L);
+      break;
+    }
+    /* The delimiter can straddle the end of the buffered input. */
+    offset = AVAIL(B) >= dlen ? AVAIL(B) - dlen + 1 : 0;
+    /* Get more input. */
+    status = fill_buffer(input, LUA_APR_BUFSIZE);
+  } while (SUCCESS_OR_EOF(B, status));
+
+  return status;
+}
+
+/* Options and state of buffer_read_records(). */
+typedef struct {
+  char sep, quote;
+  int numbers, nselect, *select;
+} lua_apr_records;
+
+/* push_field() {{{2
+ *
+ * Store a field of a record in the row table at the top of the stack. When
+ * number conversion is enabled unquoted fields that contain nothing but a
+ * number are stored as numbers.
+ */
+
+static void push_field(lua_State *L, lua_apr_records *R, int column,
+    const char *data, size_t length, int quoted)
+{
+  char buffer[LUA_APR_MAXSTR2NUM + 1];
+  lua_Number value;
+  char *endptr;
+  int position;
+
+  if (R->select == NULL)
+    position = column;
+  else if (column > R->nselect || R->select[column - 1] == 0)
+    return;
+  else
+    position = R->select[column - 1];
+
+  if (R->numbers && !quoted && length > 0 && length <= LUA_APR_MAXSTR2NUM) {
+    memcpy(buffer, data, length);
+    buffer[length] = '\0';
+    value = lua_str2number(buffer, &endptr);
+    if (endptr == buffer + length) {
+      lua_pushnumber(L, value);
+      lua_rawseti(L, -2, position);
+      return;
+    }
+  }
+  lua_pushlstring(L, data, length);
+  lua_rawseti(L, -2, position);
+}
+
+/* parse_record() {{{2
+ *
+ * Parse one record from the @avail bytes at @data into the row table at the
+ * top of the stack. Returns 1 and sets *used when a complete record was
+ * parsed, 0 when more input is needed, -1 when no input remains and -2 when
+ * the input ends inside a quoted field (both only possible at @eof). Quoted
+ * fields follow RFC 4180: they can contain the separator, line breaks and
+ * doubled quote characters.
+ */
+
+static int parse_record(lua_State *L, lua_apr_records *R, const char *data,
+    size_t avail, int eof, size_t *used)
+{
+  const char *p = data, *end = data + avail, *start, *q;
+  int column = 0, escaped;
+  luaL_Buffer buffer;
+
+  if (avail == 0)
+    return eof ? -1 : 0;
+
+  for (;;) {
+    column++;
+    if (R->quote != '\0' && p < end && *p == R->quote) {
+      /* Quoted field: find the closing quote, skipping doubled quotes. */
+      start = ++p;
+      escaped = 0;
+      for (;;) {
+        q = memchr(p, R->quote, end - p);
+        if (q == NULL)
+          return eof ? -2 : 0;
+        if (q + 1 == end && !eof)
+          return 0;
+        if (q + 1 < end && q[1] == R->quote) {
+          escaped = 1;
+          p = q + 2;
+          continue;
+        }
+        break;
+      }
+      if (!escaped) {
+        push_field(L, R, column, start, q - start, 1);
+      } else {
+        /* Replace doubled quotes by single quotes. */
+        luaL_buffinit(L, &buffer);
+        for (p = start; p < q; p++) {
+          luaL_addchar(&buffer, *p);
+          if (*p == R->quote)
+            p++;
+        }
+        luaL_pushresult(&buffer);
+        start = lua_tolstring(L, -1, NULL);
+        lua_insert(L, -2);
+        push_field(L, R, column, start, lua_objlen(L, -2), 1);
+        lua_remove(L, -2);
+      }
+      /* Skip anything between the closing quote and the separator. */
+      for (p = q + 1; p < end && *p != R->sep && *p != '\n'; p++)
+        ;
+    } else {
+      /* Unquoted field: find the separator or the end of the line. */
+      start = p;
+      while (p < end && *p != R->sep && *p != '\n')
+        p++;
+      q = p;
+      if (q < end && *q == '\n' && q > start && q[-1] == '\r')
+        q--;
+      else if (q == end && eof && q > start && q[-1] == '\r')
+        q--;
+      if (p < end || eof)
+        push_field(L, R, column, start, q - start, 0);
+    }
+    if (p == end) {
+      /* The last record doesn't need to end in a line break. */
+      if (!eof)
+        return 0;
+      *used = avail;
+      return 1;
+    } else if (*p == '\n') {
+      *used = p - data + 1;
+      return 1;
+    }
+    p++; /* skip the separator */
+  }
+}
+
+/* push_overflow() {{{2 */
+
+static int push_overflow(lua_State *L)
+{
+  lua_pushnil(L);
+  lua_pushliteral(L, "record exceeds maximum length");
+  lua_pushliteral(L, "EOVERFLOW");
+  return 3;
+}
+
 /* read_number() {{{2 */
 
 static apr_status_t read_number(lua_State *L, lua_apr_readbuf *input)
@@ -250,8 +518,12 @@ static apr_status_t read_chars(lua_State *L, lua_apr_readbuf *input, apr_size_t
       lua_pushnil(L);
       break;
     }
+    /* Translate buffered input that hasn't been translated yet. */
+    if (input->text_mode && !B->unmanaged)
+      binary_to_text(input);
     /* Check if we have enough input or reached EOF with buffered input. */
-    cornercase = input->text_mode && B->data[SAFE_SUB(1, AVAIL(B))] == '\r';
+    cornercase = input->text_mode && n >= AVAIL(B) && AVAIL(B) > 0
+                 && B->data[B->limit - 1] == '\r';
     if ((n <= AVAIL(B) && !cornercase) || CHECK_FOR_EOF(B, status)) {
       if (n > AVAIL(B))
         n = AVAIL(B);
@@ -264,8 +536,6 @@ static apr_status_t read_chars(lua_State *L, lua_apr_readbuf *input, apr_size_t
       status = fill_buffer(input, n + cornercase);
       if (!SUCCESS_OR_EOF(B, status))
         break;
-      if (input->text_mode) /* && (n + cornercase) > 0 */
-        binary_to_text(B);
     }
   }
 
@@ -284,7 +554,7 @@ static apr_status_t read_all(lua_State *L, lua_apr_readbuf *input)
       status = fill_buffer(input, APR_SIZE_MAX);
     } while (status == APR_SUCCESS);
     if (input->text_mode)
-      binary_to_text(B);
+      binary_to_text(input);
   }
   lua_pushlstring(L, CURSOR(B), AVAIL(B));
   B->index = B->limit + 1;
@@ -324,8 +594,10 @@ void init_buffers(lua_State *L,
 #endif
   /* Initialize the input buffer structure. */
   input->text_mode = text_mode;
+  input->translated = 0;
   input->object = object;
   input->read = read;
+  input->filter = NULL;
   input->buffer.unmanaged = 0;
   input->buffer.data = NULL;
   input->buffer.index = 0;
@@ -336,6 +608,7 @@ void init_buffers(lua_State *L,
   output->object = object;
   output->write = write;
   output->flush = flush;
+  output->filter = NULL;
   output->buffer.unmanaged = 0;
   output->buffer.data = NULL;
   output->buffer.index = 0;
@@ -351,8 +624,10 @@ void init_unmanaged_buffers(lua_State *L,
 {
   /* Initialize the input buffer structure. */
   input->text_mode = 0;
+  input->translated = 0;
   input->object = NULL;
   input->read = NULL;
+  input->filter = NULL;
   input->buffer.unmanaged = 1;
   input->buffer.data = data;
   input->buffer.index = 0;
@@ -363,6 +638,7 @@ void init_unmanaged_buffers(lua_State *L,
   output->object = NULL;
   output->write = NULL;
   output->flush = NULL;
+  output->filter = NULL;
   output->buffer.unmanaged = 1;
   output->buffer.data = data;
   output->buffer.index = 0;
@@ -383,6 +659,25 @@ void free_buffer(lua_State *L, lua_apr_buffer *B)
   }
 }
 
+/* buffer_text_mode() {{{1
+ *
+ * Implementation of the text_mode() method shared by files, pipes and
+ * sockets. Pushes the previous state and changes it when an argument is given.
+ */
+
+int buffer_text_mode(lua_State *L, lua_apr_readbuf *input, lua_apr_writebuf *output)
+{
+  lua_pushboolean(L, input->text_mode);
+  if (!lua_isnoneornil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TBOOLEAN);
+    if (lua_toboolean(L, 2) && !input->text_mode)
+      input->translated = input->buffer.index;
+    input->text_mode = lua_toboolean(L, 2);
+    output->text_mode = input->text_mode;
+  }
+  return 1;
+}
+
 /* read_lines() {{{1 */
 
 int read_lines(lua_State *L, lua_apr_readbuf *B)
@@ -442,16 +737,371 @@ int read_buffer(lua_State *L, lua_apr_readbuf *B)
   return nresults;
 }
 
+/* buffer_read_until() {{{1
+ *
+ * Implementation of the read_until() method shared by files, pipes, sockets
+ * and shared memory: read_until(delimiter [, max]).
+ */
+
+int buffer_read_until(lua_State *L, lua_apr_readbuf *input)
+{
+  apr_status_t status;
+  const char *delim;
+  size_t dlen;
+  lua_Integer max;
+  int overflow = 0;
+
+  delim = luaL_checklstring(L, 2, &dlen);
+  luaL_argcheck(L, dlen > 0, 2, "empty delimiter");
+  max = luaL_optinteger(L, 3, 0);
+  luaL_argcheck(L, max >= 0, 3, "maximum length can't be negative");
+  lua_settop(L, 3);
+
+  status = read_until(L, input, delim, dlen, (size_t) max, &overflow);
+  if (overflow)
+    return push_overflow(L);
+  else if (!SUCCESS_OR_EOF(&input->buffer, status))
+    return push_error_status(L, status);
+
+  return 1;
+}
+
+/* buffer_read_frame() {{{1
+ *
+ * Implementation of the read_frame() method shared by files, pipes, sockets
+ * and shared memory: read_frame(format [, max]) where format is the type of
+ * the length prefix.
+ */
+
+int buffer_read_frame(lua_State *L, lua_apr_readbuf *input)
+{
+  const char *options[] = {
+    "u8", "u16be", "u16le", "u32be", "u32le", "u64be", "u64le", NULL
+  };
+  const size_t sizes[] = { 1, 2, 2, 4, 4, 8, 8 };
+  lua_apr_buffer *B = &input->buffer;
+  apr_status_t status = APR_SUCCESS;
+  size_t i, hdrsize, length = 0;
+  const unsigned char *p;
+  apr_uint64_t value;
+  lua_Integer max;
+  int option;
+
+  option = luaL_checkoption(L, 2, NULL, options);
+  max = luaL_optinteger(L, 3, 0);
+  luaL_argcheck(L, max >= 0, 3, "maximum length can't be negative");
+  hdrsize = sizes[option];
+
+  for (;;) {
+    if (AVAIL(B) >= hdrsize) {
+      /* Decode the length prefix (odd options are big endian). */
+      p = (const unsigned char*) CURSOR(B);
+      value = 0;
+      for (i = 0; i < hdrsize; i++) {
+        if (option % 2 == 1)
+          value = (value << 8) | p[i];
+        else
+          value |= (apr_uint64_t) p[i] << (8 * i);
+      }
+      if ((max > 0 && value > (apr_uint64_t) max) || value > APR_SIZE_MAX - hdrsize)
+        return push_overflow(L);
+      length = (size_t) value;
+      /* Return the payload when it has been buffered completely. */
+      if (AVAIL(B) - hdrsize >= length) {
+        lua_pushlstring(L, CURSOR(B) + hdrsize, length);
+        B->index += hdrsize + length;
+        return 1;
+      }
+    }
+    if (CHECK_FOR_EOF(B, status)) {
+      /* End of input between frames or in the middle of a frame? */
+      if (AVAIL(B) == 0) {
+        lua_pushnil(L);
+        return 1;
+      }
+      return push_error_status(L, APR_EOF);
+    }
+    /* Read ahead so that small frames don't cost a system call each. */
+    status = fill_buffer(input, hdrsize + length > LUA_APR_BUFSIZE
+        ? hdrsize + length : LUA_APR_BUFSIZE);
+    if (!SUCCESS_OR_EOF(B, status))
+      return push_error_status(L, status);
+  }
+}
+
+/* buffer_read_struct() {{{1
+ *
+ * Implementation of the read_struct() method shared by files, pipes and
+ * sockets: read_struct(struct [, max]). Decode a structure (see
+ * `apr.struct()`) straight out of the read buffer. Returns the decoded values,
+ * nil when there's no more input or (nil, message, code) on errors, including
+ * input ending inside a structure and structures larger than @max bytes.
+ */
+
+int buffer_read_struct(lua_State *L, lua_apr_readbuf *input)
+{
+  lua_apr_buffer *B = &input->buffer;
+  apr_status_t status = APR_SUCCESS;
+  lua_apr_struct_object *S;
+  lua_Integer max;
+  size_t length;
+  int n;
+
+  max = luaL_optinteger(L, 3, 0);
+  luaL_argcheck(L, max >= 0, 3, "maximum length can't be negative");
+  S = check_struct(L, 2);
+  lua_settop(L, 2);
+
+  for (;;) {
+    n = struct_unpack(L, S, CURSOR(B), AVAIL(B), &length);
+    if (n >= 0) {
+      B->index += length;
+      return n;
+    } else if (length == APR_SIZE_MAX || (max > 0 && length > (size_t) max)) {
+      /* A length prefix that can't be (or shouldn't be) buffered. */
+      return push_overflow(L);
+    } else if (CHECK_FOR_EOF(B, status)) {
+      if (AVAIL(B) == 0) {
+        lua_pushnil(L);
+        return 1;
+      }
+      return push_error_status(L, APR_EOF);
+    }
+    status = fill_buffer(input, length > LUA_APR_BUFSIZE ? length : LUA_APR_BUFSIZE);
+    if (!SUCCESS_OR_EOF(B, status))
+      return push_error_status(L, status);
+  }
+}
+
+/* buffer_read_records() {{{1
+ *
+ * Implementation of file:read_records([options]). Parses a batch of records
+ * of delimiter separated values directly from the read buffer and returns
+ * them as a table of rows, nil when no input remains or (nil, message, code)
+ * on errors.
+ */
+
+int buffer_read_records(lua_State *L, lua_apr_readbuf *input)
+{
+  lua_apr_buffer *B = &input->buffer;
+  apr_status_t status = APR_SUCCESS;
+  lua_apr_records R;
+  const char *string;
+  size_t length, used;
+  int i, column, batch = 1000, nrows = 0, ncols = 0, eof, result;
+
+  /* Parse the options. */
+  R.sep = ',';
+  R.quote = '"';
+  R.numbers = 0;
+  R.nselect = 0;
+  R.select = NULL;
+  if (!lua_isnoneornil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_getfield(L, 2, "sep");
+    if (!lua_isnil(L, -1)) {
+      string = luaL_checklstring(L, -1, &length);
+      luaL_argcheck(L, length == 1, 2, "separator must be one character");
+      R.sep = string[0];
+    }
+    lua_getfield(L, 2, "quote");
+    if (lua_type(L, -1) == LUA_TBOOLEAN && !lua_toboolean(L, -1)) {
+      R.quote = '\0';
+    } else if (!lua_isnil(L, -1)) {
+      string = luaL_checklstring(L, -1, &length);
+      luaL_argcheck(L, length == 1, 2, "quote must be one character");
+      R.quote = string[0];
+    }
+    lua_getfield(L, 2, "numbers");
+    R.numbers = lua_toboolean(L, -1);
+    lua_getfield(L, 2, "batch");
+    if (!lua_isnil(L, -1)) {
+      batch = luaL_checkint(L, -1);
+      luaL_argcheck(L, batch > 0, 2, "batch size must be positive");
+    }
+    lua_getfield(L, 2, "fields");
+    if (!lua_isnil(L, -1)) {
+      /* Map column numbers to positions in the row tables. */
+      luaL_checktype(L, -1, LUA_TTABLE);
+      ncols = lua_objlen(L, -1);
+      for (i = 1; i <= ncols; i++) {
+        lua_rawgeti(L, -1, i);
+        column = luaL_checkint(L, -1);
+        luaL_argcheck(L, column > 0, 2, "column numbers must be positive");
+        if (column > R.nselect)
+          R.nselect = column;
+        lua_pop(L, 1);
+      }
+      R.select = lua_newuserdata(L, R.nselect * sizeof R.select[0] + 1);
+      memset(R.select, 0, R.nselect * sizeof R.select[0]);
+      for (i = ncols; i >= 1; i--) {
+        lua_rawgeti(L, -2, i);
+        R.select[lua_tointeger(L, -1) - 1] = i;
+        lua_pop(L, 1);
+      }
+    }
+  }
+
+  /* Read large chunks at a time. The buffer is shifted down here the same way
+   * fill_buffer() does it, because reserve_buffer() doesn't know about the
+   * translated offset of input buffers. */
+  if (!B->unmanaged) {
+    input->translated = SAFE_SUB(B->index, input->translated);
+    shift_buffer(B);
+    if (reserve_buffer(B, LUA_APR_RECORDS_BUFSIZE) != APR_SUCCESS)
+      return push_error_status(L, APR_ENOMEM);
+  }
+
+  lua_createtable(L, batch < 1024 ? batch : 1024, 0);
+  eof = B->unmanaged;
+  while (nrows < batch) {
+    lua_createtable(L, ncols, 0);
+    result = parse_record(L, &R, CURSOR(B), AVAIL(B), eof, &used);
+    if (result > 0) {
+      B->index += used;
+      lua_rawseti(L, -2, ++nrows);
+    } else {
+      lua_pop(L, 1);
+      /* Input that ends inside a quoted field is an error, but complete rows
+       * before it are returned first (the next call reports the error). */
+      if (result == -2 && nrows == 0)
+        return push_error_status(L, APR_EOF);
+      else if (result < 0)
+        break;
+      status = fill_buffer(input, APR_SIZE_MAX);
+      if (CHECK_FOR_EOF(B, status))
+        eof = 1;
+      else if (status != APR_SUCCESS)
+        return push_error_status(L, status);
+    }
+  }
+
+  if (nrows == 0)
+    lua_pushnil(L);
+  return 1;
+}
+
+/* read_into_buffer() {{{1
+ *
+ * Implementation of the read_into() method shared by files, pipes and sockets.
+ * Appends up to n bytes to the byte buffer given as the second argument,
+ * reading directly from the underlying object into the byte buffer's memory
+ * when no input is buffered. Returns the number of bytes appended, nil on end
+ * of file or (nil, message, code) on errors.
+ */
+
+int read_into_buffer(lua_State *L, lua_apr_readbuf *input)
+{
+  lua_apr_buffer *B = &input->buffer, *T;
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t n, len = 0;
+  lua_Integer count;
+  const char *data;
+  int top;
+
+  T = &((lua_apr_bytebuf_object*) check_object(L, 2, &lua_apr_bytebuf_type))->buffer;
+  count = luaL_optinteger(L, 3, LUA_APR_BUFSIZE);
+  luaL_argcheck(L, count > 0, 3, "number of bytes must be positive");
+  /* Don't reserve (much) more memory than one read can reasonably return. */
+  n = count < LUA_APR_READINTO_MAX ? (apr_size_t) count : LUA_APR_READINTO_MAX;
+  lua_settop(L, 3);
+
+  if (input->text_mode && !B->unmanaged) {
+    /* Let read_chars() deal with the translation of line endings. */
+    top = lua_gettop(L);
+    status = read_chars(L, input, n);
+    if (lua_gettop(L) > top && lua_isstring(L, -1)) {
+      data = lua_tolstring(L, -1, &len);
+      if (reserve_buffer(T, len) == APR_SUCCESS) {
+        memcpy(&T->data[T->limit], data, len);
+        T->limit += len;
+      } else {
+        status = APR_ENOMEM;
+      }
+    }
+  } else if (AVAIL(B) > 0 || B->unmanaged) {
+    /* Move buffered input to the byte buffer first. */
+    len = AVAIL(B) < n ? AVAIL(B) : n;
+    if (len == 0) {
+      status = APR_EOF;
+    } else if (reserve_buffer(T, len) == APR_SUCCESS) {
+      memcpy(&T->data[T->limit], CURSOR(B), len);
+      T->limit += len;
+      B->index += len;
+    } else {
+      status = APR_ENOMEM;
+    }
+  } else {
+    /* Read straight into the byte buffer. */
+    status = reserve_buffer(T, n);
+    if (status == APR_SUCCESS) {
+      len = n;
+      status = input->read(input->object, &T->data[T->limit], &len);
+      if (status == APR_SUCCESS)
+        T->limit += len;
+    }
+  }
+
+  if (status == APR_SUCCESS && len > 0) {
+    lua_pushinteger(L, len);
+    return 1;
+  } else if (status == APR_SUCCESS || CHECK_FOR_EOF(B, status)) {
+    lua_pushnil(L);
+    return 1;
+  } else {
+    return push_error_status(L, status);
+  }
+}
+
+/* reserve_buffer() {{{1
+ *
+ * Make sure there's room for at least n more bytes after the end of the data
+ * in a buffer, shifting down and/or growing the buffer as needed. Returns
+ * APR_ENOMEM when the required size doesn't fit in a size_t.
+ */
+
+apr_status_t reserve_buffer(lua_apr_buffer *B, size_t n)
+{
+  size_t newsize;
+  char *newdata;
+
+  if (B->unmanaged)
+    return n <= SPACE(B) ? APR_SUCCESS : APR_ENOSPC;
+  if (n <= SPACE(B) && B->data != NULL)
+    return APR_SUCCESS;
+  shift_buffer(B);
+  if (n <= SPACE(B) && B->data != NULL)
+    return APR_SUCCESS;
+
+  if (n > APR_SIZE_MAX - B->limit)
+    return APR_ENOMEM;
+  newsize = B->size < LUA_APR_BUFSIZE ? LUA_APR_BUFSIZE : B->size;
+  while (newsize - B->limit < n) {
+    if (newsize > APR_SIZE_MAX / 3 * 2) {
+      /* Growing by half would overflow, use the exact size instead. */
+      newsize = B->limit + n;
+      break;
+    }
+    newsize = newsize / 2 * 3;
+  }
+  newdata = realloc(B->data, newsize);
+  if (newdata == NULL)
+    return APR_ENOMEM;
+  B->data = newdata;
+  B->size = newsize;
+
+  return APR_SUCCESS;
+}
+
 /* write_buffer() {{{1 */
 
 int write_buffer(lua_State *L, lua_apr_writebuf *output)
 {
   lua_apr_buffer *B = &output->buffer;
   apr_status_t status = APR_SUCCESS;
-  int i, add_eol, n = lua_gettop(L);
+  int i, n = lua_gettop(L);
   size_t length, size;
   const char *data;
-  char *match;
 
   if (B->data == NULL) { /* allocate write buffer on first use */
     B->data = malloc(LUA_APR_BUFSIZE);
@@ -461,34 +1111,31 @@ int write_buffer(lua_State *L, lua_apr_writebuf *output)
   }
 
   for (i = 2; i <= n && status == APR_SUCCESS; i++) {
-    data = luaL_checklstring(L, i, &length);
+    data = check_bytes(L, i, &length);
+    if (!output->text_mode && !B->unmanaged && length >= B->size) {
+      /* Write large strings and blobs directly instead of copying them. */
+      status = flush_buffer(L, output, 1);
+      while (length > 0 && status == APR_SUCCESS) {
+        size = length;
+        status = output->write(output->object, data, &size);
+        data += size;
+        length -= size;
+      }
+      continue;
+    }
     while (length > 0 && status == APR_SUCCESS) {
       if (SPACE(B) > 0) { /* copy range of bytes to buffer? */
-        size = length;
-        add_eol = 0;
-        if (size > SPACE(B)) { /* never write past end of buffer */
-          size = SPACE(B);
-        }
-        if (output->text_mode) { /* copy no more than one line in text mode */
-          match = memchr(data, '\n', size);
-          if (match != NULL) {
-            size = match - data; /* don't copy EOL directly */
-            if (size + 2 <= SPACE(B))
-              add_eol = 1; /* append EOL after copying line? */
-          }
-        }
-        if (size > 0) { /* copy range of bytes to buffer! */
+        if (output->text_mode) { /* expand EOL while copying in text mode */
+          size = text_to_binary(B, data, length);
+        } else {
+          size = length;
+          if (size > SPACE(B)) /* never write past end of buffer */
+            size = SPACE(B);
           memcpy(&B->data[B->limit], data, size);
           B->limit += size;
-          data += size;
-          length -= size;
-        }
-        if (add_eol) { /* add end of line sequence to buffer? */
-          memcpy(&B->data[B->limit], "\r\n", 2);
-          B->limit += 2;
-          data += 1;
-          length -= 1;
         }
+        data += size;
+        length -= size;
       }
       if (AVAIL(B) > 0 && SPACE(B) <= 1) /* flush buffer contents? */
         status = flush_buffer(L, output, 1);
@@ -498,6 +1145,34 @@ int write_buffer(lua_State *L, lua_apr_writebuf *output)
   return push_status(L, status);
 }
 
+/* buffer_write_struct() {{{1
+ *
+ * Implementation of the write_struct() method shared by files, pipes and
+ * sockets: Encode a structure (see `apr.struct()`) straight into the write
+ * buffer.
+ */
+
+int buffer_write_struct(lua_State *L, lua_apr_writebuf *output)
+{
+  lua_apr_buffer *B = &output->buffer;
+  apr_status_t status = APR_SUCCESS;
+  lua_apr_struct_object *S;
+  size_t size;
+
+  S = check_struct(L, 2);
+  size = struct_packsize(L, S, 3);
+  if (SPACE(B) < size && !B->unmanaged)
+    status = flush_buffer(L, output, 1);
+  if (status == APR_SUCCESS)
+    status = reserve_buffer(B, size);
+  if (status == APR_SUCCESS) {
+    struct_pack(L, S, 3, &B->data[B->limit]);
+    B->limit += size;
+  }
+
+  return push_status(L, status);
+}
+
 /* flush_buffer() {{{1 */
 
 apr_status_t flush_buffer(lua_State *L, lua_apr_writebuf *output, int soft)
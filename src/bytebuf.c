@@ -0,0 +1,301 @@
+/* Byte buffers module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * Protocol code that accumulates input until a complete message has arrived
+ * and then slices it up tends to create lots of short lived Lua strings,
+ * because every `file:read()` call returns a new string and every slice is
+ * another one. A byte buffer is a mutable, growable sequence of bytes that
+ * lives outside of the Lua heap: `file:read_into()` and `socket:read_into()`
+ * append input to a byte buffer without creating Lua strings, `buffer:find()`
+ * searches the buffered bytes in place and Lua strings are only created for
+ * the parts you actually `buffer:consume()` or `buffer:peek()` at. Byte buffers
+ * are also accepted by `file:write()` and `socket:write()`. For example:
+ *
+ *     > buffer = apr.buffer()
+ *     > repeat
+ *     >>  assert(client:read_into(buffer, 4096))
+ *     >>  _, last = buffer:find '\r\n\r\n'
+ *     >> until last
+ *     > headers = buffer:consume(last)
+ */
+
+#include "lua_apr.h"
+
+/* The bytes currently in the buffer. */
+#define CURSOR(B) (&(B)->data[(B)->index])
+#define AVAIL(B) ((B)->limit - (B)->index)
+
+/* Internal functions. {{{1 */
+
+/* check_bytebuf() {{{2 */
+
+static lua_apr_buffer *check_bytebuf(lua_State *L, int idx)
+{
+  lua_apr_bytebuf_object *object = check_object(L, idx, &lua_apr_bytebuf_type);
+  return &object->buffer;
+}
+
+/* check_count() {{{2
+ *
+ * Get the optional number of bytes at the given stack index, limited to the
+ * number of bytes in the buffer (the default).
+ */
+
+static size_t check_count(lua_State *L, int idx, lua_apr_buffer *B)
+{
+  lua_Integer n = luaL_optinteger(L, idx, AVAIL(B));
+  luaL_argcheck(L, n >= 0, idx, "number of bytes can't be negative");
+  return (size_t) n < AVAIL(B) ? (size_t) n : AVAIL(B);
+}
+
+/* append_values() {{{2 */
+
+static void append_values(lua_State *L, lua_apr_buffer *B, int first)
+{
+  const char *data;
+  size_t length, offset;
+  int i, n = lua_gettop(L), self;
+
+  for (i = first; i <= n; i++) {
+    data = check_bytes(L, i, &length);
+    if (length > 0) {
+      /* The value can be (part of) the buffer itself, which
+       * reserve_buffer() may move around in memory. */
+      self = B->data != NULL && data >= B->data && data < B->data + B->size;
+      offset = self ? data - CURSOR(B) : 0;
+      if (reserve_buffer(B, length) != APR_SUCCESS)
+        raise_error_memory(L);
+      if (self)
+        data = CURSOR(B) + offset;
+      memcpy(&B->data[B->limit], data, length);
+      B->limit += length;
+    }
+  }
+}
+
+/* remove_bytes() {{{2 */
+
+static void remove_bytes(lua_apr_buffer *B, size_t n)
+{
+  B->index += n;
+  if (B->index == B->limit)
+    B->index = B->limit = 0;
+}
+
+/* apr.buffer([value]) -> buffer {{{1
+ *
+ * Create a new byte buffer. If @value is a number it gives the initial
+ * capacity of the buffer in bytes, otherwise @value (a string, blob or byte
+ * buffer) is copied into the new buffer.
+ */
+
+int lua_apr_bytebuf(lua_State *L)
+{
+  lua_apr_bytebuf_object *object;
+  lua_Integer size;
+
+  lua_settop(L, 1);
+  object = new_object(L, &lua_apr_bytebuf_type);
+  if (lua_type(L, 1) == LUA_TNUMBER) {
+    size = lua_tointeger(L, 1);
+    luaL_argcheck(L, size >= 0, 1, "size can't be negative");
+    if (reserve_buffer(&object->buffer, (size_t) size) != APR_SUCCESS)
+      raise_error_memory(L);
+  } else if (!lua_isnil(L, 1)) {
+    lua_insert(L, 1);
+    append_values(L, &object->buffer, 2);
+    lua_settop(L, 1);
+  }
+
+  return 1;
+}
+
+/* buffer:append(value [, ...]) -> buffer {{{1
+ *
+ * Append one or more strings, numbers, blobs or byte buffers to the end of
+ * the buffer. Returns the buffer so that calls can be chained.
+ */
+
+static int bytebuf_append(lua_State *L)
+{
+  lua_apr_buffer *B = check_bytebuf(L, 1);
+  append_values(L, B, 2);
+  lua_settop(L, 1);
+  return 1;
+}
+
+/* buffer:peek([n]) -> string {{{1
+ *
+ * Get the first @n bytes in the buffer (all of them by default) as a string
+ * without removing them from the buffer.
+ */
+
+static int bytebuf_peek(lua_State *L)
+{
+  lua_apr_buffer *B = check_bytebuf(L, 1);
+  lua_pushlstring(L, CURSOR(B), check_count(L, 2, B));
+  return 1;
+}
+
+/* buffer:consume([n]) -> string {{{1
+ *
+ * Remove the first @n bytes (all of them by default) from the buffer and
+ * return them as a string.
+ */
+
+static int bytebuf_consume(lua_State *L)
+{
+  lua_apr_buffer *B = check_bytebuf(L, 1);
+  size_t n = check_count(L, 2, B);
+  lua_pushlstring(L, CURSOR(B), n);
+  remove_bytes(B, n);
+  return 1;
+}
+
+/* buffer:discard([n]) -> count {{{1
+ *
+ * Remove the first @n bytes (all of them by default) from the buffer without
+ * creating a string. Returns the number of bytes removed.
+ */
+
+static int bytebuf_discard(lua_State *L)
+{
+  lua_apr_buffer *B = check_bytebuf(L, 1);
+  size_t n = check_count(L, 2, B);
+  remove_bytes(B, n);
+  lua_pushinteger(L, n);
+  return 1;
+}
+
+/* buffer:find(string [, init]) -> start, end {{{1
+ *
+ * Search the buffer for a plain @string starting at the byte offset @init
+ * (which defaults to 1). If the string is found its start and end offsets are
+ * returned like `string.find(s, pattern, init, true)` does, otherwise nothing
+ * is returned.
+ */
+
+static int bytebuf_find(lua_State *L)
+{
+  lua_apr_buffer *B;
+  const char *needle, *p, *end;
+  size_t length;
+  lua_Integer init;
+
+  B = check_bytebuf(L, 1);
+  needle = luaL_checklstring(L, 2, &length);
+  init = luaL_optinteger(L, 3, 1);
+  if (init < 0)
+    init += AVAIL(B) + 1;
+  if (init < 1)
+    init = 1;
+  if ((size_t) init - 1 + length > AVAIL(B))
+    return 0;
+
+  p = CURSOR(B) + init - 1;
+  end = CURSOR(B) + AVAIL(B) - length;
+  if (length == 0)
+    goto found;
+  while (p <= end) {
+    p = memchr(p, needle[0], end - p + 1);
+    if (p == NULL)
+      return 0;
+    if (memcmp(p, needle, length) == 0)
+      goto found;
+    p++;
+  }
+  return 0;
+
+found:
+  lua_pushinteger(L, p - CURSOR(B) + 1);
+  lua_pushinteger(L, p - CURSOR(B) + length);
+  return 2;
+}
+
+/* buffer:size() -> bytes {{{1
+ *
+ * Get the number of bytes in the buffer. You can also use the `#` operator.
+ */
+
+static int bytebuf_size(lua_State *L)
+{
+  lua_apr_buffer *B = check_bytebuf(L, 1);
+  lua_pushinteger(L, AVAIL(B));
+  return 1;
+}
+
+/* buffer:clear() -> buffer {{{1
+ *
+ * Remove all bytes from the buffer. The memory allocated by the buffer is kept
+ * so it can be reused.
+ */
+
+static int bytebuf_clear(lua_State *L)
+{
+  lua_apr_buffer *B = check_bytebuf(L, 1);
+  B->index = B->limit = 0;
+  lua_settop(L, 1);
+  return 1;
+}
+
+/* buffer:__len() {{{1 */
+
+static int bytebuf_len(lua_State *L)
+{
+  return bytebuf_size(L);
+}
+
+/* buffer:__tostring() {{{1 */
+
+static int bytebuf_tostring(lua_State *L)
+{
+  lua_apr_buffer *B = check_bytebuf(L, 1);
+  lua_pushfstring(L, "%s (%p)", lua_apr_bytebuf_type.friendlyname, B);
+  return 1;
+}
+
+/* buffer:__gc() {{{1 */
+
+static int bytebuf_gc(lua_State *L)
+{
+  lua_apr_bytebuf_object *object = check_object(L, 1, &lua_apr_bytebuf_type);
+  if (object_collectable((lua_apr_refobj*)object))
+    free_buffer(L, &object->buffer);
+  release_object((lua_apr_refobj*)object);
+  return 0;
+}
+
+/* }}} */
+
+static luaL_reg bytebuf_methods[] = {
+  { "append", bytebuf_append },
+  { "peek", bytebuf_peek },
+  { "consume", bytebuf_consume },
+  { "discard", bytebuf_discard },
+  { "find", bytebuf_find },
+  { "size", bytebuf_size },
+  { "clear", bytebuf_clear },
+  { NULL, NULL },
+};
+
+static luaL_reg bytebuf_metamethods[] = {
+  { "__len", bytebuf_len },
+  { "__tostring", bytebuf_tostring },
+  { "__eq", objects_equal },
+  { "__gc", bytebuf_gc },
+  { NULL, NULL },
+};
+
+lua_apr_objtype lua_apr_bytebuf_type = {
+  "lua_apr_bytebuf_object*",      /* metatable name in registry */
+  "buffer",                       /* friendly object name */
+  sizeof(lua_apr_bytebuf_object), /* structure size */
+  bytebuf_methods,                /* methods table */
+  bytebuf_metamethods             /* metamethods table */
+};
+
+/* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
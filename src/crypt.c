@@ -43,6 +43,21 @@
 #include <apr_md5.h>
 #include <apr_sha1.h>
 
+#if APR_HAS_THREADS
+# include <apr_atomic.h>
+# include <apr_thread_cond.h>
+# include <apr_thread_mutex.h>
+# include <apr_thread_pool.h>
+#endif
+
+/* apr_bcrypt_encode() was added in APR-util 1.5. */
+#define LUA_APR_HAVE_BCRYPT \
+  (APU_MAJOR_VERSION > 1 || (APU_MAJOR_VERSION == 1 && APU_MINOR_VERSION >= 5))
+
+/* The maximum number of threads that hash and validate passwords in the
+ * background (shared by all Lua states in the process). */
+#define LUA_APR_PASSWORD_THREADS 4
+
 /* Internal functions {{{1 */
 
 /* The APR cryptography functions zero buffers before returning and the Lua/APR
@@ -89,6 +104,213 @@ static lua_apr_sha1_ctx *sha1_check(lua_State *L, int idx, int valid)
   return context;
 }
 
+#if APR_HAS_THREADS
+
+typedef enum {
+  PASSWORD_VALIDATE, PASSWORD_HASH_MD5, PASSWORD_HASH_BCRYPT
+} lua_apr_password_op;
+
+/* The state of a password job is shared between the Lua object and the worker
+ * thread; whoever releases it last destroys the memory pool. */
+typedef struct {
+  apr_pool_t *pool;
+  apr_thread_mutex_t *mutex;
+  apr_thread_cond_t *cond;
+  apr_file_t *readable, *writable;
+  lua_apr_password_op op;
+  int refcount, done;
+  unsigned int cost;
+  char *password, *input;
+  apr_size_t passlen, inputlen;
+  apr_status_t status;
+  char digest[128];
+} lua_apr_password_task;
+
+typedef struct {
+  lua_apr_refobj header;
+  lua_apr_password_task *task;
+} lua_apr_password_job;
+
+static volatile void *password_threads = NULL;
+
+/* password_threads_get() {{{2
+ *
+ * Get the thread pool used for password jobs, creating it on first use. Two
+ * threads racing to create the pool is harmless: the loser destroys its pool.
+ */
+
+static apr_status_t password_threads_get(apr_thread_pool_t **result)
+{
+  apr_thread_pool_t *threads, *existing;
+  apr_status_t status;
+  apr_pool_t *pool;
+
+  threads = (apr_thread_pool_t*) password_threads;
+  if (threads == NULL) {
+    status = apr_pool_create(&pool, NULL);
+    if (status != APR_SUCCESS)
+      return status;
+    status = apr_thread_pool_create(&threads, 0, LUA_APR_PASSWORD_THREADS, pool);
+    if (status != APR_SUCCESS) {
+      apr_pool_destroy(pool);
+      return status;
+    }
+    existing = apr_atomic_casptr(&password_threads, threads, NULL);
+    if (existing != NULL) {
+      apr_thread_pool_destroy(threads);
+      apr_pool_destroy(pool);
+      threads = existing;
+    }
+  }
+  *result = threads;
+
+  return APR_SUCCESS;
+}
+
+/* password_task_release() {{{2 */
+
+static void password_task_release(lua_apr_password_task *task)
+{
+  int last;
+
+  apr_thread_mutex_lock(task->mutex);
+  last = (--task->refcount == 0);
+  apr_thread_mutex_unlock(task->mutex);
+  if (last) {
+    clear_mem(task->password, task->passlen);
+    clear_stack(task->digest);
+    apr_pool_destroy(task->pool);
+  }
+}
+
+/* password_worker() {{{2
+ *
+ * Runs on one of the threads of the pool: Validate or hash the password, wipe
+ * the copy of the password and signal completion by writing to the pipe.
+ */
+
+static void * APR_THREAD_FUNC password_worker(apr_thread_t *thread, void *data)
+{
+  lua_apr_password_task *task = data;
+  apr_status_t status;
+
+  switch (task->op) {
+    case PASSWORD_VALIDATE:
+      status = apr_password_validate(task->password, task->input);
+      break;
+    case PASSWORD_HASH_MD5:
+      status = apr_md5_encode(task->password, task->input, task->digest, count(task->digest));
+      break;
+#   if LUA_APR_HAVE_BCRYPT
+    case PASSWORD_HASH_BCRYPT:
+      status = apr_bcrypt_encode(task->password, task->cost,
+          (unsigned char*) task->input, task->inputlen,
+          task->digest, count(task->digest));
+      break;
+#   endif
+    default:
+      status = APR_ENOTIMPL;
+  }
+  clear_mem(task->password, task->passlen);
+  clear_mem(task->input, task->inputlen);
+
+  apr_thread_mutex_lock(task->mutex);
+  task->status = status;
+  task->done = 1;
+  apr_thread_cond_broadcast(task->cond);
+  apr_thread_mutex_unlock(task->mutex);
+  apr_file_putc('!', task->writable);
+
+  password_task_release(task);
+  return NULL;
+}
+
+/* password_job_start() {{{2
+ *
+ * Create a password job object, copy the password and the input (the digest
+ * to validate against or the salt) and queue the job on the thread pool.
+ * Returns the number of values pushed on the Lua stack.
+ */
+
+static int password_job_start(lua_State *L, lua_apr_password_op op,
+    const char *input, apr_size_t inputlen, unsigned int cost)
+{
+  lua_apr_password_task *task;
+  lua_apr_password_job *job;
+  apr_thread_pool_t *threads;
+  const char *password;
+  apr_status_t status;
+  apr_pool_t *pool;
+  size_t passlen;
+
+  password = luaL_checklstring(L, 1, &passlen);
+  status = password_threads_get(&threads);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+
+  status = apr_pool_create(&pool, NULL);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  task = apr_pcalloc(pool, sizeof *task);
+  task->pool = pool;
+  task->op = op;
+  task->cost = cost;
+  task->refcount = 2; /* the Lua object and the worker thread */
+  task->password = apr_pstrmemdup(pool, password, passlen);
+  task->passlen = passlen;
+  task->input = apr_pstrmemdup(pool, input, inputlen);
+  task->inputlen = inputlen;
+  status = apr_thread_mutex_create(&task->mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+  if (status == APR_SUCCESS)
+    status = apr_thread_cond_create(&task->cond, pool);
+  if (status == APR_SUCCESS)
+    status = apr_file_pipe_create(&task->readable, &task->writable, pool);
+  if (status != APR_SUCCESS) {
+    clear_mem(task->password, passlen);
+    apr_pool_destroy(pool);
+    return push_error_status(L, status);
+  }
+
+  job = new_object(L, &lua_apr_password_job_type);
+  if (job == NULL) {
+    clear_mem(task->password, passlen);
+    apr_pool_destroy(pool);
+    return push_error_memory(L);
+  }
+  job->task = task;
+
+  status = apr_thread_pool_push(threads, password_worker, task,
+      APR_THREAD_TASK_PRIORITY_NORMAL, NULL);
+  if (status != APR_SUCCESS) {
+    task->refcount--; /* the worker will never run */
+    return push_error_status(L, status);
+  }
+
+  return 1;
+}
+
+/* password_job_check() {{{2 */
+
+static lua_apr_password_job *password_job_check(lua_State *L, int idx)
+{
+  return check_object(L, idx, &lua_apr_password_job_type);
+}
+
+/* password_job_file() {{{2
+ *
+ * Get the read end of the pipe that becomes readable when a password job has
+ * finished (used to add password jobs to pollsets).
+ */
+
+apr_file_t *password_job_file(lua_State *L, int idx, apr_pool_t **pool)
+{
+  lua_apr_password_job *job = password_job_check(L, idx);
+  *pool = job->task->pool;
+  return job->task->readable;
+}
+
+#endif
+
 /* apr.md5_encode(password, salt) -> digest {{{1
  *
  * Encode the string @password using the [MD5] [md5] algorithm and a [salt]
@@ -176,6 +398,166 @@ int lua_apr_password_get(lua_State *L)
   return pushed;
 }
 
+#if APR_HAS_THREADS
+
+/* apr.password_validate_async(password, digest) -> job {{{1
+ *
+ * Like `apr.password_validate()` but the (potentially slow) validation runs on
+ * a background thread so that the calling thread, for example the event loop
+ * of a server, isn't blocked. On success a password job object is returned,
+ * otherwise a nil followed by an error message is returned. Use
+ * `password_job:wait()` to get the result; password jobs can also be added to
+ * a pollset (they become readable when the result is available):
+ *
+ *     > job = apr.password_validate_async(password, digest)
+ *     > pollset:add(job, 'input')
+ *     > -- later, when the pollset reports the job as readable:
+ *     > = job:wait()
+ *     true
+ *
+ * The jobs of all Lua states in the process share a pool of at most four
+ * threads. The copy of the password made for the background thread is wiped
+ * after use, but note that the Lua string passed in can't be wiped.
+ */
+
+int lua_apr_password_validate_async(lua_State *L)
+{
+  const char *digest;
+  size_t length;
+
+  digest = luaL_checklstring(L, 2, &length);
+  return password_job_start(L, PASSWORD_VALIDATE, digest, length, 0);
+}
+
+/* apr.password_hash_async(password [, algorithm [, cost]]) -> job {{{1
+ *
+ * Hash the string @password on a background thread using a random salt. The
+ * result of `password_job:wait()` is a digest that can be validated using
+ * `apr.password_validate()` or `apr.password_validate_async()`. On success a
+ * password job object is returned, otherwise a nil followed by an error
+ * message is returned. The optional @algorithm is one of the strings:
+ *
+ *  - `'bcrypt'`: [bcrypt] [bcrypt] (the default, requires APR-util 1.5 or
+ *    newer); the optional @cost (4-31, defaults to 10) is the base 2 logarithm
+ *    of the number of rounds
+ *  - `'md5'`: Apache's MD5 based algorithm (the same as `apr.md5_encode()`)
+ *
+ * [bcrypt]: http://en.wikipedia.org/wiki/Bcrypt
+ */
+
+int lua_apr_password_hash_async(lua_State *L)
+{
+  const char *options[] = { "bcrypt", "md5", NULL };
+  const char itoa64[] = "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  unsigned char salt[16];
+  apr_status_t status;
+  int i, algorithm, cost, pushed;
+
+  algorithm = luaL_checkoption(L, 2, "bcrypt", options);
+  cost = luaL_optint(L, 3, 10);
+  luaL_argcheck(L, cost >= 4 && cost <= 31, 3, "cost out of range");
+# if !LUA_APR_HAVE_BCRYPT
+  if (algorithm == 0)
+    return push_error_status(L, APR_ENOTIMPL);
+# endif
+
+# if APR_HAS_RANDOM
+  status = apr_generate_random_bytes(salt, sizeof salt);
+# else
+  status = APR_ENOTIMPL;
+# endif
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+
+  if (algorithm == 0) {
+    pushed = password_job_start(L, PASSWORD_HASH_BCRYPT, (const char*) salt, sizeof salt, cost);
+  } else {
+    /* apr_md5_encode() expects an ASCII salt of at most 8 characters. */
+    for (i = 0; i < 8; i++)
+      salt[i] = itoa64[salt[i] % 64];
+    pushed = password_job_start(L, PASSWORD_HASH_MD5, (const char*) salt, 8, 0);
+  }
+  clear_stack(salt);
+
+  return pushed;
+}
+
+/* password_job:ready() -> finished {{{1
+ *
+ * Check whether the password job has finished without blocking. Returns true
+ * when the result is available, false otherwise.
+ */
+
+static int password_job_ready(lua_State *L)
+{
+  lua_apr_password_task *task = password_job_check(L, 1)->task;
+
+  apr_thread_mutex_lock(task->mutex);
+  lua_pushboolean(L, task->done);
+  apr_thread_mutex_unlock(task->mutex);
+
+  return 1;
+}
+
+/* password_job:wait([timeout]) -> result {{{1
+ *
+ * Wait for the password job to finish and return its result. For jobs created
+ * by `apr.password_validate_async()` the result is the same as that of
+ * `apr.password_validate()`, for jobs created by `apr.password_hash_async()`
+ * the result is the digest. On error a nil followed by an error message is
+ * returned. If @timeout (a number of seconds) is given and the job doesn't
+ * finish in time a nil followed by an error message is returned with the
+ * error code `'TIMEUP'`.
+ */
+
+static int password_job_wait(lua_State *L)
+{
+  lua_apr_password_task *task = password_job_check(L, 1)->task;
+  apr_status_t status = APR_SUCCESS;
+  apr_interval_time_t timeout;
+
+  timeout = lua_isnoneornil(L, 2) ? -1 : time_get(L, 2);
+  apr_thread_mutex_lock(task->mutex);
+  while (!task->done && status == APR_SUCCESS) {
+    if (timeout < 0)
+      status = apr_thread_cond_wait(task->cond, task->mutex);
+    else
+      status = apr_thread_cond_timedwait(task->cond, task->mutex, timeout);
+  }
+  if (task->done)
+    status = task->status;
+  apr_thread_mutex_unlock(task->mutex);
+
+  if (status != APR_SUCCESS || task->op == PASSWORD_VALIDATE)
+    return push_status(L, status);
+  lua_pushstring(L, task->digest);
+  return 1;
+}
+
+/* password_job:__tostring() {{{1 */
+
+static int password_job_tostring(lua_State *L)
+{
+  lua_apr_password_job *job = password_job_check(L, 1);
+  lua_pushfstring(L, "%s (%p)", lua_apr_password_job_type.friendlyname, job->task);
+  return 1;
+}
+
+/* password_job:__gc() {{{1 */
+
+static int password_job_gc(lua_State *L)
+{
+  lua_apr_password_job *job = password_job_check(L, 1);
+  if (object_collectable((lua_apr_refobj*)job) && job->task != NULL) {
+    password_task_release(job->task);
+    job->task = NULL;
+  }
+  release_object((lua_apr_refobj*)job);
+  return 0;
+}
+
+#endif
+
 /* apr.md5_init() -> md5_context {{{1
  *
  * Create and return an object that can be used to calculate [MD5] [md5]
@@ -480,4 +862,29 @@ lua_apr_objtype lua_apr_sha1_type = {
   sha1_metamethods          /* metamethods table */
 };
 
+#if APR_HAS_THREADS
+
+static luaL_reg password_job_methods[] = {
+  { "ready", password_job_ready },
+  { "wait", password_job_wait },
+  { NULL, NULL },
+};
+
+static luaL_reg password_job_metamethods[] = {
+  { "__tostring", password_job_tostring },
+  { "__eq", objects_equal },
+  { "__gc", password_job_gc },
+  { NULL, NULL },
+};
+
+lua_apr_objtype lua_apr_password_job_type = {
+  "lua_apr_password_job*",      /* metatable name in registry */
+  "password job",               /* friendly object name */
+  sizeof(lua_apr_password_job), /* structure size */
+  password_job_methods,         /* methods table */
+  password_job_metamethods      /* metamethods table */
+};
+
+#endif
+
 /* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
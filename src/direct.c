@@ -0,0 +1,495 @@
+/* Direct I/O layer for file objects of the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * Files opened with the `'d'` flag in their mode string (see `apr.file_open()`)
+ * bypass the page cache of the operating system. On Linux this uses O_DIRECT,
+ * which requires the memory address, file offset and length of every read and
+ * write to be a multiple of the logical block size of the device. To hide
+ * this from the buffered I/O interface (see buffer.c) the read, write and
+ * flush callbacks of the buffers are replaced by the functions in this file,
+ * which keep a block aligned window of the file in memory:
+ *
+ *  - In read mode the window contains data read from the file using aligned
+ *    reads and the buffers copy data out of it
+ *  - In write mode the buffers copy data into the window and it's written to
+ *    the file using aligned writes whenever it's full
+ *
+ * Because the window always starts at a block boundary, seeking to and
+ * writing at unaligned offsets works: the partial block in front of the
+ * offset is read into the window first. The unaligned tail at the end of the
+ * data is written when the file is flushed or closed by temporarily switching
+ * off O_DIRECT, so files don't need to have a size that's a multiple of the
+ * block size. The window stays in memory so that the next aligned write
+ * rewrites the whole block.
+ *
+ * On Mac OS X direct I/O is implemented using F_NOCACHE. Other platforms
+ * don't support direct I/O.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE /* O_DIRECT and statx() */
+#endif
+
+#include "lua_apr.h"
+#include <apr_portable.h>
+
+#if !defined(WIN32) && !defined(OS2) && !defined(NETWARE)
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/stat.h>
+#endif
+
+#if !defined(WIN32) && !defined(OS2) && !defined(NETWARE) \
+    && (defined(O_DIRECT) || defined(F_NOCACHE))
+# define LUA_APR_HAVE_DIRECT_IO 1
+#else
+# define LUA_APR_HAVE_DIRECT_IO 0
+#endif
+
+/* The default alignment of direct I/O (when the kernel can't tell us). */
+#define LUA_APR_DIRECT_ALIGN 4096
+
+/* The size of the window (a multiple of the alignment). */
+#define LUA_APR_DIRECT_BUFSIZE (1024 * 1024)
+
+struct lua_apr_direct {
+  apr_os_file_t fd;   /* descriptor opened with O_DIRECT                */
+  apr_file_t *handle; /* the same descriptor for APR                    */
+  apr_size_t align;   /* alignment of memory, offsets and lengths       */
+  apr_size_t size;    /* size of window                                 */
+  char *memory;       /* allocated memory (not aligned)                 */
+  char *data;         /* window (aligned)                               */
+  apr_off_t base;     /* file offset of data[0], a multiple of align    */
+  apr_size_t index;   /* current file offset relative to base           */
+  apr_size_t limit;   /* bytes read (read mode) or pending (write mode) */
+  int writing;        /* in write mode?                                 */
+};
+
+#if LUA_APR_HAVE_DIRECT_IO
+
+/* Round an offset down to a multiple of the alignment. */
+#define ALIGN_DOWN(D, n) ((n) - ((n) % (D)->align))
+
+/* Internal functions. {{{1 */
+
+/* direct_set() {{{2
+ *
+ * Switch direct I/O on or off for the descriptor of the window.
+ */
+
+static apr_status_t direct_set(lua_apr_direct *D, int enable)
+{
+# if defined(O_DIRECT)
+  int flags = fcntl(D->fd, F_GETFL);
+  if (flags == -1)
+    return apr_get_os_error();
+  flags = enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+  if (fcntl(D->fd, F_SETFL, flags) == -1)
+    return apr_get_os_error();
+# else
+  if (fcntl(D->fd, F_NOCACHE, enable) == -1)
+    return apr_get_os_error();
+# endif
+  return APR_SUCCESS;
+}
+
+/* direct_alignment() {{{2
+ *
+ * Get the alignment required for direct I/O on a descriptor. Linux 6.1+ can
+ * tell us (see statx(2)), otherwise we assume 4 KB which is a multiple of the
+ * logical block size of practically all devices.
+ */
+
+static apr_size_t direct_alignment(apr_os_file_t fd)
+{
+  apr_size_t align = LUA_APR_DIRECT_ALIGN;
+# if defined(STATX_DIOALIGN)
+  struct statx info;
+  if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &info) == 0
+      && (info.stx_mask & STATX_DIOALIGN)) {
+    if (info.stx_dio_offset_align > align)
+      align = info.stx_dio_offset_align;
+    if (info.stx_dio_mem_align > align)
+      align = info.stx_dio_mem_align;
+  }
+# endif
+  return align;
+}
+
+/* read_fully() and write_fully() {{{2
+ *
+ * Positional reads and writes that only stop early at the end of the file.
+ */
+
+static apr_status_t read_fully(lua_apr_direct *D, char *data, apr_size_t len, apr_off_t offset, apr_size_t *done)
+{
+  ssize_t result;
+
+  *done = 0;
+  while (*done < len) {
+    result = pread(D->fd, data + *done, len - *done, offset + *done);
+    if (result < 0 && errno == EINTR)
+      continue;
+    if (result < 0)
+      return apr_get_os_error();
+    if (result == 0)
+      break;
+    *done += result;
+  }
+
+  return APR_SUCCESS;
+}
+
+static apr_status_t write_fully(lua_apr_direct *D, const char *data, apr_size_t len, apr_off_t offset)
+{
+  ssize_t result;
+
+  while (len > 0) {
+    result = pwrite(D->fd, data, len, offset);
+    if (result < 0 && errno == EINTR)
+      continue;
+    if (result < 0)
+      return apr_get_os_error();
+    data += result;
+    offset += result;
+    len -= result;
+  }
+
+  return APR_SUCCESS;
+}
+
+/* window_fill() {{{2
+ *
+ * Read the block aligned window that contains the current file offset.
+ */
+
+static apr_status_t window_fill(lua_apr_direct *D)
+{
+  apr_off_t offset = D->base + D->index;
+  apr_status_t status;
+  apr_size_t len;
+
+  status = read_fully(D, D->data, D->size, ALIGN_DOWN(D, offset), &len);
+  if (status == APR_SUCCESS) {
+    D->base = ALIGN_DOWN(D, offset);
+    D->index = offset - D->base;
+    D->limit = len;
+  }
+
+  return status;
+}
+
+/* window_sync() {{{2
+ *
+ * Write the pending data in the window to the file: Whole blocks are written
+ * using direct I/O, the unaligned tail is written with direct I/O switched
+ * off and stays in the window.
+ */
+
+static apr_status_t window_sync(lua_apr_direct *D)
+{
+  apr_size_t aligned, tail;
+  apr_status_t status;
+
+  aligned = ALIGN_DOWN(D, D->limit);
+  tail = D->limit - aligned;
+  status = write_fully(D, D->data, aligned, D->base);
+  if (status == APR_SUCCESS && tail > 0) {
+    status = direct_set(D, 0);
+    if (status == APR_SUCCESS) {
+      status = write_fully(D, D->data + aligned, tail, D->base + aligned);
+      if (status == APR_SUCCESS)
+        status = direct_set(D, 1);
+      else
+        direct_set(D, 1);
+    }
+  }
+  if (status == APR_SUCCESS) {
+    memmove(D->data, D->data + aligned, tail);
+    D->base += aligned;
+    D->index = D->limit = tail;
+  }
+
+  return status;
+}
+
+/* window_write_mode() {{{2
+ *
+ * Switch the window to write mode. The window is moved to the block that
+ * contains the current file offset and the part of that block in front of
+ * the offset is copied (or read) into the window, because it will be written
+ * back together with the new data.
+ */
+
+static apr_status_t window_write_mode(lua_apr_direct *D)
+{
+  apr_off_t offset = D->base + D->index, base = ALIGN_DOWN(D, offset);
+  apr_size_t head = offset - base, len;
+  apr_status_t status;
+
+  if (head > 0 && offset <= D->base + (apr_off_t) D->limit) {
+    memmove(D->data, D->data + (base - D->base), head);
+  } else if (head > 0) {
+    status = read_fully(D, D->data, D->align, base, &len);
+    if (status != APR_SUCCESS)
+      return status;
+    if (len < head)
+      memset(D->data + len, 0, head - len);
+  }
+  D->base = base;
+  D->index = D->limit = head;
+  D->writing = 1;
+
+  return APR_SUCCESS;
+}
+
+/* direct_read() {{{2 */
+
+static apr_status_t lua_apr_cc direct_read(lua_apr_direct *D, char *data, apr_size_t *len)
+{
+  apr_status_t status;
+  apr_size_t n;
+
+  if (D->writing) {
+    status = window_sync(D);
+    if (status != APR_SUCCESS)
+      return status;
+    D->writing = 0;
+  }
+  if (D->index >= D->limit) {
+    status = window_fill(D);
+    if (status != APR_SUCCESS)
+      return status;
+    if (D->index >= D->limit) {
+      *len = 0;
+      return APR_EOF;
+    }
+  }
+  n = D->limit - D->index;
+  if (n > *len)
+    n = *len;
+  memcpy(data, D->data + D->index, n);
+  D->index += n;
+  *len = n;
+
+  return APR_SUCCESS;
+}
+
+/* direct_write() {{{2 */
+
+static apr_status_t lua_apr_cc direct_write(lua_apr_direct *D, const char *data, apr_size_t *len)
+{
+  apr_status_t status;
+  apr_size_t n;
+
+  if (!D->writing) {
+    status = window_write_mode(D);
+    if (status != APR_SUCCESS)
+      return status;
+  }
+  n = D->size - D->limit;
+  if (n > *len)
+    n = *len;
+  memcpy(D->data + D->limit, data, n);
+  D->index = D->limit += n;
+  if (D->limit == D->size) {
+    status = write_fully(D, D->data, D->size, D->base);
+    if (status != APR_SUCCESS) {
+      D->index = D->limit -= n;
+      *len = 0;
+      return status;
+    }
+    D->base += D->size;
+    D->index = D->limit = 0;
+  }
+  *len = n;
+
+  return APR_SUCCESS;
+}
+
+/* direct_flush() {{{2 */
+
+static apr_status_t lua_apr_cc direct_flush(lua_apr_direct *D)
+{
+  return D->writing ? window_sync(D) : APR_SUCCESS;
+}
+
+#endif
+
+/* direct_enable() {{{1
+ *
+ * Enable direct I/O on a file that was just opened: Switch on O_DIRECT (or
+ * F_NOCACHE), allocate an aligned window and install the callbacks of the
+ * window in the buffers of the file. Direct I/O isn't supported in append
+ * mode because the file offset of appends isn't aligned.
+ */
+
+apr_status_t direct_enable(lua_apr_file *file)
+{
+# if LUA_APR_HAVE_DIRECT_IO
+  lua_apr_direct *D;
+  apr_status_t status;
+
+  if (file->append)
+    return APR_EINVAL;
+  D = calloc(1, sizeof *D);
+  if (D == NULL)
+    return APR_ENOMEM;
+  D->handle = file->handle;
+  apr_os_file_get(&D->fd, file->handle);
+  D->align = direct_alignment(D->fd);
+  D->size = LUA_APR_DIRECT_BUFSIZE - LUA_APR_DIRECT_BUFSIZE % D->align;
+  if (D->size == 0)
+    D->size = D->align;
+  D->memory = malloc(D->size + D->align);
+  if (D->memory == NULL) {
+    free(D);
+    return APR_ENOMEM;
+  }
+  D->data = D->memory + (D->align - (apr_uintptr_t) D->memory % D->align) % D->align;
+  status = direct_set(D, 1);
+  if (status != APR_SUCCESS) {
+    free(D->memory);
+    free(D);
+    return status;
+  }
+
+  /* The window starts at the current file offset. */
+  status = apr_file_seek(file->handle, APR_CUR, &D->base);
+  D->index = D->base % D->align;
+  D->base -= D->index;
+
+  file->direct = D;
+  file->input.object = file->output.object = D;
+  file->input.read = (lua_apr_buf_rf) direct_read;
+  file->output.write = (lua_apr_buf_wf) direct_write;
+  file->output.flush = (lua_apr_buf_ff) direct_flush;
+
+  return status;
+# else
+  return APR_ENOTIMPL;
+# endif
+}
+
+/* direct_seek() {{{1
+ *
+ * Reposition the file offset of a file in direct I/O mode. Works like
+ * apr_file_seek(): On return @offset contains the new file offset.
+ */
+
+apr_status_t direct_seek(lua_apr_direct *D, apr_seek_where_t where, apr_off_t *offset)
+{
+# if LUA_APR_HAVE_DIRECT_IO
+  apr_status_t status = APR_SUCCESS;
+  apr_finfo_t info;
+  apr_off_t target;
+
+  if (D->writing) {
+    status = window_sync(D);
+    if (status != APR_SUCCESS)
+      return status;
+    D->writing = 0;
+  }
+  target = *offset;
+  if (where == APR_CUR) {
+    target += D->base + D->index;
+  } else if (where == APR_END) {
+    status = apr_file_info_get(&info, APR_FINFO_SIZE, D->handle);
+    if (status != APR_SUCCESS)
+      return status;
+    target += info.size;
+  }
+  if (target < 0)
+    return APR_EINVAL;
+  /* Keep the window when the target is inside it. */
+  if (target < D->base || target > D->base + (apr_off_t) D->limit) {
+    D->base = ALIGN_DOWN(D, target);
+    D->limit = 0;
+  }
+  D->index = target - D->base;
+  *offset = target;
+
+  return status;
+# else
+  return APR_ENOTIMPL;
+# endif
+}
+
+/* direct_truncate() {{{1
+ *
+ * Truncate a file in direct I/O mode and move the file offset to @offset.
+ */
+
+apr_status_t direct_truncate(lua_apr_direct *D, apr_off_t offset)
+{
+# if LUA_APR_HAVE_DIRECT_IO
+  apr_status_t status = APR_SUCCESS;
+
+  if (D->writing) {
+    status = window_sync(D);
+    if (status != APR_SUCCESS)
+      return status;
+    D->writing = 0;
+  }
+  status = apr_file_trunc(D->handle, offset);
+  D->base = ALIGN_DOWN(D, offset);
+  D->index = offset - D->base;
+  D->limit = 0;
+
+  return status;
+# else
+  return APR_ENOTIMPL;
+# endif
+}
+
+/* direct_invalidate() {{{1
+ *
+ * Write the pending data of a file in direct I/O mode and forget the data in
+ * the window, because the file is about to be changed behind its back.
+ */
+
+apr_status_t direct_invalidate(lua_apr_direct *D)
+{
+# if LUA_APR_HAVE_DIRECT_IO
+  apr_status_t status = APR_SUCCESS;
+  apr_off_t offset;
+
+  if (D->writing) {
+    status = window_sync(D);
+    if (status != APR_SUCCESS)
+      return status;
+    D->writing = 0;
+  }
+  offset = D->base + D->index;
+  D->base = ALIGN_DOWN(D, offset);
+  D->index = offset - D->base;
+  D->limit = 0;
+
+  return status;
+# else
+  return APR_ENOTIMPL;
+# endif
+}
+
+/* direct_close() {{{1
+ *
+ * Write the pending data of a file in direct I/O mode and release the window.
+ */
+
+apr_status_t direct_close(lua_apr_direct *D)
+{
+  apr_status_t status = APR_SUCCESS;
+# if LUA_APR_HAVE_DIRECT_IO
+  if (D->writing)
+    status = window_sync(D);
+  free(D->memory);
+# endif
+  free(D);
+  return status;
+}
+
+/* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
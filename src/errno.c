@@ -66,6 +66,11 @@
  *
  * Note that the error descriptions above were copied verbatim from [apr_errno.h] [errno].
  *
+ * Event loops built on non-blocking sockets and pipes run into `'EAGAIN'` and
+ * `'TIMEUP'` all the time. To avoid formatting error messages for these
+ * expected conditions you can enable fast errors using `apr.fast_errors()`;
+ * the messages are then available on request using `apr.strerror()`.
+ *
  * [entropy]: http://en.wikipedia.org/wiki/Entropy_%28computing%29
  * [errno]: http://svn.apache.org/viewvc/apr/apr/trunk/include/apr_errno.h?view=markup
  */
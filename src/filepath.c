@@ -11,6 +11,8 @@
 #include <apr_portable.h>
 #include <apr_lib.h>
 #include <apr_strings.h>
+#include <stdlib.h>
+#include <errno.h>
 
 static apr_int32_t check_options(lua_State *L, int idx) /* {{{1 */
 {
@@ -24,6 +26,199 @@ static apr_int32_t check_options(lua_State *L, int idx) /* {{{1 */
   return flags;
 }
 
+static apr_int32_t check_merge_options(lua_State *L, int idx) /* {{{1 */
+{
+  const char *options[] = {
+    "true-name", "native",
+    "not-above-root", "not-absolute",
+    "not-relative", "secure-root", NULL };
+
+  const apr_int32_t values[] = {
+    APR_FILEPATH_TRUENAME, APR_FILEPATH_NATIVE,
+    APR_FILEPATH_NOTABOVEROOT, APR_FILEPATH_NOTABSOLUTE,
+    APR_FILEPATH_NOTRELATIVE, APR_FILEPATH_SECUREROOT };
+
+  apr_int32_t flags = 0;
+
+  while (!lua_isnoneornil(L, idx))
+    flags |= values[luaL_checkoption(L, idx++, NULL, options)];
+
+  return flags;
+}
+
+/* Path cache objects. {{{1 */
+
+typedef struct lua_apr_pathentry lua_apr_pathentry;
+
+struct lua_apr_pathentry {
+  char *key, *realpath;
+  size_t keylen;
+  unsigned int hash;
+  apr_status_t status;
+  apr_finfo_t info;
+  apr_time_t added;
+  lua_apr_pathentry *chain, *newer, *older;
+};
+
+typedef struct {
+  lua_apr_refobj header;
+  apr_pool_t *pool;
+  char *root, *realroot;
+  size_t realrootlen;
+  apr_interval_time_t ttl;
+  int size, capacity, mask;
+  lua_apr_pathentry **buckets;
+  lua_apr_pathentry *newest, *oldest;
+} lua_apr_pathcache;
+
+/* pathcache_check() {{{2 */
+
+static lua_apr_pathcache *pathcache_check(lua_State *L, int idx)
+{
+  lua_apr_pathcache *cache = check_object(L, idx, &lua_apr_pathcache_type);
+  if (cache->buckets == NULL)
+    luaL_error(L, "attempt to use a destroyed path cache");
+  return cache;
+}
+
+/* pathcache_hash() {{{2 */
+
+static unsigned int pathcache_hash(const char *key, size_t length)
+{
+  unsigned int hash = 2166136261u; /* FNV-1a */
+  while (length-- > 0) {
+    hash ^= (unsigned char) *key++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/* pathcache_unlink() {{{2
+ *
+ * Remove an entry from the hash chain and the LRU list and free it.
+ */
+
+static void pathcache_unlink(lua_apr_pathcache *cache, lua_apr_pathentry *entry)
+{
+  lua_apr_pathentry **link = &cache->buckets[entry->hash & cache->mask];
+
+  while (*link != entry)
+    link = &(*link)->chain;
+  *link = entry->chain;
+  if (entry->newer != NULL)
+    entry->newer->older = entry->older;
+  else
+    cache->newest = entry->older;
+  if (entry->older != NULL)
+    entry->older->newer = entry->newer;
+  else
+    cache->oldest = entry->newer;
+  cache->size--;
+  free(entry->key);
+  free(entry->realpath);
+  free(entry);
+}
+
+/* pathcache_touch() {{{2
+ *
+ * Move an entry to the front of the LRU list.
+ */
+
+static void pathcache_touch(lua_apr_pathcache *cache, lua_apr_pathentry *entry)
+{
+  if (cache->newest == entry)
+    return;
+  if (entry->newer != NULL)
+    entry->newer->older = entry->older;
+  if (entry->older != NULL)
+    entry->older->newer = entry->newer;
+  else if (cache->oldest == entry)
+    cache->oldest = entry->newer;
+  entry->newer = NULL;
+  entry->older = cache->newest;
+  if (cache->newest != NULL)
+    cache->newest->newer = entry;
+  cache->newest = entry;
+  if (cache->oldest == NULL)
+    cache->oldest = entry;
+}
+
+/* pathcache_find() {{{2 */
+
+static lua_apr_pathentry *pathcache_find(lua_apr_pathcache *cache, const char *key, size_t keylen, unsigned int hash)
+{
+  lua_apr_pathentry *entry = cache->buckets[hash & cache->mask];
+  while (entry != NULL) {
+    if (entry->hash == hash && entry->keylen == keylen && memcmp(entry->key, key, keylen) == 0)
+      return entry;
+    entry = entry->chain;
+  }
+  return NULL;
+}
+
+/* pathcache_realpath() {{{2
+ *
+ * Resolve symbolic links in an absolute path. On UNIX this uses realpath()
+ * because apr_filepath_merge() doesn't resolve symbolic links.
+ */
+
+static apr_status_t pathcache_realpath(const char *path, char **resolved, apr_pool_t *pool)
+{
+# if !defined(WIN32) && !defined(OS2) && !defined(NETWARE)
+  char *buffer = realpath(path, NULL);
+  if (buffer == NULL)
+    return APR_FROM_OS_ERROR(errno);
+  *resolved = apr_pstrdup(pool, buffer);
+  free(buffer);
+  return APR_SUCCESS;
+# else
+  return apr_filepath_merge(resolved, NULL, path, APR_FILEPATH_TRUENAME, pool);
+# endif
+}
+
+/* pathcache_resolve() {{{2
+ *
+ * Merge a request path with the root of the cache, resolve symbolic links and
+ * get the type, size and modification time of the result. Fails with
+ * APR_EABOVEROOT when the path (or a symbolic link in it) leads outside the
+ * root.
+ */
+
+static void pathcache_resolve(lua_apr_pathcache *cache, lua_apr_pathentry *entry, const char *path)
+{
+  char *merged, *resolved = NULL;
+  apr_status_t status;
+  size_t length;
+
+  apr_pool_clear(cache->pool);
+  while (*path == '/')
+    path++;
+  status = apr_filepath_merge(&merged, cache->root, path,
+      APR_FILEPATH_SECUREROOT | APR_FILEPATH_NOTABOVEROOT, cache->pool);
+  if (status == APR_SUCCESS)
+    status = pathcache_realpath(merged, &resolved, cache->pool);
+  if (status == APR_SUCCESS) {
+    length = strlen(resolved);
+    if (length < cache->realrootlen
+        || memcmp(resolved, cache->realroot, cache->realrootlen) != 0
+        || (length > cache->realrootlen && cache->realrootlen > 0
+          && cache->realroot[cache->realrootlen - 1] != '/'
+          && resolved[cache->realrootlen] != '/'))
+      status = APR_EABOVEROOT;
+  }
+  if (status == APR_SUCCESS)
+    status = apr_stat(&entry->info, resolved, APR_FINFO_TYPE | APR_FINFO_SIZE | APR_FINFO_MTIME, cache->pool);
+  if (APR_STATUS_IS_INCOMPLETE(status))
+    status = APR_SUCCESS;
+  entry->info.pool = NULL;
+  entry->status = status;
+  free(entry->realpath);
+  entry->realpath = status == APR_SUCCESS ? strdup(resolved) : NULL;
+  if (status == APR_SUCCESS && entry->realpath == NULL)
+    entry->status = APR_ENOMEM;
+  entry->added = apr_time_now();
+}
+
 /* apr.filepath_root(path [, option, ...]) -> root, path {{{1
  *
  * Extract the root from the file path @path. On success the extracted root and
@@ -197,31 +392,18 @@ int lua_apr_filepath_name(lua_State *L)
 
 int lua_apr_filepath_merge(lua_State *L)
 {
-  const char *options[] = {
-    "true-name", "native",
-    "not-above-root", "not-absolute",
-    "not-relative", "secure-root", NULL };
-
-  const apr_int32_t values[] = {
-    APR_FILEPATH_TRUENAME, APR_FILEPATH_NATIVE,
-    APR_FILEPATH_NOTABOVEROOT, APR_FILEPATH_NOTABSOLUTE,
-    APR_FILEPATH_NOTRELATIVE, APR_FILEPATH_SECUREROOT };
-
   apr_pool_t *memory_pool;
   const char *root, *path;
   apr_status_t status;
   apr_int32_t flags;
   char *merged;
-  int arg;
 
   memory_pool = to_pool(L);
   root = luaL_checkstring(L, 1);
   path = luaL_checkstring(L, 2);
   if (strcmp(root, ".") == 0)
     root = NULL;
-
-  for (arg = 3, flags = 0; !lua_isnoneornil(L, arg); arg++)
-    flags |= values[luaL_checkoption(L, arg, NULL, options)];
+  flags = check_merge_options(L, 3);
 
   status = apr_filepath_merge(&merged, root, path, flags, memory_pool);
 
@@ -365,4 +547,261 @@ int lua_apr_filepath_set(lua_State *L)
   return push_status(L, status);
 }
 
+/* apr.filepath_merge_all(root, paths [, option, ...]) -> merged [, errors] {{{1
+ *
+ * Merge the file path @root with every file path in the array @paths. This
+ * supports the same options as `apr.filepath_merge()` but uses a single
+ * memory pool for all paths, which is faster than calling
+ * `apr.filepath_merge()` in a loop. On success a table with the merged paths
+ * is returned (in the same order as @paths). If some paths can't be merged the
+ * corresponding entries of the result are false and a second table is
+ * returned that maps the indices of those paths to error messages:
+ *
+ *     > = apr.filepath_merge_all('/var/www', { 'index.html', '../etc/passwd' }, 'not-above-root')
+ *     { '/var/www/index.html', false }, { [2] = 'The given path was above the root path' }
+ */
+
+int lua_apr_filepath_merge_all(lua_State *L)
+{
+  apr_pool_t *memory_pool, *subpool;
+  const char *root, *path;
+  apr_status_t status;
+  apr_int32_t flags;
+  char *merged;
+  int i, n, errors = 0;
+
+  memory_pool = to_pool(L);
+  root = luaL_checkstring(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  if (strcmp(root, ".") == 0)
+    root = NULL;
+  flags = check_merge_options(L, 3);
+  status = apr_pool_create(&subpool, memory_pool);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+
+  n = lua_objlen(L, 2);
+  lua_settop(L, 2);
+  lua_createtable(L, n, 0); /* merged @ 3 */
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, 2, i);
+    path = lua_tostring(L, -1);
+    if (path == NULL)
+      luaL_error(L, "path %d in array is not a string", i);
+    status = apr_filepath_merge(&merged, root, path, flags, subpool);
+    lua_pop(L, 1);
+    if (status == APR_SUCCESS || APR_STATUS_IS_EPATHWILD(status)) {
+      lua_pushstring(L, merged);
+    } else {
+      if (errors++ == 0)
+        lua_newtable(L); /* errors @ 4 */
+      status_to_message(L, status);
+      lua_rawseti(L, 4, i);
+      lua_pushboolean(L, 0);
+    }
+    lua_rawseti(L, 3, i);
+    apr_pool_clear(subpool);
+  }
+  apr_pool_destroy(subpool);
+
+  return errors > 0 ? 2 : 1;
+}
+
+/* apr.filepath_cache(root [, size [, ttl]]) -> cache {{{1
+ *
+ * Create a bounded cache that maps request paths to the canonical paths of
+ * files inside the directory @root, for example the document root of a
+ * static file server. Resolving a path with `cache:resolve()` normalizes it,
+ * resolves symbolic links and gets the type, size and modification time of
+ * the file; the result (including failures, so repeated requests for missing
+ * files are also fast) is cached. The optional number @size gives the maximum
+ * number of cached paths (defaults to 1024, the least recently used path is
+ * evicted when the cache is full) and the optional number @ttl gives the
+ * number of seconds after which cached results are refreshed (defaults to 5
+ * seconds). On success the cache object is returned, otherwise a nil followed
+ * by an error message is returned.
+ */
+
+int lua_apr_filepath_cache(lua_State *L)
+{
+  lua_apr_pathcache *cache;
+  apr_status_t status;
+  const char *root;
+  char *merged;
+  int size, buckets;
+
+  root = luaL_checkstring(L, 1);
+  size = luaL_optint(L, 2, 1024);
+  luaL_argcheck(L, size > 0, 2, "size must be positive");
+
+  cache = new_object(L, &lua_apr_pathcache_type);
+  if (cache == NULL)
+    return push_error_memory(L);
+  status = apr_pool_create(&cache->pool, NULL);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  cache->ttl = lua_isnoneornil(L, 3) ? 5 * APR_USEC_PER_SEC : time_get(L, 3);
+
+  /* Make the root absolute and resolve symbolic links in it. */
+  status = apr_filepath_merge(&merged, NULL, root, APR_FILEPATH_NOTRELATIVE, cache->pool);
+  if (status == APR_SUCCESS)
+    status = pathcache_realpath(merged, &cache->realroot, cache->pool);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  cache->root = strdup(merged);
+  cache->realroot = strdup(cache->realroot);
+  if (cache->root == NULL || cache->realroot == NULL)
+    return push_error_memory(L);
+  cache->realrootlen = strlen(cache->realroot);
+
+  for (buckets = 16; buckets < size; buckets *= 2)
+    ;
+  cache->buckets = calloc(buckets, sizeof cache->buckets[0]);
+  if (cache->buckets == NULL)
+    return push_error_memory(L);
+  cache->mask = buckets - 1;
+  cache->capacity = size;
+
+  return 1;
+}
+
+/* cache:resolve(path) -> realpath, type, size, mtime {{{1
+ *
+ * Resolve the request path @path (a path relative to the root of the cache; a
+ * leading slash is ignored) using the cache. On success the canonical path is
+ * returned followed by the type, size and modification time of the file (see
+ * `apr.stat()`), otherwise a nil followed by an error message is returned.
+ * Paths that lead outside the root (also by following symbolic links) fail
+ * with the error code `'EABOVEROOT'`.
+ */
+
+static int pathcache_resolve_method(lua_State *L)
+{
+  lua_apr_pathcache *cache;
+  lua_apr_pathentry *entry;
+  unsigned int hash;
+  const char *path;
+  size_t length;
+
+  cache = pathcache_check(L, 1);
+  path = luaL_checklstring(L, 2, &length);
+  hash = pathcache_hash(path, length);
+
+  entry = pathcache_find(cache, path, length, hash);
+  if (entry == NULL) {
+    if (cache->size >= cache->capacity)
+      pathcache_unlink(cache, cache->oldest);
+    entry = calloc(1, sizeof *entry);
+    if (entry == NULL || (entry->key = malloc(length + 1)) == NULL) {
+      free(entry);
+      return push_error_memory(L);
+    }
+    memcpy(entry->key, path, length + 1);
+    entry->keylen = length;
+    entry->hash = hash;
+    entry->chain = cache->buckets[hash & cache->mask];
+    cache->buckets[hash & cache->mask] = entry;
+    cache->size++;
+    pathcache_resolve(cache, entry, path);
+  } else if (apr_time_now() - entry->added > cache->ttl) {
+    pathcache_resolve(cache, entry, path);
+  }
+  pathcache_touch(cache, entry);
+
+  if (entry->status != APR_SUCCESS)
+    return push_error_status(L, entry->status);
+  lua_pushstring(L, entry->realpath);
+  push_stat_field(L, &entry->info, APR_FINFO_TYPE, NULL);
+  push_stat_field(L, &entry->info, APR_FINFO_SIZE, NULL);
+  push_stat_field(L, &entry->info, APR_FINFO_MTIME, NULL);
+
+  return 4;
+}
+
+/* cache:invalidate([path]) -> status {{{1
+ *
+ * Forget the cached result for the request path @path, or all cached results
+ * when @path isn't given (for example after files in the root have been
+ * renamed or removed). Returns true.
+ */
+
+static int pathcache_invalidate(lua_State *L)
+{
+  lua_apr_pathcache *cache;
+  lua_apr_pathentry *entry;
+  const char *path;
+  size_t length;
+
+  cache = pathcache_check(L, 1);
+  if (lua_isnoneornil(L, 2)) {
+    while (cache->oldest != NULL)
+      pathcache_unlink(cache, cache->oldest);
+  } else {
+    path = luaL_checklstring(L, 2, &length);
+    entry = pathcache_find(cache, path, length, pathcache_hash(path, length));
+    if (entry != NULL)
+      pathcache_unlink(cache, entry);
+  }
+  lua_pushboolean(L, 1);
+
+  return 1;
+}
+
+/* cache:__tostring() {{{1 */
+
+static int pathcache_tostring(lua_State *L)
+{
+  lua_apr_pathcache *cache = check_object(L, 1, &lua_apr_pathcache_type);
+  lua_pushfstring(L, "%s (%p)", lua_apr_pathcache_type.friendlyname, cache);
+  return 1;
+}
+
+/* cache:__gc() {{{1 */
+
+static int pathcache_gc(lua_State *L)
+{
+  lua_apr_pathcache *cache = check_object(L, 1, &lua_apr_pathcache_type);
+  if (object_collectable((lua_apr_refobj*)cache)) {
+    if (cache->buckets != NULL) {
+      while (cache->oldest != NULL)
+        pathcache_unlink(cache, cache->oldest);
+      free(cache->buckets);
+      cache->buckets = NULL;
+    }
+    free(cache->root);
+    cache->root = NULL;
+    free(cache->realroot);
+    cache->realroot = NULL;
+    if (cache->pool != NULL) {
+      apr_pool_destroy(cache->pool);
+      cache->pool = NULL;
+    }
+  }
+  release_object((lua_apr_refobj*)cache);
+  return 0;
+}
+
+/* }}} */
+
+static luaL_reg pathcache_methods[] = {
+  { "resolve", pathcache_resolve_method },
+  { "invalidate", pathcache_invalidate },
+  { NULL, NULL },
+};
+
+static luaL_reg pathcache_metamethods[] = {
+  { "__tostring", pathcache_tostring },
+  { "__eq", objects_equal },
+  { "__gc", pathcache_gc },
+  { NULL, NULL },
+};
+
+lua_apr_objtype lua_apr_pathcache_type = {
+  "lua_apr_pathcache*",      /* metatable name in registry */
+  "path cache",              /* friendly object name */
+  sizeof(lua_apr_pathcache), /* structure size */
+  pathcache_methods,         /* methods table */
+  pathcache_metamethods      /* metamethods table */
+};
+
 /* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
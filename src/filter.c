@@ -0,0 +1,744 @@
+/* Compression filters for the buffered I/O interface of the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * Filters are stacked between the buffers of a file, pipe or socket and the
+ * underlying descriptor by replacing the read, write and flush callbacks of
+ * the buffers (see buffer.c). Input filters decompress the data read from the
+ * descriptor, output filters compress the data written to it. Each filter
+ * remembers the callbacks it replaced so that filters can be stacked and
+ * removed again when the object is closed. The state of a compression library
+ * is only created on first use, so a filter on a read only file doesn't
+ * allocate a compressor.
+ *
+ * The gzip and deflate formats are implemented using zlib, the zstd and lz4
+ * formats using libzstd and liblz4 (frame format). Which of these libraries
+ * are available is determined at build time (see etc/make.lua).
+ */
+
+#include "lua_apr.h"
+
+#ifndef LUA_APR_HAVE_ZLIB
+# define LUA_APR_HAVE_ZLIB 0
+#endif
+
+#ifndef LUA_APR_HAVE_ZSTD
+# define LUA_APR_HAVE_ZSTD 0
+#endif
+
+#ifndef LUA_APR_HAVE_LZ4
+# define LUA_APR_HAVE_LZ4 0
+#endif
+
+#if LUA_APR_HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+#if LUA_APR_HAVE_ZSTD
+# include <zstd.h>
+#endif
+
+#if LUA_APR_HAVE_LZ4
+# include <lz4frame.h>
+#endif
+
+/* Size of the buffer holding compressed data. */
+#define LUA_APR_FILTER_CHUNK (64 * 1024)
+
+typedef enum {
+  FILTER_GZIP, FILTER_DEFLATE, FILTER_ZSTD, FILTER_LZ4
+} lua_apr_filter_format;
+
+typedef enum {
+  FILTER_RUN, FILTER_SYNC, FILTER_FINISH
+} lua_apr_filter_mode;
+
+struct lua_apr_filter {
+  lua_apr_filter_format format;
+  int encode, level, ready;
+  /* Decoder state: the end of a compressed stream (or frame) was reached, the
+   * last call filled the output completely and the descriptor reached EOF. */
+  int finished, pending, eof;
+  /* The stream below this filter. */
+  void *object;
+  lua_apr_buf_rf read;
+  lua_apr_buf_wf write;
+  lua_apr_buf_ff flush;
+  lua_apr_filter *below;
+  /* Compressed data waiting to be decoded or written. */
+  lua_apr_buffer buffer;
+  union {
+#   if LUA_APR_HAVE_ZLIB
+    z_stream zlib;
+#   endif
+#   if LUA_APR_HAVE_ZSTD
+    ZSTD_CCtx *zstd_encoder;
+    ZSTD_DCtx *zstd_decoder;
+#   endif
+#   if LUA_APR_HAVE_LZ4
+    struct {
+      LZ4F_cctx *encoder;
+      LZ4F_dctx *decoder;
+      LZ4F_preferences_t preferences;
+    } lz4;
+#   endif
+    int unused;
+  } state;
+};
+
+static const char *filter_options[] = { "gzip", "deflate", "zstd", "lz4", NULL };
+
+/* Internal functions. {{{1 */
+
+/* filter_available() {{{2 */
+
+static int filter_available(lua_apr_filter_format format)
+{
+  switch (format) {
+    case FILTER_GZIP:
+    case FILTER_DEFLATE:
+      return LUA_APR_HAVE_ZLIB;
+    case FILTER_ZSTD:
+      return LUA_APR_HAVE_ZSTD;
+    case FILTER_LZ4:
+      return LUA_APR_HAVE_LZ4;
+  }
+  return 0;
+}
+
+/* filter_drain() {{{2
+ *
+ * Write the compressed data in the buffer of an output filter to the stream
+ * below it.
+ */
+
+static apr_status_t filter_drain(lua_apr_filter *F)
+{
+  lua_apr_buffer *B = &F->buffer;
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t len;
+
+  while (B->index < B->limit && status == APR_SUCCESS) {
+    len = B->limit - B->index;
+    status = F->write(F->object, &B->data[B->index], &len);
+    B->index += len;
+  }
+  if (B->index == B->limit)
+    B->index = B->limit = 0;
+
+  return status;
+}
+
+/* filter_reserve() {{{2
+ *
+ * Make sure the buffer of an output filter has room for at least @size bytes.
+ */
+
+static apr_status_t filter_reserve(lua_apr_filter *F, apr_size_t size)
+{
+  lua_apr_buffer *B = &F->buffer;
+  apr_status_t status = APR_SUCCESS;
+
+  if (B->size - B->limit < size) {
+    status = filter_drain(F);
+    if (status != APR_SUCCESS)
+      return status;
+    if (B->size < size) {
+      char *data = realloc(B->data, size);
+      if (data == NULL)
+        return APR_ENOMEM;
+      B->data = data;
+      B->size = size;
+    }
+  }
+
+  return status;
+}
+
+#if LUA_APR_HAVE_ZLIB
+
+/* zlib_init() {{{2 */
+
+static apr_status_t zlib_init(lua_apr_filter *F)
+{
+  z_stream *z = &F->state.zlib;
+  int result;
+
+  z->zalloc = Z_NULL;
+  z->zfree = Z_NULL;
+  z->opaque = Z_NULL;
+  z->next_in = Z_NULL;
+  z->avail_in = 0;
+  if (F->encode)
+    /* Window bits + 16 selects the gzip wrapper instead of the zlib one. */
+    result = deflateInit2(z, F->level, Z_DEFLATED,
+        F->format == FILTER_GZIP ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY);
+  else
+    /* Window bits + 32 automatically detects the gzip and zlib wrappers. */
+    result = inflateInit2(z, 15 + 32);
+
+  return result == Z_OK ? APR_SUCCESS : result == Z_MEM_ERROR ? APR_ENOMEM : APR_EINVAL;
+}
+
+/* zlib_encode() {{{2 */
+
+static apr_status_t zlib_encode(lua_apr_filter *F, const char *data, apr_size_t len, lua_apr_filter_mode mode)
+{
+  const int flush = mode == FILTER_RUN ? Z_NO_FLUSH : mode == FILTER_SYNC ? Z_SYNC_FLUSH : Z_FINISH;
+  lua_apr_buffer *B = &F->buffer;
+  z_stream *z = &F->state.zlib;
+  apr_status_t status;
+  int result;
+
+  z->next_in = (Bytef*) data;
+  z->avail_in = len;
+  for (;;) {
+    if (B->limit == B->size && (status = filter_drain(F)) != APR_SUCCESS)
+      return status;
+    z->next_out = (Bytef*) &B->data[B->limit];
+    z->avail_out = B->size - B->limit;
+    result = deflate(z, flush);
+    B->limit = B->size - z->avail_out;
+    if (result == Z_STREAM_ERROR)
+      return APR_EINVAL;
+    if (z->avail_out > 0 && z->avail_in == 0 && (flush != Z_FINISH || result == Z_STREAM_END))
+      return APR_SUCCESS;
+  }
+}
+
+/* zlib_decode() {{{2 */
+
+static apr_status_t zlib_decode(lua_apr_filter *F, char *data, apr_size_t *len)
+{
+  lua_apr_buffer *B = &F->buffer;
+  z_stream *z = &F->state.zlib;
+  int result;
+
+  z->next_in = (Bytef*) &B->data[B->index];
+  z->avail_in = B->limit - B->index;
+  z->next_out = (Bytef*) data;
+  z->avail_out = *len;
+  /* Concatenated gzip members are decoded as a single stream (like gzip -d). */
+  if (F->finished && z->avail_in > 0) {
+    inflateReset(z);
+    F->finished = 0;
+  }
+  result = inflate(z, Z_NO_FLUSH);
+  B->index = B->limit - z->avail_in;
+  *len -= z->avail_out;
+  if (result == Z_STREAM_END)
+    F->finished = 1;
+  else if (result == Z_MEM_ERROR)
+    return APR_ENOMEM;
+  else if (result != Z_OK && result != Z_BUF_ERROR)
+    return APR_EINVAL;
+  F->pending = !F->finished && z->avail_out == 0;
+
+  return APR_SUCCESS;
+}
+
+#endif
+
+#if LUA_APR_HAVE_ZSTD
+
+/* zstd_init() {{{2 */
+
+static apr_status_t zstd_init(lua_apr_filter *F)
+{
+  if (F->encode) {
+    F->state.zstd_encoder = ZSTD_createCCtx();
+    if (F->state.zstd_encoder == NULL)
+      return APR_ENOMEM;
+    if (F->level != 0)
+      ZSTD_CCtx_setParameter(F->state.zstd_encoder, ZSTD_c_compressionLevel, F->level);
+  } else {
+    F->state.zstd_decoder = ZSTD_createDCtx();
+    if (F->state.zstd_decoder == NULL)
+      return APR_ENOMEM;
+  }
+  return APR_SUCCESS;
+}
+
+/* zstd_encode() {{{2 */
+
+static apr_status_t zstd_encode(lua_apr_filter *F, const char *data, apr_size_t len, lua_apr_filter_mode mode)
+{
+  const ZSTD_EndDirective directive = mode == FILTER_RUN ? ZSTD_e_continue : mode == FILTER_SYNC ? ZSTD_e_flush : ZSTD_e_end;
+  lua_apr_buffer *B = &F->buffer;
+  ZSTD_inBuffer input = { data, len, 0 };
+  ZSTD_outBuffer output;
+  apr_status_t status;
+  size_t result;
+
+  for (;;) {
+    if (B->limit == B->size && (status = filter_drain(F)) != APR_SUCCESS)
+      return status;
+    output.dst = B->data;
+    output.size = B->size;
+    output.pos = B->limit;
+    result = ZSTD_compressStream2(F->state.zstd_encoder, &output, &input, directive);
+    B->limit = output.pos;
+    if (ZSTD_isError(result))
+      return APR_EINVAL;
+    /* For flush and end directives the result is the amount still buffered. */
+    if (input.pos == input.size && (directive == ZSTD_e_continue || result == 0))
+      return APR_SUCCESS;
+  }
+}
+
+/* zstd_decode() {{{2 */
+
+static apr_status_t zstd_decode(lua_apr_filter *F, char *data, apr_size_t *len)
+{
+  lua_apr_buffer *B = &F->buffer;
+  ZSTD_inBuffer input = { &B->data[B->index], B->limit - B->index, 0 };
+  ZSTD_outBuffer output = { data, *len, 0 };
+  size_t result;
+
+  result = ZSTD_decompressStream(F->state.zstd_decoder, &output, &input);
+  if (ZSTD_isError(result))
+    return APR_EINVAL;
+  B->index += input.pos;
+  *len = output.pos;
+  /* The result is zero when a frame has been completely decoded. */
+  F->finished = (result == 0);
+  F->pending = output.pos == output.size;
+
+  return APR_SUCCESS;
+}
+
+#endif
+
+#if LUA_APR_HAVE_LZ4
+
+/* lz4_init() {{{2 */
+
+static apr_status_t lz4_init(lua_apr_filter *F)
+{
+  lua_apr_buffer *B = &F->buffer;
+  apr_status_t status;
+  size_t result;
+
+  if (!F->encode) {
+    result = LZ4F_createDecompressionContext(&F->state.lz4.decoder, LZ4F_VERSION);
+    return LZ4F_isError(result) ? APR_ENOMEM : APR_SUCCESS;
+  }
+  memset(&F->state.lz4.preferences, 0, sizeof F->state.lz4.preferences);
+  F->state.lz4.preferences.compressionLevel = F->level;
+  result = LZ4F_createCompressionContext(&F->state.lz4.encoder, LZ4F_VERSION);
+  if (LZ4F_isError(result))
+    return APR_ENOMEM;
+  status = filter_reserve(F, LZ4F_HEADER_SIZE_MAX);
+  if (status != APR_SUCCESS)
+    return status;
+  result = LZ4F_compressBegin(F->state.lz4.encoder, &B->data[B->limit],
+      B->size - B->limit, &F->state.lz4.preferences);
+  if (LZ4F_isError(result))
+    return APR_EINVAL;
+  B->limit += result;
+
+  return APR_SUCCESS;
+}
+
+/* lz4_encode() {{{2 */
+
+static apr_status_t lz4_encode(lua_apr_filter *F, const char *data, apr_size_t len, lua_apr_filter_mode mode)
+{
+  const LZ4F_preferences_t *preferences = &F->state.lz4.preferences;
+  lua_apr_buffer *B = &F->buffer;
+  apr_status_t status;
+  size_t size, result;
+
+  /* LZ4F_compressUpdate() requires room for the worst case output. */
+  while (len > 0) {
+    size = len < LUA_APR_FILTER_CHUNK ? len : LUA_APR_FILTER_CHUNK;
+    status = filter_reserve(F, LZ4F_compressBound(size, preferences));
+    if (status != APR_SUCCESS)
+      return status;
+    result = LZ4F_compressUpdate(F->state.lz4.encoder, &B->data[B->limit],
+        B->size - B->limit, data, size, NULL);
+    if (LZ4F_isError(result))
+      return APR_EINVAL;
+    B->limit += result;
+    data += size;
+    len -= size;
+  }
+
+  if (mode != FILTER_RUN) {
+    status = filter_reserve(F, LZ4F_compressBound(0, preferences));
+    if (status != APR_SUCCESS)
+      return status;
+    if (mode == FILTER_SYNC)
+      result = LZ4F_flush(F->state.lz4.encoder, &B->data[B->limit], B->size - B->limit, NULL);
+    else
+      result = LZ4F_compressEnd(F->state.lz4.encoder, &B->data[B->limit], B->size - B->limit, NULL);
+    if (LZ4F_isError(result))
+      return APR_EINVAL;
+    B->limit += result;
+  }
+
+  return APR_SUCCESS;
+}
+
+/* lz4_decode() {{{2 */
+
+static apr_status_t lz4_decode(lua_apr_filter *F, char *data, apr_size_t *len)
+{
+  lua_apr_buffer *B = &F->buffer;
+  size_t insize = B->limit - B->index, outsize = *len, result;
+
+  result = LZ4F_decompress(F->state.lz4.decoder, data, &outsize,
+      &B->data[B->index], &insize, NULL);
+  if (LZ4F_isError(result))
+    return APR_EINVAL;
+  B->index += insize;
+  /* The result is zero when a frame has been completely decoded. */
+  F->finished = (result == 0);
+  F->pending = outsize == *len;
+  *len = outsize;
+
+  return APR_SUCCESS;
+}
+
+#endif
+
+/* filter_setup() {{{2
+ *
+ * Create the compression library state of a filter on first use.
+ */
+
+static apr_status_t filter_setup(lua_apr_filter *F)
+{
+  apr_status_t status = APR_ENOTIMPL;
+
+  if (F->ready)
+    return APR_SUCCESS;
+  switch (F->format) {
+#   if LUA_APR_HAVE_ZLIB
+    case FILTER_GZIP:
+    case FILTER_DEFLATE:
+      status = zlib_init(F);
+      break;
+#   endif
+#   if LUA_APR_HAVE_ZSTD
+    case FILTER_ZSTD:
+      status = zstd_init(F);
+      break;
+#   endif
+#   if LUA_APR_HAVE_LZ4
+    case FILTER_LZ4:
+      status = lz4_init(F);
+      break;
+#   endif
+    default:
+      break;
+  }
+  F->ready = (status == APR_SUCCESS);
+
+  return status;
+}
+
+/* filter_encode() {{{2 */
+
+static apr_status_t filter_encode(lua_apr_filter *F, const char *data, apr_size_t len, lua_apr_filter_mode mode)
+{
+  apr_status_t status = filter_setup(F);
+
+  if (status != APR_SUCCESS)
+    return status;
+  switch (F->format) {
+#   if LUA_APR_HAVE_ZLIB
+    case FILTER_GZIP:
+    case FILTER_DEFLATE:
+      return zlib_encode(F, data, len, mode);
+#   endif
+#   if LUA_APR_HAVE_ZSTD
+    case FILTER_ZSTD:
+      return zstd_encode(F, data, len, mode);
+#   endif
+#   if LUA_APR_HAVE_LZ4
+    case FILTER_LZ4:
+      return lz4_encode(F, data, len, mode);
+#   endif
+    default:
+      return APR_ENOTIMPL;
+  }
+}
+
+/* filter_decode() {{{2 */
+
+static apr_status_t filter_decode(lua_apr_filter *F, char *data, apr_size_t *len)
+{
+  switch (F->format) {
+#   if LUA_APR_HAVE_ZLIB
+    case FILTER_GZIP:
+    case FILTER_DEFLATE:
+      return zlib_decode(F, data, len);
+#   endif
+#   if LUA_APR_HAVE_ZSTD
+    case FILTER_ZSTD:
+      return zstd_decode(F, data, len);
+#   endif
+#   if LUA_APR_HAVE_LZ4
+    case FILTER_LZ4:
+      return lz4_decode(F, data, len);
+#   endif
+    default:
+      return APR_ENOTIMPL;
+  }
+}
+
+/* filter_read() {{{2
+ *
+ * Read callback of input filters. Decodes buffered compressed data and reads
+ * more compressed data from the stream below when the decoder needs it.
+ */
+
+static apr_status_t lua_apr_cc filter_read(void *object, char *data, apr_size_t *len)
+{
+  lua_apr_filter *F = object;
+  lua_apr_buffer *B = &F->buffer;
+  apr_status_t status = filter_setup(F);
+  apr_size_t size, before;
+
+  if (status != APR_SUCCESS || *len == 0)
+    return status;
+  while (status == APR_SUCCESS) {
+    if (B->index < B->limit || F->pending) {
+      size = *len;
+      before = B->index;
+      status = filter_decode(F, data, &size);
+      if (status != APR_SUCCESS || size > 0) {
+        *len = size;
+        return status;
+      }
+      /* Remaining input is the start of the next stream or frame. */
+      if (B->index < B->limit) {
+        if (B->index == before)
+          status = APR_EINVAL;
+        continue;
+      }
+    }
+    if (F->eof) {
+      /* EOF in the middle of a compressed stream means it was truncated. */
+      *len = 0;
+      return F->finished ? APR_EOF : APR_INCOMPLETE;
+    }
+    B->index = 0;
+    B->limit = 0;
+    size = B->size;
+    status = F->read(F->object, B->data, &size);
+    if (status == APR_SUCCESS)
+      B->limit = size;
+    else if (APR_STATUS_IS_EOF(status))
+      F->eof = 1, status = APR_SUCCESS;
+  }
+
+  *len = 0;
+  return status;
+}
+
+/* filter_write() {{{2 */
+
+static apr_status_t lua_apr_cc filter_write(void *object, const char *data, apr_size_t *len)
+{
+  lua_apr_filter *F = object;
+  apr_status_t status = filter_encode(F, data, *len, FILTER_RUN);
+  if (status != APR_SUCCESS)
+    *len = 0;
+  return status;
+}
+
+/* filter_flush() {{{2
+ *
+ * Flush callback of output filters: Compress all data received so far in
+ * such a way that the other side can decode it, write the compressed data and
+ * flush the stream below.
+ */
+
+static apr_status_t lua_apr_cc filter_flush(void *object)
+{
+  lua_apr_filter *F = object;
+  apr_status_t status = APR_SUCCESS;
+
+  if (F->ready)
+    status = filter_encode(F, NULL, 0, FILTER_SYNC);
+  if (status == APR_SUCCESS)
+    status = filter_drain(F);
+  if (status == APR_SUCCESS && F->flush != NULL)
+    status = F->flush(F->object);
+
+  return status;
+}
+
+/* filter_free() {{{2 */
+
+static void filter_free(lua_apr_filter *F)
+{
+  if (F->ready) {
+    switch (F->format) {
+#     if LUA_APR_HAVE_ZLIB
+      case FILTER_GZIP:
+      case FILTER_DEFLATE:
+        if (F->encode)
+          deflateEnd(&F->state.zlib);
+        else
+          inflateEnd(&F->state.zlib);
+        break;
+#     endif
+#     if LUA_APR_HAVE_ZSTD
+      case FILTER_ZSTD:
+        if (F->encode)
+          ZSTD_freeCCtx(F->state.zstd_encoder);
+        else
+          ZSTD_freeDCtx(F->state.zstd_decoder);
+        break;
+#     endif
+#     if LUA_APR_HAVE_LZ4
+      case FILTER_LZ4:
+        if (F->encode)
+          LZ4F_freeCompressionContext(F->state.lz4.encoder);
+        else
+          LZ4F_freeDecompressionContext(F->state.lz4.decoder);
+        break;
+#     endif
+      default:
+        break;
+    }
+  }
+  free(F->buffer.data);
+  free(F);
+}
+
+/* filter_alloc() {{{2 */
+
+static lua_apr_filter *filter_alloc(lua_apr_filter_format format, int encode, int level, apr_size_t size)
+{
+  lua_apr_filter *F = calloc(1, sizeof *F);
+
+  if (F != NULL) {
+    F->format = format;
+    F->encode = encode;
+    F->level = level;
+    F->finished = 1; /* no stream started yet */
+    F->buffer.size = size > LUA_APR_FILTER_CHUNK ? size : LUA_APR_FILTER_CHUNK;
+    F->buffer.data = malloc(F->buffer.size);
+    if (F->buffer.data == NULL) {
+      free(F);
+      F = NULL;
+    }
+  }
+
+  return F;
+}
+
+/* buffer_filter() {{{1
+ *
+ * Implementation of the filter() method shared by files, pipes and sockets:
+ * Stack a decoder on the input buffer and an encoder on the output buffer.
+ */
+
+int buffer_filter(lua_State *L, lua_apr_readbuf *input, lua_apr_writebuf *output)
+{
+  lua_apr_buffer *B = &input->buffer;
+  lua_apr_filter *decoder, *encoder;
+  lua_apr_filter_format format;
+  apr_status_t status;
+  apr_size_t avail;
+  int level;
+
+  format = luaL_checkoption(L, 2, NULL, filter_options);
+  level = luaL_optint(L, 3, -1);
+  if (!filter_available(format))
+    return push_error_status(L, APR_ENOTIMPL);
+  if (format == FILTER_ZSTD && level < 0)
+    level = 0; /* default compression level of libzstd */
+  else if (format == FILTER_LZ4 && level < 0)
+    level = 0; /* fast mode of liblz4 */
+  luaL_argcheck(L, level <= (format == FILTER_ZSTD ? 22 : format == FILTER_LZ4 ? 12 : 9),
+      3, "compression level out of range");
+
+  /* Data written before the filter is added isn't compressed. */
+  status = flush_buffer(L, output, 1);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+
+  /* Data that was already read (but not consumed) is the start of the
+   * compressed stream, so it's moved into the buffer of the decoder. */
+  avail = !B->unmanaged && B->index < B->limit ? B->limit - B->index : 0;
+  decoder = filter_alloc(format, 0, level, avail);
+  encoder = filter_alloc(format, 1, level, 0);
+  if (decoder == NULL || encoder == NULL) {
+    if (decoder != NULL) filter_free(decoder);
+    if (encoder != NULL) filter_free(encoder);
+    return push_error_memory(L);
+  }
+  if (avail > 0) {
+    memcpy(decoder->buffer.data, &B->data[B->index], avail);
+    decoder->buffer.limit = avail;
+  }
+  if (!B->unmanaged)
+    B->index = B->limit = 0;
+  input->translated = 0;
+
+  /* Stack the decoder on the input buffer. */
+  decoder->object = input->object;
+  decoder->read = input->read;
+  decoder->below = input->filter;
+  input->object = decoder;
+  input->read = filter_read;
+  input->filter = decoder;
+
+  /* Stack the encoder on the output buffer. */
+  encoder->object = output->object;
+  encoder->write = output->write;
+  encoder->flush = output->flush;
+  encoder->below = output->filter;
+  output->object = encoder;
+  output->write = filter_write;
+  output->flush = filter_flush;
+  output->filter = encoder;
+
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/* close_filters() {{{1
+ *
+ * Finish the compressed streams of the output filters, remove all filters and
+ * restore the original callbacks. Must be called after flushing the output
+ * buffer and before closing the descriptor.
+ */
+
+apr_status_t close_filters(lua_apr_readbuf *input, lua_apr_writebuf *output)
+{
+  apr_status_t status = APR_SUCCESS, result;
+  lua_apr_filter *F;
+
+  while ((F = output->filter) != NULL) {
+    if (F->ready) {
+      result = filter_encode(F, NULL, 0, FILTER_FINISH);
+      if (result == APR_SUCCESS)
+        result = filter_drain(F);
+      if (status == APR_SUCCESS)
+        status = result;
+    }
+    output->object = F->object;
+    output->write = F->write;
+    output->flush = F->flush;
+    output->filter = F->below;
+    filter_free(F);
+  }
+
+  while ((F = input->filter) != NULL) {
+    input->object = F->object;
+    input->read = F->read;
+    input->filter = F->below;
+    filter_free(F);
+  }
+
+  return status;
+}
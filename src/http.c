@@ -57,6 +57,7 @@
 #if LUA_APR_HAVE_APREQ
 
 #include "lua_apr.h"
+#include <apr_lib.h>
 #include <apreq_error.h>
 #include <apreq_cookie.h>
 #include <apreq_param.h>
@@ -239,7 +240,304 @@ static int push_multipart_entries(void *ctx, const char *key, const char *value)
   return 1;
 }
 
-/* apr.parse_headers(request) -> headers, body {{{1
+/* uri_classes[] {{{2
+ *
+ * Lookup table used by apr.uri_encode() and apr.uri_decode(). Every byte is
+ * classified in advance so that the encoder and decoder only need a single
+ * table lookup per byte. Bytes 0x80-0xFF are never safe or special and are
+ * left to the implicit zero initialization.
+ */
+
+#define URI_FORM_SAFE 1 /* bytes that are left alone by form encoding */
+#define URI_PATH_SAFE 2 /* bytes that are left alone by path encoding */
+#define URI_FORM_SPECIAL 4 /* bytes that are decoded in form encoded strings */
+#define URI_PATH_SPECIAL 8 /* bytes that are decoded in path encoded strings */
+
+#define U (URI_FORM_SAFE | URI_PATH_SAFE) /* alphanumerics and "-._~" */
+#define P URI_PATH_SAFE /* sub-delimiters, ":", "@" and "/" */
+#define D (URI_FORM_SPECIAL | URI_PATH_SPECIAL) /* "%" */
+#define Q (URI_PATH_SAFE | URI_FORM_SPECIAL) /* "+" */
+
+static const unsigned char uri_classes[256] = {
+  /* 0x00 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  /* 0x10 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  /* 0x20 */ 0, P, 0, 0, P, D, P, P, P, P, P, Q, P, U, U, P,
+  /* 0x30 */ U, U, U, U, U, U, U, U, U, U, P, P, 0, P, 0, 0,
+  /* 0x40 */ P, U, U, U, U, U, U, U, U, U, U, U, U, U, U, U,
+  /* 0x50 */ U, U, U, U, U, U, U, U, U, U, U, 0, 0, 0, 0, U,
+  /* 0x60 */ 0, U, U, U, U, U, U, U, U, U, U, U, U, U, U, U,
+  /* 0x70 */ U, U, U, U, U, U, U, U, U, U, U, 0, 0, 0, U, 0
+};
+
+#undef U
+#undef P
+#undef D
+#undef Q
+
+/* uri_check_set() {{{2 */
+
+static int uri_check_set(lua_State *L, int idx)
+{
+  const char *options[] = { "form", "path", NULL };
+  return luaL_checkoption(L, idx, "form", options);
+}
+
+/* uri_hexval() {{{2 */
+
+static int uri_hexval(unsigned char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  else if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  else if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* uri_decode_length() {{{2
+ *
+ * Get the length of the prefix of a string that doesn't need to be decoded.
+ */
+
+static size_t uri_decode_length(const char *string, size_t length, int special)
+{
+  const unsigned char *run = (const unsigned char*) string;
+  const unsigned char *end = run + length;
+
+  while (run < end && !(uri_classes[*run] & special))
+    run++;
+
+  return run - (const unsigned char*) string;
+}
+
+/* uri_decode_push() {{{2
+ *
+ * Decode a percent-encoded string and push the result on the Lua stack. When
+ * the string contains an invalid escape sequence the original string is pushed
+ * and APREQ_ERROR_BADSEQ is returned.
+ */
+
+static apr_status_t uri_decode_push(lua_State *L, const char *string, size_t length, int special)
+{
+  const unsigned char *run, *start, *end;
+  luaL_Buffer buffer;
+  int high, low;
+
+  start = (const unsigned char*) string;
+  end = start + length;
+  run = start + uri_decode_length(string, length, special);
+  if (run == end) {
+    lua_pushlstring(L, string, length);
+    return APR_SUCCESS;
+  }
+
+  luaL_buffinit(L, &buffer);
+  luaL_addlstring(&buffer, string, run - start);
+  while (run < end) {
+    if (*run == '+') {
+      luaL_addchar(&buffer, ' ');
+      run++;
+    } else {
+      if (end - run < 3 || (high = uri_hexval(run[1])) < 0 || (low = uri_hexval(run[2])) < 0) {
+        luaL_pushresult(&buffer);
+        lua_pop(L, 1);
+        lua_pushlstring(L, string, length);
+        return APREQ_ERROR_BADSEQ;
+      }
+      luaL_addchar(&buffer, (char) (high << 4 | low));
+      run += 3;
+    }
+    start = run;
+    while (run < end && !(uri_classes[*run] & special))
+      run++;
+    luaL_addlstring(&buffer, (const char*) start, run - start);
+  }
+  luaL_pushresult(&buffer);
+
+  return APR_SUCCESS;
+}
+
+/* table_clear() {{{2
+ *
+ * Remove all entries from the table at the given (absolute) stack index so
+ * that the caller's table can be reused without allocating a new one.
+ */
+
+static void table_clear(lua_State *L, int idx)
+{
+  lua_pushnil(L);
+  while (lua_next(L, idx)) {
+    lua_pop(L, 1);
+    lua_pushvalue(L, -1);
+    lua_pushnil(L);
+    lua_rawset(L, idx);
+  }
+}
+
+/* table_add() {{{2
+ *
+ * Pop a name/value pair from the Lua stack and store it in the table at the
+ * given (absolute) stack index, following the same rules as push_scalars():
+ * Duplicate names result in a table that collects all values.
+ */
+
+static void table_add(lua_State *L, int idx)
+{
+  /* Stack: name, value. */
+  lua_pushvalue(L, -2);
+  lua_rawget(L, idx);
+  if (lua_isnil(L, -1)) {
+    /* 1st occurrence. */
+    lua_pop(L, 1);
+    lua_rawset(L, idx);
+  } else if (lua_istable(L, -1)) {
+    /* Later values. */
+    lua_insert(L, -2);
+    lua_rawseti(L, -2, lua_objlen(L, -2) + 1);
+    lua_pop(L, 2);
+  } else {
+    /* 2nd occurrence. */
+    lua_newtable(L);
+    lua_insert(L, -2);
+    lua_rawseti(L, -2, 1);
+    lua_insert(L, -2);
+    lua_rawseti(L, -2, 2);
+    lua_rawset(L, idx);
+  }
+}
+
+/* push_lowercase() {{{2
+ *
+ * Push a header name normalized to lowercase. Because Lua interns all strings
+ * the common header names are shared with the rest of the Lua state: Only the
+ * first occurrence of a name allocates memory.
+ */
+
+static void push_lowercase(lua_State *L, const char *name, size_t length)
+{
+  char buffer[64];
+  luaL_Buffer lbuffer;
+  size_t i;
+
+  if (length <= sizeof buffer) {
+    for (i = 0; i < length; i++)
+      buffer[i] = apr_tolower(name[i]);
+    lua_pushlstring(L, buffer, length);
+  } else {
+    luaL_buffinit(L, &lbuffer);
+    for (i = 0; i < length; i++)
+      luaL_addchar(&lbuffer, apr_tolower(name[i]));
+    luaL_pushresult(&lbuffer);
+  }
+}
+
+/* parse_headers_into() {{{2
+ *
+ * Parse HTTP headers directly into the Lua table at the given (absolute) stack
+ * index without going through apreq and an APR table. Header names are
+ * normalized to lowercase, folded (continuation) lines are joined using a
+ * single space and both CR LF and LF line endings are accepted. Returns the
+ * offset of the body in the request string.
+ */
+
+static apr_status_t parse_headers_into(lua_State *L, int idx, const char *request, size_t size, size_t *offset)
+{
+  const char *p, *end, *eol, *next, *colon, *name_end, *value, *value_end;
+  luaL_Buffer buffer;
+
+  p = request;
+  end = request + size;
+  while (p < end) {
+    eol = memchr(p, '\n', end - p);
+    next = eol != NULL ? eol + 1 : end;
+    if (eol == NULL)
+      eol = end;
+    if (eol > p && eol[-1] == '\r')
+      eol--;
+    if (eol == p) {
+      /* Empty line separates the headers from the body. */
+      p = next;
+      break;
+    }
+    colon = memchr(p, ':', eol - p);
+    if (colon == NULL || colon == p || *p == ' ' || *p == '\t') {
+      *offset = p - request;
+      return APREQ_ERROR_BADHEADER;
+    }
+    name_end = colon;
+    while (name_end > p && (name_end[-1] == ' ' || name_end[-1] == '\t'))
+      name_end--;
+    push_lowercase(L, p, name_end - p);
+    luaL_buffinit(L, &buffer);
+    for (;;) {
+      value = colon + 1;
+      value_end = eol;
+      while (value < value_end && (*value == ' ' || *value == '\t'))
+        value++;
+      while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+        value_end--;
+      luaL_addlstring(&buffer, value, value_end - value);
+      p = next;
+      if (p >= end || (*p != ' ' && *p != '\t'))
+        break;
+      /* Folded header line. */
+      colon = p - 1;
+      eol = memchr(p, '\n', end - p);
+      next = eol != NULL ? eol + 1 : end;
+      if (eol == NULL)
+        eol = end;
+      if (eol > p && eol[-1] == '\r')
+        eol--;
+      luaL_addchar(&buffer, ' ');
+    }
+    luaL_pushresult(&buffer);
+    table_add(L, idx);
+  }
+  *offset = p - request;
+
+  return APR_SUCCESS;
+}
+
+/* parse_query_string_into() {{{2
+ *
+ * Parse a URL encoded string directly into the Lua table at the given
+ * (absolute) stack index, using `&` and `;` to delineate words. Names and
+ * values are decoded; the first invalid escape sequence is reported but
+ * parsing continues with the undecoded text.
+ */
+
+static apr_status_t parse_query_string_into(lua_State *L, int idx, const char *qs, size_t size)
+{
+  const char *p, *end, *word_end, *equals;
+  apr_status_t status = APR_SUCCESS, decode_status;
+
+  p = qs;
+  end = qs + size;
+  while (p < end) {
+    for (word_end = p; word_end < end && *word_end != '&' && *word_end != ';'; word_end++)
+      ;
+    if (word_end > p) {
+      equals = memchr(p, '=', word_end - p);
+      decode_status = uri_decode_push(L, p, (equals != NULL ? equals : word_end) - p, URI_FORM_SPECIAL);
+      if (status == APR_SUCCESS)
+        status = decode_status;
+      if (equals == NULL) {
+        lua_pushboolean(L, 1);
+      } else {
+        decode_status = uri_decode_push(L, equals + 1, word_end - equals - 1, URI_FORM_SPECIAL);
+        if (status == APR_SUCCESS)
+          status = decode_status;
+      }
+      table_add(L, idx);
+    }
+    p = word_end + 1;
+  }
+
+  return status;
+}
+
+/* apr.parse_headers(request [, headers]) -> headers, body {{{1
  *
  * Parse the [headers] [headers] in a [HTTP] [http] request string according to
  * [RFC 822] [rfc822]. On success a table of header name/value pairs and the
@@ -254,7 +552,20 @@ static int push_multipart_entries(void *ctx, const char *key, const char *value)
  *  - If the request string doesn't contain an empty line to separate the
  *    headers from the body, the last header might be silently discarded
  *
+ * If the optional table @headers is given, it is cleared and the headers are
+ * stored in it (and returned) instead of in a new table. In this case a fast
+ * parser built into Lua/APR is used instead of [apreq2] [apreq2]: Header
+ * names are normalized to lowercase (so `headers['content-type']` works for
+ * any spelling), folded header lines are joined and the last header is kept
+ * even when there's no empty line before the body. Reusing one table for
+ * every request of a connection avoids creating garbage:
+ *
+ *     > headers = {}
+ *     > = apr.parse_headers('Host: example.com\r\nContent-Length: 0\r\n\r\n', headers)
+ *     { host = 'example.com', ['content-length'] = '0' }, ''
+ *
  * [rfc822]: http://tools.ietf.org/html/rfc822
+ * [apreq2]: http://httpd.apache.org/apreq/
  */
 
 int lua_apr_parse_headers(lua_State *L)
@@ -270,9 +581,19 @@ int lua_apr_parse_headers(lua_State *L)
   const char *request;
   size_t requestsize;
 
+  request = luaL_checklstring(L, 1, &requestsize);
+  if (!lua_isnoneornil(L, 2)) {
+    /* Parse directly into the caller's table. */
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_settop(L, 2);
+    table_clear(L, 2);
+    parser_status = parse_headers_into(L, 2, request, requestsize, &bodysize);
+    lua_pushlstring(L, request + bodysize, requestsize - bodysize);
+    return push_http_result(L, parser_status, 2);
+  }
+
   pool = to_pool(L);
   apreq_init(L, pool);
-  request = luaL_checklstring(L, 1, &requestsize);
 
   /* Create the parser and bucket brigade. */
   allocator = apr_bucket_alloc_create(pool);
@@ -394,7 +715,7 @@ int lua_apr_parse_cookie_header(lua_State *L)
   return push_http_result(L, status, 1);
 }
 
-/* apr.parse_query_string(query_string) -> parameters {{{1
+/* apr.parse_query_string(query_string [, parameters]) -> parameters {{{1
  *
  * Parse a URL encoded string into a Lua table. On success the table with
  * parameter name/value pairs is returned, otherwise nil followed by an error
@@ -402,6 +723,14 @@ int lua_apr_parse_cookie_header(lua_State *L)
  * 
  * This function uses `&` and `;` as the set of tokens to delineate words, and
  * will treat a word without `=` as a name/value pair with the value true.
+ *
+ * If the optional table @parameters is given, it is cleared and the
+ * parameters are stored in it (and returned) instead of in a new table, using
+ * a fast parser built into Lua/APR instead of [apreq2] [apreq2]. Invalid
+ * escape sequences are left undecoded and reported with the error code
+ * `'BADSEQ'` after the table.
+ *
+ * [apreq2]: http://httpd.apache.org/apreq/
  */
 
 int lua_apr_parse_query_string(lua_State *L)
@@ -410,9 +739,19 @@ int lua_apr_parse_query_string(lua_State *L)
   apr_pool_t *pool;
   apr_table_t *table;
   const char *qs;
+  size_t size;
+
+  qs = luaL_checklstring(L, 1, &size);
+  if (!lua_isnoneornil(L, 2)) {
+    /* Parse directly into the caller's table. */
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_settop(L, 2);
+    table_clear(L, 2);
+    status = parse_query_string_into(L, 2, qs, size);
+    return push_http_result(L, status, 1);
+  }
 
   pool = to_pool(L);
-  qs = luaL_checkstring(L, 1);
   table = apr_table_make(pool, DEFAULT_TABLE_SIZE);
   status = apreq_parse_query_string(pool, table, qs);
   if (status != APR_SUCCESS && apr_is_empty_table(table))
@@ -445,54 +784,97 @@ int lua_apr_header_attribute(lua_State *L)
   return 1;
 }
 
-/* apr.uri_encode(string) -> encoded {{{1
+/* apr.uri_encode(string [, set]) -> encoded {{{1
  *
  * Encode unsafe bytes in @string using [percent-encoding] [percenc] so that
- * the string can be embedded in a [URI] [uri] query string.
+ * the string can be embedded in a [URI] [uri]. The optional argument @set
+ * selects the bytes that are left alone:
+ *
+ *  - `'form'` (the default) encodes everything except letters, digits and the
+ *    characters `-._~` and encodes spaces as `+`, as expected in query strings
+ *    and `application/x-www-form-urlencoded` request bodies
+ *  - `'path'` also leaves the characters `!$&'()*+,;=:@/` alone and encodes
+ *    spaces as `%20`, which is suitable for the path component of a URI
+ *
+ * This function is binary safe. When nothing needs to be encoded @string
+ * itself is returned without copying it.
  *
  * [percenc]: http://en.wikipedia.org/wiki/Percent-encoding
+ * [uri]: http://en.wikipedia.org/wiki/Uniform_Resource_Identifier
  */
 
 int lua_apr_uri_encode(lua_State *L)
 {
-  apr_pool_t *pool;
-  const char *string, *encoded;
+  const char hexdigits[] = "0123456789ABCDEF";
+  const unsigned char *string, *run, *end;
+  luaL_Buffer buffer;
+  int safe, form;
   size_t length;
+  char escape[3];
+
+  string = (const unsigned char*) luaL_checklstring(L, 1, &length);
+  form = (uri_check_set(L, 2) == 0);
+  safe = form ? URI_FORM_SAFE : URI_PATH_SAFE;
+
+  /* Find the first byte that needs to be encoded. */
+  end = string + length;
+  run = string;
+  while (run < end && (uri_classes[*run] & safe))
+    run++;
+  if (run == end) {
+    lua_settop(L, 1);
+    return 1;
+  }
 
-  pool = to_pool(L);
-  string = luaL_checklstring(L, 1, &length);
-  encoded = apreq_escape(pool, string, length);
-  lua_pushstring(L, encoded);
+  luaL_buffinit(L, &buffer);
+  luaL_addlstring(&buffer, (const char*) string, run - string);
+  escape[0] = '%';
+  while (run < end) {
+    if (*run == ' ' && form) {
+      luaL_addchar(&buffer, '+');
+    } else {
+      escape[1] = hexdigits[*run >> 4];
+      escape[2] = hexdigits[*run & 0x0F];
+      luaL_addlstring(&buffer, escape, 3);
+    }
+    string = ++run;
+    while (run < end && (uri_classes[*run] & safe))
+      run++;
+    luaL_addlstring(&buffer, (const char*) string, run - string);
+  }
+  luaL_pushresult(&buffer);
 
   return 1;
 }
 
-/* apr.uri_decode(encoded) -> string {{{1
+/* apr.uri_decode(encoded [, set]) -> string {{{1
  *
- * Decode all [percent-encoded] [percenc] bytes in the string @encoded.
+ * Decode all [percent-encoded] [percenc] bytes in the string @encoded. The
+ * optional argument @set is `'form'` (the default, `+` is decoded to a space)
+ * or `'path'` (`+` is left alone). On success the decoded string is returned,
+ * otherwise a nil followed by an error message and the error code `'BADSEQ'`
+ * is returned (when a `%` isn't followed by two hexadecimal digits). This
+ * function is binary safe. When nothing needs to be decoded @encoded itself is
+ * returned without copying it.
  */
 
 int lua_apr_uri_decode(lua_State *L)
 {
-  apr_status_t status;
-  apr_pool_t *pool;
   const char *encoded;
-  char *string;
-  size_t enclen;
-  apr_size_t strlen;
-
-  pool = to_pool(L);
-  encoded = luaL_checklstring(L, 1, &enclen);
-  string = apr_palloc(pool, enclen + 1);
-  if (string == NULL)
-    return push_error_memory(L);
-  memcpy(string, encoded, enclen);
+  size_t length;
+  int special;
 
-  status = apreq_decode(string, &strlen, encoded, enclen);
-  if (status != APR_SUCCESS)
-    return push_error_status(L, status);
+  encoded = luaL_checklstring(L, 1, &length);
+  special = uri_check_set(L, 2) == 0 ? URI_FORM_SPECIAL : URI_PATH_SPECIAL;
+  if (uri_decode_length(encoded, length, special) == length) {
+    lua_settop(L, 1);
+    return 1;
+  }
+  if (uri_decode_push(L, encoded, length, special) != APR_SUCCESS) {
+    lua_pop(L, 1);
+    return push_http_error(L, APREQ_ERROR_BADSEQ, 1);
+  }
 
-  lua_pushlstring(L, string, strlen);
   return 1;
 }
 
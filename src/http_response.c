@@ -0,0 +1,561 @@
+/* HTTP response module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * Building an HTTP response in Lua with `string.format()` and `..` and then
+ * writing it using `socket:write()` copies the same bytes several times. The
+ * response objects in this module append the status line, headers and body
+ * chunks to a single buffer that's owned by the response. Large strings (4 KB
+ * and up) aren't copied at all; they're referenced from the response until
+ * it's sent. Everything is then sent to the socket using a single
+ * [vectored write] [writev]. For example:
+ *
+ *     > response = client:response(200)
+ *     > response:header('Content-Type', 'text/plain')
+ *     > response:header('Transfer-Encoding', 'chunked')
+ *     > response:write('Hello ', 'world!')
+ *     > response:finish()
+ *
+ * [writev]: http://en.wikipedia.org/wiki/Vectored_I/O
+ */
+
+#include "lua_apr.h"
+#include <apr_lib.h>
+#include <apr_network_io.h>
+#include <apr_strings.h>
+#include <string.h>
+#ifdef WIN32
+# define strcasecmp _stricmp
+# define strncasecmp _strnicmp
+#else
+# include <strings.h>
+#endif
+
+/* Strings of at least this size are referenced instead of copied. */
+#define LUA_APR_RESPONSE_REFSIZE 4096
+
+/* Maximum number of I/O vectors passed to apr_socket_sendv() at once. */
+#define LUA_APR_RESPONSE_MAXVEC 64
+
+/* Internal functions. {{{1 */
+
+typedef struct {
+  const char *data; /* NULL for data in the response buffer */
+  size_t offset, length;
+} lua_apr_response_segment;
+
+typedef struct {
+  lua_apr_refobj header;
+  lua_apr_socket *socket;
+  int chunked, body_started, finished, references;
+  char *buffer;
+  size_t buflen, bufsize;
+  lua_apr_response_segment *segments;
+  int nsegments, maxsegments;
+} lua_apr_response;
+
+/* response_check() {{{2 */
+
+static lua_apr_response *response_check(lua_State *L, int idx, int open)
+{
+  lua_apr_response *response = check_object(L, idx, &lua_apr_response_type);
+  if (open && response->finished)
+    luaL_error(L, "attempt to use a finished HTTP response");
+  if (open && response->socket->handle == NULL)
+    luaL_error(L, "attempt to use a closed socket");
+  return response;
+}
+
+/* response_segment() {{{2
+ *
+ * Reserve a new segment at the end of the response.
+ */
+
+static lua_apr_response_segment *response_segment(lua_State *L, lua_apr_response *R)
+{
+  lua_apr_response_segment *segments;
+  int size;
+
+  if (R->nsegments == R->maxsegments) {
+    size = R->maxsegments > 0 ? R->maxsegments * 2 : 16;
+    segments = realloc(R->segments, size * sizeof segments[0]);
+    if (segments == NULL)
+      raise_error_memory(L);
+    R->segments = segments;
+    R->maxsegments = size;
+  }
+
+  return &R->segments[R->nsegments++];
+}
+
+/* response_copy() {{{2
+ *
+ * Copy a string to the end of the response buffer.
+ */
+
+static void response_copy(lua_State *L, lua_apr_response *R, const char *data, size_t length)
+{
+  lua_apr_response_segment *segment;
+  size_t size;
+  char *buffer;
+
+  if (length == 0)
+    return;
+  if (R->buflen + length > R->bufsize) {
+    size = R->bufsize > 0 ? R->bufsize : LUA_APR_BUFSIZE;
+    while (size < R->buflen + length)
+      size *= 2;
+    buffer = realloc(R->buffer, size);
+    if (buffer == NULL)
+      raise_error_memory(L);
+    R->buffer = buffer;
+    R->bufsize = size;
+  }
+  memcpy(&R->buffer[R->buflen], data, length);
+
+  /* Extend the last segment if it ends where the new data starts. */
+  segment = R->nsegments > 0 ? &R->segments[R->nsegments - 1] : NULL;
+  if (segment != NULL && segment->data == NULL && segment->offset + segment->length == R->buflen) {
+    segment->length += length;
+  } else {
+    segment = response_segment(L, R);
+    segment->data = NULL;
+    segment->offset = R->buflen;
+    segment->length = length;
+  }
+  R->buflen += length;
+}
+
+/* response_append() {{{2
+ *
+ * Append the string or blob at the given stack index to the response, either
+ * by copying it or (for large strings and all blobs) by referencing it from the
+ * environment of the response so that it isn't garbage collected before it's
+ * been sent.
+ */
+
+static void response_append(lua_State *L, lua_apr_response *R, int idx)
+{
+  lua_apr_response_segment *segment;
+  const char *data;
+  size_t length;
+
+  data = check_bytes(L, idx, &length);
+  /* Blobs are immutable so they can always be referenced; byte buffers can
+   * change before the response is sent so they're always copied. */
+  if (lua_type(L, idx) == LUA_TUSERDATA
+      ? !object_has_type(L, idx, &lua_apr_blob_type, 1)
+      : length < LUA_APR_RESPONSE_REFSIZE) {
+    response_copy(L, R, data, length);
+  } else {
+    segment = response_segment(L, R);
+    segment->data = data;
+    segment->offset = 0;
+    segment->length = length;
+    object_env_private(L, 1);
+    lua_pushvalue(L, idx);
+    lua_rawseti(L, -2, ++R->references);
+    lua_pop(L, 1);
+  }
+}
+
+/* check_header_text() {{{2
+ *
+ * Check that a reason phrase or header name or value doesn't contain line
+ * breaks or NUL bytes, which would allow a caller to inject headers or split
+ * the response.
+ */
+
+static const char *check_header_text(lua_State *L, int idx, size_t *length)
+{
+  const char *text = luaL_checklstring(L, idx, length);
+
+  if (memchr(text, '\r', *length) != NULL
+      || memchr(text, '\n', *length) != NULL
+      || memchr(text, '\0', *length) != NULL)
+    luaL_argerror(L, idx, "contains CR, LF or NUL character");
+  return text;
+}
+
+/* last_coding_chunked() {{{2
+ *
+ * Check whether the last transfer coding in the value of a Transfer-Encoding
+ * header is "chunked" (e.g. "chunked" or "gzip, chunked").
+ */
+
+static int last_coding_chunked(const char *value, size_t length)
+{
+  const char *end = value + length, *start;
+
+  while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+    end--;
+  start = end;
+  while (start > value && start[-1] != ',')
+    start--;
+  while (start < end && (*start == ' ' || *start == '\t'))
+    start++;
+  return end - start == 7 && strncasecmp(start, "chunked", 7) == 0;
+}
+
+/* response_end_headers() {{{2 */
+
+static void response_end_headers(lua_State *L, lua_apr_response *R)
+{
+  if (!R->body_started) {
+    response_copy(L, R, "\r\n", 2);
+    R->body_started = 1;
+  }
+}
+
+/* response_reset() {{{2
+ *
+ * Forget about the data that has been sent and release the references to the
+ * strings in the environment of the response.
+ */
+
+static void response_reset(lua_State *L, lua_apr_response *R)
+{
+  R->buflen = 0;
+  R->nsegments = 0;
+  if (R->references > 0) {
+    object_env_private(L, 1);
+    for (; R->references > 0; R->references--) {
+      lua_pushnil(L);
+      lua_rawseti(L, -2, R->references);
+    }
+    lua_pop(L, 1);
+  }
+}
+
+/* response_sendv() {{{2
+ *
+ * Send the segments of a response using vectored writes, until everything has
+ * been sent or an error occurs.
+ */
+
+static apr_status_t response_sendv(lua_apr_response *R)
+{
+  struct iovec vectors[LUA_APR_RESPONSE_MAXVEC];
+  lua_apr_response_segment *segment;
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t sent;
+  size_t skip = 0;
+  int first = 0, count, i;
+
+  while (first < R->nsegments && status == APR_SUCCESS) {
+    /* Fill the I/O vectors, skipping any bytes already sent. */
+    for (count = 0; count < LUA_APR_RESPONSE_MAXVEC && first + count < R->nsegments; count++) {
+      segment = &R->segments[first + count];
+      vectors[count].iov_base = (void*) ((segment->data != NULL ? segment->data
+            : R->buffer + segment->offset) + (count == 0 ? skip : 0));
+      vectors[count].iov_len = segment->length - (count == 0 ? skip : 0);
+    }
+    sent = 0;
+    status = apr_socket_sendv(R->socket->handle, vectors, count, &sent);
+    /* Advance past the data that was sent. */
+    for (i = 0; i < count && sent >= vectors[i].iov_len; i++)
+      sent -= vectors[i].iov_len;
+    first += i;
+    skip = (i == 0 ? skip : 0) + sent;
+  }
+
+  return status;
+}
+
+/* response_flush() {{{2
+ *
+ * Send everything added to the response so far. Data written earlier using
+ * socket:write() is sent first. When the socket has a compression filter the
+ * data is passed through the filter instead of using a vectored write. Text
+ * mode is ignored because HTTP requires CR LF line endings anyway.
+ */
+
+static apr_status_t response_flush(lua_State *L, lua_apr_response *R)
+{
+  lua_apr_writebuf *output = &R->socket->output;
+  lua_apr_response_segment *segment;
+  apr_status_t status;
+  const char *data;
+  apr_size_t length, written;
+  int i;
+
+  status = flush_buffer(L, output, 1);
+  if (status == APR_SUCCESS && output->filter == NULL) {
+    status = response_sendv(R);
+  } else if (status == APR_SUCCESS) {
+    for (i = 0; i < R->nsegments && status == APR_SUCCESS; i++) {
+      segment = &R->segments[i];
+      data = segment->data != NULL ? segment->data : R->buffer + segment->offset;
+      length = segment->length;
+      while (length > 0 && status == APR_SUCCESS) {
+        written = length;
+        status = output->write(output->object, data, &written);
+        data += written;
+        length -= written;
+      }
+    }
+    if (status == APR_SUCCESS)
+      status = output->flush(output->object);
+  }
+  response_reset(L, R);
+
+  return status;
+}
+
+/* status_reason() {{{2 */
+
+static const char *status_reason(int code)
+{
+  switch (code) {
+    case 100: return "Continue";
+    case 101: return "Switching Protocols";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 202: return "Accepted";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 303: return "See Other";
+    case 304: return "Not Modified";
+    case 307: return "Temporary Redirect";
+    case 308: return "Permanent Redirect";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 409: return "Conflict";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 416: return "Range Not Satisfiable";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    default:  return "Unknown";
+  }
+}
+
+/* socket:response([status [, reason]]) -> response {{{1
+ *
+ * Create an HTTP response object for the connected @socket. The status line
+ * is added right away using the number @status (defaults to 200) and the
+ * string @reason (defaults to the standard reason phrase for @status, a
+ * @reason that contains CR, LF or NUL characters raises an error). On success
+ * the response object is returned, otherwise a nil followed by an error
+ * message is returned.
+ *
+ * Response objects can be reused for several requests on the same (keep-alive)
+ * connection: After `response:finish()` a new response can be created.
+ */
+
+int socket_response(lua_State *L)
+{
+  lua_apr_response *response;
+  lua_apr_socket *socket;
+  const char *reason;
+  size_t length;
+  char line[64];
+  int status;
+
+  socket = check_object(L, 1, &lua_apr_socket_type);
+  if (socket->handle == NULL)
+    luaL_error(L, "attempt to use a closed socket");
+  status = luaL_optint(L, 2, 200);
+  luaL_argcheck(L, status >= 100 && status <= 999, 2, "invalid status code");
+  if (lua_isnoneornil(L, 3)) {
+    reason = status_reason(status);
+    length = strlen(reason);
+  } else {
+    reason = check_header_text(L, 3, &length);
+  }
+  lua_settop(L, 3);
+
+  response = new_object(L, &lua_apr_response_type); /* response @ 4 */
+  if (response == NULL)
+    return push_error_memory(L);
+  response->socket = socket;
+
+  /* Keep the socket alive as long as the response. */
+  object_env_private(L, 4);
+  lua_pushvalue(L, 1);
+  lua_setfield(L, -2, "socket");
+  lua_pop(L, 1);
+
+  apr_snprintf(line, sizeof line, "HTTP/1.1 %i ", status);
+  response_copy(L, response, line, strlen(line));
+  response_copy(L, response, reason, length);
+  response_copy(L, response, "\r\n", 2);
+
+  return 1;
+}
+
+/* response:header(name, value) -> response {{{1
+ *
+ * Add a header to the response. Headers must be added before the first call
+ * to `response:write()`. Adding a `Transfer-Encoding` header whose last
+ * coding is `chunked` (e.g. `chunked` or `gzip, chunked`) makes
+ * `response:write()` use [chunked transfer encoding] [chunked]. Names and
+ * values that contain CR, LF or NUL characters raise an error. Returns the
+ * response so that calls can be chained.
+ *
+ * [chunked]: http://en.wikipedia.org/wiki/Chunked_transfer_encoding
+ */
+
+static int response_header(lua_State *L)
+{
+  lua_apr_response *response;
+  const char *name, *value;
+  size_t length;
+
+  response = response_check(L, 1, 1);
+  name = check_header_text(L, 2, &length);
+  value = check_header_text(L, 3, &length);
+  if (response->body_started)
+    luaL_error(L, "attempt to add header after HTTP response body");
+  if (strcasecmp(name, "Transfer-Encoding") == 0)
+    response->chunked = last_coding_chunked(value, length);
+
+  response_append(L, response, 2);
+  response_copy(L, response, ": ", 2);
+  response_append(L, response, 3);
+  response_copy(L, response, "\r\n", 2);
+  lua_settop(L, 1);
+
+  return 1;
+}
+
+/* response:write(value [, ...]) -> response {{{1
+ *
+ * Add one or more strings to the body of the response. Nothing is sent until
+ * `response:send()` or `response:finish()` is called. When chunked transfer
+ * encoding is used all the strings given to one call form a single chunk.
+ * Returns the response so that calls can be chained.
+ */
+
+static int response_write(lua_State *L)
+{
+  lua_apr_response *response;
+  size_t total = 0, length;
+  char size[32];
+  int i, n;
+
+  response = response_check(L, 1, 1);
+  n = lua_gettop(L);
+  for (i = 2; i <= n; i++) {
+    check_bytes(L, i, &length);
+    total += length;
+  }
+  response_end_headers(L, response);
+  if (total > 0) {
+    if (response->chunked) {
+      /* Chunk sizes are hexadecimal. */
+      apr_snprintf(size, sizeof size, "%lx\r\n", (unsigned long) total);
+      response_copy(L, response, size, strlen(size));
+    }
+    for (i = 2; i <= n; i++)
+      response_append(L, response, i);
+    if (response->chunked)
+      response_copy(L, response, "\r\n", 2);
+  }
+  lua_settop(L, 1);
+
+  return 1;
+}
+
+/* response:send() -> status {{{1
+ *
+ * Send everything that was added to the response so far using a single
+ * vectored write (if the socket has a filter, the data is passed through the
+ * socket's buffers instead; text mode is ignored because HTTP requires CR LF
+ * line endings anyway). This can be used to stream a response (for example
+ * with chunked encoding). On success true is returned, otherwise a nil
+ * followed by an error message is returned.
+ */
+
+static int response_send(lua_State *L)
+{
+  lua_apr_response *response = response_check(L, 1, 1);
+  return push_status(L, response_flush(L, response));
+}
+
+/* response:finish() -> status {{{1
+ *
+ * End the response (when chunked transfer encoding is used this adds the last
+ * chunk) and send everything that hasn't been sent yet. Afterwards the
+ * response can no longer be used. On success true is returned, otherwise a
+ * nil followed by an error message is returned.
+ */
+
+static int response_finish(lua_State *L)
+{
+  lua_apr_response *response;
+  apr_status_t status;
+
+  response = response_check(L, 1, 1);
+  response_end_headers(L, response);
+  if (response->chunked)
+    response_copy(L, response, "0\r\n\r\n", 5);
+  status = response_flush(L, response);
+  response->finished = 1;
+
+  return push_status(L, status);
+}
+
+/* response:__tostring() {{{1 */
+
+static int response_tostring(lua_State *L)
+{
+  lua_apr_response *response = response_check(L, 1, 0);
+  lua_pushfstring(L, "%s (%p)", lua_apr_response_type.friendlyname, response);
+  return 1;
+}
+
+/* response:__gc() {{{1 */
+
+static int response_gc(lua_State *L)
+{
+  lua_apr_response *response = response_check(L, 1, 0);
+  if (object_collectable((lua_apr_refobj*)response)) {
+    free(response->buffer);
+    response->buffer = NULL;
+    free(response->segments);
+    response->segments = NULL;
+  }
+  release_object((lua_apr_refobj*)response);
+  return 0;
+}
+
+/* }}} */
+
+static luaL_reg response_methods[] = {
+  { "header", response_header },
+  { "write", response_write },
+  { "send", response_send },
+  { "finish", response_finish },
+  { NULL, NULL },
+};
+
+static luaL_reg response_metamethods[] = {
+  { "__tostring", response_tostring },
+  { "__eq", objects_equal },
+  { "__gc", response_gc },
+  { NULL, NULL },
+};
+
+lua_apr_objtype lua_apr_response_type = {
+  "lua_apr_response*",      /* metatable name in registry */
+  "HTTP response",          /* friendly object name */
+  sizeof(lua_apr_response), /* structure size */
+  response_methods,         /* methods table */
+  response_metamethods      /* metamethods table */
+};
+
+/* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
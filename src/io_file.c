@@ -6,14 +6,42 @@
  * License: MIT
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE /* fallocate(), SEEK_DATA and SEEK_HOLE */
+#endif
+
 #include "lua_apr.h"
 #include <apr_file_info.h>
 #include <apr_file_io.h>
 #include <apr_lib.h>
 #include <apr_portable.h>
 #include <apr_strings.h>
+#include <limits.h>
 #include <stdio.h>
 
+#if !defined(WIN32) && !defined(OS2) && !defined(NETWARE)
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/uio.h>
+#endif
+
+/* The number of arguments to file:write() passed to apr_file_writev() without
+ * allocating memory in append mode. */
+#define LUA_APR_APPEND_VECTORS 16
+
+/* The maximum number of vectors passed to one apr_file_writev() call in append
+ * mode, more values are joined into a single string first. On Windows
+ * apr_file_writev() writes the vectors one by one so the values are always
+ * joined. */
+#if defined(WIN32)
+# define LUA_APR_APPEND_MAXVEC 1
+#elif defined(IOV_MAX)
+# define LUA_APR_APPEND_MAXVEC IOV_MAX
+#else
+# define LUA_APR_APPEND_MAXVEC APR_MAX_IOVEC_SIZE
+#endif
+
 /* TODO Bind apr_file_pipe_create_ex(), apr_file_sync(), apr_file_datasync() */
 
 /* Internal functions. {{{1 */
@@ -47,6 +75,20 @@ void init_file_buffers(lua_State *L, lua_apr_file *file, int text_mode)
       (lua_apr_buf_ff) apr_file_flush);
 }
 
+/* file_init_mode() {{{2
+ *
+ * Initialize the buffers of a newly opened file according to its mode string
+ * and the flags returned by parse_mode_str().
+ */
+
+void file_init_mode(lua_State *L, lua_apr_file *file, const char *mode, apr_int32_t flags)
+{
+  init_file_buffers(L, file, !(flags & APR_FOPEN_BINARY));
+  if (strchr(mode, 't') != NULL && !(flags & APR_FOPEN_BINARY))
+    file->input.text_mode = file->output.text_mode = 1;
+  file->append = (flags & APR_FOPEN_APPEND) != 0;
+}
+
 /* file_check() {{{2 */
 
 lua_apr_file *file_check(lua_State *L, int i, int open)
@@ -64,6 +106,17 @@ apr_status_t file_close_impl(lua_State *L, lua_apr_file *file)
   apr_status_t status = APR_SUCCESS;
   if (file->handle != NULL) {
     status = flush_buffer(L, &file->output, 1);
+    if (file->output.filter != NULL || file->input.filter != NULL) {
+      apr_status_t filter_status = close_filters(&file->input, &file->output);
+      if (status == APR_SUCCESS)
+        status = filter_status;
+    }
+    if (file->direct != NULL) {
+      apr_status_t direct_status = direct_close(file->direct);
+      file->direct = NULL;
+      if (status == APR_SUCCESS)
+        status = direct_status;
+    }
     if (status == APR_SUCCESS)
       status = apr_file_close(file->handle);
     else
@@ -76,11 +129,103 @@ apr_status_t file_close_impl(lua_State *L, lua_apr_file *file)
   return status;
 }
 
+/* file_seek_impl() {{{2
+ *
+ * Reposition the file offset of a file, taking direct I/O mode into account.
+ */
+
+static apr_status_t file_seek_impl(lua_apr_file *file, apr_seek_where_t where, apr_off_t *offset)
+{
+  if (file->direct != NULL)
+    return direct_seek(file->direct, where, offset);
+  return apr_file_seek(file->handle, where, offset);
+}
+
+/* seek_extent() {{{2
+ *
+ * Find the start of the next data (or hole) in a sparse file at or after
+ * @offset using SEEK_DATA (or SEEK_HOLE). Where these aren't available the
+ * whole file is data followed by an implicit hole at the end of the file,
+ * which is what file systems without support for holes report as well.
+ * Returns APR_EOF when there's no data (or hole) after @offset.
+ */
+
+static apr_status_t seek_extent(lua_apr_file *file, int data, apr_off_t *offset)
+{
+# if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  apr_os_file_t fd;
+  off_t result;
+
+  apr_os_file_get(&fd, file->handle);
+  result = lseek(fd, *offset, data ? SEEK_DATA : SEEK_HOLE);
+  if (result == (off_t) -1)
+    return errno == ENXIO ? APR_EOF : apr_get_os_error();
+  *offset = result;
+
+  return APR_SUCCESS;
+# else
+  apr_status_t status;
+  apr_finfo_t info;
+
+  status = apr_file_info_get(&info, APR_FINFO_SIZE, file->handle);
+  if (status != APR_SUCCESS)
+    return status;
+  if (*offset >= info.size)
+    return APR_EOF;
+  if (!data)
+    *offset = info.size;
+
+  return APR_SUCCESS;
+# endif
+}
+
+/* file_fallocate() {{{2
+ *
+ * Allocate disk space for (or deallocate) a range of a file using
+ * fallocate() on Linux and posix_fallocate() on other UNIX systems.
+ */
+
+static apr_status_t file_fallocate(lua_apr_file *file, int punch, int keep_size, apr_off_t offset, apr_off_t length)
+{
+# if !defined(WIN32) && !defined(OS2) && !defined(NETWARE)
+  apr_os_file_t fd;
+
+  apr_os_file_get(&fd, file->handle);
+# if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+  {
+    int mode = keep_size ? FALLOC_FL_KEEP_SIZE : 0;
+    if (punch) {
+#     if defined(FALLOC_FL_PUNCH_HOLE)
+      mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+#     else
+      return APR_ENOTIMPL;
+#     endif
+    }
+    if (fallocate(fd, mode, offset, length) == 0)
+      return APR_SUCCESS;
+    /* posix_fallocate() emulates preallocation on file systems that don't
+     * support fallocate(), but only when the file size may change. */
+    if (errno != EOPNOTSUPP || punch || keep_size)
+      return apr_get_os_error();
+  }
+# endif
+# if defined(__linux__) || (defined(_POSIX_ADVISORY_INFO) && _POSIX_ADVISORY_INFO > 0)
+  if (!punch && !keep_size) {
+    int error = posix_fallocate(fd, offset, length);
+    return error == 0 ? APR_SUCCESS : APR_FROM_OS_ERROR(error);
+  }
+# endif
+# endif
+  return APR_ENOTIMPL;
+}
+
 /* push_file_error() {{{2 */
 
 static int push_file_error(lua_State *L, lua_apr_file *file, apr_status_t status)
 {
   char message[LUA_APR_MSGSIZE];
+  if (push_fast_error(L, status))
+    return 3;
   apr_strerror(status, message, count(message));
   lua_pushnil(L);
   if (file->path != NULL)
@@ -105,7 +250,7 @@ static int push_file_status(lua_State *L, lua_apr_file *file, apr_status_t statu
 
 /* parse_mode_str() {{{2 */
 
-static apr_int32_t parse_mode_str(const char *mode)
+apr_int32_t parse_mode_str(const char *mode)
 {
   apr_int32_t flags = 0;
   if (*mode == 'r') {
@@ -130,6 +275,162 @@ static apr_int32_t parse_mode_str(const char *mode)
   return flags;
 }
 
+/* lock_range() {{{2
+ *
+ * Lock (F_RDLCK or F_WRLCK) or unlock (F_UNLCK) a range of bytes in a file.
+ * On Linux this uses open file description locks which (unlike traditional
+ * POSIX record locks) belong to the file handle, so two handles in the same
+ * process exclude each other and closing an unrelated handle to the same file
+ * doesn't release the lock. A @length of zero means "up to the end of file".
+ * Returns APR_EAGAIN when @wait is false and the range is locked.
+ */
+
+#if !defined(WIN32) && !defined(OS2) && !defined(NETWARE)
+
+static apr_status_t lock_range(apr_file_t *handle, int type, apr_off_t offset, apr_off_t length, int wait)
+{
+  struct flock lock;
+  apr_os_file_t fd;
+  apr_status_t status;
+  int cmd, result;
+
+  status = apr_os_file_get(&fd, handle);
+  if (status != APR_SUCCESS)
+    return status;
+  memset(&lock, 0, sizeof lock);
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = offset;
+  lock.l_len = length;
+# ifdef F_OFD_SETLK
+  cmd = wait ? F_OFD_SETLKW : F_OFD_SETLK;
+# else
+  cmd = wait ? F_SETLKW : F_SETLK;
+# endif
+  do {
+    result = fcntl(fd, cmd, &lock);
+  } while (result < 0 && errno == EINTR);
+  if (result < 0)
+    return errno == EACCES ? APR_EAGAIN : APR_FROM_OS_ERROR(errno);
+
+  return APR_SUCCESS;
+}
+
+#else
+
+#define F_RDLCK 0
+#define F_WRLCK 1
+#define F_UNLCK 2
+
+static apr_status_t lock_range(apr_file_t *handle, int type, apr_off_t offset, apr_off_t length, int wait)
+{
+  OVERLAPPED overlapped;
+  apr_os_file_t fd;
+  apr_status_t status;
+  DWORD low, high, flags;
+  BOOL result;
+
+  status = apr_os_file_get(&fd, handle);
+  if (status != APR_SUCCESS)
+    return status;
+  memset(&overlapped, 0, sizeof overlapped);
+  overlapped.Offset = (DWORD) (offset & 0xFFFFFFFF);
+  overlapped.OffsetHigh = (DWORD) (offset >> 32);
+  low = length > 0 ? (DWORD) (length & 0xFFFFFFFF) : MAXDWORD;
+  high = length > 0 ? (DWORD) (length >> 32) : MAXDWORD;
+  if (type == F_UNLCK) {
+    result = UnlockFileEx(fd, 0, low, high, &overlapped);
+  } else {
+    flags = (type == F_WRLCK ? LOCKFILE_EXCLUSIVE_LOCK : 0) | (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY);
+    result = LockFileEx(fd, flags, 0, low, high, &overlapped);
+  }
+  if (!result)
+    return GetLastError() == ERROR_LOCK_VIOLATION ? APR_EAGAIN : apr_get_os_error();
+
+  return APR_SUCCESS;
+}
+
+#endif
+
+/* write_append() {{{2
+ *
+ * Implementation of file:write() for files opened in append mode: All
+ * arguments are written using a single apr_file_writev() call so that the
+ * kernel appends them as one record (O_APPEND), even when several processes
+ * write to the same file. In text mode, with more values than the system
+ * accepts in one vectored write and on Windows the values are joined into a
+ * single string first. The write buffer isn't used at all.
+ */
+
+static int write_append(lua_State *L, lua_apr_file *file)
+{
+  struct iovec stackvectors[LUA_APR_APPEND_VECTORS], *vectors = stackvectors;
+  apr_status_t status;
+  apr_size_t total = 0, written = 0;
+  luaL_Buffer buffer;
+  const char *data;
+  size_t length, i, n;
+
+  /* Don't reorder data that was buffered before. */
+  status = flush_buffer(L, &file->output, 1);
+  if (status != APR_SUCCESS)
+    return push_file_error(L, file, status);
+
+  n = lua_gettop(L) - 1;
+  if (file->output.text_mode || n > LUA_APR_APPEND_MAXVEC) {
+    /* Join the values into a single string, expanding LF to CR LF. */
+    luaL_buffinit(L, &buffer);
+    for (i = 1; i <= n; i++) {
+      data = check_bytes(L, i + 1, &length);
+      if (!file->output.text_mode) {
+        luaL_addlstring(&buffer, data, length);
+        continue;
+      }
+      for (; length > 0; data++, length--) {
+        if (*data == '\n')
+          luaL_addchar(&buffer, '\r');
+        luaL_addchar(&buffer, *data);
+      }
+    }
+    luaL_pushresult(&buffer);
+    data = lua_tolstring(L, -1, &length);
+    vectors[0].iov_base = (void*) data;
+    vectors[0].iov_len = length;
+    total = length;
+    n = 1;
+  } else {
+    if (n > LUA_APR_APPEND_VECTORS) {
+      vectors = lua_newuserdata(L, n * sizeof vectors[0]);
+    }
+    for (i = 0; i < n; i++) {
+      data = check_bytes(L, i + 2, &length);
+      vectors[i].iov_base = (void*) data;
+      vectors[i].iov_len = length;
+      total += length;
+    }
+  }
+
+  if (total > 0) {
+    status = apr_file_writev(file->handle, vectors, n, &written);
+    /* Only a signal or a full disk can cause a short write; write the rest in
+     * the usual way (the record is no longer atomic but it is complete). */
+    for (i = 0; status == APR_SUCCESS && written < total && i < n; i++) {
+      if (written >= vectors[i].iov_len) {
+        written -= vectors[i].iov_len;
+        total -= vectors[i].iov_len;
+      } else {
+        status = apr_file_write_full(file->handle,
+            (const char*) vectors[i].iov_base + written,
+            vectors[i].iov_len - written, NULL);
+        total -= vectors[i].iov_len;
+        written = 0;
+      }
+    }
+  }
+
+  return push_file_status(L, file, status);
+}
+
 #if APR_MAJOR_VERSION > 1 || (APR_MAJOR_VERSION == 1 && APR_MINOR_VERSION >= 4)
 
 /* apr.file_link(source, target) -> status {{{1
@@ -432,7 +733,9 @@ int lua_apr_stat(lua_State *L)
  *
  *  - `'r'`: read mode (the default)
  *  - `'w'`: write mode
- *  - `'a'`: append mode
+ *  - `'a'`: append mode (<em>in Lua/APR every call to `file:write()` results
+ *    in a single write to the end of the file, so records written by
+ *    concurrent processes don't interleave</em>)
  *  - `'r+'`: update mode, all previous data is preserved
  *  - `'w+'`: update mode, all previous data is erased
  *  - `'a+'`: append update mode, previous data is preserved, writing is only
@@ -440,8 +743,21 @@ int lua_apr_stat(lua_State *L)
  *
  * The @mode string may also have a `b` at the end, which is needed in some
  * systems to open the file in binary mode. This string is exactly what is used
- * in the standard C function [fopen()] [fopen]. The @permissions argument is
- * documented elsewhere.
+ * in the standard C function [fopen()] [fopen]. <em>Lua/APR also accepts a `t`
+ * at the end of the @mode string which explicitly enables text mode (CR LF to
+ * LF translation) on platforms where it isn't the default, see
+ * `file:text_mode()`.</em> The @permissions argument is documented elsewhere.
+ *
+ * <em>A `d` in the @mode string opens the file for direct I/O, bypassing the
+ * page cache of the operating system (using `O_DIRECT` on Linux and
+ * `F_NOCACHE` on Mac OS X). This is useful for large sequential scans and
+ * write once files that would otherwise push more useful data out of the page
+ * cache. Direct I/O requires block aligned transfers; Lua/APR takes care of
+ * this using an aligned buffer of 1 MB, so reads, writes and seeks work as
+ * usual. Not all file systems support direct I/O (e.g. tmpfs doesn't), in
+ * which case `apr.file_open()` fails. Direct I/O can't be combined with
+ * append mode, and files opened for direct I/O can't be read or written using
+ * an asynchronous I/O engine (see `apr.aio()`).</em>
  *
  * [fopen]: http://linux.die.net/man/3/fopen
  */
@@ -451,7 +767,7 @@ int lua_apr_file_open(lua_State *L)
   apr_status_t status;
   lua_apr_file *file;
   apr_int32_t flags;
-  const char *path;
+  const char *path, *mode;
   apr_fileperms_t perm;
 
 # if defined(WIN32) || defined(OS2) || defined(NETWARE)
@@ -461,7 +777,8 @@ int lua_apr_file_open(lua_State *L)
   /* On UNIX like systems apr_os_file_t is an integer. */
   if (lua_isnumber(L, 1)) {
     apr_os_file_t fd = (apr_os_file_t) lua_tonumber(L, 1);
-    flags = parse_mode_str(luaL_optstring(L, 2, "r"));
+    mode = luaL_optstring(L, 2, "r");
+    flags = parse_mode_str(mode);
     file = file_alloc(L, NULL, NULL);
     status = apr_os_file_put(&file->handle, &fd, flags, file->pool->ptr);
   }
@@ -469,14 +786,22 @@ int lua_apr_file_open(lua_State *L)
   else {
     path = luaL_checkstring(L, 1);
     perm = check_permissions(L, 3, 0);
-    flags = parse_mode_str(luaL_optstring(L, 2, "r"));
+    mode = luaL_optstring(L, 2, "r");
+    flags = parse_mode_str(mode);
     file = file_alloc(L, path, NULL);
     status = apr_file_open(&file->handle, path, flags, perm, file->pool->ptr);
   }
 
   if (status != APR_SUCCESS)
     return push_file_error(L, file, status);
-  init_file_buffers(L, file, !(flags & APR_FOPEN_BINARY));
+  file_init_mode(L, file, mode, flags);
+  if (strchr(mode, 'd') != NULL) {
+    status = direct_enable(file);
+    if (status != APR_SUCCESS) {
+      file_close_impl(L, file);
+      return push_file_error(L, file, status);
+    }
+  }
 
   return 1;
 }
@@ -515,6 +840,63 @@ static int file_lines(lua_State *L)
   return read_lines(L, &file->input);
 }
 
+/* file:text_mode([enabled]) -> previous {{{1
+ *
+ * Get or set the text mode of @file (this also works on pipes). In text mode
+ * CR LF pairs are translated to LF on input and LF is expanded to CR LF on
+ * output. On Windows, OS/2 and Netware text mode is the default for files that
+ * weren't opened in binary mode; on other platforms it's disabled by default
+ * but can be enabled using this method or by passing a `t` in the mode string
+ * of `apr.file_open()`. Returns true when text mode was previously enabled,
+ * false otherwise. Note that disabling text mode doesn't undo the translation
+ * of input that was already buffered; use `file:seek()` to discard it.
+ */
+
+static int file_text_mode(lua_State *L)
+{
+  lua_apr_file *file = file_check(L, 1, 1);
+  return buffer_text_mode(L, &file->input, &file->output);
+}
+
+/* file:filter(format [, level]) -> status {{{1
+ *
+ * Add a compression filter to @file (this also works on pipes). After this
+ * call the data read from @file is decompressed and the data written to @file
+ * is compressed, so for example `file:read('*l')` can be used directly on a
+ * `.gz` file. The following values are valid for @format:
+ *
+ *  - `'gzip'`: The [gzip] [gzip] file format
+ *  - `'deflate'`: The [zlib] [zlib] format (as used by HTTP's `deflate`
+ *    content coding)
+ *  - `'zstd'`: The [Zstandard] [zstd] frame format
+ *  - `'lz4'`: The [LZ4] [lz4] frame format
+ *
+ * When reading, `'gzip'` and `'deflate'` both accept gzip as well as zlib
+ * streams and concatenated streams are decompressed as one. The optional
+ * @level gives the compression level (0-9 for gzip and deflate, 1-22 for zstd
+ * and 0-12 for lz4). Data that was already buffered when the filter is added
+ * is handled correctly: Buffered output is written uncompressed and buffered
+ * input is decompressed. Filters can be stacked by calling this method more
+ * than once. The compressed stream is finished when @file is closed.
+ * Filtered files can't be repositioned using `file:seek()`.
+ *
+ * On success true is returned, otherwise a nil followed by an error message is
+ * returned. Which formats are supported depends on the libraries that were
+ * available when the Lua/APR binding was built; for other formats the error
+ * code is `'ENOTIMPL'`.
+ *
+ * [gzip]: http://en.wikipedia.org/wiki/Gzip
+ * [zlib]: http://en.wikipedia.org/wiki/Zlib
+ * [zstd]: http://en.wikipedia.org/wiki/Zstandard
+ * [lz4]: http://en.wikipedia.org/wiki/LZ4_(compression_algorithm)
+ */
+
+static int file_filter(lua_State *L)
+{
+  lua_apr_file *file = file_check(L, 1, 1);
+  return buffer_filter(L, &file->input, &file->output);
+}
+
 /* file:truncate([offset]) -> status {{{1
  *
  * Truncate the file's length to the specified @offset (defaults to 0). On
@@ -531,11 +913,93 @@ static int file_truncate(lua_State *L)
 
   file = file_check(L, 1, 1);
   offset = luaL_optlong(L, 2, 0);
-  status = apr_file_trunc(file->handle, offset);
+  /* Buffered output would otherwise be written after the truncation. */
+  status = flush_buffer(L, &file->output, 1);
+  if (status == APR_SUCCESS) {
+    if (file->direct != NULL)
+      status = direct_truncate(file->direct, offset);
+    else
+      status = apr_file_trunc(file->handle, offset);
+  }
 
   return push_status(L, status);
 }
 
+/* file:allocate(offset, length [, keep_size]) -> status {{{1
+ *
+ * Allocate disk space for the @length bytes starting at @offset, so that
+ * writing them later won't fail because the disk is full and the file system
+ * can place them in one contiguous extent instead of extending the file one
+ * buffer at a time. When the range extends beyond the end of the file the
+ * file size grows accordingly unless @keep_size is true. On success true is
+ * returned, otherwise a nil followed by an error message is returned.
+ *
+ * This uses `fallocate()` on Linux and `posix_fallocate()` on other UNIX
+ * systems (where @keep_size isn't supported). On other platforms the error
+ * code `'ENOTIMPL'` is returned.
+ */
+
+static int file_allocate(lua_State *L)
+{
+  apr_status_t status;
+  lua_apr_file *file;
+  apr_off_t offset, length;
+
+  file = file_check(L, 1, 1);
+  offset = luaL_checklong(L, 2);
+  length = luaL_checklong(L, 3);
+  luaL_argcheck(L, offset >= 0, 2, "offset can't be negative");
+  luaL_argcheck(L, length > 0, 3, "length must be positive");
+  status = flush_buffer(L, &file->output, 1);
+  if (status == APR_SUCCESS)
+    status = file_fallocate(file, 0, lua_toboolean(L, 4), offset, length);
+
+  return push_file_status(L, file, status);
+}
+
+/* file:punch_hole(offset, length) -> status {{{1
+ *
+ * Deallocate the disk space of the @length bytes starting at @offset without
+ * changing the file size. Reading the range afterwards returns zero bytes
+ * and `file:seek('hole')` can find it. On success true is returned,
+ * otherwise a nil followed by an error message is returned. This is only
+ * supported on Linux (and not by all file systems); on other platforms the
+ * error code `'ENOTIMPL'` is returned.
+ */
+
+static int file_punch_hole(lua_State *L)
+{
+  apr_status_t status;
+  lua_apr_file *file;
+  lua_apr_buffer *B;
+  apr_off_t offset, length, temp = 0;
+
+  file = file_check(L, 1, 1);
+  B = &file->input.buffer;
+  offset = luaL_checklong(L, 2);
+  length = luaL_checklong(L, 3);
+  luaL_argcheck(L, offset >= 0, 2, "offset can't be negative");
+  luaL_argcheck(L, length > 0, 3, "length must be positive");
+
+  /* Write buffered output and forget buffered input, because both may
+   * overlap with the hole. */
+  status = flush_buffer(L, &file->output, 1);
+  if (status == APR_SUCCESS && file->direct != NULL)
+    status = direct_invalidate(file->direct);
+  if (status == APR_SUCCESS && B->index < B->limit) {
+    status = file_seek_impl(file, APR_CUR, &temp);
+    temp -= B->limit - B->index;
+    if (status == APR_SUCCESS)
+      status = file_seek_impl(file, APR_SET, &temp);
+    B->index = B->limit = 0;
+    file->input.translated = 0;
+  }
+  if (status == APR_SUCCESS)
+    status = file_fallocate(file, 1, 1, offset, length);
+
+  return push_file_status(L, file, status);
+}
+
 /* file:read([format, ...]) -> mixed value, ... {{{1
  *
  * This function implements the interface of Lua's `file:read()` function.
@@ -547,40 +1011,205 @@ static int file_read(lua_State *L)
   return read_buffer(L, &file->input);
 }
 
+/* file:read_until(delimiter [, max]) -> string {{{1
+ *
+ * Read from @file up to the next occurrence of the string @delimiter, which
+ * can be longer than one byte (e.g. `'\0'` for the output of `find -print0`
+ * or `'\r\n\r\n'` for the end of HTTP headers). The data before the
+ * delimiter is returned and the delimiter is skipped. The search happens in
+ * the read buffer of @file, without creating intermediate strings. When the
+ * end of the file is reached before a delimiter is found the remaining data
+ * is returned, or nil when there's no more data. If the optional argument
+ * @max is given and the delimiter isn't found within the first @max bytes,
+ * nil followed by an error message and the error code `'EOVERFLOW'` is
+ * returned instead. No line ending translation is performed in text mode.
+ */
+
+static int file_read_until(lua_State *L)
+{
+  lua_apr_file *file = file_check(L, 1, 1);
+  return buffer_read_until(L, &file->input);
+}
+
+/* file:read_frame(format [, max]) -> string {{{1
+ *
+ * Read a length prefixed frame from @file and return its payload. The string
+ * @format gives the type of the length prefix: one of `'u8'`, `'u16be'`,
+ * `'u16le'`, `'u32be'`, `'u32le'`, `'u64be'` or `'u64le'` (the number of bits
+ * followed by big or little endian byte order). Returns nil when the end of
+ * the file is reached before the next frame, or nil followed by an error
+ * message and the error code `'EOF'` when the file ends in the middle of a
+ * frame. If the optional argument @max is given and the length prefix is
+ * larger than @max, nil followed by an error message and the error code
+ * `'EOVERFLOW'` is returned.
+ */
+
+static int file_read_frame(lua_State *L)
+{
+  lua_apr_file *file = file_check(L, 1, 1);
+  return buffer_read_frame(L, &file->input);
+}
+
+/* file:read_struct(struct [, max]) -> value, ... {{{1
+ *
+ * Read a binary structure from @file and return the decoded values. The
+ * argument @struct is a structure descriptor or a format string (see
+ * `apr.struct()`). The values are decoded directly from the read buffer of
+ * @file. Returns nil when the end of the file is reached before the next
+ * structure, or nil followed by an error message and the error code `'EOF'`
+ * when the file ends in the middle of a structure. When a length prefix makes
+ * the structure larger than the optional argument @max (in bytes) or larger
+ * than can possibly be buffered, nil followed by an error message and the
+ * error code `'EOVERFLOW'` is returned.
+ */
+
+static int file_read_struct(lua_State *L)
+{
+  lua_apr_file *file = file_check(L, 1, 1);
+  return buffer_read_struct(L, &file->input);
+}
+
+/* file:read_records([options]) -> rows {{{1
+ *
+ * Read a batch of records from a file containing delimiter separated values
+ * (e.g. [CSV] [csv] or TSV files) and return them as a table of rows, where
+ * each row is a table of fields. Returns nil when the end of the file has been
+ * reached. The records are parsed in C directly from the read buffer, so
+ * reading a file this way is a lot faster than splitting the lines returned
+ * by `file:lines()` in Lua. The optional argument @options is a table with
+ * any of the following fields:
+ *
+ *  - `sep`: the field separator (a string of one character, defaults to
+ *    `','`; use `'\t'` for TSV files)
+ *  - `quote`: the quote character (defaults to `'"'`) or false to disable
+ *    quoting. As in [RFC 4180] [rfc4180] quoted fields can contain separators,
+ *    line breaks and quote characters (written twice)
+ *  - `fields`: a list of column numbers to select (the selected fields are
+ *    stored in the rows in the order given, other fields are skipped)
+ *  - `numbers`: true to convert unquoted fields that contain a number to a
+ *    Lua number
+ *  - `batch`: the maximum number of rows to return (defaults to 1000)
+ *
+ * Lines can end in LF or CR LF. When the file ends inside a quoted field the
+ * complete rows before it are returned and the next call returns nil followed
+ * by an error message and the error code `'EOF'`. Here's an example:
+ *
+ *     > handle = apr.file_open('export.tsv')
+ *     > options = { sep = '\t', quote = false, fields = { 3, 1 }, numbers = true }
+ *     > for rows in function() return handle:read_records(options) end do
+ *     >>  for _, row in ipairs(rows) do print(row[1], row[2]) end
+ *     >> end
+ *
+ * [csv]: http://en.wikipedia.org/wiki/Comma-separated_values
+ * [rfc4180]: http://tools.ietf.org/html/rfc4180
+ */
+
+static int file_read_records(lua_State *L)
+{
+  lua_apr_file *file = file_check(L, 1, 1);
+  return buffer_read_records(L, &file->input);
+}
+
+/* file:read_into(buffer [, n]) -> count {{{1
+ *
+ * Read up to @n bytes (which defaults to 1024) from @file and append them to
+ * the byte @buffer (see `apr.buffer()`) without creating a Lua string. When
+ * @file doesn't have any buffered input the data is read directly into the
+ * memory of @buffer. At most 64 MB is read by one call. Returns the number of
+ * bytes read, nil when the end of the file has been reached or nil followed by
+ * an error message and code.
+ */
+
+static int file_read_into(lua_State *L)
+{
+  lua_apr_file *file = file_check(L, 1, 1);
+  return read_into_buffer(L, &file->input);
+}
+
 /* file:write(value [, ...]) -> status {{{1
  *
  * This function implements the interface of Lua's `file:write()` function.
+ * Besides strings and numbers the values can be blobs (see `apr.blob()`) and
+ * byte buffers (see `apr.buffer()`).
+ *
+ * When @file was opened in append mode (`'a'` or `'a+'`) the values aren't
+ * buffered: All values given to one call are written to the end of the file
+ * using a single vectored write, which means concurrent writers (e.g. several
+ * processes sharing a log file) don't need a lock to keep their records from
+ * interleaving. Files with a compression filter are always buffered. On
+ * Windows the values are joined and written using one `WriteFile()` call,
+ * but Windows doesn't guarantee that appends by different processes don't
+ * interleave, so use `file:lock()` there.
  */
 
 static int file_write(lua_State *L)
 {
   lua_apr_file *file = file_check(L, 1, 1);
+  if (file->append && file->output.filter == NULL)
+    return write_append(L, file);
   return write_buffer(L, &file->output);
 }
 
+/* file:write_struct(struct, value [, ...]) -> status {{{1
+ *
+ * Encode the given values as a binary structure and write it to @file. The
+ * argument @struct is a structure descriptor or a format string (see
+ * `apr.struct()`). The values are encoded directly into the write buffer of
+ * @file. In append mode the structure is written to the file right away.
+ */
+
+static int file_write_struct(lua_State *L)
+{
+  lua_apr_file *file = file_check(L, 1, 1);
+  int nresults = buffer_write_struct(L, &file->output);
+  apr_status_t status;
+  if (file->append && lua_toboolean(L, -nresults)) {
+    status = flush_buffer(L, &file->output, 1);
+    if (status != APR_SUCCESS)
+      return push_file_error(L, file, status);
+  }
+  return nresults;
+}
+
 /* file:seek([whence [, offset]]) -> offset {{{1
  *
  * This function implements the interface of Lua's `file:seek()` function.
+ *
+ * <em>In addition to `'set'`, `'cur'` and `'end'` the string @whence can be
+ * `'data'` or `'hole'`, which move the file offset to the start of the next
+ * data or hole in a sparse file at or after the absolute @offset (which
+ * defaults to the current offset). This makes it possible to copy sparse
+ * files without reading or writing the holes (see also `file:allocate()` and
+ * `file:punch_hole()`). Every file ends with an implicit hole, so seeking to
+ * a hole in a file without holes moves to the end of the file. When there's
+ * no data (or hole) after @offset a nil followed by an error message and the
+ * error code `'EOF'` is returned. On platforms without `SEEK_DATA` and
+ * `SEEK_HOLE` the whole file is reported as data.</em>
  */
 
 static int file_seek(lua_State *L)
 {
   /* TODO Seek the write buffer as well! */
 
-  const char *const modenames[] = { "set", "cur", "end", NULL };
-  const apr_seek_where_t modes[] = { APR_SET, APR_CUR, APR_END };
+  const char *const modenames[] = { "set", "cur", "end", "data", "hole", NULL };
+  const apr_seek_where_t modes[] = { APR_SET, APR_CUR, APR_END, APR_SET, APR_SET };
 
   apr_status_t status;
   lua_apr_file *file;
   lua_apr_buffer *B;
   apr_off_t offset;
-  int mode;
+  int option, mode;
 
   file = file_check(L, 1, 1);
   B = &file->input.buffer;
-  mode = modes[luaL_checkoption(L, 2, "cur", modenames)];
+  option = luaL_checkoption(L, 2, "cur", modenames);
+  mode = modes[option];
   offset = luaL_optlong(L, 3, 0);
 
+  /* Compressed streams can't be repositioned. */
+  if (file->input.filter != NULL || file->output.filter != NULL)
+    return push_file_error(L, file, APR_ENOTIMPL);
+
   /* XXX Flush write buffer before changing offset! */
   if (!(mode == APR_CUR && offset == 0)) {
     status = flush_buffer(L, &file->output, 1);
@@ -591,14 +1220,27 @@ static int file_seek(lua_State *L)
   /* Make relative offsets absolute, adjust for buffered input. */
   if (mode == APR_CUR && B->index < B->limit) {
     apr_off_t temp = 0;
-    status = apr_file_seek(file->handle, APR_CUR, &temp);
+    status = file_seek_impl(file, APR_CUR, &temp);
+    if (status != APR_SUCCESS)
+      return push_file_error(L, file, status);
+    mode = APR_SET, offset = temp - (B->limit - B->index) + offset;
+  }
+
+  /* Find the next data or hole (this also writes buffered output). */
+  if (option >= 3) {
+    apr_off_t temp = 0;
+    status = file_seek_impl(file, APR_CUR, &temp);
+    if (status == APR_SUCCESS) {
+      if (lua_isnoneornil(L, 3))
+        offset = temp - (B->limit - B->index);
+      status = seek_extent(file, option == 3, &offset);
+    }
     if (status != APR_SUCCESS)
       return push_file_error(L, file, status);
-    mode = APR_SET, offset = temp - (B->limit - B->index);
   }
 
   /* Perform the requested seek() operation. */
-  status = apr_file_seek(file->handle, mode, &offset);
+  status = file_seek_impl(file, mode, &offset);
   if (status != APR_SUCCESS)
     return push_file_error(L, file, status);
 
@@ -609,6 +1251,7 @@ static int file_seek(lua_State *L)
    */
   file->input.buffer.index = 0;
   file->input.buffer.limit = 0;
+  file->input.translated = 0;
 
   /* FIXME Bound to lose precision when APR_FOPEN_LARGEFILE is in effect? */
   lua_pushnumber(L, (lua_Number) offset);
@@ -689,6 +1332,96 @@ static int file_unlock(lua_State *L)
   return push_file_status(L, file, status);
 }
 
+/* file:lock_range(type, offset, length [, timeout]) -> status {{{1
+ *
+ * Establish an advisory lock on a range of bytes in @file. The @type is
+ * `'shared'` or `'exclusive'` (see `file:lock()`), the numbers @offset and
+ * @length give the range (a @length of zero locks up to the end of file, even
+ * as the file grows). On success true is returned, otherwise a nil followed by
+ * an error message is returned. The optional @timeout is one of:
+ *
+ *  - not given: block until the lock can be acquired
+ *  - `'non-blocking'` or zero: fail with the error code `'EAGAIN'` when the
+ *    range is locked by someone else
+ *  - a number of seconds: keep trying until the lock is acquired or the
+ *    timeout expires, in which case the error code is `'TIMEUP'`
+ *
+ * On Linux [open file description locks] [ofd_locks] are used: They're
+ * associated with the file object instead of the process, so two file objects
+ * for the same file exclude each other even within one process. On other UNIX
+ * systems traditional POSIX record locks are used and on Windows `LockFileEx()`
+ * is used.
+ *
+ * [ofd_locks]: http://man7.org/linux/man-pages/man2/fcntl.2.html
+ */
+
+static int file_lock_range(lua_State *L)
+{
+  const char *options[] = { "shared", "exclusive", NULL };
+  const int types[] = { F_RDLCK, F_WRLCK };
+  apr_interval_time_t timeout = -1, delay = 1000, remaining;
+  apr_time_t deadline;
+  apr_off_t offset, length;
+  apr_status_t status;
+  lua_apr_file *file;
+  int type;
+
+  file = file_check(L, 1, 1);
+  type = types[luaL_checkoption(L, 2, NULL, options)];
+  offset = (apr_off_t) luaL_checknumber(L, 3);
+  length = (apr_off_t) luaL_checknumber(L, 4);
+  luaL_argcheck(L, offset >= 0, 3, "offset must be >= 0");
+  luaL_argcheck(L, length >= 0, 4, "length must be >= 0");
+  if (lua_type(L, 5) == LUA_TSTRING) {
+    if (strcmp(lua_tostring(L, 5), "non-blocking") != 0)
+      luaL_argerror(L, 5, "invalid option");
+    timeout = 0;
+  } else if (!lua_isnoneornil(L, 5)) {
+    timeout = time_get(L, 5);
+    luaL_argcheck(L, timeout >= 0, 5, "timeout must be >= 0");
+  }
+
+  if (timeout < 0)
+    return push_file_status(L, file, lock_range(file->handle, type, offset, length, 1));
+
+  /* Poll with exponential back off until the deadline. */
+  deadline = apr_time_now() + timeout;
+  for (;;) {
+    status = lock_range(file->handle, type, offset, length, 0);
+    if (status != APR_EAGAIN || timeout == 0)
+      break;
+    remaining = deadline - apr_time_now();
+    if (remaining <= 0) {
+      status = APR_TIMEUP;
+      break;
+    }
+    apr_sleep(delay < remaining ? delay : remaining);
+    if (delay < 50000)
+      delay *= 2;
+  }
+
+  return push_file_status(L, file, status);
+}
+
+/* file:unlock_range(offset, length) -> status {{{1
+ *
+ * Remove a lock established using `file:lock_range()`. The @offset and
+ * @length should match those of the lock. On success true is returned,
+ * otherwise a nil followed by an error message is returned.
+ */
+
+static int file_unlock_range(lua_State *L)
+{
+  apr_off_t offset, length;
+  lua_apr_file *file;
+
+  file = file_check(L, 1, 1);
+  offset = (apr_off_t) luaL_checknumber(L, 2);
+  length = (apr_off_t) luaL_checknumber(L, 3);
+
+  return push_file_status(L, file, lock_range(file->handle, F_UNLCK, offset, length, 0));
+}
+
 /* pipe:timeout_get() -> timeout {{{1
  *
  * Get the timeout value or blocking state of @pipe. On success the timeout
@@ -863,15 +1596,27 @@ static int file_gc(lua_State *L)
 
 static luaL_Reg file_methods[] = {
   { "close", file_close },
+  { "filter", file_filter },
   { "flush", file_flush },
   { "lock", file_lock },
   { "lines", file_lines },
   { "truncate", file_truncate },
+  { "allocate", file_allocate },
+  { "punch_hole", file_punch_hole },
   { "read", file_read },
+  { "read_into", file_read_into },
+  { "read_until", file_read_until },
+  { "read_frame", file_read_frame },
+  { "read_struct", file_read_struct },
+  { "read_records", file_read_records },
   { "seek", file_seek },
   { "stat", file_stat },
+  { "text_mode", file_text_mode },
   { "unlock", file_unlock },
+  { "lock_range", file_lock_range },
+  { "unlock_range", file_unlock_range },
   { "write", file_write },
+  { "write_struct", file_write_struct },
   { "timeout_get", pipe_timeout_get },
   { "timeout_set", pipe_timeout_set },
 # if !defined(WIN32) && !defined(OS2) && !defined(NETWARE)
@@ -87,7 +87,12 @@ static apr_status_t socket_close_impl(lua_State *L, lua_apr_socket *socket)
 {
   apr_status_t status = APR_SUCCESS;
   if (socket->handle != NULL) {
-    status = apr_socket_close(socket->handle);
+    if (socket->output.filter != NULL || socket->input.filter != NULL)
+      status = close_filters(&socket->input, &socket->output);
+    if (status == APR_SUCCESS)
+      status = apr_socket_close(socket->handle);
+    else
+      apr_socket_close(socket->handle);
     socket->handle = NULL;
   }
   if (socket->pool != NULL) {
@@ -461,9 +466,61 @@ static int socket_read(lua_State *L)
   return read_buffer(L, &object->input);
 }
 
+/* socket:read_until(delimiter [, max]) -> string {{{1
+ *
+ * Read from @socket up to the next occurrence of the string @delimiter. See
+ * `file:read_until()` for details.
+ */
+
+static int socket_read_until(lua_State *L)
+{
+  lua_apr_socket *object = socket_check(L, 1, 1);
+  return buffer_read_until(L, &object->input);
+}
+
+/* socket:read_frame(format [, max]) -> string {{{1
+ *
+ * Read a length prefixed frame from @socket and return its payload. See
+ * `file:read_frame()` for details.
+ */
+
+static int socket_read_frame(lua_State *L)
+{
+  lua_apr_socket *object = socket_check(L, 1, 1);
+  return buffer_read_frame(L, &object->input);
+}
+
+/* socket:read_struct(struct [, max]) -> value, ... {{{1
+ *
+ * Read a binary structure from @socket and return the decoded values. See
+ * `file:read_struct()` for details.
+ */
+
+static int socket_read_struct(lua_State *L)
+{
+  lua_apr_socket *object = socket_check(L, 1, 1);
+  return buffer_read_struct(L, &object->input);
+}
+
+/* socket:read_into(buffer [, n]) -> count {{{1
+ *
+ * Read up to @n bytes (which defaults to 1024) from @socket and append them to
+ * the byte @buffer (see `apr.buffer()`) without creating a Lua string. Returns
+ * the number of bytes read, nil when the other side closed the connection or
+ * nil followed by an error message and code.
+ */
+
+static int socket_read_into(lua_State *L)
+{
+  lua_apr_socket *object = socket_check(L, 1, 1);
+  return read_into_buffer(L, &object->input);
+}
+
 /* socket:write(value [, ...]) -> status {{{1
  *
  * This function implements the interface of Lua's `file:write()` function.
+ * Besides strings and numbers the values can be blobs (see `apr.blob()`) and
+ * byte buffers (see `apr.buffer()`).
  */
 
 static int socket_write(lua_State *L)
@@ -471,6 +528,28 @@ static int socket_write(lua_State *L)
   lua_apr_socket *object = socket_check(L, 1, 1);
   int nresults = write_buffer(L, &object->output);
   apr_status_t status = flush_buffer(L, &object->output, 1);
+  /* Make sure compressed data reaches the other side. */
+  if (status == APR_SUCCESS && object->output.filter != NULL)
+    status = object->output.flush(object->output.object);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  return nresults;
+}
+
+/* socket:write_struct(struct, value [, ...]) -> status {{{1
+ *
+ * Encode the given values as a binary structure and send it to the other side
+ * of @socket. See `file:write_struct()` for details.
+ */
+
+static int socket_write_struct(lua_State *L)
+{
+  lua_apr_socket *object = socket_check(L, 1, 1);
+  int nresults = buffer_write_struct(L, &object->output);
+  apr_status_t status = flush_buffer(L, &object->output, 1);
+  /* Make sure compressed data reaches the other side. */
+  if (status == APR_SUCCESS && object->output.filter != NULL)
+    status = object->output.flush(object->output.object);
   if (status != APR_SUCCESS)
     return push_error_status(L, status);
   return nresults;
@@ -487,6 +566,34 @@ static int socket_lines(lua_State *L)
   return read_lines(L, &object->input);
 }
 
+/* socket:text_mode([enabled]) -> previous {{{1
+ *
+ * Get or set the text mode of @socket. Sockets are always created in binary
+ * mode; in text mode CR LF pairs are translated to LF on input and LF is
+ * expanded to CR LF on output, which can be convenient for line based network
+ * protocols. Returns true when text mode was previously enabled, false
+ * otherwise.
+ */
+
+static int socket_text_mode(lua_State *L)
+{
+  lua_apr_socket *object = socket_check(L, 1, 1);
+  return buffer_text_mode(L, &object->input, &object->output);
+}
+
+/* socket:filter(format [, level]) -> status {{{1
+ *
+ * Add a compression filter to @socket, this works the same as `file:filter()`.
+ * Every call to `socket:write()` flushes the compressor so that the other side
+ * can decompress the data right away.
+ */
+
+static int socket_filter(lua_State *L)
+{
+  lua_apr_socket *object = socket_check(L, 1, 1);
+  return buffer_filter(L, &object->input, &object->output);
+}
+
 /* socket:timeout_get() -> timeout {{{1
  *
  * Get the timeout value or blocking state of @socket. On success the timeout
@@ -758,8 +865,16 @@ luaL_reg socket_methods[] = {
   { "accept", socket_accept },
   { "connect", socket_connect },
   { "read", socket_read },
+  { "read_into", socket_read_into },
+  { "read_until", socket_read_until },
+  { "read_frame", socket_read_frame },
+  { "read_struct", socket_read_struct },
   { "write", socket_write },
+  { "write_struct", socket_write_struct },
   { "lines", socket_lines },
+  { "text_mode", socket_text_mode },
+  { "filter", socket_filter },
+  { "response", socket_response },
   { "timeout_get", socket_timeout_get },
   { "timeout_set", socket_timeout_set },
   { "opt_get", socket_opt_get },
@@ -22,11 +22,342 @@
  * [pipeline]: http://en.wikipedia.org/wiki/Pipeline_(Unix)
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE /* splice() and tee() */
+#endif
+
 #include "lua_apr.h"
 #include <apr_file_io.h>
+#include <apr_portable.h>
+
+#ifdef __linux__
+# include <fcntl.h>
+# include <unistd.h>
+# include <errno.h>
+# include <limits.h>
+# include <sys/stat.h>
+# define LUA_APR_HAVE_SPLICE 1
+#else
+# define LUA_APR_HAVE_SPLICE 0
+#endif
+
+/* Size of the chunks moved by apr.splice() (the default pipe capacity on
+ * Linux) and of the buffer used when splice() isn't available. */
+#define LUA_APR_SPLICE_CHUNK (64 * 1024)
+
+/* Flags accepted by apr.splice() and apr.tee(). */
+#define LUA_APR_SPLICE_MOVE 1
+#define LUA_APR_SPLICE_MORE 2
+#define LUA_APR_SPLICE_NONBLOCK 4
+
+/* The source or destination of apr.splice() and apr.tee(). */
+typedef struct {
+  lua_apr_readbuf *input;
+  lua_apr_writebuf *output;
+  int fd, is_pipe, direct;
+} lua_apr_splice_end;
 
 static int pipe_open(lua_State*, lua_apr_openpipe_f);
 
+/* Internal functions. {{{1 */
+
+/* check_splice_end() {{{2
+ *
+ * Get the buffers and (where supported) the file descriptor of the file, pipe
+ * or socket at the given stack index.
+ */
+
+static void check_splice_end(lua_State *L, int idx, lua_apr_splice_end *end)
+{
+  end->fd = -1;
+  end->is_pipe = 0;
+  end->direct = 0;
+  if (object_has_type(L, idx, &lua_apr_socket_type, 1)) {
+    lua_apr_socket *socket = check_object(L, idx, &lua_apr_socket_type);
+    if (socket->handle == NULL)
+      luaL_error(L, "attempt to use a closed socket");
+    end->input = &socket->input;
+    end->output = &socket->output;
+#   if LUA_APR_HAVE_SPLICE
+    {
+      apr_os_sock_t fd;
+      if (apr_os_sock_get(&fd, socket->handle) == APR_SUCCESS)
+        end->fd = fd;
+    }
+#   endif
+  } else {
+    lua_apr_file *file = file_check(L, idx, 1);
+    end->input = &file->input;
+    end->output = &file->output;
+    end->direct = file->direct != NULL;
+#   if LUA_APR_HAVE_SPLICE
+    {
+      apr_os_file_t fd;
+      struct stat info;
+      if (apr_os_file_get(&fd, file->handle) == APR_SUCCESS) {
+        end->fd = fd;
+        end->is_pipe = fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+      }
+    }
+#   endif
+  }
+  /* Filtered data has to pass through the filter callbacks and direct I/O
+   * files use positional reads and writes through their aligned window, so
+   * the file offset of their descriptor is meaningless. */
+  if (end->input->filter != NULL || end->output->filter != NULL || end->direct)
+    end->fd = -1;
+}
+
+/* check_splice_flags() {{{2 */
+
+static int check_splice_flags(lua_State *L, int idx)
+{
+  const char *flags = luaL_optstring(L, idx, "");
+  int result = 0;
+
+  if (strstr(flags, "move") != NULL)
+    result |= LUA_APR_SPLICE_MOVE;
+  if (strstr(flags, "more") != NULL)
+    result |= LUA_APR_SPLICE_MORE;
+  if (strstr(flags, "nonblock") != NULL)
+    result |= LUA_APR_SPLICE_NONBLOCK;
+
+  return result;
+}
+
+/* write_all() {{{2 */
+
+static apr_status_t write_all(lua_apr_writebuf *output, const char *data, apr_size_t length)
+{
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t size;
+
+  while (length > 0 && status == APR_SUCCESS) {
+    size = length;
+    status = output->write(output->object, data, &size);
+    data += size;
+    length -= size;
+  }
+
+  return status;
+}
+
+/* splice_account() {{{2 */
+
+static void splice_account(apr_off_t *remaining, apr_off_t *total, apr_size_t size)
+{
+  *total += size;
+  if (*remaining > 0)
+    *remaining -= size;
+}
+
+/* splice_limit() {{{2 */
+
+static apr_size_t splice_limit(apr_off_t remaining, apr_size_t size)
+{
+  return (remaining >= 0 && (apr_off_t) size > remaining) ? (apr_size_t) remaining : size;
+}
+
+/* splice_buffered() {{{2
+ *
+ * Pass on the data that was already read into the input buffer of @src so
+ * that data is never reordered. When @consume is false the data is left in the
+ * input buffer (used by apr.tee()).
+ */
+
+static apr_status_t splice_buffered(lua_apr_splice_end *src, lua_apr_splice_end *dst,
+    apr_off_t *remaining, apr_off_t *total, int consume)
+{
+  lua_apr_buffer *B = &src->input->buffer;
+  apr_status_t status;
+  apr_size_t avail;
+
+  avail = splice_limit(*remaining, B->limit > B->index ? B->limit - B->index : 0);
+  if (avail == 0)
+    return APR_SUCCESS;
+  status = write_all(dst->output, &B->data[B->index], avail);
+  if (status == APR_SUCCESS) {
+    if (consume)
+      B->index += avail;
+    splice_account(remaining, total, avail);
+  }
+
+  return status;
+}
+
+/* splice_copy() {{{2
+ *
+ * Copy data from @src to @dst through a single buffer, used on platforms
+ * without splice() and for descriptors that splice() doesn't support.
+ */
+
+static apr_status_t splice_copy(lua_apr_splice_end *src, lua_apr_splice_end *dst,
+    apr_off_t *remaining, apr_off_t *total)
+{
+  apr_status_t status = APR_SUCCESS, write_status;
+  apr_size_t size;
+  char *buffer;
+
+  buffer = malloc(LUA_APR_SPLICE_CHUNK);
+  if (buffer == NULL)
+    return APR_ENOMEM;
+
+  while (*remaining != 0 && status == APR_SUCCESS) {
+    size = splice_limit(*remaining, LUA_APR_SPLICE_CHUNK);
+    status = src->input->read(src->input->object, buffer, &size);
+    if (size > 0) {
+      write_status = write_all(dst->output, buffer, size);
+      if (write_status != APR_SUCCESS) {
+        status = write_status;
+        break;
+      }
+      splice_account(remaining, total, size);
+    }
+  }
+  free(buffer);
+
+  return APR_STATUS_IS_EOF(status) ? APR_SUCCESS : status;
+}
+
+#if LUA_APR_HAVE_SPLICE
+
+/* splice_unsupported() {{{2
+ *
+ * Check whether splice() failed in a way that the copy loop can handle.
+ */
+
+static int splice_unsupported(int error, int flags)
+{
+  return error == EINVAL || error == ENOSYS || error == EXDEV
+      || (error == EAGAIN && !(flags & SPLICE_F_NONBLOCK));
+}
+
+/* splice_drain() {{{2
+ *
+ * Write the data left in the intermediate pipe to @dst using the regular
+ * write function (which honors socket and pipe timeouts).
+ */
+
+static apr_status_t splice_drain(int fd, lua_apr_splice_end *dst, apr_size_t pending)
+{
+  apr_status_t status = APR_SUCCESS;
+  char buffer[LUA_APR_BUFSIZE * 4];
+  ssize_t size;
+
+  while (pending > 0 && status == APR_SUCCESS) {
+    size = read(fd, buffer, pending < sizeof buffer ? pending : sizeof buffer);
+    if (size < 0 && errno == EINTR)
+      continue;
+    else if (size <= 0)
+      return size < 0 ? apr_get_os_error() : APR_EOF;
+    status = write_all(dst->output, buffer, size);
+    pending -= size;
+  }
+
+  return status;
+}
+
+/* splice_linux() {{{2
+ *
+ * Move data from @src to @dst inside the kernel using splice(). One of the two
+ * descriptors needs to be a pipe, otherwise the data is moved through an
+ * intermediate pipe. Sets @fallback when the copy loop should take over.
+ */
+
+static apr_status_t splice_linux(lua_apr_splice_end *src, lua_apr_splice_end *dst,
+    apr_off_t *remaining, apr_off_t *total, int flags, int *fallback)
+{
+  apr_status_t status = APR_SUCCESS;
+  ssize_t size, moved;
+  int fds[2] = { -1, -1 };
+
+  *fallback = 0;
+
+  if (src->is_pipe || dst->is_pipe) {
+    while (*remaining != 0) {
+      size = splice(src->fd, NULL, dst->fd, NULL,
+          splice_limit(*remaining, LUA_APR_SPLICE_CHUNK), flags);
+      if (size > 0)
+        splice_account(remaining, total, size);
+      else if (size == 0)
+        break; /* end of file */
+      else if (errno == EINTR)
+        continue;
+      else if (splice_unsupported(errno, flags)) {
+        *fallback = 1;
+        break;
+      } else {
+        status = apr_get_os_error();
+        break;
+      }
+    }
+    return status;
+  }
+
+  /* Neither end is a pipe: Splice through an intermediate pipe. */
+  if (pipe2(fds, O_CLOEXEC) < 0) {
+    *fallback = 1;
+    return APR_SUCCESS;
+  }
+  while (*remaining != 0 && status == APR_SUCCESS) {
+    size = splice(src->fd, NULL, fds[1], NULL,
+        splice_limit(*remaining, LUA_APR_SPLICE_CHUNK), flags);
+    if (size == 0)
+      break; /* end of file */
+    else if (size < 0) {
+      if (errno == EINTR)
+        continue;
+      else if (splice_unsupported(errno, flags))
+        *fallback = 1;
+      else
+        status = apr_get_os_error();
+      break;
+    }
+    /* Move the data from the intermediate pipe to the destination. */
+    moved = 0;
+    while (moved < size) {
+      ssize_t n = splice(fds[0], NULL, dst->fd, NULL, size - moved, flags & ~SPLICE_F_NONBLOCK);
+      if (n > 0)
+        moved += n;
+      else if (n < 0 && errno == EINTR)
+        continue;
+      else if (n < 0 && splice_unsupported(errno, 0) ) {
+        /* Let the regular write function handle the rest. */
+        status = splice_drain(fds[0], dst, size - moved);
+        *fallback = 1;
+        break;
+      } else {
+        status = n < 0 ? apr_get_os_error() : APR_EOF;
+        break;
+      }
+    }
+    if (status == APR_SUCCESS)
+      splice_account(remaining, total, size);
+    if (*fallback)
+      break;
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  return status;
+}
+
+/* splice_os_flags() {{{2 */
+
+static int splice_os_flags(int flags)
+{
+  int result = 0;
+  if (flags & LUA_APR_SPLICE_MOVE)
+    result |= SPLICE_F_MOVE;
+  if (flags & LUA_APR_SPLICE_MORE)
+    result |= SPLICE_F_MORE;
+  if (flags & LUA_APR_SPLICE_NONBLOCK)
+    result |= SPLICE_F_NONBLOCK;
+  return result;
+}
+
+#endif
+
 /* apr.pipe_open_stdin() -> pipe {{{1
  *
  * Open standard input as a pipe. On success the pipe is returned, otherwise a
@@ -125,6 +456,127 @@ int lua_apr_pipe_create(lua_State *L)
   return 2;
 }
 
+/* apr.splice(source, target [, length [, flags]]) -> transferred {{{1
+ *
+ * Transfer data from the file, pipe or socket @source to the file, pipe or
+ * socket @target without passing it through Lua strings. If @length is given
+ * no more than @length bytes are transferred, otherwise data is transferred
+ * until the end of @source is reached. On success the number of transferred
+ * bytes is returned, otherwise a nil followed by an error message is returned.
+ * This makes it easy to forward the output of a child process to a log file
+ * or to relay data between two sockets:
+ *
+ *     > process = assert(apr.proc_create 'make')
+ *     > assert(process:cmdtype_set 'program/env/path')
+ *     > assert(process:io_set('none', 'parent', 'none'))
+ *     > assert(process:exec { 'all' })
+ *     > logfile = assert(apr.file_open('build.log', 'w'))
+ *     > = apr.splice(process:out_get(), logfile)
+ *     4923
+ *
+ * On Linux the data is moved inside the kernel using [splice()] [splice]. On
+ * other platforms (and for descriptors that don't support splicing) the data
+ * is copied through a single buffer in C. Data that was already buffered by
+ * `file:read()` or `socket:read()` is transferred first. The optional string
+ * @flags can contain any of the words `move`, `more` and `nonblock`, which
+ * map to the `SPLICE_F_*` flags on Linux and are ignored elsewhere. With
+ * `nonblock` the transfer stops when no more data is available without
+ * blocking.
+ *
+ * [splice]: http://man7.org/linux/man-pages/man2/splice.2.html
+ */
+
+int lua_apr_splice(lua_State *L)
+{
+  lua_apr_splice_end src, dst;
+  apr_off_t remaining, total = 0;
+  apr_status_t status;
+  int flags, fallback = 1;
+
+  check_splice_end(L, 1, &src);
+  check_splice_end(L, 2, &dst);
+  remaining = lua_isnoneornil(L, 3) ? -1 : (apr_off_t) luaL_checknumber(L, 3);
+  luaL_argcheck(L, lua_isnoneornil(L, 3) || remaining >= 0, 3, "length must be positive");
+  flags = check_splice_flags(L, 4);
+
+  /* Make sure data is written in the right order. */
+  status = flush_buffer(L, dst.output, 1);
+  if (status == APR_SUCCESS)
+    status = splice_buffered(&src, &dst, &remaining, &total, 1);
+
+# if LUA_APR_HAVE_SPLICE
+  if (status == APR_SUCCESS && remaining != 0 && src.fd >= 0 && dst.fd >= 0)
+    status = splice_linux(&src, &dst, &remaining, &total, splice_os_flags(flags), &fallback);
+# endif
+
+  if (status == APR_SUCCESS && remaining != 0 && fallback)
+    status = splice_copy(&src, &dst, &remaining, &total);
+
+  /* Write the aligned window of a direct I/O file to disk. */
+  if (status == APR_SUCCESS && dst.direct)
+    status = dst.output->flush(dst.output->object);
+
+  if (status != APR_SUCCESS && !(APR_STATUS_IS_EAGAIN(status) && total > 0))
+    return push_error_status(L, status);
+  lua_pushnumber(L, (lua_Number) total);
+  return 1;
+}
+
+/* apr.tee(source, target [, length [, flags]]) -> duplicated {{{1
+ *
+ * Duplicate up to @length bytes (by default everything available) from the
+ * pipe @source to the pipe @target without consuming the data in @source, so
+ * that it can still be read or spliced elsewhere. On success the number of
+ * duplicated bytes is returned, otherwise a nil followed by an error message
+ * is returned. The @flags are the same as for `apr.splice()`. This function
+ * uses [tee()] [tee] and is only available on Linux, on other platforms the
+ * error code `'ENOTIMPL'` is returned.
+ *
+ * [tee]: http://man7.org/linux/man-pages/man2/tee.2.html
+ */
+
+int lua_apr_tee(lua_State *L)
+{
+  lua_apr_splice_end src, dst;
+  apr_off_t remaining, total = 0;
+  apr_status_t status;
+  int flags;
+
+  check_splice_end(L, 1, &src);
+  check_splice_end(L, 2, &dst);
+  remaining = lua_isnoneornil(L, 3) ? -1 : (apr_off_t) luaL_checknumber(L, 3);
+  luaL_argcheck(L, lua_isnoneornil(L, 3) || remaining >= 0, 3, "length must be positive");
+  flags = check_splice_flags(L, 4);
+
+# if LUA_APR_HAVE_SPLICE
+  luaL_argcheck(L, src.is_pipe, 1, "pipe expected");
+  luaL_argcheck(L, dst.is_pipe, 2, "pipe expected");
+  status = flush_buffer(L, dst.output, 1);
+  if (status == APR_SUCCESS)
+    status = splice_buffered(&src, &dst, &remaining, &total, 0);
+  while (status == APR_SUCCESS && remaining != 0) {
+    ssize_t size = tee(src.fd, dst.fd, remaining > 0 && remaining < INT_MAX
+        ? (size_t) remaining : INT_MAX, splice_os_flags(flags));
+    if (size < 0 && errno == EINTR)
+      continue;
+    else if (size < 0)
+      status = apr_get_os_error();
+    else
+      total += size;
+    break;
+  }
+# else
+  (void) remaining;
+  (void) flags;
+  status = APR_ENOTIMPL;
+# endif
+
+  if (status != APR_SUCCESS && !(APR_STATUS_IS_EAGAIN(status) && total > 0))
+    return push_error_status(L, status);
+  lua_pushnumber(L, (lua_Number) total);
+  return 1;
+}
+
 /* }}}1 */
 
 int pipe_open(lua_State *L, lua_apr_openpipe_f open_std_pipe)
@@ -35,6 +35,8 @@
 #include "lua_apr.h"
 #include <apr_ldap.h>
 #include <apr_uri.h>
+#include <apr_portable.h>
+#include <apr_strings.h>
 
 #if APR_HAS_LDAP
 
@@ -101,11 +103,36 @@ static int ldap_ssl_inited = 0, ldap_rebind_inited = 0;
 
 /* Types and macros. {{{2 */
 
+/* Idle connections in an LDAP connection pool. */
+typedef struct lua_apr_ldap_pooled lua_apr_ldap_pooled;
+struct lua_apr_ldap_pooled {
+  lua_apr_ldap_pooled *next;
+  apr_pool_t *pool;
+  LDAP *ldap;
+  apr_time_t last_used;
+};
+
+/* LDAP connection pools (always allocated in unmanaged memory). */
+typedef struct {
+  lua_apr_refobj header;
+  apr_pool_t *pool;
+# if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;
+# endif
+  const char *hostname, *who, *passwd;
+  int portno, secure, size, count;
+  apr_interval_time_t idle_timeout, check_interval;
+  lua_apr_ldap_pooled *bound, *verify;
+} lua_apr_ldap_pool_object;
+
 /* LDAP objects. */
 typedef struct {
   lua_apr_refobj header;
   apr_pool_t *pool;
   LDAP* ldap;
+  apr_socket_t *socket; /* used to add the connection to pollsets */
+  lua_apr_ldap_pool_object *owner; /* pool the connection was acquired from */
+  lua_apr_ldap_pooled *node;
 } lua_apr_ldap_object;
 
 /* Union of option value types. */
@@ -118,6 +145,17 @@ typedef union {
 #define check_ldap_connection(L, idx) \
   (lua_apr_ldap_object*) check_object(L, idx, &lua_apr_ldap_type)
 
+#define check_ldap_pool(L, idx) \
+  (lua_apr_ldap_pool_object*) check_object(L, idx, &lua_apr_ldap_pool_type)
+
+#if APR_HAS_THREADS
+# define ldap_pool_lock(pool) apr_thread_mutex_lock((pool)->mutex)
+# define ldap_pool_unlock(pool) apr_thread_mutex_unlock((pool)->mutex)
+#else
+# define ldap_pool_lock(pool) ((void) 0)
+# define ldap_pool_unlock(pool) ((void) 0)
+#endif
+
 #define raise_ldap_error(L, status) \
   luaL_error(L, ldap_err2string(status))
 
@@ -285,6 +323,344 @@ static int push_ldap_error(lua_State *L, apr_status_t status, apr_ldap_err_t *er
   return 3;
 }
 
+/* ldap_url_target() {{{2
+ *
+ * Parse an LDAP URL into the host name, port number and security mode used to
+ * connect to the server. Initializes SSL support as needed.
+ */
+
+static apr_status_t ldap_url_target(apr_pool_t *memory_pool, const char *url,
+    int starttls, const char **hostname, int *portno, int *secure)
+{
+  apr_ldap_err_t *error = NULL;
+  apr_status_t status;
+  apr_uri_t info;
+
+  *secure = starttls ? APR_LDAP_STARTTLS : APR_LDAP_NONE;
+
+  /* Get and parse the LDAP URL. */
+  status = apr_uri_parse(memory_pool, url, &info);
+  if (status != APR_SUCCESS)
+    return status;
+
+  /* Get the host name and port number of the LDAP server. */
+  *hostname = (info.hostname != NULL) ? info.hostname : "127.0.0.1";
+  *portno = (info.port_str != NULL) ? info.port : APR_URI_LDAP_DEFAULT_PORT;
+
+  /* Use a secure connection? */
+  if (info.scheme != NULL && strcmp(info.scheme, "ldaps") == 0)
+    *secure = APR_LDAP_SSL;
+
+  /* Automatically call apr_ldap_ssl_init() as needed because this
+   * stuff is so low level it doesn't make sense to expose it to Lua. */
+  if (*secure != APR_LDAP_NONE && !ldap_ssl_inited) {
+    if (ldap_pool == NULL) {
+      /* Create a private memory pool for SSL and rebind support. */
+      status = apr_pool_create(&ldap_pool, NULL);
+      if (status != APR_SUCCESS)
+        return status;
+    }
+    status = apr_ldap_ssl_init(ldap_pool, NULL, 0, &error);
+    if (status != APR_SUCCESS)
+      return status;
+    ldap_ssl_inited = 1;
+  }
+
+  return APR_SUCCESS;
+}
+
+/* ldap_pooled_close() {{{2
+ *
+ * Close a list of pooled LDAP connections.
+ */
+
+static void ldap_pooled_close(lua_apr_ldap_pooled *node)
+{
+  lua_apr_ldap_pooled *next;
+
+  while (node != NULL) {
+    next = node->next;
+    ldap_unbind(node->ldap);
+    apr_pool_destroy(node->pool);
+    node = next;
+  }
+}
+
+/* ldap_pool_evict() {{{2
+ *
+ * Move the connections in @list that have been idle for too long to the list
+ * @expired. Must be called with the pool locked.
+ */
+
+static void ldap_pool_evict(lua_apr_ldap_pool_object *pool, lua_apr_ldap_pooled **list,
+    apr_time_t now, lua_apr_ldap_pooled **expired)
+{
+  lua_apr_ldap_pooled *node;
+
+  if (pool->idle_timeout <= 0)
+    return;
+  while ((node = *list) != NULL) {
+    if (now - node->last_used > pool->idle_timeout) {
+      *list = node->next;
+      node->next = *expired;
+      *expired = node;
+      pool->count--;
+    } else
+      list = &node->next;
+  }
+}
+
+/* ldap_pooled_alive() {{{2
+ *
+ * Check whether a pooled connection is still usable by reading the root DSE,
+ * which is about the cheapest operation supported by all directory servers.
+ */
+
+static int ldap_pooled_alive(lua_apr_ldap_pooled *node)
+{
+  char *attrs[] = { "1.1", NULL };
+  struct timeval timeout = { 5, 0 };
+  LDAPMessage *result = NULL;
+  int status;
+
+  status = ldap_search_ext_s(node->ldap, "", LDAP_SCOPE_BASE,
+      "(objectClass=*)", attrs, 0, NULL, NULL, &timeout, 1, &result);
+  if (result != NULL)
+    ldap_msgfree(result);
+  return status == LDAP_SUCCESS;
+}
+
+/* ldap_pool_connect() {{{2
+ *
+ * Open a new connection for an LDAP connection pool, binding it to the service
+ * account when @bind is true. Returns zero on success, otherwise pushes nil
+ * followed by an error message and returns the number of values pushed.
+ */
+
+static int ldap_pool_connect(lua_State *L, lua_apr_ldap_pool_object *pool, int bind, lua_apr_ldap_pooled **result)
+{
+  lua_apr_ldap_pooled *node;
+  apr_ldap_err_t *error = NULL;
+  apr_pool_t *memory_pool;
+  apr_status_t status;
+  int version = LDAP_VERSION3, rc;
+  LDAP *ldap;
+
+  status = apr_pool_create(&memory_pool, NULL);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  status = apr_ldap_init(memory_pool, &ldap, pool->hostname, pool->portno, pool->secure, &error);
+  if (status != APR_SUCCESS) {
+    rc = push_ldap_error(L, status, error);
+    apr_pool_destroy(memory_pool);
+    return rc;
+  }
+  rc = ldap_set_option(ldap, LDAP_OPT_PROTOCOL_VERSION, &version);
+  if (rc == LDAP_SUCCESS && bind)
+    rc = ldap_simple_bind_s(ldap, (char*)pool->who, (char*)pool->passwd);
+  if (rc != LDAP_SUCCESS) {
+    ldap_unbind(ldap);
+    apr_pool_destroy(memory_pool);
+    return push_ldap_status(L, rc);
+  }
+
+  node = apr_palloc(memory_pool, sizeof *node);
+  node->next = NULL;
+  node->pool = memory_pool;
+  node->ldap = ldap;
+  node->last_used = apr_time_now();
+  *result = node;
+  return 0;
+}
+
+/* ldap_pool_option() {{{2
+ *
+ * Get the numeric option @name from the options table at stack index 2 or
+ * @def when the option isn't set. Raises an error that names the option when
+ * its value isn't a number.
+ */
+
+static lua_Number ldap_pool_option(lua_State *L, const char *name, lua_Number def)
+{
+  lua_Number value = def;
+
+  lua_getfield(L, 2, name);
+  if (lua_isnumber(L, -1))
+    value = lua_tonumber(L, -1);
+  else if (!lua_isnil(L, -1))
+    luaL_argerror(L, 2, lua_pushfstring(L, "option '%s' must be a number", name));
+  lua_pop(L, 1);
+
+  return value;
+}
+
+/* ldap_pool_get() {{{2
+ *
+ * Get an idle connection from an LDAP connection pool or open a new one when
+ * the pool isn't full yet. When the pool is full but holds an idle connection
+ * of the other kind, that connection is closed to make room for a new one.
+ * Idle connections are health checked when they haven't been used for a
+ * while. When @bind is true the connection is bound to the service account,
+ * otherwise it's used for verification binds. Returns zero on success,
+ * otherwise pushes nil followed by an error message and returns the number of
+ * values pushed.
+ */
+
+static int ldap_pool_get(lua_State *L, lua_apr_ldap_pool_object *pool, int bind, lua_apr_ldap_pooled **result)
+{
+  lua_apr_ldap_pooled **list, **other, *node, *expired;
+  apr_time_t now;
+  int reserved, n;
+
+  list = bind ? &pool->bound : &pool->verify;
+  other = bind ? &pool->verify : &pool->bound;
+  for (;;) {
+    now = apr_time_now();
+    node = expired = NULL;
+    reserved = 0;
+    ldap_pool_lock(pool);
+    ldap_pool_evict(pool, &pool->bound, now, &expired);
+    ldap_pool_evict(pool, &pool->verify, now, &expired);
+    if (*list != NULL) {
+      node = *list;
+      *list = node->next;
+    } else if (pool->count < pool->size) {
+      pool->count++;
+      reserved = 1;
+    } else if (*other != NULL) {
+      /* Close an idle connection of the other kind and reuse its slot. */
+      node = *other;
+      *other = node->next;
+      node->next = expired;
+      expired = node;
+      node = NULL;
+      reserved = 1;
+    }
+    ldap_pool_unlock(pool);
+    ldap_pooled_close(expired);
+
+    if (node != NULL) {
+      if (now - node->last_used < pool->check_interval || ldap_pooled_alive(node)) {
+        node->next = NULL;
+        *result = node;
+        return 0;
+      }
+      /* Discard the dead connection and try again. */
+      node->next = NULL;
+      ldap_pooled_close(node);
+      ldap_pool_lock(pool);
+      pool->count--;
+      ldap_pool_unlock(pool);
+    } else if (!reserved) {
+      return push_error_message(L, "LDAP connection pool exhausted");
+    } else {
+      n = ldap_pool_connect(L, pool, bind, result);
+      if (n > 0) {
+        ldap_pool_lock(pool);
+        pool->count--;
+        ldap_pool_unlock(pool);
+      }
+      return n;
+    }
+  }
+}
+
+/* ldap_pool_put() {{{2
+ *
+ * Return a connection to an LDAP connection pool. When @node is NULL the
+ * connection was closed and only the number of connections is updated.
+ */
+
+static void ldap_pool_put(lua_apr_ldap_pool_object *pool, lua_apr_ldap_pooled *node, int bind)
+{
+  ldap_pool_lock(pool);
+  if (node == NULL) {
+    pool->count--;
+  } else {
+    lua_apr_ldap_pooled **list = bind ? &pool->bound : &pool->verify;
+    node->last_used = apr_time_now();
+    node->next = *list;
+    *list = node;
+  }
+  ldap_pool_unlock(pool);
+}
+
+/* ldap_pool_close_real() {{{2
+ *
+ * Release a reference to an LDAP connection pool, destroying the pool when
+ * the last reference is released.
+ */
+
+static void ldap_pool_close_real(lua_apr_ldap_pool_object *pool)
+{
+  if (object_collectable((lua_apr_refobj*)pool)) {
+    if (pool->pool != NULL) {
+      ldap_pooled_close(pool->bound);
+      ldap_pooled_close(pool->verify);
+      pool->bound = pool->verify = NULL;
+      apr_pool_destroy(pool->pool);
+      pool->pool = NULL;
+    }
+  }
+  release_object((lua_apr_refobj*)pool);
+}
+
+/* ldap_conn_release() {{{2
+ *
+ * Return a connection acquired from an LDAP connection pool to the pool.
+ */
+
+static void ldap_conn_release(lua_apr_ldap_object *object)
+{
+  lua_apr_ldap_pool_object *owner = object->owner;
+
+  if (owner != NULL) {
+    if (object->ldap == NULL) {
+      /* The connection was unbound; forget about it. */
+      apr_pool_destroy(object->node->pool);
+      ldap_pool_put(owner, NULL, 1);
+    } else
+      ldap_pool_put(owner, object->node, 1);
+    object->owner = NULL;
+    object->node = NULL;
+    object->ldap = NULL;
+    object->pool = NULL;
+    object->socket = NULL;
+    ldap_pool_close_real(owner);
+  }
+}
+
+/* ldap_socket_get() {{{2
+ *
+ * Get an APR socket wrapping the descriptor of the LDAP connection at the
+ * given stack index so that the connection can be added to a pollset. The
+ * socket is allocated from the memory pool of the connection which is stored
+ * in @pool.
+ */
+
+apr_socket_t *ldap_socket_get(lua_State *L, int idx, apr_pool_t **pool)
+{
+  lua_apr_ldap_object *object;
+  apr_os_sock_t fd;
+  apr_status_t status;
+
+  object = check_ldap_connection(L, idx);
+  luaL_argcheck(L, object->ldap != NULL, idx, "LDAP connection is closed");
+# ifdef LDAP_OPT_DESC
+  if (ldap_get_option(object->ldap, LDAP_OPT_DESC, &fd) != LDAP_SUCCESS || fd < 0)
+    luaL_error(L, "LDAP connection not established yet");
+  status = apr_os_sock_put(&object->socket, &fd, object->pool);
+  if (status != APR_SUCCESS)
+    raise_error_status(L, status);
+# else
+  (void) fd;
+  (void) status;
+  raise_error_status(L, APR_ENOTIMPL);
+# endif
+  *pool = object->pool;
+  return object->socket;
+}
+
 /* Search iterator. {{{2 */
 
 static void set_attributes(lua_State *L, LDAP *ld, LDAPMessage *entry, int tab)
@@ -324,58 +700,180 @@ static void push_distinguished_name(lua_State *L, LDAP *ld, LDAPMessage *entry)
   ldap_memfree(dn);
 }
 
+/* Search state, allocated as a userdata that is kept alive by the search
+ * iterator. The strings referenced by the state are stored in the environment
+ * table of the userdata so that they don't get garbage collected. */
+typedef struct {
+  int msgid, done, batch, async, pagesize;
+  int scope, attrsonly, sizelimit;
+  struct timeval timeval, *timeout;
+  ldap_pchar_t base, filter;
+  char *attrs[1];
+} lua_apr_ldap_search_state;
+
+/* Support for the Simple Paged Results control (RFC 2696). The WinLDAP API
+ * implements this control using different functions, which are not (yet)
+ * supported here. */
+#if defined(LDAP_CONTROL_PAGEDRESULTS) && !defined(WINLDAPAPI)
+# define LUA_APR_HAVE_LDAP_PAGING 1
+#else
+# define LUA_APR_HAVE_LDAP_PAGING 0
+#endif
+
+static int search_start(LDAP *ld, lua_apr_ldap_search_state *search, struct berval *cookie)
+{
+  LDAPControl *controls[2] = { NULL, NULL };
+  int status;
+
+# if LUA_APR_HAVE_LDAP_PAGING
+  if (search->pagesize > 0) {
+    status = ldap_create_page_control(ld, search->pagesize, cookie, 0, &controls[0]);
+    if (status != LDAP_SUCCESS)
+      return status;
+  }
+# endif
+
+  status = ldap_search_ext(ld, search->base, search->scope, search->filter,
+      search->attrs, search->attrsonly, controls[0] != NULL ? controls : NULL,
+      NULL, search->timeout, search->sizelimit, &search->msgid);
+
+# if LUA_APR_HAVE_LDAP_PAGING
+  if (controls[0] != NULL)
+    ldap_control_free(controls[0]);
+# endif
+
+  return status;
+}
+
+/* Handle the result message at the end of a page of search results: If the
+ * server indicates more results are available the search is restarted for the
+ * next page, otherwise the search is marked as done. */
+
+static int search_next_page(LDAP *ld, lua_apr_ldap_search_state *search, LDAPMessage *message)
+{
+  int status = LDAP_SUCCESS;
+# if LUA_APR_HAVE_LDAP_PAGING
+  LDAPControl **controls = NULL, *control;
+  struct berval cookie = { 0, NULL };
+  ber_int_t estimate;
+  int error;
+
+  if (search->pagesize > 0) {
+    status = ldap_parse_result(ld, message, &error, NULL, NULL, NULL, &controls, 0);
+    if (status == LDAP_SUCCESS)
+      status = error;
+    if (status == LDAP_SUCCESS && controls != NULL) {
+      control = ldap_control_find(LDAP_CONTROL_PAGEDRESULTS, controls, NULL);
+      if (control != NULL)
+        status = ldap_parse_pageresponse_control(ld, control, &estimate, &cookie);
+    }
+    if (controls != NULL)
+      ldap_controls_free(controls);
+    if (status == LDAP_SUCCESS && cookie.bv_len > 0) {
+      status = search_start(ld, search, &cookie);
+      ber_memfree(cookie.bv_val);
+      return status;
+    }
+    if (cookie.bv_val != NULL)
+      ber_memfree(cookie.bv_val);
+  }
+# endif
+
+  search->done = 1;
+  return status;
+}
+
 static int search_iterator(lua_State *L)
 {
+  static struct timeval poll_only = { 0, 0 };
   LDAPMessage *result, *message, *entry;
   lua_apr_ldap_object *object;
-  struct timeval *timeout;
-  int status, msgid;
+  lua_apr_ldap_search_state *search;
+  int status, count = 0;
 
   object = lua_touserdata(L, lua_upvalueindex(1));
-  msgid = lua_tointeger(L, lua_upvalueindex(2));
-  timeout = lua_touserdata(L, lua_upvalueindex(3));
-  status = ldap_result(object->ldap, msgid, LDAP_MSG_ONE, timeout, &result);
-
-  if (status == 0)
-    raise_error_status(L, APR_TIMEUP);
-  else if (status == -1)
-    /* TODO Can we get a more specific error (message) here? ld_errno? */
-    raise_error_message(L, "Unspecified error");
-  else if (status == LDAP_RES_SEARCH_RESULT) {
-    /* end of search results */
+  search = lua_touserdata(L, lua_upvalueindex(2));
+  luaL_argcheck(L, object->ldap != NULL, 1, "LDAP connection is closed");
+  if (search->done)
     return 0;
-  } else {
-    message = ldap_first_message(object->ldap, result);
-    switch (ldap_msgtype(message)) {
-      case LDAP_RES_SEARCH_ENTRY:
-        entry = ldap_first_entry(object->ldap, message);
-        push_distinguished_name(L, object->ldap, entry);
-        lua_newtable(L);
-        set_attributes(L, object->ldap, entry, lua_gettop(L));
-        ldap_msgfree(result);
+
+  /* In batch mode results are collected in two tables (at index 1 and 2). */
+  if (search->batch) {
+    lua_settop(L, 0);
+    lua_newtable(L);
+    lua_newtable(L);
+  }
+
+  for (;;) {
+    status = ldap_result(object->ldap, search->msgid,
+        search->batch ? LDAP_MSG_RECEIVED : LDAP_MSG_ONE,
+        search->async ? &poll_only : search->timeout, &result);
+    if (status == 0) {
+      if (!search->async)
+        raise_error_status(L, APR_TIMEUP);
+      else if (count > 0)
         return 2;
-      /* No reference to LDAP_RES_SEARCH_REFERENCE on MSDN. Maybe is has a replacement? */
-#     ifdef LDAP_RES_SEARCH_REFERENCE
-      case LDAP_RES_SEARCH_REFERENCE: {
-        LDAPMessage *reference = ldap_first_reference(object->ldap, message);
-        push_distinguished_name(L, object->ldap, reference); /* is this supposed to work? */
-        ldap_msgfree(result);
-        return 1;
+      /* Nothing received yet: tell the caller to try again later. */
+      lua_pushboolean(L, 0);
+      return 1;
+    } else if (status == -1)
+      /* TODO Can we get a more specific error (message) here? ld_errno? */
+      raise_error_message(L, "Unspecified error");
+
+    message = ldap_first_message(object->ldap, result);
+    while (message != NULL) {
+      switch (ldap_msgtype(message)) {
+        case LDAP_RES_SEARCH_ENTRY:
+          entry = ldap_first_entry(object->ldap, message);
+          push_distinguished_name(L, object->ldap, entry);
+          lua_newtable(L);
+          set_attributes(L, object->ldap, entry, lua_gettop(L));
+          if (!search->batch) {
+            ldap_msgfree(result);
+            return 2;
+          }
+          count++;
+          lua_rawseti(L, 2, count);
+          lua_rawseti(L, 1, count);
+          break;
+        /* No reference to LDAP_RES_SEARCH_REFERENCE on MSDN. Maybe is has a replacement? */
+#       ifdef LDAP_RES_SEARCH_REFERENCE
+        case LDAP_RES_SEARCH_REFERENCE: {
+          LDAPMessage *reference = ldap_first_reference(object->ldap, message);
+          push_distinguished_name(L, object->ldap, reference); /* is this supposed to work? */
+          if (!search->batch) {
+            ldap_msgfree(result);
+            return 1;
+          }
+          count++;
+          lua_rawseti(L, 1, count);
+          lua_pushboolean(L, 0);
+          lua_rawseti(L, 2, count);
+          break;
+        }
+#       endif
+        case LDAP_RES_SEARCH_RESULT:
+          /* end of search results (or of the current page) */
+          status = search_next_page(object->ldap, search, message);
+          if (status != LDAP_SUCCESS) {
+            ldap_msgfree(result);
+            search->done = 1;
+            raise_ldap_error(L, status);
+          }
+          break;
+        default:
+          ldap_msgfree(result);
+          raise_error_message(L, "unhandled message type in search results");
       }
-#     endif
-      case LDAP_RES_SEARCH_RESULT:
-        /* end of search results */
-        ldap_msgfree(result);
-        return 0;
-      default:
-        ldap_msgfree(result);
-        raise_error_message(L, "unhandled message type in search results");
+      message = ldap_next_message(object->ldap, message);
     }
-  }
+    ldap_msgfree(result);
 
-  /* shouldn't be reached. */
-  ldap_msgfree(result);
-  return 0;
+    if (search->done)
+      return count > 0 ? 2 : 0;
+    else if (count > 0)
+      return 2;
+  }
 }
 
 /* Support for modifications. {{{2 */
@@ -669,52 +1167,24 @@ int lua_apr_ldap(lua_State *L)
 {
   lua_apr_ldap_object *object;
   apr_ldap_err_t *error = NULL;
-  apr_pool_t *memory_pool;
   apr_status_t status;
-  int portno, secure = APR_LDAP_NONE;
+  int portno, secure;
   const char *url, *hostname;
-  apr_uri_t info;
 
   lua_settop(L, 2);
-  memory_pool = to_pool(L);
   url = luaL_optstring(L, 1, "ldap://127.0.0.1");
-  if (lua_toboolean(L, 2))
-    secure = APR_LDAP_STARTTLS;
 
-  /* Get and parse the LDAP URL. */
-  status = apr_uri_parse(memory_pool, url, &info);
+  /* Get the host name, port number and security of the LDAP server. */
+  status = ldap_url_target(to_pool(L), url, lua_toboolean(L, 2), &hostname, &portno, &secure);
   if (status != APR_SUCCESS)
     return push_error_status(L, status);
 
-  /* Get the host name and port number of the LDAP server. */
-  hostname = (info.hostname != NULL) ? info.hostname : "127.0.0.1";
-  portno = (info.port_str != NULL) ? info.port : APR_URI_LDAP_DEFAULT_PORT;
-
-  /* Use a secure connection? */
-  if (info.scheme != NULL && strcmp(info.scheme, "ldaps") == 0)
-    secure = APR_LDAP_SSL;
-
   /* Create the userdata object and memory pool. */
   object = new_object(L, &lua_apr_ldap_type);
   status = apr_pool_create(&object->pool, NULL);
   if (status != APR_SUCCESS)
     return push_error_status(L, status);
 
-  /* Automatically call apr_ldap_ssl_init() as needed because this
-   * stuff is so low level it doesn't make sense to expose it to Lua. */
-  if (secure != APR_LDAP_NONE && !ldap_ssl_inited) {
-    if (ldap_pool == NULL) {
-      /* Create a private memory pool for SSL and rebind support. */
-      status = apr_pool_create(&ldap_pool, NULL);
-      if (status != APR_SUCCESS)
-        return push_error_status(L, status);
-    }
-    status = apr_ldap_ssl_init(ldap_pool, NULL, 0, &error);
-    if (status != APR_SUCCESS)
-      return push_error_status(L, status);
-    ldap_ssl_inited = 1;
-  }
-
   /* Open the LDAP connection. */
   status = apr_ldap_init(object->pool, &object->ldap, hostname, portno, secure, &error);
   if (status != APR_SUCCESS)
@@ -723,6 +1193,98 @@ int lua_apr_ldap(lua_State *L)
   return 1;
 }
 
+/* apr.ldap_pool(url [, options]) -> ldap_pool {{{1
+ *
+ * Create a pool of LDAP connections to the server at @url (see `apr.ldap()`).
+ * Creating connections and binding is expensive, so a pool keeps connections
+ * open and reuses them. The pool can be shared between threads using
+ * `apr.ref()` and `apr.deref()`. The optional table @options supports the
+ * following fields:
+ *
+ *  - **who** and **passwd**: the service account used to bind the connections
+ *    returned by `ldap_pool:acquire()` (defaults to an anonymous bind)
+ *  - **size**: the maximum number of open connections (defaults to 10). Bound
+ *    and verification connections share this limit: when the pool is full an
+ *    idle connection of the other kind is closed to make room
+ *  - **idle_timeout**: idle connections are closed after this number of
+ *    seconds (defaults to 60, zero disables idle eviction)
+ *  - **check_interval**: connections that have been idle for more than this
+ *    number of seconds are checked by reading the root DSE before they are
+ *    reused (defaults to 5)
+ *  - **starttls**: if true connections use STARTTLS
+ *
+ * On success the pool is returned, otherwise a nil followed by an error message
+ * is returned. Here's an example:
+ *
+ *     local pool = assert(apr.ldap_pool('ldap://localhost', {
+ *       who = 'cn=service,dc=example,dc=com', passwd = '...' }))
+ *     -- Search using the service account.
+ *     local ldap_conn = assert(pool:acquire())
+ *     for dn, attrs in ldap_conn:search { base = 'dc=example,dc=com' } do ... end
+ *     pool:release(ldap_conn)
+ *     -- Check the credentials of a user.
+ *     if pool:verify('cn=john,dc=example,dc=com', password) then ... end
+ */
+
+int lua_apr_ldap_pool(lua_State *L)
+{
+  lua_apr_ldap_pool_object *pool;
+  lua_Number idle_timeout, check_interval;
+  apr_status_t status;
+  const char *url;
+  int size;
+
+  lua_settop(L, 2);
+  url = luaL_checkstring(L, 1);
+  if (!lua_isnil(L, 2))
+    luaL_checktype(L, 2, LUA_TTABLE);
+  else {
+    lua_newtable(L);
+    lua_replace(L, 2);
+  }
+
+  /* Check the numeric options before anything is allocated. */
+  size = (int) ldap_pool_option(L, "size", 10);
+  idle_timeout = ldap_pool_option(L, "idle_timeout", 60);
+  check_interval = ldap_pool_option(L, "check_interval", 5);
+  luaL_argcheck(L, size > 0, 2, "pool size must be positive");
+  luaL_argcheck(L, idle_timeout >= 0 && check_interval >= 0, 2,
+      "idle_timeout and check_interval can't be negative");
+
+  /* Create the object in unmanaged memory so that pooled connections can
+   * reference it from any thread. */
+  pool = new_object(L, &lua_apr_ldap_pool_type);
+  pool = prepare_reference(&lua_apr_ldap_pool_type, (lua_apr_refobj*)pool);
+  if (pool == NULL)
+    raise_error_memory(L);
+  status = apr_pool_create(&pool->pool, NULL);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+# if APR_HAS_THREADS
+  status = apr_thread_mutex_create(&pool->mutex, APR_THREAD_MUTEX_DEFAULT, pool->pool);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+# endif
+
+  /* Get the options. */
+  lua_getfield(L, 2, "starttls");
+  status = ldap_url_target(pool->pool, url, lua_toboolean(L, -1),
+      &pool->hostname, &pool->portno, &pool->secure);
+  lua_pop(L, 1);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  lua_getfield(L, 2, "who");
+  pool->who = lua_isstring(L, -1) ? apr_pstrdup(pool->pool, lua_tostring(L, -1)) : NULL;
+  lua_getfield(L, 2, "passwd");
+  pool->passwd = lua_isstring(L, -1) ? apr_pstrdup(pool->pool, lua_tostring(L, -1)) : NULL;
+  lua_pop(L, 2);
+  pool->size = size;
+  pool->idle_timeout = (apr_interval_time_t) (idle_timeout * APR_USEC_PER_SEC);
+  pool->check_interval = (apr_interval_time_t) (check_interval * APR_USEC_PER_SEC);
+
+  return 1;
+}
+
 /* apr.ldap_info() -> string {{{1
  *
  * This function returns a string describing the LDAP [SDK] [sdk] (library)
@@ -945,8 +1507,9 @@ static int lua_apr_ldap_bind(lua_State *L)
 
 /* ldap_conn:unbind() -> status {{{1
  *
- * Unbind from the directory. On success true is returned, otherwise a nil
- * followed by an error message is returned.
+ * Unbind from the directory and release the memory of the connection (a
+ * connection acquired from a pool is removed from the pool). On success true
+ * is returned, otherwise a nil followed by an error message is returned.
  */
 
 static int lua_apr_ldap_unbind(lua_State *L)
@@ -955,7 +1518,16 @@ static int lua_apr_ldap_unbind(lua_State *L)
   int status;
 
   object = check_ldap_connection(L, 1);
+  luaL_argcheck(L, object->ldap != NULL, 1, "LDAP connection is closed");
   status = ldap_unbind(object->ldap);
+  object->ldap = NULL;
+  if (object->owner != NULL) {
+    ldap_conn_release(object);
+  } else if (object->pool != NULL) {
+    apr_pool_destroy(object->pool);
+    object->pool = NULL;
+    object->socket = NULL;
+  }
 
   return push_ldap_status(L, status);
 }
@@ -1182,96 +1754,146 @@ static int lua_apr_ldap_rebind_remove(lua_State*L)
  *  - **timeout**: The timeout in seconds (default is no timeout). The
  *    precision is microseconds
  *
+ *  - **pagesize**: Use the [Simple Paged Results] [rfc2696] control to
+ *    retrieve the results in pages of the given number of entries. The search
+ *    iterator transparently requests the next page when the current page is
+ *    exhausted. This is useful for large directories because servers often
+ *    limit the number of entries returned by a single search. Returns an error
+ *    when the LDAP SDK doesn't support this control
+ *
+ *  - **batch**: If this is true the search iterator returns all entries that
+ *    have been received so far (instead of one entry at a time) as two tables:
+ *    A list of distinguished names and a list of attribute tables (the
+ *    attribute table of a search reference is false)
+ *
+ *  - **async**: If this is true the search iterator never blocks: When no
+ *    results have been received yet false is returned. You can add the LDAP
+ *    connection to a [pollset](#pollset) to find out when results are
+ *    available, this makes it possible to drive a search from an event loop:
+ *
+ *         local pollset = apr.pollset(10)
+ *         local next_entry = ldap_conn:search { base = ..., async = true }
+ *         assert(pollset:add(ldap_conn, 'input'))
+ *         while true do
+ *           local dn, attrs = next_entry()
+ *           if dn == nil then break end
+ *           if dn == false then
+ *             pollset:poll(-1)
+ *           else
+ *             -- Do something with the entry.
+ *           end
+ *         end
+ *
+ *    The LDAP connection can only be added to a pollset after the first
+ *    operation, because the connection to the server is established lazily
+ *
  * [distinguished_name]: http://www.keplerproject.org/lualdap/manual.html#dn
  * [rfc2254]: http://www.ietf.org/rfc/rfc2254.txt
+ * [rfc2696]: http://www.ietf.org/rfc/rfc2696.txt
  * [lualdap]: http://www.keplerproject.org/lualdap/manual.html#connection
  */
 
 static int lua_apr_ldap_search(lua_State *L)
 {
   lua_apr_ldap_object *object;
-  int scope, attrsonly, sizelimit;
-  int status, i, n, msgid, time_idx;
-  struct timeval *timeout;
-  ldap_pchar_t base, filter;
-  char **attrs;
+  lua_apr_ldap_search_state *search;
+  int status, i, n;
 
   lua_settop(L, 2);
   object = check_ldap_connection(L, 1);
   luaL_checktype(L, 2, LUA_TTABLE);
 
+  /* Allocate the search state and a table to keep its strings alive. */
+  lua_getfield(L, 2, "attrs");
+  n = lua_istable(L, -1) ? lua_objlen(L, -1) : 1;
+  lua_pop(L, 1);
+  search = lua_newuserdata(L, sizeof *search + sizeof search->attrs[0] * n);
+  memset(search, 0, sizeof *search);
+  lua_newtable(L);
+  lua_pushvalue(L, -1);
+  lua_setfenv(L, 3);
+
   /* Get the size limit (if any). */
   lua_getfield(L, 2, "sizelimit");
-  sizelimit = lua_isnumber(L, -1) ? lua_tointeger(L, -1) : LDAP_NO_LIMIT;
+  search->sizelimit = lua_isnumber(L, -1) ? lua_tointeger(L, -1) : LDAP_NO_LIMIT;
   lua_pop(L, 1);
 
+  /* Get the page size (if any). */
+  lua_getfield(L, 2, "pagesize");
+  search->pagesize = lua_isnumber(L, -1) ? lua_tointeger(L, -1) : 0;
+  lua_pop(L, 1);
+# if !LUA_APR_HAVE_LDAP_PAGING
+  if (search->pagesize > 0)
+    return push_error_status(L, APR_ENOTIMPL);
+# endif
+
   /* Check if we're interested in attribute values. */
   lua_getfield(L, 2, "attrsonly");
-  attrsonly = lua_toboolean(L, -1);
+  search->attrsonly = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+
+  /* Check whether the iterator should return batches and/or not block. */
+  lua_getfield(L, 2, "batch");
+  search->batch = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+  lua_getfield(L, 2, "async");
+  search->async = lua_toboolean(L, -1);
   lua_pop(L, 1);
 
   /* Get "base" string. */
   lua_getfield(L, 2, "base");
-  base = (ldap_pchar_t) (lua_isstring(L, -1) ? lua_tostring(L, -1) : NULL);
-  lua_pop(L, 1);
+  search->base = (ldap_pchar_t) (lua_isstring(L, -1) ? lua_tostring(L, -1) : NULL);
+  lua_rawseti(L, 4, 1);
 
   /* Get "filter" string. */
   lua_getfield(L, 2, "filter");
-  filter = (ldap_pchar_t) (lua_isstring(L, -1) ? lua_tostring(L, -1) : NULL);
-  lua_pop(L, 1);
+  search->filter = (ldap_pchar_t) (lua_isstring(L, -1) ? lua_tostring(L, -1) : NULL);
+  lua_rawseti(L, 4, 2);
 
   /* Get timeout value. */
-  timeout = lua_newuserdata(L, sizeof *timeout);
-  time_idx = lua_gettop(L);
   lua_getfield(L, 2, "timeout");
-  timeout = number_to_time(L, -1, timeout);
+  search->timeout = number_to_time(L, -1, &search->timeval);
   lua_pop(L, 1);
 
   /* Get scope type from string. */
   lua_getfield(L, 2, "scope");
-  scope = LDAP_SCOPE_DEFAULT;
+  search->scope = LDAP_SCOPE_DEFAULT;
   if (lua_isstring(L, -1)) {
     const char *scopename = lua_tostring(L, -1);
     if (strcmp(scopename, "base") == 0)
-      scope = LDAP_SCOPE_BASE;
+      search->scope = LDAP_SCOPE_BASE;
     else if (strcmp(scopename, "one") == 0)
-      scope = LDAP_SCOPE_ONELEVEL;
+      search->scope = LDAP_SCOPE_ONELEVEL;
     else if (strcmp(scopename, "sub") == 0)
-      scope = LDAP_SCOPE_SUBTREE;
+      search->scope = LDAP_SCOPE_SUBTREE;
   }
   lua_pop(L, 1);
 
   /* Get attributes to search for as NULL terminated array of strings. */
   lua_getfield(L, 2, "attrs");
-  n = lua_istable(L, -1) ? lua_objlen(L, -1) : 1;
-  attrs = lua_newuserdata(L, sizeof attrs[0] * (n + 1));
   if (!lua_istable(L, -1)) {
-    attrs[0] = (char*)lua_tostring(L, -1);
-    attrs[1] = NULL;
+    search->attrs[0] = (char*)lua_tostring(L, -1);
+    search->attrs[1] = NULL;
+    lua_rawseti(L, 4, 3);
   } else {
     for (i = 0; i < n; i++) {
       lua_rawgeti(L, -1, i + 1);
-      attrs[i] = (char*)lua_tostring(L, -1);
-      lua_pop(L, 1); /* pop string */
+      search->attrs[i] = (char*)lua_tostring(L, -1);
+      lua_rawseti(L, 4, i + 3);
     }
-    attrs[n] = NULL;
+    search->attrs[n] = NULL;
+    lua_pop(L, 1); /* pop "attrs" */
   }
-  lua_pop(L, 1); /* pop "attrs" */
 
   /* Start the search. */
-  status = ldap_search_ext(object->ldap, base, scope, filter, attrs,
-      attrsonly, NULL, NULL, timeout, sizelimit, &msgid);
+  status = search_start(object->ldap, search, NULL);
   if (status != LDAP_SUCCESS)
     raise_ldap_error(L, status);
 
   /* Prepare the search iterator and its upvalues. */
   lua_pushvalue(L, 1);
-  lua_pushnumber(L, msgid);
-  if (timeout != NULL)
-    lua_pushvalue(L, time_idx);
-  else
-    lua_pushlightuserdata(L, NULL);
-  lua_pushcclosure(L, search_iterator, 3);
+  lua_pushvalue(L, 3);
+  lua_pushcclosure(L, search_iterator, 2);
 
   return 1;
 }
@@ -1425,14 +2047,184 @@ static int ldap_gc(lua_State *L)
   lua_apr_ldap_object *object;
 
   object = check_ldap_connection(L, 1);
-  if (object->ldap != NULL) {
+  if (object->owner != NULL) {
+    /* Return pooled connections to their pool. */
+    ldap_conn_release(object);
+  } else if (object->pool != NULL) {
     apr_pool_destroy(object->pool);
+    object->pool = NULL;
     object->ldap = NULL;
   }
 
   return 0;
 }
 
+/* ldap_pool:acquire() -> ldap_conn {{{1
+ *
+ * Get a connection bound to the service account from the pool. An idle
+ * connection is reused when possible, otherwise a new connection is opened
+ * (unless the pool is full). On success the LDAP connection object is
+ * returned, otherwise a nil followed by an error message is returned. The
+ * connection is returned to the pool by `ldap_pool:release()` or when it's
+ * garbage collected. Don't rebind pooled connections, use
+ * `ldap_pool:verify()` to check credentials instead.
+ */
+
+static int ldap_pool_acquire(lua_State *L)
+{
+  lua_apr_ldap_object *object;
+  lua_apr_ldap_pooled *node;
+  lua_apr_ldap_pool_object *pool;
+  int n;
+
+  pool = check_ldap_pool(L, 1);
+  n = ldap_pool_get(L, pool, 1, &node);
+  if (n > 0)
+    return n;
+  object = new_object(L, &lua_apr_ldap_type);
+  object->pool = node->pool;
+  object->ldap = node->ldap;
+  object->node = node;
+  object->owner = pool;
+  object_incref((lua_apr_refobj*)pool);
+
+  return 1;
+}
+
+/* ldap_pool:release(ldap_conn) -> status {{{1
+ *
+ * Return a connection acquired using `ldap_pool:acquire()` to the pool. The
+ * connection object can no longer be used afterwards. Returns true.
+ */
+
+static int ldap_pool_release(lua_State *L)
+{
+  lua_apr_ldap_object *object;
+  lua_apr_ldap_pool_object *pool;
+
+  pool = check_ldap_pool(L, 1);
+  object = check_ldap_connection(L, 2);
+  luaL_argcheck(L, object->owner == pool, 2, "connection doesn't belong to pool");
+  ldap_conn_release(object);
+  lua_pushboolean(L, 1);
+
+  return 1;
+}
+
+/* ldap_pool:verify(who, passwd) -> status {{{1
+ *
+ * Verify the credentials of a user by binding as the user with distinguished
+ * name @who and password @passwd. Verification binds use separate pooled
+ * connections so that the service account connections keep their identity.
+ * Returns true when the credentials are valid, otherwise a nil followed by an
+ * error message is returned. Empty passwords are always rejected, because
+ * LDAP treats them as an unauthenticated bind that succeeds.
+ */
+
+static int ldap_pool_verify(lua_State *L)
+{
+  lua_apr_ldap_pooled *node;
+  lua_apr_ldap_pool_object *pool;
+  const char *who, *passwd;
+  size_t length;
+  int n, status;
+
+  pool = check_ldap_pool(L, 1);
+  who = luaL_checkstring(L, 2);
+  passwd = luaL_checklstring(L, 3, &length);
+  if (length == 0)
+    return push_ldap_status(L, LDAP_INVALID_CREDENTIALS);
+
+  n = ldap_pool_get(L, pool, 0, &node);
+  if (n > 0)
+    return n;
+  status = ldap_simple_bind_s(node->ldap, (char*)who, (char*)passwd);
+  if (status == LDAP_SUCCESS || status == LDAP_INVALID_CREDENTIALS) {
+    ldap_pool_put(pool, node, 0);
+  } else {
+    /* Don't reuse connections that failed in unexpected ways. */
+    ldap_pooled_close(node);
+    ldap_pool_put(pool, NULL, 0);
+  }
+
+  return push_ldap_status(L, status);
+}
+
+/* ldap_pool:evict() -> count {{{1
+ *
+ * Close the connections that have been idle for longer than the idle timeout.
+ * This also happens automatically when connections are acquired, but calling
+ * this function periodically releases connections of idle pools. Returns the
+ * number of closed connections.
+ */
+
+static int ldap_pool_evict_idle(lua_State *L)
+{
+  lua_apr_ldap_pooled *expired = NULL, *node;
+  lua_apr_ldap_pool_object *pool;
+  apr_time_t now;
+  int count = 0;
+
+  pool = check_ldap_pool(L, 1);
+  now = apr_time_now();
+  ldap_pool_lock(pool);
+  ldap_pool_evict(pool, &pool->bound, now, &expired);
+  ldap_pool_evict(pool, &pool->verify, now, &expired);
+  ldap_pool_unlock(pool);
+  for (node = expired; node != NULL; node = node->next)
+    count++;
+  ldap_pooled_close(expired);
+  lua_pushinteger(L, count);
+
+  return 1;
+}
+
+/* ldap_pool:count() -> open, idle {{{1
+ *
+ * Get the number of open connections and the number of idle connections in
+ * the pool.
+ */
+
+static int ldap_pool_count(lua_State *L)
+{
+  lua_apr_ldap_pooled *node;
+  lua_apr_ldap_pool_object *pool;
+  int open, idle = 0;
+
+  pool = check_ldap_pool(L, 1);
+  ldap_pool_lock(pool);
+  open = pool->count;
+  for (node = pool->bound; node != NULL; node = node->next)
+    idle++;
+  for (node = pool->verify; node != NULL; node = node->next)
+    idle++;
+  ldap_pool_unlock(pool);
+  lua_pushinteger(L, open);
+  lua_pushinteger(L, idle);
+
+  return 2;
+}
+
+/* tostring(ldap_pool) -> string {{{1 */
+
+static int ldap_pool_tostring(lua_State *L)
+{
+  lua_apr_ldap_pool_object *pool;
+
+  pool = check_ldap_pool(L, 1);
+  lua_pushfstring(L, "%s (%p)", lua_apr_ldap_pool_type.friendlyname, pool);
+
+  return 1;
+}
+
+/* ldap_pool:__gc() {{{1 */
+
+static int ldap_pool_gc(lua_State *L)
+{
+  ldap_pool_close_real(check_ldap_pool(L, 1));
+  return 0;
+}
+
 /* }}}1 */
 
 static luaL_reg ldap_metamethods[] = {
@@ -1467,4 +2259,28 @@ lua_apr_objtype lua_apr_ldap_type = {
   ldap_metamethods             /* metamethods table */
 };
 
+static luaL_reg ldap_pool_metamethods[] = {
+  { "__tostring", ldap_pool_tostring },
+  { "__eq", objects_equal },
+  { "__gc", ldap_pool_gc },
+  { NULL, NULL }
+};
+
+static luaL_reg ldap_pool_methods[] = {
+  { "acquire", ldap_pool_acquire },
+  { "release", ldap_pool_release },
+  { "verify", ldap_pool_verify },
+  { "evict", ldap_pool_evict_idle },
+  { "count", ldap_pool_count },
+  { NULL, NULL }
+};
+
+lua_apr_objtype lua_apr_ldap_pool_type = {
+  "lua_apr_ldap_pool*",        /* metatable name in registry */
+  "LDAP connection pool",      /* friendly object name */
+  sizeof(lua_apr_ldap_pool_object), /* structure size */
+  ldap_pool_methods,           /* methods table */
+  ldap_pool_metamethods        /* metamethods table */
+};
+
 #endif
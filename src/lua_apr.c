@@ -17,6 +17,9 @@
 /* Used to make sure that APR is only initialized once. */
 static int apr_was_initialized = 0;
 
+/* The address of this variable is the registry key of the fast errors flag. */
+static const int fast_errors_key = 0;
+
 /* List of all userdata types exposed to Lua by the binding. */
 lua_apr_objtype *lua_apr_types[] = {
   &lua_apr_file_type,
@@ -34,6 +37,7 @@ lua_apr_objtype *lua_apr_types[] = {
   &lua_apr_dbp_type,
 # if APR_HAS_LDAP
   &lua_apr_ldap_type,
+  &lua_apr_ldap_pool_type,
 # endif
 #if LUA_APR_HAVE_MEMCACHE
   &lua_apr_memcache_type,
@@ -42,6 +46,17 @@ lua_apr_objtype *lua_apr_types[] = {
   &lua_apr_md5_type,
   &lua_apr_sha1_type,
   &lua_apr_xml_type,
+  &lua_apr_timer_type,
+  &lua_apr_response_type,
+  &lua_apr_pathcache_type,
+  &lua_apr_blob_type,
+  &lua_apr_bytebuf_type,
+  &lua_apr_struct_type,
+# if APR_HAS_THREADS
+  &lua_apr_password_job_type,
+  &lua_apr_aio_type,
+  &lua_apr_wal_type,
+# endif
   NULL
 };
 
@@ -60,9 +75,22 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
     { "os_default_encoding", lua_apr_os_default_encoding },
     { "os_locale_encoding", lua_apr_os_locale_encoding },
     { "type", lua_apr_type },
+    { "fast_errors", lua_apr_fast_errors },
+    { "strerror", lua_apr_strerror },
     { "ref", lua_apr_ref },
     { "deref", lua_apr_deref },
 
+    /* blob.c -- immutable byte blobs. */
+    { "blob", lua_apr_blob },
+
+    /* bytebuf.c -- growable byte buffers. */
+    { "buffer", lua_apr_bytebuf },
+
+#   if APR_HAS_THREADS
+    /* aio.c -- asynchronous file I/O. */
+    { "aio", lua_apr_aio },
+#   endif
+
     /* base64.c -- base64 encoding/decoding. */
     { "base64_encode", lua_apr_base64_encode },
     { "base64_decode", lua_apr_base64_decode },
@@ -72,6 +100,10 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
     { "md5_encode", lua_apr_md5_encode },
     { "password_get", lua_apr_password_get },
     { "password_validate", lua_apr_password_validate },
+#   if APR_HAS_THREADS
+    { "password_validate_async", lua_apr_password_validate_async },
+    { "password_hash_async", lua_apr_password_hash_async },
+#   endif
     { "sha1_init", lua_apr_sha1_init },
 
     /* date.c -- date parsing. */
@@ -95,6 +127,8 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
     { "filepath_parent", lua_apr_filepath_parent },
     { "filepath_name", lua_apr_filepath_name },
     { "filepath_merge", lua_apr_filepath_merge },
+    { "filepath_merge_all", lua_apr_filepath_merge_all },
+    { "filepath_cache", lua_apr_filepath_cache },
     { "filepath_list_split", lua_apr_filepath_list_split },
     { "filepath_list_merge", lua_apr_filepath_list_merge },
     { "filepath_get", lua_apr_filepath_get },
@@ -152,11 +186,14 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
     { "pipe_open_stderr", lua_apr_pipe_open_stderr },
     { "namedpipe_create", lua_apr_namedpipe_create },
     { "pipe_create", lua_apr_pipe_create },
+    { "splice", lua_apr_splice },
+    { "tee", lua_apr_tee },
 
 #   if APR_HAS_LDAP
     /* ldap.c -- LDAP connection handling. */
     { "ldap", lua_apr_ldap },
     { "ldap_info", lua_apr_ldap_info },
+    { "ldap_pool", lua_apr_ldap_pool },
     { "ldap_url_check", lua_apr_ldap_url_check },
     { "ldap_url_parse", lua_apr_ldap_url_parse },
 #   endif
@@ -186,9 +223,13 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
     /* str.c -- string handling. */
     { "strnatcmp", lua_apr_strnatcmp },
     { "strnatcasecmp", lua_apr_strnatcasecmp },
+    { "natsort", lua_apr_natsort },
     { "strfsize", lua_apr_strfsize },
     { "tokenize_to_argv", lua_apr_tokenize_to_argv },
 
+    /* struct.c -- binary structures. */
+    { "struct", lua_apr_struct },
+
 #   if APR_HAS_THREADS
 
     /* thread.c -- multi threading. */
@@ -206,6 +247,9 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
     { "time_explode", lua_apr_time_explode },
     { "time_implode", lua_apr_time_implode },
     { "time_format", lua_apr_time_format },
+    { "clock_monotonic", lua_apr_clock_monotonic },
+    { "cycles", lua_apr_cycles },
+    { "timerfd", lua_apr_timerfd },
 
     /* uri.c -- URI parsing/unparsing. */
     { "uri_parse", lua_apr_uri_parse },
@@ -218,9 +262,15 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
 
     /* uuid.c -- UUID generation. */
     { "uuid_get", lua_apr_uuid_get },
+    { "uuid_batch", lua_apr_uuid_batch },
     { "uuid_format", lua_apr_uuid_format },
     { "uuid_parse", lua_apr_uuid_parse },
 
+#   if APR_HAS_THREADS
+    /* wal.c -- write-ahead logs. */
+    { "wal", lua_apr_wal },
+#   endif
+
     /* xlate.c -- character encoding translation. */
     { "xlate", lua_apr_xlate },
 
@@ -392,6 +442,15 @@ int lua_apr_os_locale_encoding(lua_State *L)
  *  - `'md5 context'`
  *  - `'sha1 context'`
  *  - `'xml parser'`
+ *  - `'timer'`
+ *  - `'HTTP response'`
+ *  - `'path cache'`
+ *  - `'blob'`
+ *  - `'buffer'`
+ *  - `'struct'`
+ *  - `'password job'`
+ *  - `'I/O engine'`
+ *  - `'write-ahead log'`
  */
 
 int lua_apr_type(lua_State *L)
@@ -412,6 +471,88 @@ int lua_apr_type(lua_State *L)
   return 0;
 }
 
+/* apr.fast_errors([enabled]) -> previous {{{1
+ *
+ * Enable or disable "fast errors" for the current Lua state and return the
+ * previous setting as a boolean. When @enabled is not given the setting is
+ * left unchanged. Fast errors are disabled by default.
+ *
+ * Non-blocking sockets, pipes and pollsets report the expected conditions
+ * `'EAGAIN'` and `'TIMEUP'` very frequently and formatting an error message
+ * for each of them is wasted effort when the caller only checks the error
+ * code. When fast errors are enabled functions that fail with one of these
+ * conditions return nil followed by the symbolic name of the error twice, in
+ * place of the message and the error code. The message can be produced later
+ * on using `apr.strerror()`. All other errors are reported as before.
+ */
+
+int lua_apr_fast_errors(lua_State *L)
+{
+  lua_pushlightuserdata(L, (void*)&fast_errors_key);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  lua_pushboolean(L, lua_toboolean(L, -1));
+  if (!lua_isnone(L, 1)) {
+    lua_pushlightuserdata(L, (void*)&fast_errors_key);
+    lua_pushboolean(L, lua_toboolean(L, 1));
+    lua_rawset(L, LUA_REGISTRYINDEX);
+  }
+  return 1;
+}
+
+/* apr.strerror(code) -> message {{{1
+ *
+ * Get the error message for the error @code returned by a function in the
+ * Lua/APR binding. The @code can be a numeric error code or the symbolic names
+ * `'EAGAIN'` and `'TIMEUP'` returned by functions when fast errors are enabled
+ * (see `apr.fast_errors()`).
+ */
+
+int lua_apr_strerror(lua_State *L)
+{
+  apr_status_t status;
+  const char *name;
+
+  if (lua_type(L, 1) == LUA_TNUMBER) {
+    status = (apr_status_t) lua_tointeger(L, 1);
+  } else {
+    name = luaL_checkstring(L, 1);
+    if (strcmp(name, "EAGAIN") == 0)
+      status = APR_EAGAIN;
+    else if (strcmp(name, "TIMEUP") == 0)
+      status = APR_TIMEUP;
+    else
+      return luaL_argerror(L, 1, lua_pushfstring(L, "unknown error code " LUA_QS, name));
+  }
+
+  return status_to_message(L, status);
+}
+
+/* push_fast_error() returns (nil, name, name) for expected errors when enabled. {{{1 */
+
+int push_fast_error(lua_State *L, apr_status_t status)
+{
+  int enabled;
+
+  /* Check the status first because that's cheaper than the registry. */
+  if (!APR_STATUS_IS_EAGAIN(status) && !APR_STATUS_IS_TIMEUP(status))
+    return 0;
+
+  lua_pushlightuserdata(L, (void*)&fast_errors_key);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  enabled = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+  if (!enabled)
+    return 0;
+
+  lua_pushnil(L);
+  if (APR_STATUS_IS_EAGAIN(status))
+    lua_pushliteral(L, "EAGAIN");
+  else
+    lua_pushliteral(L, "TIMEUP");
+  lua_pushvalue(L, -1);
+  return 3;
+}
+
 /* status_to_message() converts APR status codes to error messages. {{{1 */
 
 int status_to_message(lua_State *L, apr_status_t status)
@@ -443,6 +584,8 @@ int push_status(lua_State *L, apr_status_t status)
 
 int push_error_status(lua_State *L, apr_status_t status)
 {
+  if (push_fast_error(L, status))
+    return 3;
   lua_pushnil(L);
   status_to_message(L, status);
   status_to_name(L, status);
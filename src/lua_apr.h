@@ -174,10 +174,16 @@ typedef struct {
   char *data;
 } lua_apr_buffer;
 
+typedef struct lua_apr_filter lua_apr_filter;
+typedef struct lua_apr_struct_object lua_apr_struct_object;
+typedef struct lua_apr_direct lua_apr_direct;
+
 typedef struct {
   int text_mode;
+  size_t translated;
   void *object;
   lua_apr_buf_rf read;
+  lua_apr_filter *filter;
   lua_apr_buffer buffer;
 } lua_apr_readbuf;
 
@@ -186,9 +192,16 @@ typedef struct {
   void *object;
   lua_apr_buf_wf write;
   lua_apr_buf_ff flush;
+  lua_apr_filter *filter;
   lua_apr_buffer buffer;
 } lua_apr_writebuf;
 
+/* Structure for byte buffer objects. */
+typedef struct {
+  lua_apr_refobj header;
+  lua_apr_buffer buffer;
+} lua_apr_bytebuf_object;
+
 /* Structure for file objects. */
 typedef struct {
   lua_apr_refobj header;
@@ -197,6 +210,8 @@ typedef struct {
   apr_file_t *handle;
   lua_apr_pool *pool;
   const char *path;
+  int append; /* every file:write() is one write() call */
+  lua_apr_direct *direct; /* aligned window for direct I/O (see direct.c) */
 } lua_apr_file;
 
 /* Structure for socket objects. */
@@ -209,6 +224,15 @@ typedef struct {
   int family, protocol;
 } lua_apr_socket;
 
+/* Structure for timer objects. */
+typedef struct {
+  lua_apr_refobj header;
+  apr_pool_t *pool;
+  apr_file_t *handle;
+  int fd; /* only used where timerfd_create() is available */
+  apr_interval_time_t interval;
+} lua_apr_timer;
+
 /* Structure used to define Lua userdata types created by Lua/APR. */
 typedef struct {
   const char *typename, *friendlyname;
@@ -239,6 +263,16 @@ extern lua_apr_objtype lua_apr_memcache_type;
 extern lua_apr_objtype lua_apr_memcache_server_type;
 #endif
 extern lua_apr_objtype lua_apr_ldap_type;
+extern lua_apr_objtype lua_apr_ldap_pool_type;
+extern lua_apr_objtype lua_apr_timer_type;
+extern lua_apr_objtype lua_apr_password_job_type;
+extern lua_apr_objtype lua_apr_response_type;
+extern lua_apr_objtype lua_apr_pathcache_type;
+extern lua_apr_objtype lua_apr_blob_type;
+extern lua_apr_objtype lua_apr_bytebuf_type;
+extern lua_apr_objtype lua_apr_struct_type;
+extern lua_apr_objtype lua_apr_aio_type;
+extern lua_apr_objtype lua_apr_wal_type;
 
 /* Prototypes. {{{1 */
 
@@ -248,30 +282,55 @@ int lua_apr_version_get(lua_State*);
 int lua_apr_os_default_encoding(lua_State*);
 int lua_apr_os_locale_encoding(lua_State*);
 int lua_apr_type(lua_State*);
+int lua_apr_fast_errors(lua_State*);
+int lua_apr_strerror(lua_State*);
+int push_fast_error(lua_State*, apr_status_t);
 int status_to_message(lua_State*, apr_status_t);
 int push_status(lua_State*, apr_status_t);
 int push_error_status(lua_State*, apr_status_t);
 
+/* aio.c */
+int lua_apr_aio(lua_State*);
+apr_file_t *aio_engine_file(lua_State*, int, apr_pool_t**);
+
 /* base64.c */
 int lua_apr_base64_encode(lua_State*);
 int lua_apr_base64_decode(lua_State*);
 
+/* blob.c */
+int lua_apr_blob(lua_State*);
+const char *check_bytes(lua_State*, int, size_t*);
+
 /* buffer.c */
 void init_buffers(lua_State*, lua_apr_readbuf*, lua_apr_writebuf*, void*, int,
                   lua_apr_buf_rf, lua_apr_buf_wf, lua_apr_buf_ff);
 void init_unmanaged_buffers(lua_State*, lua_apr_readbuf*, lua_apr_writebuf*, char*, size_t);
+int buffer_text_mode(lua_State*, lua_apr_readbuf*, lua_apr_writebuf*);
 int read_lines(lua_State*, lua_apr_readbuf*);
 int read_buffer(lua_State*, lua_apr_readbuf*);
+int buffer_read_until(lua_State*, lua_apr_readbuf*);
+int buffer_read_frame(lua_State*, lua_apr_readbuf*);
+int buffer_read_struct(lua_State*, lua_apr_readbuf*);
+int buffer_read_records(lua_State*, lua_apr_readbuf*);
+int read_into_buffer(lua_State*, lua_apr_readbuf*);
+apr_status_t reserve_buffer(lua_apr_buffer*, size_t);
 int write_buffer(lua_State*, lua_apr_writebuf*);
+int buffer_write_struct(lua_State*, lua_apr_writebuf*);
 apr_status_t flush_buffer(lua_State*, lua_apr_writebuf*, int);
 void free_buffer(lua_State*, lua_apr_buffer*);
 
+/* bytebuf.c */
+int lua_apr_bytebuf(lua_State*);
+
 /* crypt.c */
 int lua_apr_md5_init(lua_State*);
 int lua_apr_md5_encode(lua_State*);
 int lua_apr_sha1_init(lua_State*);
 int lua_apr_password_validate(lua_State*);
 int lua_apr_password_get(lua_State*);
+int lua_apr_password_validate_async(lua_State*);
+int lua_apr_password_hash_async(lua_State*);
+apr_file_t *password_job_file(lua_State*, int, apr_pool_t**);
 
 /* date.c */
 int lua_apr_date_parse_http(lua_State*);
@@ -284,6 +343,13 @@ int lua_apr_dbd(lua_State*);
 int lua_apr_dbm_open(lua_State*);
 int lua_apr_dbm_getnames(lua_State*);
 
+/* direct.c */
+apr_status_t direct_enable(lua_apr_file*);
+apr_status_t direct_seek(lua_apr_direct*, apr_seek_where_t, apr_off_t*);
+apr_status_t direct_truncate(lua_apr_direct*, apr_off_t);
+apr_status_t direct_invalidate(lua_apr_direct*);
+apr_status_t direct_close(lua_apr_direct*);
+
 /* env.c */
 int lua_apr_env_get(lua_State*);
 int lua_apr_env_set(lua_State*);
@@ -297,11 +363,17 @@ int lua_apr_filepath_root(lua_State*);
 int lua_apr_filepath_parent(lua_State*);
 int lua_apr_filepath_name(lua_State*);
 int lua_apr_filepath_merge(lua_State*);
+int lua_apr_filepath_merge_all(lua_State*);
+int lua_apr_filepath_cache(lua_State*);
 int lua_apr_filepath_list_split(lua_State*);
 int lua_apr_filepath_list_merge(lua_State*);
 int lua_apr_filepath_get(lua_State*);
 int lua_apr_filepath_set(lua_State*);
 
+/* filter.c */
+int buffer_filter(lua_State*, lua_apr_readbuf*, lua_apr_writebuf*);
+apr_status_t close_filters(lua_apr_readbuf*, lua_apr_writebuf*);
+
 /* fnmatch.c */
 int lua_apr_fnmatch(lua_State*);
 int lua_apr_fnmatch_test(lua_State*);
@@ -318,6 +390,9 @@ int lua_apr_header_attribute(lua_State*);
 int lua_apr_uri_encode(lua_State*);
 int lua_apr_uri_decode(lua_State*);
 
+/* http_response.c */
+int socket_response(lua_State*);
+
 /* io_dir.c */
 int lua_apr_temp_dir_get(lua_State*);
 int lua_apr_dir_make(lua_State*);
@@ -339,6 +414,8 @@ int lua_apr_stat(lua_State*);
 int lua_apr_file_open(lua_State*);
 lua_apr_file *file_alloc(lua_State*, const char*, lua_apr_pool*);
 void init_file_buffers(lua_State*, lua_apr_file*, int);
+void file_init_mode(lua_State*, lua_apr_file*, const char*, apr_int32_t);
+apr_int32_t parse_mode_str(const char*);
 lua_apr_file *file_check(lua_State*, int, int);
 apr_status_t file_close_impl(lua_State*, lua_apr_file*);
 
@@ -354,12 +431,16 @@ int lua_apr_pipe_open_stdout(lua_State*);
 int lua_apr_pipe_open_stderr(lua_State*);
 int lua_apr_namedpipe_create(lua_State*);
 int lua_apr_pipe_create(lua_State*);
+int lua_apr_splice(lua_State*);
+int lua_apr_tee(lua_State*);
 
 /* ldap.c */
 int lua_apr_ldap(lua_State*);
 int lua_apr_ldap_info(lua_State*);
+int lua_apr_ldap_pool(lua_State*);
 int lua_apr_ldap_url_check(lua_State*);
 int lua_apr_ldap_url_parse(lua_State*);
+apr_socket_t *ldap_socket_get(lua_State*, int, apr_pool_t**);
 
 /* memory_pool.c */
 apr_pool_t *to_pool(lua_State*);
@@ -406,6 +487,7 @@ int lua_apr_unserialize(lua_State*);
 /* stat.c */
 void check_stat_request(lua_State*, lua_apr_stat_context*);
 int push_stat_results(lua_State*, lua_apr_stat_context*, const char*);
+void push_stat_field(lua_State*, apr_finfo_t*, apr_int32_t, const char*);
 
 /* shm.c */
 int lua_apr_shm_create(lua_State*);
@@ -422,9 +504,17 @@ int lua_apr_signal_names(lua_State*);
 /* str.c */
 int lua_apr_strnatcmp(lua_State*);
 int lua_apr_strnatcasecmp(lua_State*);
+int lua_apr_natsort(lua_State*);
 int lua_apr_strfsize(lua_State*);
 int lua_apr_tokenize_to_argv(lua_State*);
 
+/* struct.c */
+int lua_apr_struct(lua_State*);
+lua_apr_struct_object *check_struct(lua_State*, int);
+int struct_unpack(lua_State*, lua_apr_struct_object*, const char*, size_t, size_t*);
+size_t struct_packsize(lua_State*, lua_apr_struct_object*, int);
+void struct_pack(lua_State*, lua_apr_struct_object*, int, char*);
+
 /* thread.c */
 int lua_apr_thread(lua_State*);
 int lua_apr_thread_yield(lua_State*);
@@ -438,8 +528,12 @@ int lua_apr_time_now(lua_State*);
 int lua_apr_time_explode(lua_State*);
 int lua_apr_time_implode(lua_State*);
 int lua_apr_time_format(lua_State*);
+int lua_apr_clock_monotonic(lua_State*);
+int lua_apr_cycles(lua_State*);
+int lua_apr_timerfd(lua_State*);
 apr_time_t time_check(lua_State*, int);
 int time_push(lua_State*, apr_time_t);
+apr_uint64_t monotonic_now(void);
 
 /* uri.c */
 int lua_apr_uri_parse(lua_State*);
@@ -454,9 +548,13 @@ int push_groupname(lua_State*, apr_pool_t*, apr_gid_t);
 
 /* uuid.c */
 int lua_apr_uuid_get(lua_State*);
+int lua_apr_uuid_batch(lua_State*);
 int lua_apr_uuid_format(lua_State*);
 int lua_apr_uuid_parse(lua_State*);
 
+/* wal.c */
+int lua_apr_wal(lua_State*);
+
 /* xlate.c */
 int lua_apr_xlate(lua_State*);
 
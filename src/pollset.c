@@ -10,7 +10,9 @@
  *
  *  1. Create a pollset object by calling `apr.pollset()`
  *  2. Add one or more sockets to the pollset (e.g. a server socket listening
- *     for connections or a bunch of sockets receiving data)
+ *     for connections or a bunch of sockets receiving data) and optionally
+ *     other objects like pipes and timers (see `pollset:add()` for the full
+ *     list)
  *  3. Call `pollset:poll()` in a loop to process readable/writable sockets
  *
  * You can keep adding and removing sockets from the pollset at runtime, just
@@ -24,6 +26,7 @@
 
 #include "lua_apr.h"
 #include <apr_poll.h>
+#include <apr_ldap.h> /* APR_HAS_LDAP */
 
 /* Internal functions. {{{1 */
 
@@ -32,12 +35,10 @@ typedef struct {
   apr_pollset_t *pollset;  /* opaque pointer allocated by APR from memory pool */
   apr_pool_t *memory_pool; /* standalone memory pool for pollset               */
   apr_pollfd_t *fds;       /* file descriptor array allocated from memory pool */
+  lua_apr_readbuf **bufs;  /* read buffers of the objects in the fds array     */
   int size;                /* size of file descriptor array                    */
 } lua_apr_pollset_object;
 
-#define check_socket(L, idx) \
-   check_object(L, idx, &lua_apr_socket_type)
-
 /* check_pollset() */
 
 static lua_apr_pollset_object* check_pollset(lua_State *L, int idx, int open) {
@@ -47,16 +48,74 @@ static lua_apr_pollset_object* check_pollset(lua_State *L, int idx, int open) {
   return object;
 }
 
-/* find_fd_by_socket() {{{2 */
+/* check_pollable() {{{2
+ *
+ * Check that the value at the given stack index is an object that can be
+ * added to a pollset. Returns the address of the object and initializes the
+ * descriptor fields of the given pollfd structure. For objects with a read
+ * buffer (sockets, pipes and files) the buffer is stored in @buffer so that
+ * buffered input can be reported as readable.
+ */
+
+static void *check_pollable(lua_State *L, int idx, apr_pollfd_t *pollfd, lua_apr_readbuf **buffer)
+{
+  *buffer = NULL;
+  if (object_has_type(L, idx, &lua_apr_socket_type, 1)) {
+    lua_apr_socket *socket = check_object(L, idx, &lua_apr_socket_type);
+    pollfd->p = socket->pool;
+    pollfd->desc_type = APR_POLL_SOCKET;
+    pollfd->desc.s = socket->handle;
+    *buffer = &socket->input;
+    return socket;
+  } else if (object_has_type(L, idx, &lua_apr_file_type, 1)) {
+    lua_apr_file *file = file_check(L, idx, 1);
+    pollfd->p = file->pool->ptr;
+    pollfd->desc_type = APR_POLL_FILE;
+    pollfd->desc.f = file->handle;
+    *buffer = &file->input;
+    return file;
+  } else if (object_has_type(L, idx, &lua_apr_timer_type, 1)) {
+    lua_apr_timer *timer = check_object(L, idx, &lua_apr_timer_type);
+    if (timer->handle == NULL)
+      luaL_error(L, "attempt to use a closed timer");
+    pollfd->p = timer->pool;
+    pollfd->desc_type = APR_POLL_FILE;
+    pollfd->desc.f = timer->handle;
+    return timer;
+  }
+# if APR_HAS_THREADS
+  else if (object_has_type(L, idx, &lua_apr_password_job_type, 1)) {
+    pollfd->desc_type = APR_POLL_FILE;
+    pollfd->desc.f = password_job_file(L, idx, &pollfd->p);
+    return lua_touserdata(L, idx);
+  }
+  else if (object_has_type(L, idx, &lua_apr_aio_type, 1)) {
+    pollfd->desc_type = APR_POLL_FILE;
+    pollfd->desc.f = aio_engine_file(L, idx, &pollfd->p);
+    return lua_touserdata(L, idx);
+  }
+# endif
+# if APR_HAS_LDAP
+  else if (object_has_type(L, idx, &lua_apr_ldap_type, 1)) {
+    pollfd->desc_type = APR_POLL_SOCKET;
+    pollfd->desc.s = ldap_socket_get(L, idx, &pollfd->p);
+    return lua_touserdata(L, idx);
+  }
+# endif
+  luaL_typerror(L, idx, "socket, pipe, timer, password job, I/O engine or LDAP connection");
+  return NULL;
+}
+
+/* find_fd_by_object() {{{2 */
 
-static apr_pollfd_t* find_fd_by_socket(lua_apr_pollset_object *object, lua_apr_socket *socket)
+static apr_pollfd_t* find_fd_by_object(lua_apr_pollset_object *object, void *client_data)
 {
   apr_pollfd_t *fd;
   int i;
 
   for (i = 0; i < object->size; i++) {
     fd = &object->fds[i];
-    if (fd->desc_type == APR_POLL_SOCKET && fd->client_data == socket)
+    if (fd->desc_type != APR_NO_DESC && fd->client_data == client_data)
       return fd;
   }
 
@@ -76,6 +135,20 @@ static apr_pollfd_t* find_empty_fd(lua_apr_pollset_object *object)
   return NULL;
 }
 
+/* has_buffered_input() {{{2
+ *
+ * Check whether an entry of the pollset has input waiting in its read buffer.
+ */
+
+static int has_buffered_input(lua_apr_pollset_object *object, int i)
+{
+  lua_apr_readbuf *input = object->bufs[i];
+  return object->fds[i].desc_type != APR_NO_DESC
+    && (object->fds[i].reqevents & APR_POLLIN)
+    && input != NULL
+    && input->buffer.limit > input->buffer.index;
+}
+
 /* destroy_pollset() {{{2 */
 
 static apr_status_t destroy_pollset(lua_apr_pollset_object *object)
@@ -99,9 +172,10 @@ static apr_status_t destroy_pollset(lua_apr_pollset_object *object)
 
 /* apr.pollset(size) -> pollset {{{1
  *
- * Create a pollset object. The number @size is the maximum number of sockets
- * that the pollset can hold. On success a pollset object is returned,
- * otherwise a nil followed by an error message is returned.
+ * Create a pollset object. The number @size is the maximum number of objects
+ * that the pollset can hold (see `pollset:add()` for the types of objects
+ * that can be added). On success a pollset object is returned, otherwise a
+ * nil followed by an error message is returned.
  */
 
 int lua_apr_pollset(lua_State *L)
@@ -117,6 +191,7 @@ int lua_apr_pollset(lua_State *L)
     status = apr_pollset_create(&object->pollset, size, object->memory_pool, 0);
     if (status == APR_SUCCESS) {
       object->fds = apr_pcalloc(object->memory_pool, sizeof object->fds[0] * size);
+      object->bufs = apr_pcalloc(object->memory_pool, sizeof object->bufs[0] * size);
       object->size = size;
       /* Unused descriptors are marked with APR_NO_DESC. */
       for (i = 0; i < size; i++)
@@ -130,19 +205,38 @@ int lua_apr_pollset(lua_State *L)
   return push_error_status(L, status);
 }
 
-/* pollset:add(socket, flag [, ...]) -> status {{{1
+/* pollset:add(object, flag [, ...]) -> status {{{1
  *
- * Add a network socket to the pollset. On success true is returned, otherwise
- * a nil followed by an error message is returned. One or two of the following
- * flags should be provided:
+ * Add an object to the pollset. On success true is returned, otherwise a nil
+ * followed by an error message is returned. The following objects can be
+ * added:
+ *
+ *  - network sockets
+ *  - pipes (e.g. created with `apr.pipe_create()`, `apr.namedpipe_create()`
+ *    or the standard input/output pipes of a child process); other file
+ *    objects can be added as well but most platforms only support polling
+ *    pipes, FIFOs and terminals (e.g. `apr.file_open(0)` for standard input on
+ *    UNIX)
+ *  - interval timers created with `apr.timerfd()`, which are reported as
+ *    readable when they expire
+ *  - password jobs created with `apr.password_validate_async()` or
+ *    `apr.password_hash_async()`, which are reported as readable when their
+ *    result is available
+ *  - asynchronous I/O engines created with `apr.aio()`, which are reported as
+ *    readable when completions are waiting
+ *  - LDAP connections, which are reported as readable when search results are
+ *    available (see the `async` option of `ldap_conn:search()`)
+ *
+ * Sockets and pipes that have data in their read buffer are always reported
+ * as readable. One or two of the following flags should be provided:
  *
  *  - `'input'` indicates that the socket can be read without blocking
  *  - `'output'` indicates that the socket can be written without blocking
  *
- * If the socket is already in the pollset the flags of the existing entry in
- * the pollset will be combined with the new flags. If you want to *change* a
- * socket from readable to writable or the other way around, you have to first
- * remove the socket from the pollset and then add it back with the new flag.
+ * If the object is already in the pollset the flags of the existing entry in
+ * the pollset will be combined with the new flags. If you want to *change* an
+ * object from readable to writable or the other way around, you have to first
+ * remove the object from the pollset and then add it back with the new flag.
  */
 
 static int pollset_add(lua_State *L)
@@ -152,16 +246,17 @@ static int pollset_add(lua_State *L)
 
   lua_apr_pollset_object *object;
   apr_int16_t reqevents;
-  lua_apr_socket *socket;
-  apr_pollfd_t *fd;
+  apr_pollfd_t *fd, desc;
+  lua_apr_readbuf *buffer;
   apr_status_t status;
+  void *pollable;
 
   /* pollset, socket, flag1 [, flag2] */
   lua_settop(L, 4);
 
   /* Get the object arguments. */
   object = check_pollset(L, 1, 1);
-  socket = check_socket(L, 2);
+  pollable = check_pollable(L, 2, &desc, &buffer);
 
   /* Check the requested event type(s). */
   reqevents = values[luaL_checkoption(L, 3, NULL, options)];
@@ -172,7 +267,7 @@ static int pollset_add(lua_State *L)
   object_env_private(L, 1);
 
   /* Check if the socket is already in the pollset. */
-  fd = find_fd_by_socket(object, socket);
+  fd = find_fd_by_object(object, pollable);
   if (fd != NULL) {
     /* XXX I couldn't find any documentation on having a socket that is both
      * readable and writable in the file descriptor array, and I also don't
@@ -194,19 +289,22 @@ static int pollset_add(lua_State *L)
     if (fd == NULL) {
       status = APR_ENOMEM;
     } else {
-      fd->p = socket->pool;
-      fd->desc_type = APR_POLL_SOCKET;
+      fd->p = desc.p;
+      fd->desc_type = desc.desc_type;
       fd->reqevents = reqevents;
       fd->rtnevents = 0;
-      fd->desc.s = socket->handle;
-      fd->client_data = socket;
+      fd->desc = desc.desc;
+      fd->client_data = pollable;
       /* Add the file descriptor to the pollset. */
       status = apr_pollset_add(object->pollset, fd);
-      if (status == APR_SUCCESS) {
+      if (status != APR_SUCCESS) {
+        fd->desc_type = APR_NO_DESC;
+      } else {
+        object->bufs[fd - object->fds] = buffer;
         /* Add the socket to the environment table of the pollset so that the
          * socket doesn't get garbage collected as long as it's contained in
          * the pollset. */
-        lua_pushlightuserdata(L, socket);
+        lua_pushlightuserdata(L, pollable);
         lua_pushvalue(L, 2);
         lua_rawset(L, 5);
       }
@@ -218,29 +316,31 @@ static int pollset_add(lua_State *L)
 
 /* pollset:remove(socket) -> status {{{1
  *
- * Remove a @socket from the pollset. On success true is returned, otherwise a
- * nil followed by an error message is returned. It is not an error if the
- * socket is not contained in the pollset.
+ * Remove a @socket (or timer) from the pollset. On success true is returned,
+ * otherwise a nil followed by an error message is returned. It is not an
+ * error if the socket is not contained in the pollset.
  */
 
 static int pollset_remove(lua_State *L)
 {
-  lua_apr_pollset_object *object = APR_SUCCESS;
-  lua_apr_socket *socket;
-  apr_pollfd_t *fd;
-  apr_status_t status;
+  lua_apr_pollset_object *object;
+  apr_status_t status = APR_SUCCESS;
+  apr_pollfd_t *fd, desc;
+  lua_apr_readbuf *buffer;
+  void *pollable;
 
   object = check_pollset(L, 1, 1);
-  socket = check_socket(L, 2);
-  fd = find_fd_by_socket(object, socket);
+  pollable = check_pollable(L, 2, &desc, &buffer);
+  fd = find_fd_by_object(object, pollable);
   if (fd != NULL) {
     /* Remove it from the pollset. */
     status = apr_pollset_remove(object->pollset, fd);
     /* Remove it from our file descriptor array. */
     fd->desc_type = APR_NO_DESC;
+    object->bufs[fd - object->fds] = NULL;
     /* Remove it from the environment. */
     object_env_private(L, 1);
-    lua_pushlightuserdata(L, socket);
+    lua_pushlightuserdata(L, pollable);
     lua_pushnil(L);
     lua_rawset(L, -3);
   }
@@ -256,7 +356,9 @@ static int pollset_remove(lua_State *L)
  * negative number means wait until a descriptor is signaled. On success a
  * table with sockets waiting to be read followed by a table with sockets
  * waiting to be written is returned, otherwise a nil followed by an error
- * message is returned.
+ * message is returned. Sockets and pipes with data in their read buffer are
+ * reported as readable without waiting (the operating system doesn't know
+ * about data that Lua/APR has already read into its buffers).
  */
 
 static int pollset_poll(lua_State *L)
@@ -266,7 +368,7 @@ static int pollset_poll(lua_State *L)
   const apr_pollfd_t *fds;
   apr_status_t status;
   apr_int32_t num_fds;
-  int i;
+  int i, j, buffered = 0;
 
   /* Normalize stack to (pollset, timeout, environment). */
   lua_settop(L, 2);
@@ -274,8 +376,19 @@ static int pollset_poll(lua_State *L)
   timeout = luaL_checkint(L, 2);
   object_env_private(L, 1); /* environment @ 3 */
 
+  /* Don't block when buffered input is available. */
+  for (i = 0; i < object->size; i++)
+    if (has_buffered_input(object, i))
+      buffered++;
+  if (buffered > 0)
+    timeout = 0;
+
   /* Poll the sockets. */
   status = apr_pollset_poll(object->pollset, timeout, &num_fds, &fds);
+  if (buffered > 0 && APR_STATUS_IS_TIMEUP(status)) {
+    status = APR_SUCCESS;
+    num_fds = 0;
+  }
   if (status != APR_SUCCESS)
     return push_error_status(L, status);
 
@@ -300,6 +413,21 @@ static int pollset_poll(lua_State *L)
       lua_pop(L, 1);
   }
 
+  /* Add objects with buffered input that weren't reported as readable. */
+  for (i = 0; buffered > 0 && i < object->size; i++) {
+    if (has_buffered_input(object, i)) {
+      for (j = 0; j < num_fds; j++)
+        if (fds[j].client_data == object->fds[i].client_data && (fds[j].rtnevents & APR_POLLIN))
+          break;
+      if (j == num_fds) {
+        lua_pushlightuserdata(L, object->fds[i].client_data);
+        lua_rawget(L, 3);
+        lua_rawseti(L, 4, lua_objlen(L, 4) + 1);
+      }
+      buffered--;
+    }
+  }
+
   return 2;
 }
 
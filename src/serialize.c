@@ -73,7 +73,7 @@ static void load_lua_apr(lua_State *L)
  * [UUID] [uuid] with the object. The UUID is returned as a string. When you
  * pass this UUID to `apr.deref()` you'll get the same object back. This only
  * works once, but of course you're free to generate another UUID for the same
- * object.
+ * object. I/O engines (see `apr.aio()`) can't be referenced.
  *
  * [uuid]: http://en.wikipedia.org/wiki/Universally_unique_identifier
  */
@@ -95,6 +95,11 @@ int lua_apr_ref(lua_State *L)
       break;
     }
   luaL_argcheck(L, type != NULL, 1, "userdata cannot be referenced");
+# if APR_HAS_THREADS
+  /* I/O engines aren't locked and keep values alive in the environment of the
+   * object that queued the requests, so they're bound to one Lua state. */
+  luaL_argcheck(L, type != &lua_apr_aio_type, 1, "I/O engines cannot be referenced");
+# endif
 
   /* Prepare to insert object in chain of references. */
   node = calloc(1, sizeof(reference));
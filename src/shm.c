@@ -166,6 +166,32 @@ static int shm_read(lua_State *L)
   return read_buffer(L, &object->input);
 }
 
+/* shm:read_until(delimiter [, max]) -> string {{{1
+ *
+ * Read from the shared memory segment up to the next occurrence of the string
+ * @delimiter. See `file:read_until()` for details.
+ */
+
+static int shm_read_until(lua_State *L)
+{
+  lua_apr_shm *object = check_shm(L, 1);
+  object->last_op = &object->input.buffer;
+  return buffer_read_until(L, &object->input);
+}
+
+/* shm:read_frame(format [, max]) -> string {{{1
+ *
+ * Read a length prefixed frame from the shared memory segment and return its
+ * payload. See `file:read_frame()` for details.
+ */
+
+static int shm_read_frame(lua_State *L)
+{
+  lua_apr_shm *object = check_shm(L, 1);
+  object->last_op = &object->input.buffer;
+  return buffer_read_frame(L, &object->input);
+}
+
 /* shm:write(value [, ...]) -> status {{{1
  *
  * This function implements the interface of Lua's `file:write()` function.
@@ -279,6 +305,8 @@ static luaL_reg shm_metamethods[] = {
 
 static luaL_reg shm_methods[] = {
   { "read", shm_read },
+  { "read_until", shm_read_until },
+  { "read_frame", shm_read_frame },
   { "write", shm_write },
   { "seek", shm_seek },
   { "detach", shm_detach },
@@ -0,0 +1,558 @@
+/* Binary structures module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * Binary file formats and network protocols are made up of fixed width
+ * integers, floating point numbers and strings in a well defined byte order.
+ * Lua 5.1 doesn't have a way to encode or decode such structures, so this
+ * module provides one: A format string describes a structure and is compiled
+ * into a descriptor once, which can then be used to pack and unpack strings
+ * with `struct:pack()` and `struct:unpack()`, or to read and write structures
+ * directly from and to the I/O buffers of files, pipes and sockets using
+ * `file:read_struct()` and `file:write_struct()` without creating any
+ * intermediate strings. The following options are supported in format
+ * strings (this is a subset of the options supported by `string.pack()` in
+ * Lua 5.3):
+ *
+ *  - `<`: following items are little endian
+ *  - `>`: following items are big endian
+ *  - `=`: following items use the native byte order (the default)
+ *  - `b` and `B`: a signed or unsigned 8 bit integer
+ *  - `h` and `H`: a signed or unsigned 16 bit integer
+ *  - `i[n]` and `I[n]`: a signed or unsigned integer of @n bytes (1 to 8,
+ *    default 4)
+ *  - `l` and `L`: a signed or unsigned 64 bit integer (values beyond 2^53
+ *    lose precision because Lua numbers are doubles)
+ *  - `f` and `d`: a single or double precision floating point number
+ *  - `cn`: a fixed size string of @n bytes (padded with zero bytes)
+ *  - `s[n]`: a string prefixed by its length as an unsigned integer of @n
+ *    bytes (1 to 8, default 4)
+ *  - `x`: one byte of padding (skipped when unpacking)
+ *
+ * Spaces in format strings are ignored. Here's an example:
+ *
+ *     > header = apr.struct '>I4 H H s2'
+ *     > data = header:pack(0xCAFEBABE, 1, 2, 'name')
+ *     > = #data, header:size()
+ *     14, nil
+ *     > = header:unpack(data)
+ *     3405691582, 1, 2, 'name', 15
+ */
+
+#include "lua_apr.h"
+#include <apr_lib.h>
+
+/* Internal functions. {{{1 */
+
+typedef struct {
+  char type;          /* one of the characters 'i', 'f', 'c', 's' or 'x' */
+  char big_endian;    /* byte order of integers, floats and length prefixes */
+  char is_signed;     /* signed integer? */
+  unsigned char size; /* size of number or length prefix in bytes */
+  size_t length;      /* size of fixed size strings */
+} lua_apr_struct_field;
+
+struct lua_apr_struct_object {
+  lua_apr_refobj header;
+  lua_apr_struct_field *fields;
+  int nfields, nvalues, variable;
+  size_t size; /* minimum size in bytes */
+};
+
+/* The registry key of the table that caches compiled format strings. */
+static const char *cache_key = "Lua/APR compiled structure formats";
+
+/* native_big_endian() {{{2 */
+
+static int native_big_endian(void)
+{
+  const apr_uint16_t test = 1;
+  return *(const unsigned char*) &test == 0;
+}
+
+/* parse_size() {{{2 */
+
+static size_t parse_size(lua_State *L, const char **fmt, size_t def, size_t max)
+{
+  size_t size = 0;
+
+  if (!apr_isdigit(**fmt))
+    return def;
+  while (apr_isdigit(**fmt)) {
+    size = size * 10 + (*(*fmt)++ - '0');
+    if (size > max)
+      luaL_error(L, "size in structure format out of range");
+  }
+  if (size == 0)
+    luaL_error(L, "size in structure format can't be zero");
+
+  return size;
+}
+
+/* compile_format() {{{2
+ *
+ * Compile a format string into a new structure descriptor which is pushed
+ * onto the Lua stack.
+ */
+
+static lua_apr_struct_object *compile_format(lua_State *L, const char *format)
+{
+  lua_apr_struct_object *S;
+  lua_apr_struct_field *F;
+  const char *fmt;
+  int big_endian = native_big_endian();
+  char option;
+
+  S = new_object(L, &lua_apr_struct_type);
+  /* Every option consumes at least one character. */
+  S->fields = malloc(strlen(format) * sizeof S->fields[0] + 1);
+  if (S->fields == NULL)
+    raise_error_memory(L);
+
+  for (fmt = format; *fmt != '\0';) {
+    option = *fmt++;
+    F = &S->fields[S->nfields];
+    F->big_endian = big_endian;
+    F->is_signed = apr_islower(option);
+    F->length = 0;
+    switch (option) {
+      case ' ': continue;
+      case '<': big_endian = 0; continue;
+      case '>': big_endian = 1; continue;
+      case '=': big_endian = native_big_endian(); continue;
+      case 'b': case 'B': F->type = 'i'; F->size = 1; break;
+      case 'h': case 'H': F->type = 'i'; F->size = 2; break;
+      case 'l': case 'L': F->type = 'i'; F->size = 8; break;
+      case 'i': case 'I':
+        F->type = 'i';
+        F->size = (unsigned char) parse_size(L, &fmt, 4, 8);
+        break;
+      case 'f': F->type = 'f'; F->size = sizeof(float); break;
+      case 'd': F->type = 'f'; F->size = sizeof(double); break;
+      case 'c':
+        F->type = 'c';
+        F->size = 0;
+        F->length = parse_size(L, &fmt, 0, APR_SIZE_MAX / 2);
+        if (F->length == 0)
+          luaL_error(L, "missing size for format option 'c'");
+        break;
+      case 's':
+        F->type = 's';
+        F->size = (unsigned char) parse_size(L, &fmt, 4, 8);
+        S->variable = 1;
+        break;
+      case 'x': F->type = 'x'; F->size = 1; break;
+      default:
+        luaL_error(L, "invalid format option '%c'", option);
+    }
+    S->size += F->type == 'c' ? F->length : F->size;
+    if (F->type != 'x')
+      S->nvalues++;
+    S->nfields++;
+  }
+
+  return S;
+}
+
+/* encode_uint() / decode_uint() {{{2 */
+
+static void encode_uint(char *p, apr_uint64_t value, int size, int big_endian)
+{
+  int i;
+  for (i = 0; i < size; i++, value >>= 8)
+    p[big_endian ? size - i - 1 : i] = (char) (value & 0xFF);
+}
+
+static apr_uint64_t decode_uint(const char *p, int size, int big_endian)
+{
+  const unsigned char *q = (const unsigned char*) p;
+  apr_uint64_t value = 0;
+  int i;
+  for (i = 0; i < size; i++)
+    value = (value << 8) | q[big_endian ? i : size - i - 1];
+  return value;
+}
+
+/* copy_ordered() {{{2
+ *
+ * Copy the bytes of a floating point number, reversing them when the byte
+ * order of the field isn't the native byte order.
+ */
+
+static void copy_ordered(char *dst, const char *src, int size, int big_endian)
+{
+  int i;
+  if (big_endian == native_big_endian())
+    memcpy(dst, src, size);
+  else
+    for (i = 0; i < size; i++)
+      dst[i] = src[size - i - 1];
+}
+
+/* check_integer() {{{2 */
+
+static apr_uint64_t check_integer(lua_State *L, int idx, lua_apr_struct_field *F)
+{
+  lua_Number value = luaL_checknumber(L, idx), limit;
+
+  if (F->size < 8) {
+    limit = (lua_Number) ((apr_uint64_t) 1 << (F->size * 8));
+    if (F->is_signed ? (value < -limit / 2 || value >= limit / 2) : (value < 0 || value >= limit))
+      luaL_argerror(L, idx, "integer overflow");
+  } else if (!F->is_signed && value < 0) {
+    luaL_argerror(L, idx, "integer overflow");
+  }
+  if (F->is_signed)
+    return (apr_uint64_t) (apr_int64_t) value;
+  return (apr_uint64_t) value;
+}
+
+/* check_struct() {{{2
+ *
+ * Get the structure descriptor at the given stack index. Format strings are
+ * compiled and cached (in a table with weak values) and replaced on the stack
+ * by their descriptor so that it isn't garbage collected while in use.
+ */
+
+lua_apr_struct_object *check_struct(lua_State *L, int idx)
+{
+  lua_apr_struct_object *S;
+
+  if (lua_type(L, idx) != LUA_TSTRING)
+    return check_object(L, idx, &lua_apr_struct_type);
+
+  lua_getfield(L, LUA_REGISTRYINDEX, cache_key);
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushliteral(L, "v");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, cache_key);
+  }
+  lua_pushvalue(L, idx);
+  lua_rawget(L, -2);
+  if (lua_isuserdata(L, -1)) {
+    S = check_object(L, -1, &lua_apr_struct_type);
+  } else {
+    lua_pop(L, 1);
+    S = compile_format(L, lua_tostring(L, idx));
+    lua_pushvalue(L, idx);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);
+  }
+  lua_replace(L, idx);
+  lua_pop(L, 1);
+
+  return S;
+}
+
+/* struct_unpack() {{{2
+ *
+ * Decode a structure from the @avail bytes at @data and push the values onto
+ * the Lua stack. Returns the number of values pushed and sets *length to the
+ * number of bytes used. When @avail isn't enough nothing is pushed, -1 is
+ * returned and *length is set to the minimum number of bytes needed.
+ */
+
+int struct_unpack(lua_State *L, lua_apr_struct_object *S, const char *data, size_t avail, size_t *length)
+{
+  lua_apr_struct_field *F;
+  size_t offset = 0, needed;
+  apr_uint64_t value;
+  int i, top = lua_gettop(L);
+  double d;
+  float f;
+
+  luaL_checkstack(L, S->nvalues, "too many values in structure");
+  for (i = 0; i < S->nfields; i++) {
+    F = &S->fields[i];
+    needed = F->type == 'c' ? F->length : F->size;
+    if (avail - offset < needed)
+      goto incomplete;
+    switch (F->type) {
+      case 'i':
+        value = decode_uint(data + offset, F->size, F->big_endian);
+        if (F->is_signed && F->size < 8 && (value >> (F->size * 8 - 1)) != 0)
+          value |= ~(apr_uint64_t) 0 << (F->size * 8);
+        if (F->is_signed)
+          lua_pushnumber(L, (lua_Number) (apr_int64_t) value);
+        else
+          lua_pushnumber(L, (lua_Number) value);
+        break;
+      case 'f':
+        if (F->size == sizeof(float)) {
+          copy_ordered((char*) &f, data + offset, F->size, F->big_endian);
+          lua_pushnumber(L, f);
+        } else {
+          copy_ordered((char*) &d, data + offset, F->size, F->big_endian);
+          lua_pushnumber(L, d);
+        }
+        break;
+      case 'c':
+        lua_pushlstring(L, data + offset, F->length);
+        break;
+      case 's':
+        value = decode_uint(data + offset, F->size, F->big_endian);
+        if (value > APR_SIZE_MAX - offset - needed) {
+          /* Can't possibly be buffered. */
+          lua_settop(L, top);
+          *length = APR_SIZE_MAX;
+          return -1;
+        }
+        if (avail - offset - needed < value) {
+          needed += (size_t) value;
+          goto incomplete;
+        }
+        lua_pushlstring(L, data + offset + needed, (size_t) value);
+        needed += (size_t) value;
+        break;
+    }
+    offset += needed;
+  }
+
+  *length = offset;
+  return lua_gettop(L) - top;
+
+incomplete:
+  lua_settop(L, top);
+  *length = offset + needed;
+  return -1;
+}
+
+/* struct_packsize() {{{2
+ *
+ * Check the values for a structure starting at stack index @first and
+ * return the number of bytes needed to pack them.
+ */
+
+size_t struct_packsize(lua_State *L, lua_apr_struct_object *S, int first)
+{
+  lua_apr_struct_field *F;
+  size_t total = 0, length;
+  int i, idx = first;
+
+  for (i = 0; i < S->nfields; i++) {
+    F = &S->fields[i];
+    switch (F->type) {
+      case 'i':
+        check_integer(L, idx++, F);
+        total += F->size;
+        break;
+      case 'f':
+        luaL_checknumber(L, idx++);
+        total += F->size;
+        break;
+      case 'c':
+        luaL_checklstring(L, idx, &length);
+        luaL_argcheck(L, length <= F->length, idx, "string longer than field");
+        idx++;
+        total += F->length;
+        break;
+      case 's':
+        luaL_checklstring(L, idx, &length);
+        luaL_argcheck(L, F->size == 8 || length < ((apr_uint64_t) 1 << (F->size * 8)),
+            idx, "string too long for length prefix");
+        idx++;
+        total += F->size + length;
+        break;
+      case 'x':
+        total += 1;
+        break;
+    }
+  }
+
+  return total;
+}
+
+/* struct_pack() {{{2
+ *
+ * Encode the values starting at stack index @first into the memory at @out,
+ * which must be at least struct_packsize() bytes.
+ */
+
+void struct_pack(lua_State *L, lua_apr_struct_object *S, int first, char *out)
+{
+  lua_apr_struct_field *F;
+  const char *string;
+  size_t length;
+  int i, idx = first;
+  double d;
+  float f;
+
+  for (i = 0; i < S->nfields; i++) {
+    F = &S->fields[i];
+    switch (F->type) {
+      case 'i':
+        encode_uint(out, check_integer(L, idx++, F), F->size, F->big_endian);
+        out += F->size;
+        break;
+      case 'f':
+        if (F->size == sizeof(float)) {
+          f = (float) lua_tonumber(L, idx++);
+          copy_ordered(out, (const char*) &f, F->size, F->big_endian);
+        } else {
+          d = (double) lua_tonumber(L, idx++);
+          copy_ordered(out, (const char*) &d, F->size, F->big_endian);
+        }
+        out += F->size;
+        break;
+      case 'c':
+        string = lua_tolstring(L, idx++, &length);
+        memcpy(out, string, length);
+        memset(out + length, 0, F->length - length);
+        out += F->length;
+        break;
+      case 's':
+        string = lua_tolstring(L, idx++, &length);
+        encode_uint(out, length, F->size, F->big_endian);
+        memcpy(out + F->size, string, length);
+        out += F->size + length;
+        break;
+      case 'x':
+        *out++ = '\0';
+        break;
+    }
+  }
+}
+
+/* apr.struct(format) -> struct {{{1
+ *
+ * Compile the string @format into a structure descriptor. See the
+ * introduction of this module for the supported options. Note that the
+ * methods that accept a structure descriptor also accept a format string,
+ * which is compiled on first use and cached.
+ */
+
+int lua_apr_struct(lua_State *L)
+{
+  luaL_checkstring(L, 1);
+  lua_settop(L, 1);
+  check_struct(L, 1);
+  return 1;
+}
+
+/* struct:size() -> bytes {{{1
+ *
+ * Get the size in bytes of the structure. When the structure contains length
+ * prefixed strings (which means its size depends on the values) nil is
+ * returned instead.
+ */
+
+static int struct_size(lua_State *L)
+{
+  lua_apr_struct_object *S = check_struct(L, 1);
+  if (S->variable)
+    lua_pushnil(L);
+  else
+    lua_pushinteger(L, S->size);
+  return 1;
+}
+
+/* struct:pack(value [, ...]) -> string {{{1
+ *
+ * Encode the given values according to the structure and return the
+ * resulting string.
+ */
+
+static int struct_pack_method(lua_State *L)
+{
+  lua_apr_struct_object *S = check_struct(L, 1);
+  size_t size = struct_packsize(L, S, 2);
+  luaL_Buffer buffer;
+  char *out;
+
+  if (size <= LUAL_BUFFERSIZE) {
+    luaL_buffinit(L, &buffer);
+    out = luaL_prepbuffer(&buffer);
+    struct_pack(L, S, 2, out);
+    luaL_addsize(&buffer, size);
+    luaL_pushresult(&buffer);
+  } else {
+    out = lua_newuserdata(L, size);
+    struct_pack(L, S, 2, out);
+    lua_pushlstring(L, out, size);
+  }
+
+  return 1;
+}
+
+/* struct:unpack(string [, init]) -> value, ..., next {{{1
+ *
+ * Decode the values of the structure from @string starting at the byte offset
+ * @init (which defaults to 1). The decoded values are returned followed by
+ * the offset of the first byte after the structure. If @string is too short
+ * an error is raised.
+ */
+
+static int struct_unpack_method(lua_State *L)
+{
+  lua_apr_struct_object *S = check_struct(L, 1);
+  const char *data;
+  size_t length, used;
+  lua_Integer init;
+  int n;
+
+  data = luaL_checklstring(L, 2, &length);
+  init = luaL_optinteger(L, 3, 1);
+  luaL_argcheck(L, init >= 1 && (size_t) init <= length + 1, 3, "initial position out of string");
+  n = struct_unpack(L, S, data + init - 1, length - (init - 1), &used);
+  if (n < 0)
+    luaL_argerror(L, 2, "data string too short");
+  lua_pushinteger(L, init + used);
+
+  return n + 1;
+}
+
+/* struct:__tostring() {{{1 */
+
+static int struct_tostring(lua_State *L)
+{
+  lua_apr_struct_object *S = check_struct(L, 1);
+  lua_pushfstring(L, "%s (%p)", lua_apr_struct_type.friendlyname, S);
+  return 1;
+}
+
+/* struct:__gc() {{{1 */
+
+static int struct_gc(lua_State *L)
+{
+  lua_apr_struct_object *S = check_object(L, 1, &lua_apr_struct_type);
+  if (object_collectable((lua_apr_refobj*)S)) {
+    free(S->fields);
+    S->fields = NULL;
+  }
+  release_object((lua_apr_refobj*)S);
+  return 0;
+}
+
+/* }}} */
+
+static luaL_reg struct_methods[] = {
+  { "size", struct_size },
+  { "pack", struct_pack_method },
+  { "unpack", struct_unpack_method },
+  { NULL, NULL },
+};
+
+static luaL_reg struct_metamethods[] = {
+  { "__tostring", struct_tostring },
+  { "__eq", objects_equal },
+  { "__gc", struct_gc },
+  { NULL, NULL },
+};
+
+lua_apr_objtype lua_apr_struct_type = {
+  "lua_apr_struct_object*",      /* metatable name in registry */
+  "struct",                      /* friendly object name */
+  sizeof(lua_apr_struct_object), /* structure size */
+  struct_methods,                /* methods table */
+  struct_metamethods             /* metamethods table */
+};
+
+/* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
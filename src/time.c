@@ -25,6 +25,28 @@
 #include "lua_apr.h"
 #include <apr_time.h>
 #include <apr_date.h>
+#include <apr_portable.h>
+#include <time.h>
+
+#if defined(_MSC_VER)
+# include <intrin.h>
+#elif defined(__APPLE__)
+# include <mach/mach_time.h>
+#endif
+
+/* Interval timers are implemented on top of timerfd_create() which means
+ * they're only available on Linux (2.6.25 and newer). */
+#if defined(__linux__)
+# include <sys/timerfd.h>
+# include <poll.h>
+# include <unistd.h>
+# include <errno.h>
+# define LUA_APR_HAVE_TIMERFD 1
+#else
+# define LUA_APR_HAVE_TIMERFD 0
+#endif
+
+#define NSEC_PER_SEC 1000000000
 
 /* Internal functions {{{1 */
 
@@ -98,6 +120,104 @@ int time_push(lua_State *L, apr_time_t time)
   return 1;
 }
 
+/* monotonic_now() returns the value of a monotonic clock in nanoseconds. {{{2 */
+
+apr_uint64_t monotonic_now(void)
+{
+# if defined(WIN32)
+  static LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  /* Split the conversion in two to avoid overflowing 64 bits. */
+  return (apr_uint64_t) (counter.QuadPart / frequency.QuadPart) * NSEC_PER_SEC
+       + (apr_uint64_t) (counter.QuadPart % frequency.QuadPart) * NSEC_PER_SEC / frequency.QuadPart;
+# elif defined(__APPLE__)
+  static mach_timebase_info_data_t timebase;
+  if (timebase.denom == 0)
+    mach_timebase_info(&timebase);
+  return mach_absolute_time() * timebase.numer / timebase.denom;
+# elif defined(CLOCK_MONOTONIC)
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (apr_uint64_t) now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+# else
+  /* XXX Not monotonic, but better than nothing. */
+  return (apr_uint64_t) apr_time_now() * 1000;
+# endif
+}
+
+/* read_cycle_counter() reads the CPU's time stamp counter. {{{2 */
+
+static apr_uint64_t read_cycle_counter(void)
+{
+# if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  return __rdtsc();
+# elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+  apr_uint32_t low, high;
+  __asm__ __volatile__ ("rdtsc" : "=a" (low), "=d" (high));
+  return ((apr_uint64_t) high << 32) | low;
+# elif defined(__GNUC__) && defined(__aarch64__)
+  apr_uint64_t value;
+  __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (value));
+  return value;
+# else
+  /* Fall back to the monotonic clock on other architectures. */
+  return monotonic_now();
+# endif
+}
+
+/* check_timer() {{{2 */
+
+static lua_apr_timer *check_timer(lua_State *L, int idx, int open)
+{
+  lua_apr_timer *timer = check_object(L, idx, &lua_apr_timer_type);
+  if (open && timer->handle == NULL)
+    luaL_error(L, "attempt to use a closed timer");
+  return timer;
+}
+
+#if LUA_APR_HAVE_TIMERFD
+
+/* timer_arm() {{{2 */
+
+static apr_status_t timer_arm(lua_apr_timer *timer, apr_interval_time_t interval, apr_interval_time_t initial)
+{
+  struct itimerspec spec;
+
+  spec.it_interval.tv_sec = apr_time_sec(interval);
+  spec.it_interval.tv_nsec = apr_time_usec(interval) * 1000;
+  spec.it_value.tv_sec = apr_time_sec(initial);
+  spec.it_value.tv_nsec = apr_time_usec(initial) * 1000;
+  if (timerfd_settime(timer->fd, 0, &spec, NULL) != 0)
+    return apr_get_os_error();
+  timer->interval = interval;
+
+  return APR_SUCCESS;
+}
+
+#endif
+
+/* timer_close_impl() {{{2 */
+
+static apr_status_t timer_close_impl(lua_apr_timer *timer)
+{
+  apr_status_t status = APR_SUCCESS;
+
+  if (timer->handle != NULL) {
+    /* Closes the file descriptor created by timerfd_create(). */
+    status = apr_file_close(timer->handle);
+    timer->handle = NULL;
+  }
+  if (timer->pool != NULL) {
+    apr_pool_destroy(timer->pool);
+    timer->pool = NULL;
+  }
+
+  return status;
+}
+
 /* apr.sleep(seconds) -> nothing {{{1
  *
  * Sleep for the specified number of @seconds. Sub-second resolution is
@@ -125,6 +245,54 @@ int lua_apr_time_now(lua_State *L)
   return time_push(L, apr_time_now());
 }
 
+/* apr.clock_monotonic() -> nanoseconds {{{1
+ *
+ * Get the current value of a [monotonic clock] [monotonic] as a number of
+ * nanoseconds. Unlike `apr.time_now()` the monotonic clock isn't affected by
+ * changes to the system's wall-clock time (e.g. by [NTP] [ntp] adjustments)
+ * so it's suitable for measuring intervals and latencies:
+ *
+ *     > start = apr.clock_monotonic()
+ *     > do_something()
+ *     > print('took', apr.clock_monotonic() - start, 'nanoseconds')
+ *
+ * The starting point of the clock is unspecified (on Linux it's the moment
+ * the system booted) so only the difference between two values is
+ * meaningful. Note that Lua numbers are double precision floating point
+ * numbers, which means the values returned by this function lose their
+ * nanosecond precision after roughly 100 days of system uptime (the
+ * resolution degrades gracefully to a few nanoseconds).
+ *
+ * [monotonic]: http://linux.die.net/man/3/clock_gettime
+ * [ntp]: http://en.wikipedia.org/wiki/Network_Time_Protocol
+ */
+
+int lua_apr_clock_monotonic(lua_State *L)
+{
+  lua_pushnumber(L, (lua_Number) monotonic_now());
+  return 1;
+}
+
+/* apr.cycles() -> counter {{{1
+ *
+ * Read the processor's [time stamp counter] [tsc] and return it as a number.
+ * This is the cheapest way to take a timestamp but the result is measured in
+ * CPU ticks instead of a unit of time, the counter may not be synchronized
+ * between processors and its frequency may vary with power management on
+ * older hardware. Use it to compare the relative cost of code fragments, use
+ * `apr.clock_monotonic()` when you need time measurements. On platforms
+ * without a time stamp counter the value of `apr.clock_monotonic()` is
+ * returned instead.
+ *
+ * [tsc]: http://en.wikipedia.org/wiki/Time_Stamp_Counter
+ */
+
+int lua_apr_cycles(lua_State *L)
+{
+  lua_pushnumber(L, (lua_Number) read_cycle_counter());
+  return 1;
+}
+
 /* apr.time_explode([time [, timezone]]) -> components {{{1
  *
  * Convert the numeric value @time (current time if none given) to its human
@@ -282,4 +450,248 @@ int lua_apr_time_format(lua_State *L)
   }
 }
 
+/* apr.timerfd(interval [, initial]) -> timer {{{1
+ *
+ * Create an interval timer that expires every @interval seconds (sub-second
+ * resolution is supported), starting after @initial seconds (defaults to
+ * @interval). When @interval is zero and @initial isn't given the timer is
+ * created disarmed, use `timer:set()` to start it. On success the timer
+ * object is returned, otherwise a nil followed by an error message is
+ * returned.
+ *
+ * Timer objects can be added to a pollset using `pollset:add(timer,
+ * 'input')` in which case they will be returned in the list of readable
+ * objects when they've expired. This makes it possible to combine periodic
+ * tasks with network I/O in a single event loop:
+ *
+ *     local pollset = assert(apr.pollset(10))
+ *     local timer = assert(apr.timerfd(0.5))
+ *     assert(pollset:add(timer, 'input'))
+ *     while true do
+ *       local readable = assert(pollset:poll(-1))
+ *       for _, object in ipairs(readable) do
+ *         if object == timer then
+ *           -- Acknowledge the expiration(s) and run the periodic task.
+ *           local expirations = timer:read()
+ *         end
+ *       end
+ *     end
+ *
+ * The timer is based on the monotonic clock so it's not affected by changes
+ * to the system time. Timers are only available on Linux, on other platforms
+ * the error code `'ENOTIMPL'` is returned.
+ */
+
+int lua_apr_timerfd(lua_State *L)
+{
+  lua_apr_timer *timer;
+  apr_status_t status;
+  apr_interval_time_t interval, initial;
+
+  luaL_checktype(L, 1, LUA_TNUMBER);
+  interval = time_get(L, 1);
+  initial = lua_isnoneornil(L, 2) ? interval : time_get(L, 2);
+  luaL_argcheck(L, interval >= 0, 1, "interval must be positive");
+  luaL_argcheck(L, initial > 0 || lua_isnoneornil(L, 2), 2, "initial expiration must be positive");
+
+  timer = new_object(L, &lua_apr_timer_type);
+# if LUA_APR_HAVE_TIMERFD
+  status = apr_pool_create(&timer->pool, NULL);
+  if (status == APR_SUCCESS) {
+    timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer->fd < 0) {
+      status = apr_get_os_error();
+    } else {
+      /* Wrap the descriptor in an APR file so that it can be polled. */
+      status = apr_os_file_put(&timer->handle, &timer->fd, APR_FOPEN_READ, timer->pool);
+      if (status != APR_SUCCESS)
+        close(timer->fd);
+      else
+        status = timer_arm(timer, interval, initial);
+    }
+  }
+  if (status == APR_SUCCESS)
+    return 1;
+  timer_close_impl(timer);
+# else
+  status = APR_ENOTIMPL;
+# endif
+
+  return push_error_status(L, status);
+}
+
+/* timer:read() -> expirations {{{1
+ *
+ * Get the number of times @timer has expired since the timer was created or
+ * since the last call to `timer:read()` (this acknowledges the expirations).
+ * This function never blocks: If the timer hasn't expired yet zero is
+ * returned. On error a nil followed by an error message is returned.
+ */
+
+static int timer_read(lua_State *L)
+{
+  lua_apr_timer *timer = check_timer(L, 1, 1);
+# if LUA_APR_HAVE_TIMERFD
+  apr_uint64_t expirations = 0;
+
+  if (read(timer->fd, &expirations, sizeof expirations) < 0 && errno != EAGAIN)
+    return push_error_status(L, apr_get_os_error());
+  lua_pushnumber(L, (lua_Number) expirations);
+  return 1;
+# else
+  (void) timer;
+  return push_error_status(L, APR_ENOTIMPL);
+# endif
+}
+
+/* timer:wait([timeout]) -> expirations {{{1
+ *
+ * Block until @timer expires or @timeout seconds have passed (the default is
+ * to wait forever), then return the number of expirations like
+ * `timer:read()` does. This is a simple alternative to a pollset when all you
+ * need is a periodic task. On error a nil followed by an error message is
+ * returned.
+ */
+
+static int timer_wait(lua_State *L)
+{
+  lua_apr_timer *timer = check_timer(L, 1, 1);
+# if LUA_APR_HAVE_TIMERFD
+  struct pollfd pfd;
+  int timeout;
+
+  timeout = lua_isnoneornil(L, 2) ? -1 : (int) (time_get(L, 2) / 1000);
+  pfd.fd = timer->fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  while (poll(&pfd, 1, timeout) < 0)
+    if (errno != EINTR)
+      return push_error_status(L, apr_get_os_error());
+  lua_settop(L, 1);
+  return timer_read(L);
+# else
+  (void) timer;
+  return push_error_status(L, APR_ENOTIMPL);
+# endif
+}
+
+/* timer:set(interval [, initial]) -> status {{{1
+ *
+ * Change the @interval of @timer and restart it so that it next expires after
+ * @initial seconds (defaults to @interval). An @interval of zero makes the
+ * timer expire only once, or stops the timer when @initial isn't given. On
+ * success true is returned, otherwise a nil followed by an error message is
+ * returned.
+ */
+
+static int timer_set(lua_State *L)
+{
+  lua_apr_timer *timer;
+  apr_interval_time_t interval, initial;
+
+  timer = check_timer(L, 1, 1);
+  luaL_checktype(L, 2, LUA_TNUMBER);
+  interval = time_get(L, 2);
+  initial = lua_isnoneornil(L, 3) ? interval : time_get(L, 3);
+  luaL_argcheck(L, interval >= 0, 2, "interval must be positive");
+  luaL_argcheck(L, initial > 0 || lua_isnoneornil(L, 3), 3, "initial expiration must be positive");
+# if LUA_APR_HAVE_TIMERFD
+  return push_status(L, timer_arm(timer, interval, initial));
+# else
+  return push_status(L, APR_ENOTIMPL);
+# endif
+}
+
+/* timer:interval_get() -> interval {{{1
+ *
+ * Get the interval of @timer in seconds.
+ */
+
+static int timer_interval_get(lua_State *L)
+{
+  lua_apr_timer *timer = check_timer(L, 1, 1);
+  return time_push(L, timer->interval);
+}
+
+#if !defined(WIN32) && !defined(OS2) && !defined(NETWARE)
+
+/* timer:fd_get() -> fd {{{1
+ *
+ * Get the underlying file descriptor of @timer (a number).
+ */
+
+static int timer_fd_get(lua_State *L)
+{
+  lua_apr_timer *timer = check_timer(L, 1, 1);
+  lua_pushinteger(L, timer->fd);
+  return 1;
+}
+
+#endif
+
+/* timer:close() -> status {{{1
+ *
+ * Stop and close @timer. On success true is returned, otherwise a nil followed
+ * by an error message is returned. Timers are automatically closed when they
+ * are garbage collected.
+ */
+
+static int timer_close(lua_State *L)
+{
+  lua_apr_timer *timer = check_timer(L, 1, 1);
+  return push_status(L, timer_close_impl(timer));
+}
+
+/* timer:__tostring() {{{1 */
+
+static int timer_tostring(lua_State *L)
+{
+  lua_apr_timer *timer = check_timer(L, 1, 0);
+  if (timer->handle != NULL)
+    lua_pushfstring(L, "%s (%p)", lua_apr_timer_type.friendlyname, timer->handle);
+  else
+    lua_pushfstring(L, "%s (closed)", lua_apr_timer_type.friendlyname);
+  return 1;
+}
+
+/* timer:__gc() {{{1 */
+
+static int timer_gc(lua_State *L)
+{
+  lua_apr_timer *timer = check_timer(L, 1, 0);
+  if (object_collectable((lua_apr_refobj*)timer))
+    timer_close_impl(timer);
+  release_object((lua_apr_refobj*)timer);
+  return 0;
+}
+
+/* Internal object definitions. {{{1 */
+
+static luaL_Reg timer_methods[] = {
+  { "read", timer_read },
+  { "wait", timer_wait },
+  { "set", timer_set },
+  { "interval_get", timer_interval_get },
+# if !defined(WIN32) && !defined(OS2) && !defined(NETWARE)
+  { "fd_get", timer_fd_get },
+# endif
+  { "close", timer_close },
+  { NULL, NULL }
+};
+
+static luaL_Reg timer_metamethods[] = {
+  { "__tostring", timer_tostring },
+  { "__eq", objects_equal },
+  { "__gc", timer_gc },
+  { NULL, NULL }
+};
+
+lua_apr_objtype lua_apr_timer_type = {
+  "lua_apr_timer*",      /* metatable name in registry */
+  "timer",               /* friendly object name */
+  sizeof(lua_apr_timer), /* structure size */
+  timer_methods,         /* methods table */
+  timer_metamethods      /* metamethods table */
+};
+
 /* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
@@ -19,22 +19,237 @@
 
 #include "lua_apr.h"
 #include <apr_uuid.h>
+#include <apr_general.h>
+
+#if defined(WIN32)
+# include <process.h>
+# define uuidgen_getpid() ((long) _getpid())
+#else
+# include <unistd.h>
+# define uuidgen_getpid() ((long) getpid())
+#endif
 
 #define APR_UUID_LENGTH sizeof(apr_uuid_t)
 
-/* apr.uuid_get() -> binary {{{1
+/* Thread local storage for the UUID generator state, so that generating UUIDs
+ * doesn't require any locking. Without compiler support the state is shared
+ * between threads and protected by a spin lock, because unsynchronized updates
+ * could make two threads generate the same UUID. */
+#if defined(_MSC_VER)
+# define LUA_APR_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+# define LUA_APR_THREAD_LOCAL __thread
+#else
+# define LUA_APR_THREAD_LOCAL
+# define LUA_APR_UUIDGEN_SHARED APR_HAS_THREADS
+#endif
+
+#if LUA_APR_UUIDGEN_SHARED
+static volatile apr_uint32_t generator_lock = 0;
+# define uuidgen_lock() \
+  while (apr_atomic_cas32(&generator_lock, 1, 0) != 0) apr_thread_yield()
+# define uuidgen_unlock() apr_atomic_set32(&generator_lock, 0)
+#else
+# define uuidgen_lock() ((void) 0)
+# define uuidgen_unlock() ((void) 0)
+#endif
+
+typedef struct {
+  int seeded;
+  long pid; /* process that seeded the generator */
+  apr_uint64_t state[2];
+  apr_uint64_t last_ms;
+  unsigned int counter;
+} lua_apr_uuidgen;
+
+static LUA_APR_THREAD_LOCAL lua_apr_uuidgen generator;
+
+static const char hexdigits[] = "0123456789abcdef";
+
+/* Internal functions. {{{1 */
+
+/* uuidgen_next() {{{2
+ *
+ * Get 64 pseudo random bits from the per-thread generator (xorshift128+). The
+ * generator is seeded on first use from the system's random number generator
+ * (if available) so that UUIDs generated by different threads and processes
+ * don't collide. It's seeded again when the process ID changes, because a
+ * child created by apr.proc_fork() inherits the state of its parent.
+ */
+
+static apr_uint64_t uuidgen_next(lua_apr_uuidgen *gen)
+{
+  apr_uint64_t x, y;
+  long pid = uuidgen_getpid();
+
+  if (!gen->seeded || gen->pid != pid) {
+#   if APR_HAS_RANDOM
+    if (apr_generate_random_bytes((unsigned char *) gen->state, sizeof gen->state) != APR_SUCCESS)
+#   endif
+    {
+      gen->state[0] = (apr_uint64_t) apr_time_now() ^ (apr_uint64_t) (apr_uintptr_t) gen;
+      gen->state[1] = monotonic_now() ^ 0x9E3779B97F4A7C15ULL ^ ((apr_uint64_t) pid << 32);
+    }
+    if (gen->state[0] == 0 && gen->state[1] == 0)
+      gen->state[1] = 1;
+    gen->seeded = 1;
+    gen->pid = pid;
+  }
+
+  x = gen->state[0];
+  y = gen->state[1];
+  gen->state[0] = y;
+  x ^= x << 23;
+  gen->state[1] = x ^ y ^ (x >> 17) ^ (y >> 26);
+  return gen->state[1] + y;
+}
+
+/* uuid_generate() {{{2
+ *
+ * Generate a UUID of the given version. Version 4 UUIDs consist of 122 random
+ * bits, version 7 UUIDs start with a 48-bit big endian Unix timestamp in
+ * milliseconds followed by a 12-bit counter that keeps UUIDs generated by the
+ * same thread in the same millisecond ordered (RFC 9562, method 1). Other
+ * versions use apr_uuid_get().
+ */
+
+static void uuid_generate(apr_uuid_t *uuid, int version)
+{
+  lua_apr_uuidgen *gen = &generator;
+  apr_uint64_t bits, ms;
+  int i;
+
+  if (version != 4 && version != 7) {
+    apr_uuid_get(uuid);
+    return;
+  }
+
+  uuidgen_lock();
+  if (version == 4) {
+    bits = uuidgen_next(gen);
+    for (i = 0; i < 8; i++)
+      uuid->data[i] = (unsigned char) (bits >> (i * 8));
+    bits = uuidgen_next(gen);
+    for (i = 0; i < 8; i++)
+      uuid->data[8 + i] = (unsigned char) (bits >> (i * 8));
+  } else {
+    ms = (apr_uint64_t) apr_time_as_msec(apr_time_now());
+    if (ms > gen->last_ms) {
+      /* Start the counter at a random value below half its range. */
+      gen->last_ms = ms;
+      gen->counter = (unsigned int) (uuidgen_next(gen) & 0x7FF);
+    } else if (++gen->counter > 0xFFF) {
+      /* Counter overflow or clock went backwards: borrow from the future. */
+      gen->last_ms++;
+      gen->counter = (unsigned int) (uuidgen_next(gen) & 0x7FF);
+    }
+    ms = gen->last_ms;
+    for (i = 0; i < 6; i++)
+      uuid->data[i] = (unsigned char) (ms >> ((5 - i) * 8));
+    uuid->data[6] = (unsigned char) (gen->counter >> 8);
+    uuid->data[7] = (unsigned char) gen->counter;
+    bits = uuidgen_next(gen);
+    for (i = 0; i < 8; i++)
+      uuid->data[8 + i] = (unsigned char) (bits >> (i * 8));
+  }
+  uuidgen_unlock();
+
+  /* Set the version and variant bits. */
+  uuid->data[6] = (unsigned char) ((uuid->data[6] & 0x0F) | (version << 4));
+  uuid->data[8] = (unsigned char) ((uuid->data[8] & 0x3F) | 0x80);
+}
+
+/* uuid_hexformat() {{{2
+ *
+ * Format a binary UUID in the standard format without going through
+ * sprintf() like apr_uuid_format() does. The @formatted buffer must have room
+ * for APR_UUID_FORMATTED_LENGTH characters (no NUL terminator is written).
+ */
+
+static void uuid_hexformat(char *formatted, const unsigned char *uuid)
+{
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    if (i == 4 || i == 6 || i == 8 || i == 10)
+      *formatted++ = '-';
+    *formatted++ = hexdigits[uuid[i] >> 4];
+    *formatted++ = hexdigits[uuid[i] & 0x0F];
+  }
+}
+
+/* check_uuid_version() {{{2 */
+
+static int check_uuid_version(lua_State *L, int idx, int def)
+{
+  int version = luaL_optint(L, idx, def);
+  luaL_argcheck(L, version == 1 || version == 4 || version == 7, idx,
+      "version must be 1, 4 or 7");
+  return version;
+}
+
+/* apr.uuid_get([version]) -> binary {{{1
  *
- * Generate and return a UUID as a binary string of 16 bytes.
+ * Generate and return a UUID as a binary string of 16 bytes. By default the
+ * UUID is generated by APR, based on the time and the host. When the optional
+ * @version is 4 a random UUID is returned and when it is 7 a time ordered
+ * UUID is returned: These sort in order of creation which improves index
+ * locality when they are used as database keys. Note that version 4 and 7
+ * UUIDs are generated from a fast pseudo random number generator, this means
+ * they're unique but shouldn't be used as secrets.
  */
 
 int lua_apr_uuid_get(lua_State *L)
 {
   apr_uuid_t uuid;
-  apr_uuid_get(&uuid);
+  uuid_generate(&uuid, check_uuid_version(L, 1, 1));
   lua_pushlstring(L, (const char *) uuid.data, sizeof uuid);
   return 1;
 }
 
+/* apr.uuid_batch(n [, format [, version]]) -> uuids {{{1
+ *
+ * Generate @n UUIDs at once and return them in a table. This is a lot faster
+ * than calling `apr.uuid_get()` and `apr.uuid_format()` @n times. The
+ * optional @format can be `'binary'` (the default) for strings of 16 bytes or
+ * `'string'` for standard format UUIDs. The optional @version is the same as
+ * for `apr.uuid_get()` except that it defaults to 4, because the random and
+ * time ordered UUIDs don't need the lock that APR takes for every version 1
+ * UUID (pass 1 to get those anyway):
+ *
+ *     > for _, uuid in ipairs(apr.uuid_batch(3, 'string', 7)) do print(uuid) end
+ *     01928a3e-51c0-7a2f-9d13-4be2c1e3a7f0
+ *     01928a3e-51c0-7a30-b86e-0f3c47d2e915
+ *     01928a3e-51c0-7a31-8f02-6a1d93b7c4e8
+ */
+
+int lua_apr_uuid_batch(lua_State *L)
+{
+  const char *options[] = { "binary", "string", NULL };
+  char formatted[APR_UUID_FORMATTED_LENGTH];
+  apr_uuid_t uuid;
+  int i, n, as_string, version;
+
+  n = luaL_checkint(L, 1);
+  luaL_argcheck(L, n >= 0, 1, "number of UUIDs must be positive");
+  as_string = luaL_checkoption(L, 2, "binary", options);
+  version = check_uuid_version(L, 3, 4);
+
+  lua_createtable(L, n, 0);
+  for (i = 1; i <= n; i++) {
+    uuid_generate(&uuid, version);
+    if (as_string) {
+      uuid_hexformat(formatted, uuid.data);
+      lua_pushlstring(L, formatted, sizeof formatted);
+    } else {
+      lua_pushlstring(L, (const char *) uuid.data, APR_UUID_LENGTH);
+    }
+    lua_rawseti(L, -2, i);
+  }
+
+  return 1;
+}
+
 /* apr.uuid_format(binary) -> formatted {{{1
  *
  * Format a UUID of 16 bytes following the standard format of 32 hexadecimal
@@ -48,7 +263,7 @@ int lua_apr_uuid_format(lua_State *L)
 {
   size_t length;
   const char *uuid;
-  char formatted[APR_UUID_FORMATTED_LENGTH + 1];
+  char formatted[APR_UUID_FORMATTED_LENGTH];
 
   uuid = luaL_checklstring(L, 1, &length);
 
@@ -57,8 +272,7 @@ int lua_apr_uuid_format(lua_State *L)
     luaL_argerror(L, 1, lua_pushfstring(L, msg, APR_UUID_LENGTH));
   }
 
-  /* pointer to structure == pointer to first element */
-  apr_uuid_format(formatted, (const apr_uuid_t *) uuid);
+  uuid_hexformat(formatted, (const unsigned char *) uuid);
   lua_pushlstring(L, formatted, APR_UUID_FORMATTED_LENGTH);
   return 1;
 }
@@ -0,0 +1,659 @@
+/* Write-ahead log module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * Making a record durable means writing it to a file and waiting for the
+ * operating system to flush it to disk using `fsync()`, which takes anywhere
+ * from a fraction of a millisecond to tens of milliseconds. When every
+ * thread does this by itself the number of durable records per second is
+ * limited by the latency of `fsync()`. A write-ahead log created with
+ * `apr.wal()` uses *group commit* instead: Records appended by different
+ * threads while a commit is in progress are collected and the next commit
+ * writes all of them using one `write()` and one `fdatasync()`, so the
+ * throughput grows with the number of concurrent threads. Write-ahead logs
+ * can be passed to other threads like all Lua/APR objects (see `apr.ref()`):
+ *
+ *     > wal = assert(apr.wal '/var/lib/jobs/queue.log')
+ *     > for i = 1, 4 do
+ *     >>  apr.thread(function()
+ *     >>    for j = 1, 1000 do
+ *     >>      local seq = assert(wal:append('job ' .. i .. '.' .. j))
+ *     >>      -- The record is on disk now.
+ *     >>    end
+ *     >>  end)
+ *     >> end
+ *
+ * Every record is stored with a 32 bit length and a [CRC-32C] [crc32c]
+ * checksum of the length and the data. When a log is opened it's scanned
+ * from the start to count the records and to remove a torn or corrupted tail
+ * left behind by a crash, after which `wal:replay()` returns at least the
+ * records whose `wal:append()` call succeeded. It can return more: records
+ * that were written by a commit whose `fdatasync()` failed, or that reached
+ * the disk before a crash prevented `wal:append()` from returning, are intact
+ * and are replayed as well. Records are numbered from one in the order they
+ * were written.
+ *
+ * [crc32c]: http://en.wikipedia.org/wiki/Cyclic_redundancy_check
+ */
+
+#include "lua_apr.h"
+#include <apr_portable.h>
+
+#if APR_HAS_THREADS
+
+#include <apr_thread_cond.h>
+#include <apr_thread_mutex.h>
+
+#if !defined(WIN32)
+# include <unistd.h>
+#endif
+
+/* Every record starts with a 32 bit length and a 32 bit checksum. */
+#define LUA_APR_WAL_HEADER 8
+
+/* The size of the chunks read by the recovery scan. */
+#define LUA_APR_WAL_SCANSIZE (1024 * 1024)
+
+/* Internal functions. {{{1 */
+
+typedef enum { WAL_SYNC_DATA, WAL_SYNC_FULL, WAL_SYNC_NONE } lua_apr_wal_sync;
+
+static const char *const wal_sync_names[] = { "data", "full", "none", NULL };
+
+/* The state of a log lives in its own memory pool so that the Lua object only
+ * contains a pointer (objects can be copied by apr.ref()). */
+typedef struct {
+  apr_pool_t *pool;            /* memory pool of log                       */
+  const char *path;            /* pathname of log file                     */
+  apr_file_t *handle;          /* log file, positioned at the end          */
+  apr_os_file_t fd;            /* native descriptor for fsync()            */
+  apr_thread_mutex_t *mutex;   /* protects everything below                */
+  apr_thread_cond_t *cond;     /* signals the end of a commit              */
+  lua_apr_buffer pending;      /* records waiting for the next commit      */
+  lua_apr_buffer committing;   /* records written by the current commit    */
+  lua_apr_wal_sync sync;       /* how to flush commits to disk             */
+  apr_interval_time_t delay;   /* time to wait for more records            */
+  apr_uint64_t last;           /* sequence number of last appended record  */
+  apr_uint64_t durable;        /* sequence number of last durable record   */
+  apr_uint64_t commits;        /* number of commits so far                 */
+  apr_off_t size;              /* size of log file after the last commit   */
+  int busy;                    /* is a commit in progress?                 */
+  int closed;                  /* has wal:close() been called?             */
+  apr_status_t status;         /* error of failed commit (log is unusable) */
+} lua_apr_wal_state;
+
+typedef struct {
+  lua_apr_refobj header;
+  lua_apr_wal_state *wal;
+} lua_apr_wal_object;
+
+/* crc32c() {{{2
+ *
+ * Update a CRC-32C (Castagnoli) checksum, four bits at a time.
+ */
+
+static apr_uint32_t crc32c(apr_uint32_t crc, const unsigned char *data, apr_size_t len)
+{
+  static const apr_uint32_t table[16] = {
+    0x00000000, 0x105ec76f, 0x20bd8ede, 0x30e349b1,
+    0x417b1dbc, 0x5125dad3, 0x61c69362, 0x7198540d,
+    0x82f63b78, 0x92a8fc17, 0xa24bb5a6, 0xb21572c9,
+    0xc38d26c4, 0xd3d3e1ab, 0xe330a81a, 0xf36e6f75,
+  };
+
+  while (len-- > 0) {
+    crc ^= *data++;
+    crc = (crc >> 4) ^ table[crc & 15];
+    crc = (crc >> 4) ^ table[crc & 15];
+  }
+
+  return crc;
+}
+
+/* record_checksum() {{{2
+ *
+ * Calculate the checksum of a record from its encoded length and its data.
+ */
+
+static apr_uint32_t record_checksum(const unsigned char *length, const char *data, apr_size_t size)
+{
+  apr_uint32_t crc = 0xFFFFFFFF;
+  crc = crc32c(crc, length, 4);
+  crc = crc32c(crc, (const unsigned char*) data, size);
+  return crc ^ 0xFFFFFFFF;
+}
+
+/* get_u32() and put_u32() {{{2 */
+
+static apr_uint32_t get_u32(const char *p)
+{
+  const unsigned char *u = (const unsigned char*) p;
+  return u[0] | (u[1] << 8) | (u[2] << 16) | ((apr_uint32_t) u[3] << 24);
+}
+
+static void put_u32(char *p, apr_uint32_t value)
+{
+  p[0] = (char) (value & 0xFF);
+  p[1] = (char) ((value >> 8) & 0xFF);
+  p[2] = (char) ((value >> 16) & 0xFF);
+  p[3] = (char) ((value >> 24) & 0xFF);
+}
+
+/* check_wal() {{{2 */
+
+static lua_apr_wal_state *check_wal(lua_State *L, int idx)
+{
+  lua_apr_wal_object *object = check_object(L, idx, &lua_apr_wal_type);
+  return object->wal;
+}
+
+/* scan_fill() {{{2
+ *
+ * Make sure the scan buffer contains at least @n bytes. Returns APR_EOF when
+ * the end of the file is reached first.
+ */
+
+static apr_status_t scan_fill(apr_file_t *handle, lua_apr_buffer *B, apr_size_t n)
+{
+  apr_status_t status;
+  apr_size_t len;
+
+  while (B->limit - B->index < n) {
+    status = reserve_buffer(B, n > LUA_APR_WAL_SCANSIZE ? n : LUA_APR_WAL_SCANSIZE);
+    if (status != APR_SUCCESS)
+      return status;
+    len = B->size - B->limit;
+    status = apr_file_read(handle, B->data + B->limit, &len);
+    if (status != APR_SUCCESS)
+      return status;
+    B->limit += len;
+  }
+
+  return APR_SUCCESS;
+}
+
+/* scan_log() {{{2
+ *
+ * Read the records of a log file from the start and verify their checksums.
+ * Scanning stops at the end of the file, at the first torn or corrupt record
+ * or after @last records (when nonzero). On return @count contains the number
+ * of valid records and @end the file offset after the last valid record.
+ *
+ * When @callback is a stack index the function at that index is called with
+ * the sequence number and data of the records from @first onwards. If the
+ * function raises an error *error is set and the error message is left on the
+ * stack.
+ */
+
+static apr_status_t scan_log(lua_State *L, apr_file_t *handle, int callback,
+    apr_uint64_t first, apr_uint64_t last, apr_uint64_t *count, apr_off_t *end,
+    int *error)
+{
+  lua_apr_buffer B = { 0, 0, 0, 0, NULL };
+  apr_status_t status;
+  apr_uint32_t length;
+  apr_finfo_t info;
+
+  *count = 0;
+  *end = 0;
+  status = apr_file_info_get(&info, APR_FINFO_SIZE, handle);
+  while (status == APR_SUCCESS && (last == 0 || *count < last)) {
+    /* Get the header and data of the next record. */
+    status = scan_fill(handle, &B, LUA_APR_WAL_HEADER);
+    if (status != APR_SUCCESS)
+      break;
+    length = get_u32(B.data + B.index);
+    if ((apr_off_t) length > info.size - *end - LUA_APR_WAL_HEADER)
+      break;
+    status = scan_fill(handle, &B, LUA_APR_WAL_HEADER + length);
+    if (status != APR_SUCCESS)
+      break;
+    if (record_checksum((unsigned char*) B.data + B.index,
+          B.data + B.index + LUA_APR_WAL_HEADER, length)
+        != get_u32(B.data + B.index + 4))
+      break;
+    *count += 1;
+    *end += LUA_APR_WAL_HEADER + length;
+    /* Pass the record to the callback? */
+    if (callback && *count >= first) {
+      lua_pushvalue(L, callback);
+      lua_pushnumber(L, (lua_Number) *count);
+      lua_pushlstring(L, B.data + B.index + LUA_APR_WAL_HEADER, length);
+      if (lua_pcall(L, 2, 0, 0) != 0) {
+        *error = 1;
+        break;
+      }
+    }
+    B.index += LUA_APR_WAL_HEADER + length;
+  }
+
+  free(B.data);
+
+  /* A torn tail at the end of the file isn't an error. */
+  return APR_STATUS_IS_EOF(status) ? APR_SUCCESS : status;
+}
+
+/* sync_log() {{{2
+ *
+ * Flush the log file to disk. APR doesn't have fdatasync() so this is
+ * implemented using the native API of the platform.
+ */
+
+static apr_status_t sync_log(lua_apr_wal_state *wal)
+{
+  if (wal->sync == WAL_SYNC_NONE)
+    return APR_SUCCESS;
+# if defined(WIN32)
+  if (!FlushFileBuffers(wal->fd))
+    return apr_get_os_error();
+# elif defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+  if ((wal->sync == WAL_SYNC_DATA ? fdatasync(wal->fd) : fsync(wal->fd)) != 0)
+    return apr_get_os_error();
+# else
+  if (fsync(wal->fd) != 0)
+    return apr_get_os_error();
+# endif
+  return APR_SUCCESS;
+}
+
+/* wait_durable() {{{2
+ *
+ * Wait until the record with sequence number @seq is durable, committing the
+ * pending records when no other thread is doing so. Must be called with the
+ * mutex locked; the mutex is released while the log file is written so that
+ * other threads can append records to the next commit in the mean time.
+ */
+
+static apr_status_t wait_durable(lua_apr_wal_state *wal, apr_uint64_t seq)
+{
+  apr_status_t status;
+  apr_uint64_t batch;
+  lua_apr_buffer swap;
+
+  while (wal->durable < seq && wal->status == APR_SUCCESS) {
+    if (wal->busy) {
+      /* Another thread is committing, our record is in the next commit. */
+      apr_thread_cond_wait(wal->cond, wal->mutex);
+      continue;
+    }
+    /* Become the thread that commits all pending records. */
+    wal->busy = 1;
+    if (wal->delay > 0) {
+      apr_thread_mutex_unlock(wal->mutex);
+      apr_sleep(wal->delay);
+      apr_thread_mutex_lock(wal->mutex);
+    }
+    swap = wal->committing;
+    wal->committing = wal->pending;
+    wal->pending = swap;
+    batch = wal->last;
+    apr_thread_mutex_unlock(wal->mutex);
+    status = apr_file_write_full(wal->handle, wal->committing.data,
+        wal->committing.limit, NULL);
+    if (status == APR_SUCCESS)
+      status = sync_log(wal);
+    apr_thread_mutex_lock(wal->mutex);
+    if (status == APR_SUCCESS) {
+      wal->durable = batch;
+      wal->size += wal->committing.limit;
+      wal->commits++;
+    } else {
+      /* The log file may contain part of the commit now, which is why the log
+       * can't be used anymore. The next apr.wal() call will remove it. */
+      wal->status = status;
+    }
+    wal->committing.index = wal->committing.limit = 0;
+    wal->busy = 0;
+    apr_thread_cond_broadcast(wal->cond);
+  }
+
+  return wal->durable >= seq ? APR_SUCCESS : wal->status;
+}
+
+/* destroy_wal() {{{2 */
+
+static void destroy_wal(lua_apr_wal_state *wal)
+{
+  free(wal->pending.data);
+  free(wal->committing.data);
+  apr_pool_destroy(wal->pool);
+}
+
+/* apr.wal(path [, options]) -> wal {{{1
+ *
+ * Open the write-ahead log at @path, creating the file when it doesn't exist.
+ * Existing logs are scanned to count their records. The scan stops at the
+ * first torn or corrupted record, which is removed from the file together with
+ * everything after it. A log should only be opened once at a time; pass the
+ * log object to other threads to share it. The optional @options table
+ * supports the following fields:
+ *
+ *  - `sync`: how commits are flushed to disk: the string `'data'` uses
+ *    `fdatasync()` (the default), `'full'` uses `fsync()` and `'none'`
+ *    doesn't flush at all (records are durable when the process crashes but
+ *    not when the system crashes)
+ *  - `delay`: the number of seconds the committing thread waits for other
+ *    threads to append records before it writes the commit (defaults to zero,
+ *    this trades latency for fewer commits)
+ *
+ * On success the log is returned, otherwise a nil followed by an error message
+ * is returned.
+ */
+
+int lua_apr_wal(lua_State *L)
+{
+  lua_apr_wal_object *object;
+  lua_apr_wal_sync sync = WAL_SYNC_DATA;
+  apr_interval_time_t delay = 0;
+  apr_status_t status;
+  apr_pool_t *pool;
+  const char *path;
+  lua_apr_wal_state *wal;
+  apr_uint64_t count;
+  apr_finfo_t info;
+  apr_off_t end;
+  int error = 0;
+
+  path = luaL_checkstring(L, 1);
+  if (!lua_isnoneornil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_getfield(L, 2, "sync");
+    if (!lua_isnil(L, -1))
+      sync = luaL_checkoption(L, -1, NULL, wal_sync_names);
+    lua_getfield(L, 2, "delay");
+    if (!lua_isnil(L, -1)) {
+      luaL_argcheck(L, lua_tonumber(L, -1) >= 0, 2, "delay can't be negative");
+      delay = (apr_interval_time_t) (luaL_checknumber(L, -1) * APR_USEC_PER_SEC);
+    }
+    lua_pop(L, 2);
+  }
+
+  status = apr_pool_create(&pool, NULL);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  wal = apr_pcalloc(pool, sizeof *wal);
+  wal->pool = pool;
+  wal->path = apr_pstrdup(pool, path);
+  wal->sync = sync;
+  wal->delay = delay;
+
+  /* Open the log file. */
+  status = apr_file_open(&wal->handle, path, APR_FOPEN_READ | APR_FOPEN_WRITE
+      | APR_FOPEN_CREATE | APR_FOPEN_BINARY, APR_FPROT_OS_DEFAULT, pool);
+  if (status == APR_SUCCESS)
+    status = apr_os_file_get(&wal->fd, wal->handle);
+
+  /* Count the records and remove a torn or corrupted tail. */
+  if (status == APR_SUCCESS)
+    status = scan_log(L, wal->handle, 0, 0, 0, &count, &end, &error);
+  if (status == APR_SUCCESS)
+    status = apr_file_info_get(&info, APR_FINFO_SIZE, wal->handle);
+  if (status == APR_SUCCESS && info.size > end) {
+    status = apr_file_trunc(wal->handle, end);
+    if (status == APR_SUCCESS)
+      status = sync_log(wal);
+  }
+  if (status == APR_SUCCESS)
+    status = apr_file_seek(wal->handle, APR_SET, &end);
+
+  if (status == APR_SUCCESS)
+    status = apr_thread_mutex_create(&wal->mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+  if (status == APR_SUCCESS)
+    status = apr_thread_cond_create(&wal->cond, pool);
+  if (status != APR_SUCCESS) {
+    destroy_wal(wal);
+    return push_error_status(L, status);
+  }
+  wal->last = wal->durable = count;
+  wal->size = end;
+
+  object = new_object(L, &lua_apr_wal_type);
+  object->wal = wal;
+  return 1;
+}
+
+/* wal:append(record [, ...]) -> seq {{{1
+ *
+ * Append one or more records (strings, blobs or byte buffers) to the log and
+ * wait until they're durable. The records are written to disk together with
+ * the records appended by other threads in the mean time. On success the
+ * sequence number of the (last) record is returned, otherwise a nil followed
+ * by an error message is returned. After a failed commit the log can't be
+ * used anymore because the log file may contain part of the commit; close it
+ * and open it again to remove the partial commit.
+ *
+ * When multiple records are given they end up in the same commit and they
+ * have consecutive sequence numbers.
+ */
+
+static int wal_append(lua_State *L)
+{
+  lua_apr_wal_state *wal;
+  apr_status_t status = APR_SUCCESS;
+  apr_uint64_t seq = 0;
+  const char *data;
+  size_t length, total = 0;
+  char *p;
+  int i, n;
+
+  wal = check_wal(L, 1);
+  n = lua_gettop(L);
+  luaL_checkany(L, 2);
+  for (i = 2; i <= n; i++) {
+    check_bytes(L, i, &length);
+    luaL_argcheck(L, length <= 0xFFFFFFFF, i, "record too large");
+    total += LUA_APR_WAL_HEADER + length;
+  }
+
+  /* Errors can't be raised while the mutex is locked. */
+  apr_thread_mutex_lock(wal->mutex);
+  if (wal->closed)
+    status = APR_EOF;
+  else if (wal->status != APR_SUCCESS)
+    status = wal->status;
+  else
+    status = reserve_buffer(&wal->pending, total);
+  if (status == APR_SUCCESS) {
+    for (i = 2; i <= n; i++) {
+      data = check_bytes(L, i, &length);
+      p = wal->pending.data + wal->pending.limit;
+      put_u32(p, (apr_uint32_t) length);
+      put_u32(p + 4, record_checksum((unsigned char*) p, data, length));
+      memcpy(p + LUA_APR_WAL_HEADER, data, length);
+      wal->pending.limit += LUA_APR_WAL_HEADER + length;
+    }
+    wal->last += n - 1;
+    seq = wal->last;
+    status = wait_durable(wal, seq);
+  }
+  apr_thread_mutex_unlock(wal->mutex);
+
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  lua_pushnumber(L, (lua_Number) seq);
+  return 1;
+}
+
+/* wal:replay(callback [, first]) -> count {{{1
+ *
+ * Call the function @callback with the sequence number and data of every
+ * durable record in the log, starting from the record with sequence number
+ * @first (defaults to 1). Records appended while the log is being replayed
+ * aren't included. The log file is read using a separate file handle so
+ * other threads can keep appending records. On success the number of records
+ * passed to @callback is returned, otherwise a nil followed by an error
+ * message is returned. Errors raised by @callback are propagated.
+ */
+
+static int wal_replay(lua_State *L)
+{
+  lua_apr_wal_state *wal;
+  apr_status_t status;
+  apr_uint64_t first, last, count;
+  apr_pool_t *pool;
+  apr_file_t *handle;
+  apr_off_t end;
+  lua_Number n;
+  int error = 0;
+
+  wal = check_wal(L, 1);
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  n = luaL_optnumber(L, 3, 1);
+  first = n > 1 ? (apr_uint64_t) n : 1;
+  lua_settop(L, 2);
+
+  apr_thread_mutex_lock(wal->mutex);
+  last = wal->durable;
+  apr_thread_mutex_unlock(wal->mutex);
+  if (first > last) {
+    lua_pushinteger(L, 0);
+    return 1;
+  }
+
+  status = apr_pool_create(&pool, NULL);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  status = apr_file_open(&handle, wal->path, APR_FOPEN_READ | APR_FOPEN_BINARY,
+      APR_FPROT_OS_DEFAULT, pool);
+  if (status == APR_SUCCESS)
+    status = scan_log(L, handle, 2, first, last, &count, &end, &error);
+  apr_pool_destroy(pool);
+
+  if (error)
+    return lua_error(L);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  lua_pushnumber(L, (lua_Number) (count >= first ? count - first + 1 : 0));
+  return 1;
+}
+
+/* wal:stats() -> table {{{1
+ *
+ * Get a table with statistics about the log:
+ *
+ *  - `records`: the sequence number of the last durable record
+ *  - `commits`: the number of commits since the log was opened (the number of
+ *    records appended since then divided by this number is the average
+ *    number of records per `fdatasync()`)
+ *  - `size`: the size of the log file in bytes
+ */
+
+static int wal_stats(lua_State *L)
+{
+  lua_apr_wal_state *wal;
+  apr_uint64_t durable, commits;
+  apr_off_t size;
+
+  wal = check_wal(L, 1);
+  apr_thread_mutex_lock(wal->mutex);
+  durable = wal->durable;
+  commits = wal->commits;
+  size = wal->size;
+  apr_thread_mutex_unlock(wal->mutex);
+
+  lua_createtable(L, 0, 3);
+  lua_pushnumber(L, (lua_Number) durable);
+  lua_setfield(L, -2, "records");
+  lua_pushnumber(L, (lua_Number) commits);
+  lua_setfield(L, -2, "commits");
+  lua_pushnumber(L, (lua_Number) size);
+  lua_setfield(L, -2, "size");
+
+  return 1;
+}
+
+/* wal:close() -> status {{{1
+ *
+ * Commit any pending records and close the log file. The log is closed for
+ * all threads that share it: Appending records afterwards fails with the
+ * error code `'EOF'`. On success true is returned, otherwise a nil followed
+ * by an error message is returned.
+ */
+
+static int wal_close(lua_State *L)
+{
+  lua_apr_wal_state *wal;
+  apr_status_t status;
+
+  wal = check_wal(L, 1);
+  apr_thread_mutex_lock(wal->mutex);
+  if (wal->closed) {
+    status = APR_SUCCESS;
+  } else {
+    status = wait_durable(wal, wal->last);
+    /* Don't close the file while another thread is still writing to it. */
+    while (wal->busy)
+      apr_thread_cond_wait(wal->cond, wal->mutex);
+    wal->closed = 1;
+    if (status == APR_SUCCESS)
+      status = apr_file_close(wal->handle);
+    else
+      apr_file_close(wal->handle);
+    wal->handle = NULL;
+  }
+  apr_thread_mutex_unlock(wal->mutex);
+
+  return push_status(L, status);
+}
+
+/* wal:__tostring() {{{1 */
+
+static int wal_tostring(lua_State *L)
+{
+  lua_apr_wal_object *object = check_object(L, 1, &lua_apr_wal_type);
+  if (!object->wal->closed)
+    lua_pushfstring(L, "%s (%p)", lua_apr_wal_type.friendlyname, object->wal);
+  else
+    lua_pushfstring(L, "%s (closed)", lua_apr_wal_type.friendlyname);
+  return 1;
+}
+
+/* wal:__gc() {{{1 */
+
+static int wal_gc(lua_State *L)
+{
+  lua_apr_wal_object *object = check_object(L, 1, &lua_apr_wal_type);
+  if (object_collectable((lua_apr_refobj*)object) && object->wal != NULL) {
+    /* Commit the records of threads that are still waiting (if any). */
+    apr_thread_mutex_lock(object->wal->mutex);
+    if (!object->wal->closed)
+      wait_durable(object->wal, object->wal->last);
+    apr_thread_mutex_unlock(object->wal->mutex);
+    destroy_wal(object->wal);
+    object->wal = NULL;
+  }
+  release_object((lua_apr_refobj*)object);
+  return 0;
+}
+
+/* }}}1 */
+
+static luaL_reg wal_methods[] = {
+  { "append", wal_append },
+  { "replay", wal_replay },
+  { "stats", wal_stats },
+  { "close", wal_close },
+  { NULL, NULL },
+};
+
+static luaL_reg wal_metamethods[] = {
+  { "__tostring", wal_tostring },
+  { "__eq", objects_equal },
+  { "__gc", wal_gc },
+  { NULL, NULL },
+};
+
+lua_apr_objtype lua_apr_wal_type = {
+  "lua_apr_wal_object*",      /* metatable name in registry */
+  "write-ahead log",          /* friendly object name */
+  sizeof(lua_apr_wal_object), /* structure size */
+  wal_methods,                /* methods table */
+  wal_metamethods             /* metamethods table */
+};
+
+#endif
+
+/* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
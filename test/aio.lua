@@ -0,0 +1,124 @@
+--[[
+
+ Unit tests for the asynchronous file I/O module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+local helpers = require 'apr.test.helpers'
+
+if not apr.aio then
+  helpers.warning "Asynchronous I/O not available! (APR was built without threads)\n"
+  return false
+end
+
+-- Wait for the given number of completions and index them by request id.
+local function collect(engine, count)
+  local results = {}
+  while count > 0 do
+    local completions = assert(engine:completions(1, 10))
+    assert(#completions > 0, "Timeout waiting for completions")
+    for _, completion in ipairs(completions) do
+      results[completion.id] = completion
+      count = count - 1
+    end
+  end
+  return results
+end
+
+local function testengine(options)
+
+  local engine = assert(apr.aio(options))
+  assert(apr.type(engine) == 'I/O engine')
+  assert(engine:backend() == 'io_uring' or engine:backend() == 'threads')
+  assert(tostring(engine):find '^I/O engine %(')
+  assert(not pcall(apr.ref, engine))
+
+  -- Test engine:open(), engine:write() and engine:fsync().
+  local path = helpers.tmpname()
+  local open_id = engine:open(path, 'w+b')
+  assert(engine:pending() == 1)
+  assert(engine:submit() == 1)
+  local results = collect(engine, 1)
+  assert(results[open_id].op == 'open')
+  local handle = results[open_id].result
+  assert(apr.type(handle) == 'file')
+  assert(engine:pending() == 0)
+
+  local blocks = {}
+  for i = 1, 16 do blocks[i] = string.rep(string.char(64 + i), 4096) end
+  local ids = {}
+  for i = 16, 1, -1 do
+    -- Write the blocks in reverse order (the offsets matter, not the order).
+    ids[i] = engine:write(handle, (i - 1) * 4096, i % 2 == 0 and blocks[i] or apr.buffer(blocks[i]))
+  end
+  results = collect(engine, 16)
+  for i = 1, 16 do
+    assert(results[ids[i]].op == 'write')
+    assert(results[ids[i]].result == 4096)
+    assert(results[ids[i]].file == handle)
+  end
+  local fsync_id = engine:fsync(handle, true)
+  results = collect(engine, 1)
+  assert(results[fsync_id].result == true)
+  assert(helpers.readfile(path) == table.concat(blocks))
+
+  -- Test engine:read() including reads past the end of the file.
+  for i = 1, 16 do ids[i] = engine:read(handle, (i - 1) * 4096, 4096) end
+  local short_id = engine:read(handle, 16 * 4096 - 10, 4096)
+  local eof_id = engine:read(handle, 16 * 4096, 4096)
+  assert(engine:pending() == 18)
+  results = collect(engine, 18)
+  for i = 1, 16 do assert(results[ids[i]].result == blocks[i]) end
+  assert(results[short_id].result == string.rep('P', 10))
+  assert(results[eof_id].result == '')
+
+  -- Test error reporting.
+  local missing_id = engine:open(helpers.tmpname())
+  results = collect(engine, 1)
+  assert(results[missing_id].result == nil)
+  assert(results[missing_id].error:find 'lua%-apr%-tempfile')
+  assert(results[missing_id].code == 'ENOENT')
+
+  -- Files opened for direct I/O are rejected.
+  assert(not pcall(engine.open, engine, path, 'rbd'))
+  local direct = apr.file_open(path, 'rbd')
+  if direct then
+    assert(not pcall(engine.read, engine, direct, 0, 4096))
+    assert(not pcall(engine.write, engine, direct, 0, 'data'))
+    assert(direct:close())
+  end
+
+  -- Test that engines can be added to pollsets.
+  local pollset = assert(apr.pollset(1))
+  assert(pollset:add(engine, 'input'))
+  local read_id = engine:read(handle, 0, 4096)
+  assert(engine:submit() == 1)
+  local readable = assert(pollset:poll(10 * 1000000))
+  assert(readable[1] == engine)
+  results = assert(engine:completions())
+  assert(#results == 1 and results[1].id == read_id)
+  assert(pollset:remove(engine))
+  assert(pollset:destroy())
+
+  -- Test engine:close() with requests in flight.
+  engine:read(handle, 0, 4096)
+  engine:submit()
+  engine:read(handle, 0, 4096)
+  assert(engine:close())
+  assert(not pcall(engine.submit, engine))
+  assert(handle:close())
+
+end
+
+testengine { backend = 'threads', threads = 2 }
+testengine()
@@ -0,0 +1,50 @@
+--[[
+
+ Unit tests for the immutable byte blobs module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+local helpers = require 'apr.test.helpers'
+
+-- Test apr.blob(), blob:size() and blob:tostring().
+local data = 'binary\0safe ' .. string.rep('payload ', 10000)
+local blob = assert(apr.blob(data))
+assert(apr.type(blob) == 'blob')
+assert(blob:size() == #data)
+assert(#blob == #data)
+assert(blob:tostring() == data)
+assert(blob:tostring(1, 6) == 'binary')
+assert(blob:tostring(-8) == 'payload ')
+assert(blob:tostring(10, 5) == '')
+assert(#apr.blob '' == 0 and apr.blob '':tostring() == '')
+assert(tostring(blob):find '^blob %(')
+
+-- Test that blobs survive apr.ref() and apr.deref().
+local reference = apr.deref(apr.ref(blob))
+assert(reference == blob)
+assert(reference:tostring() == data)
+
+-- Test that file:write() and socket:write() accept blobs.
+local tempfile = helpers.tmpname()
+local handle = assert(apr.file_open(tempfile, 'wb'))
+assert(handle:write('<', blob, '>', apr.blob 'small'))
+assert(handle:close())
+assert(helpers.readfile(tempfile) == '<' .. data .. '>small')
+handle = assert(apr.file_open(tempfile, 'a'))
+assert(handle:write(blob))
+assert(handle:close())
+assert(helpers.readfile(tempfile) == '<' .. data .. '>small' .. data)
+handle = assert(apr.file_open(tempfile, 'wb'))
+assert(not pcall(handle.write, handle, {}))
+assert(handle:close())
+assert(os.remove(tempfile))
@@ -0,0 +1,88 @@
+--[[
+
+ Unit tests for the byte buffers module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+local helpers = require 'apr.test.helpers'
+
+-- Test apr.buffer() and the basic buffer operations.
+local buffer = assert(apr.buffer())
+assert(apr.type(buffer) == 'buffer')
+assert(#buffer == 0 and buffer:peek() == '')
+assert(buffer:append('GET / HTTP/1.1\r\n', 42, apr.blob '\r\n\r\nbody') == buffer)
+assert(buffer:size() == #'GET / HTTP/1.1\r\n42\r\n\r\nbody')
+assert(buffer:peek(3) == 'GET')
+assert(select(2, buffer:find '\r\n\r\n') == 22)
+assert(buffer:find('\r\n', 17) == 19)
+assert(not buffer:find 'missing')
+assert(buffer:consume(4) == 'GET ')
+assert(buffer:find '/' == 1)
+assert(buffer:discard(select(2, buffer:find '\r\n\r\n')) == 18)
+assert(buffer:peek() == 'body')
+assert(buffer:consume(100) == 'body')
+assert(#buffer == 0)
+
+-- Appending a buffer to itself and to another buffer.
+buffer:append 'abc'
+buffer:append(buffer)
+assert(buffer:peek() == 'abcabc')
+local copy = apr.buffer(buffer)
+assert(copy:peek() == 'abcabc')
+assert(buffer:clear() == buffer and #buffer == 0 and #copy == 6)
+assert(#apr.buffer(1024 * 64) == 0)
+assert(not pcall(buffer.append, buffer, {}))
+
+-- Test file:read_into() and file:write() with buffers.
+local tempfile = helpers.tmpname()
+local data = string.rep('0123456789', 10000)
+local handle = assert(apr.file_open(tempfile, 'wb'))
+assert(handle:write(apr.buffer(data)))
+assert(handle:close())
+handle = assert(apr.file_open(tempfile, 'rb'))
+assert(handle:read(5) == '01234')
+assert(handle:read_into(buffer, 10) == 10)
+assert(buffer:peek() == '5678901234')
+local count
+repeat
+  count = handle:read_into(buffer, 4096)
+  assert(count == nil or count > 0)
+until not count
+assert(buffer:peek() == data:sub(6))
+assert(handle:read_into(buffer) == nil)
+assert(handle:close())
+
+-- Negative and huge counts.
+handle = assert(apr.file_open(tempfile, 'rb'))
+buffer:clear()
+assert(not pcall(handle.read_into, handle, buffer, -1))
+assert(not pcall(handle.read_into, handle, buffer, 0))
+repeat
+  count = handle:read_into(buffer, 2^62)
+  assert(count == nil or count > 0)
+until not count
+assert(buffer:peek() == data)
+assert(handle:close())
+assert(not pcall(apr.buffer, -1))
+assert(not pcall(apr.buffer, 2^62))
+assert(os.remove(tempfile))
+
+-- Test pipe:read_into() (pipes are file objects).
+local input, output = assert(apr.pipe_create())
+assert(output:write 'through a pipe')
+assert(output:close())
+buffer:clear()
+assert(input:read_into(buffer, 7) == 7)
+assert(input:read_into(buffer, 100) == 7)
+assert(buffer:peek() == 'through a pipe')
+assert(input:close())
@@ -47,3 +47,27 @@ assert(context:digest() == '2fd4e1c67a2d28fced849ee1bb76e7391b93eb12')
 assert(context:reset())
 assert(context:update 'The quick brown fox jumps over the lazy cog')
 assert(context:digest() == 'de9f2c7fd25e1b3afad3e85a0bd17d9b100db4b3')
+
+-- Test password validation and hashing on background threads.
+if apr.password_validate_async then
+  local job = assert(apr.password_validate_async(pass, hash))
+  assert(apr.type(job) == 'password job')
+  assert(job:wait() == true)
+  assert(job:ready())
+  job = assert(apr.password_validate_async('wrong', hash))
+  assert(not job:wait())
+  job = assert(apr.password_hash_async(pass, 'md5'))
+  local pollset = assert(apr.pollset(1))
+  assert(pollset:add(job, 'input'))
+  local readable = assert(pollset:poll(10 * 1000000))
+  assert(readable[1] == job)
+  local digest = assert(job:wait())
+  assert(digest:find '^%$apr1%$')
+  assert(apr.password_validate(pass, digest))
+  job = apr.password_hash_async(pass, 'bcrypt', 4)
+  if job then
+    digest = assert(job:wait(10))
+    assert(digest:find '^%$2y%$04%$')
+    assert(apr.password_validate_async(pass, digest):wait())
+  end
+end
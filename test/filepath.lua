@@ -113,6 +113,40 @@ for i = 1, #parts_in do
   end
 end
 
+-- Test apr.filepath_merge_all(). {{{1
+
+local merged, errors = assert(apr.filepath_merge_all('/var/www', { 'index.html', 'a/../b.css', '../etc/passwd' }, 'not-above-root'))
+assert(merged[1] == '/var/www/index.html')
+assert(merged[2] == '/var/www/b.css')
+assert(merged[3] == false)
+assert(type(errors[3]) == 'string' and errors[1] == nil)
+assert(#assert(apr.filepath_merge_all('/', {})) == 0)
+
+-- Test apr.filepath_cache(). {{{1
+
+local root = helpers.tmpname()
+assert(apr.dir_make(root))
+helpers.writefile(root .. '/index.html', 'Hello world!')
+local cache = assert(apr.filepath_cache(root, 2))
+assert(apr.type(cache) == 'path cache')
+local realpath, kind, size, mtime = assert(cache:resolve '/index.html')
+assert(realpath:find 'index.html$')
+assert(kind == 'file' and size == 12 and type(mtime) == 'number')
+assert(cache:resolve 'index.html' == realpath)
+local value, msg, code = cache:resolve '../index.html'
+assert(value == nil and code == 'EABOVEROOT')
+local value, msg, code = cache:resolve 'missing.html'
+assert(value == nil and code == 'ENOENT')
+-- Cached results stay until they're invalidated (or expire).
+helpers.writefile(root .. '/missing.html', '')
+assert(not cache:resolve 'missing.html')
+assert(cache:invalidate 'missing.html')
+assert(cache:resolve 'missing.html')
+assert(cache:invalidate())
+assert(os.remove(root .. '/missing.html'))
+assert(os.remove(root .. '/index.html'))
+assert(apr.dir_remove(root))
+
 -- Test apr.filepath_which() and apr.filepath_executable(). {{{1
 
 local lua_program = assert(apr.filepath_which 'lua')
@@ -113,6 +113,38 @@ Cookie: wiki=randkey&944319634&rev&1&id&4216
 
 assert(helpers.deepequal(expected, actual))
 
+-- Test apr.parse_headers() with a reusable table.
+local headers = { stale = 'value' }
+local actual, body = assert(apr.parse_headers(nl2crlf [[
+Host: lua-users.org
+Content-TYPE:  text/plain 
+X-Folded: first
+  second
+Set-Cookie: a=1
+set-cookie: b=2
+
+body]], headers))
+assert(actual == headers)
+assert(body == 'body')
+assert(helpers.deepequal(headers, {
+  ['host'] = 'lua-users.org',
+  ['content-type'] = 'text/plain',
+  ['x-folded'] = 'first second',
+  ['set-cookie'] = { 'a=1', 'b=2' },
+}))
+local actual, body = assert(apr.parse_headers('Connection: close', headers))
+assert(helpers.deepequal(headers, { connection = 'close' }))
+assert(body == '')
+local actual, body, msg, code = apr.parse_headers('Good: yes\r\nbad header\r\n\r\n', headers)
+assert(actual.good == 'yes' and code == 'BADHEADER')
+
+-- Test apr.parse_query_string() with a reusable table.
+local parameters = { stale = true }
+assert(apr.parse_query_string('key=1;key=2&key=3&novalue&a+b=c%20d', parameters) == parameters)
+assert(helpers.deepequal(parameters, { key = { '1', '2', '3' }, novalue = true, ['a b'] = 'c d' }))
+local actual, msg, code = apr.parse_query_string('bad=%zz', parameters)
+assert(actual.bad == '%zz' and code == 'BADSEQ')
+
 -- Test apr.parse_multipart() {{{1
 
 local expected = {
@@ -191,3 +223,26 @@ for plain, encoded in pairs(reserved) do
   assert(apr.uri_encode(plain) == encoded)
   assert(apr.uri_encode(plain) == encoded)
 end
+
+-- The decoder should invert the encoder for all bytes (binary safe).
+local bytes = {}
+for i = 0, 255 do bytes[#bytes + 1] = string.char(i) end
+bytes = table.concat(bytes)
+assert(apr.uri_decode(apr.uri_encode(bytes)) == bytes)
+assert(apr.uri_decode(apr.uri_encode(bytes, 'path'), 'path') == bytes)
+
+-- Form versus path encoding.
+assert(apr.uri_encode('a b/c+d') == 'a+b%2Fc%2Bd')
+assert(apr.uri_encode('a b/c+d', 'path') == 'a%20b/c+d')
+assert(apr.uri_decode('a+b%2Fc%2bd') == 'a b/c+d')
+assert(apr.uri_decode('a+b%2Fc', 'path') == 'a+b/c')
+
+-- Strings that don't need escaping are returned as is.
+assert(apr.uri_encode 'Plain-Text_1.0~' == 'Plain-Text_1.0~')
+assert(apr.uri_decode 'Plain-Text_1.0~' == 'Plain-Text_1.0~')
+
+-- Invalid escape sequences are reported.
+for _, invalid in ipairs { '%', '%4', '%zz', 'abc%4g' } do
+  local value, msg, code = apr.uri_decode(invalid)
+  assert(value == nil and code == 'BADSEQ')
+end
@@ -22,7 +22,10 @@
 -- Names of modules for which tests have been written (the individual lines
 -- enable automatic rebasing between git feature branches and master branch).
 local modules = {
+  'aio',
   'base64',
+  'blob',
+  'bytebuf',
   'crypt',
   'date',
   'dbd',
@@ -44,12 +47,14 @@ local modules = {
   'shm',
   'signal',
   'str',
+  'struct',
   'thread',
   'thread_queue',
   'time',
   'uri',
   'user',
   'uuid',
+  'wal',
   'xlate',
   'xml'
 }
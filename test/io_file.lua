@@ -215,3 +215,408 @@ for testsize = 1, maxmultiplier do
   assert(os.remove(apr_file))
 
 end
+
+-- Test file:text_mode(). {{{1
+
+local crlfname = helpers.tmpname()
+local lines = { 'first', 'second\r', '', 'fourth' }
+-- Write the lines in text mode (LF is expanded to CR LF).
+local handle = assert(apr.file_open(crlfname, 'wt'))
+assert(handle:text_mode() == true)
+assert(handle:write(table.concat(lines, '\n'):rep(500)))
+assert(handle:close())
+local crlfdata = table.concat(lines, '\r\n'):rep(500)
+assert(helpers.readfile(crlfname) == crlfdata)
+-- Binary mode is the default on UNIX (this is a no-op on Windows).
+handle = assert(apr.file_open(crlfname, 'rb'))
+assert(handle:text_mode() == false)
+assert(handle:read '*a' == crlfdata)
+assert(handle:close())
+-- Read everything at once in text mode.
+handle = assert(apr.file_open(crlfname, 'r'))
+assert(handle:text_mode(true) ~= nil)
+local textdata = table.concat(lines, '\n'):rep(500)
+assert(handle:read '*a' == textdata)
+assert(handle:close())
+-- Read in small chunks so that CR LF pairs straddle buffer boundaries.
+handle = assert(apr.file_open(crlfname, 'rt'))
+local chunks = {}
+for _, size in ipairs { 1, 2, 3, 5, 7, 1023, 1024, 1025 } do
+  chunks[#chunks + 1] = assert(handle:read(size))
+end
+chunks[#chunks + 1] = handle:read '*a'
+assert(table.concat(chunks) == textdata)
+-- Seeking discards translated input.
+assert(handle:seek('set', 0) == 0)
+assert(handle:read(7) == 'first\ns')
+assert(handle:text_mode(false) == true)
+assert(handle:seek('set', 7) == 7)
+assert(handle:read(8) == 'second\r\r')
+assert(handle:close())
+os.remove(crlfname)
+
+-- Test file:filter(). {{{1
+
+local gzname = helpers.tmpname()
+local handle = assert(apr.file_open(gzname, 'wb'))
+local status, errmsg, errcode = handle:filter 'gzip'
+if errcode == 'ENOTIMPL' then
+  helpers.warning "Compression filters not available, skipping tests.\n"
+  assert(handle:close())
+else
+  assert(status)
+  local plaintext = testdata:rep(1000)
+  assert(handle:write(plaintext))
+  assert(handle:flush())
+  assert(handle:write(plaintext))
+  assert(handle:close())
+  local compressed = helpers.readfile(gzname)
+  assert(compressed:sub(1, 2) == '\031\139') -- gzip magic
+  assert(#compressed < #plaintext)
+  -- Read it back line by line.
+  handle = assert(apr.file_open(gzname, 'rb'))
+  assert(handle:filter 'gzip')
+  local lines = {}
+  for line in handle:lines() do lines[#lines + 1] = line end
+  assert(handle:close())
+  assert(table.concat(lines, '\n') .. '\n' == plaintext:rep(2))
+  -- Seeking isn't possible in filtered files.
+  handle = assert(apr.file_open(gzname, 'rb'))
+  assert(handle:filter 'gzip')
+  assert(handle:read(#testdata) == testdata)
+  assert(select(3, handle:seek('set', 0)) == 'ENOTIMPL')
+  assert(handle:close())
+  -- A plain text header followed by compressed data that was already buffered.
+  handle = assert(apr.file_open(gzname, 'wb'))
+  assert(handle:write 'header\n')
+  assert(handle:filter('deflate', 9))
+  assert(handle:write(plaintext))
+  assert(handle:close())
+  handle = assert(apr.file_open(gzname, 'rb'))
+  assert(handle:read() == 'header')
+  assert(handle:filter 'deflate')
+  assert(handle:read '*a' == plaintext)
+  assert(handle:close())
+  -- Truncated streams are reported as errors.
+  helpers.writefile(gzname, compressed:sub(1, #compressed / 2))
+  handle = assert(apr.file_open(gzname, 'rb'))
+  assert(handle:filter 'gzip')
+  assert(select(3, handle:read '*a') == 'INCOMPLETE')
+  assert(handle:close())
+  -- Other formats are optional.
+  for _, format in ipairs { 'zstd', 'lz4' } do
+    handle = assert(apr.file_open(gzname, 'wb'))
+    local status, errmsg, errcode = handle:filter(format)
+    if status then
+      assert(handle:write(plaintext))
+      assert(handle:close())
+      handle = assert(apr.file_open(gzname, 'rb'))
+      assert(handle:filter(format))
+      assert(handle:read '*a' == plaintext)
+    else
+      assert(errcode == 'ENOTIMPL')
+    end
+    assert(handle:close())
+  end
+end
+os.remove(gzname)
+
+-- Test apr.splice() and apr.tee(). {{{1
+
+local source = helpers.tmpname()
+local target = helpers.tmpname()
+local payload = testdata:rep(1000)
+helpers.writefile(source, payload)
+
+-- Splice a file to a file, reading the first line through the buffer first.
+local input = assert(apr.file_open(source, 'rb'))
+local output = assert(apr.file_open(target, 'wb'))
+local firstline = assert(input:read())
+assert(output:write(firstline, '\n'))
+assert(apr.splice(input, output) == #payload - #firstline - 1)
+assert(input:close())
+assert(output:close())
+assert(helpers.readfile(target) == payload)
+
+-- Splice a limited number of bytes through a pipe.
+local pipe_in, pipe_out = assert(apr.pipe_create())
+local input = assert(apr.file_open(source, 'rb'))
+assert(apr.splice(input, pipe_out, 100) == 100)
+assert(input:close())
+assert(pipe_out:close())
+assert(pipe_in:read '*a' == payload:sub(1, 100))
+assert(pipe_in:close())
+
+-- Duplicate the contents of a pipe with apr.tee().
+local a_in, a_out = assert(apr.pipe_create())
+local b_in, b_out = assert(apr.pipe_create())
+assert(a_out:write 'duplicated')
+assert(a_out:flush())
+local count, message, code = apr.tee(a_in, b_out)
+if count then
+  assert(count == 10)
+  assert(b_out:close())
+  assert(b_in:read '*a' == 'duplicated')
+  assert(a_out:close())
+  assert(a_in:read '*a' == 'duplicated')
+else
+  assert(code == 'ENOTIMPL', message)
+end
+
+assert(os.remove(source))
+assert(os.remove(target))
+
+-- Test file:lock_range() and file:unlock_range(). {{{1
+
+local lockfile = helpers.tmpname()
+local first = assert(apr.file_open(lockfile, 'w'))
+local second = assert(apr.file_open(lockfile, 'w'))
+assert(first:lock_range('exclusive', 0, 10))
+-- Disjoint ranges don't conflict.
+assert(second:lock_range('exclusive', 10, 10, 'non-blocking'))
+assert(second:unlock_range(10, 10))
+-- Overlapping locks conflict on Linux (OFD locks) and Windows, but POSIX
+-- record locks on other platforms belong to the process so they don't.
+local status, message, code = second:lock_range('shared', 5, 10, 'non-blocking')
+if not status then
+  assert(code == 'EAGAIN', message)
+  local status, message, code = second:lock_range('shared', 5, 10, 0.05)
+  assert(code == 'TIMEUP', message)
+  assert(first:unlock_range(0, 10))
+  assert(second:lock_range('shared', 5, 10, 1))
+end
+assert(first:close())
+assert(second:close())
+
+-- Test atomic append mode. {{{1
+
+local appender = assert(apr.file_open(lockfile, 'w'))
+assert(appender:close())
+local a = assert(apr.file_open(lockfile, 'a'))
+local b = assert(apr.file_open(lockfile, 'a'))
+for i = 1, 100 do
+  assert(a:write('first ', i, '\n'))
+  assert(b:write('second ', i, '\n'))
+end
+assert(a:close())
+assert(b:close())
+local count = 0
+for line in io.lines(lockfile) do
+  assert(line:find '^first %d+$' or line:find '^second %d+$')
+  count = count + 1
+end
+assert(count == 200)
+
+-- More values than fit in one vectored write (IOV_MAX is usually 1024).
+local values = {}
+for i = 1, 2000 do values[i] = i .. '\n' end
+a = assert(apr.file_open(lockfile, 'ab'))
+assert(a:write(unpack(values)))
+assert(a:close())
+assert(helpers.readfile(lockfile):find(table.concat(values), 1, true))
+assert(os.remove(lockfile))
+
+-- Test file:read_until() and file:read_frame(). {{{1
+
+local framefile = helpers.tmpname()
+local long = string.rep('x', 5000)
+helpers.writefile(framefile, 'one\0two\0' .. long .. '\r\n\r\nrest')
+local handle = assert(apr.file_open(framefile, 'rb'))
+assert(handle:read_until '\0' == 'one')
+assert(handle:read_until '\0' == 'two')
+-- The delimiter can straddle the read buffer boundary.
+assert(handle:read_until '\r\n\r\n' == long)
+assert(handle:read_until '\0' == 'rest')
+assert(handle:read_until '\0' == nil)
+assert(handle:close())
+handle = assert(apr.file_open(framefile, 'rb'))
+local _, message, code = handle:read_until('\r\n\r\n', 100)
+assert(code == 'EOVERFLOW', message)
+assert(handle:close())
+
+helpers.writefile(framefile, '\0\5hello' .. '\3\0\0\0abc' .. '\0\0\0\0' .. '\0\9short')
+handle = assert(apr.file_open(framefile, 'rb'))
+assert(handle:read_frame 'u16be' == 'hello')
+assert(handle:read_frame 'u32le' == 'abc')
+assert(handle:read_frame 'u32be' == '')
+local _, message, code = handle:read_frame('u16be', 8)
+assert(code == 'EOVERFLOW', message)
+local _, message, code = handle:read_frame 'u16be'
+assert(code == 'EOF', message)
+assert(handle:close())
+handle = assert(apr.file_open(framefile, 'rb'))
+assert(handle:read_frame 'u8' == '')
+assert(handle:read_frame 'u8' == 'hello')
+assert(handle:close())
+assert(os.remove(framefile))
+
+-- Test file:read_records(). {{{1
+
+local csvfile = helpers.tmpname()
+helpers.writefile(csvfile, 'name,age,quote\r\n' ..
+    'alice,42,"says ""hi"""\r\n' ..
+    'bob,7,"multi\nline, with comma"\n' ..
+    ',,\n' ..
+    'last,3.5,unterminated')
+local handle = assert(apr.file_open(csvfile, 'rb'))
+local rows = assert(handle:read_records())
+assert(#rows == 5)
+helpers.checktuple({ 'name', 'age', 'quote' }, unpack(rows[1]))
+helpers.checktuple({ 'alice', '42', 'says "hi"' }, unpack(rows[2]))
+helpers.checktuple({ 'bob', '7', 'multi\nline, with comma' }, unpack(rows[3]))
+helpers.checktuple({ '', '', '' }, unpack(rows[4]))
+helpers.checktuple({ 'last', '3.5', 'unterminated' }, unpack(rows[5]))
+assert(handle:read_records() == nil)
+assert(handle:close())
+
+-- Selected columns, number conversion and batches.
+handle = assert(apr.file_open(csvfile, 'rb'))
+rows = assert(handle:read_records { fields = { 2, 1 }, numbers = true, batch = 2 })
+assert(#rows == 2)
+helpers.checktuple({ 'age', 'name' }, unpack(rows[1]))
+helpers.checktuple({ 42, 'alice' }, unpack(rows[2]))
+rows = assert(handle:read_records { fields = { 2 }, numbers = true })
+assert(#rows == 3 and rows[1][1] == 7 and rows[2][1] == '' and rows[3][1] == 3.5)
+assert(handle:close())
+
+-- Tab separated values without quoting, spanning many read buffers.
+local lines = {}
+for i = 1, 10000 do lines[i] = i .. '\t"' .. i .. '\tx' end
+helpers.writefile(csvfile, table.concat(lines, '\n') .. '\n')
+handle = assert(apr.file_open(csvfile, 'rb'))
+local count = 0
+for rows in function() return handle:read_records { sep = '\t', quote = false, numbers = true } end do
+  for _, row in ipairs(rows) do
+    count = count + 1
+    helpers.checktuple({ count, '"' .. count, 'x' }, unpack(row))
+  end
+end
+assert(count == 10000)
+assert(handle:close())
+
+-- Mixing file:read() (in text mode) with file:read_records().
+helpers.writefile(csvfile, 'header\r\n1,2\r\n3,4\r\n')
+handle = assert(apr.file_open(csvfile, 'r'))
+assert(handle:read() == 'header')
+rows = assert(handle:read_records { numbers = true, batch = 1 })
+assert(#rows == 1 and rows[1][1] == 1 and rows[1][2] == 2)
+assert(handle:read() == '3,4')
+assert(handle:read() == nil)
+assert(handle:close())
+
+-- A quoted field that isn't terminated before the end of the file.
+helpers.writefile(csvfile, 'a,b\nc,"d')
+handle = assert(apr.file_open(csvfile, 'rb'))
+rows = assert(handle:read_records())
+assert(#rows == 1)
+helpers.checktuple({ 'a', 'b' }, unpack(rows[1]))
+local status, message, code = handle:read_records()
+assert(not status and code == 'EOF', message)
+assert(handle:close())
+assert(os.remove(csvfile))
+
+-- Test direct I/O mode. {{{1
+
+local directfile = helpers.tmpname()
+local handle, message = apr.file_open(directfile, 'w+bd')
+if not handle then
+  -- Not all file systems support direct I/O (e.g. tmpfs doesn't).
+  helpers.warning("Skipping direct I/O tests: %s\n", message)
+else
+  -- Write more than one window (1 MB) in unaligned pieces.
+  local chunks = {}
+  for i = 1, 300 do chunks[i] = string.rep(string.char(32 + i % 90), 3000 + i) end
+  local data = table.concat(chunks)
+  for i = 1, #chunks do assert(handle:write(chunks[i])) end
+  assert(handle:flush())
+  assert(helpers.readfile(directfile) == data)
+  -- Read back from an unaligned offset.
+  assert(handle:seek('set', 5000) == 5000)
+  assert(handle:read(10000) == data:sub(5001, 15000))
+  assert(handle:seek('end', -123) == #data - 123)
+  assert(handle:read '*a' == data:sub(-123))
+  -- Overwrite a range that straddles block boundaries.
+  assert(handle:seek('set', 4000))
+  assert(handle:write(string.rep('!', 9000)))
+  data = data:sub(1, 4000) .. string.rep('!', 9000) .. data:sub(13001)
+  assert(handle:seek('set', 0) == 0)
+  assert(handle:read '*a' == data)
+  -- Truncate to an unaligned size and append.
+  assert(handle:truncate(10001))
+  assert(handle:write 'tail')
+  data = data:sub(1, 10001) .. 'tail'
+  assert(handle:close())
+  assert(helpers.readfile(directfile) == data)
+  handle = assert(apr.file_open(directfile, 'rbd'))
+  assert(handle:read '*a' == data)
+  assert(handle:close())
+  -- apr.splice() goes through the aligned window, in both directions.
+  local splicefile = helpers.tmpname()
+  handle = assert(apr.file_open(directfile, 'rbd'))
+  assert(handle:read(10) == data:sub(1, 10))
+  local output = assert(apr.file_open(splicefile, 'w+bd'))
+  assert(output:write 'head')
+  assert(apr.splice(handle, output) == #data - 10)
+  assert(handle:close())
+  assert(helpers.readfile(splicefile) == 'head' .. data:sub(11))
+  assert(output:seek('set', 0) == 0)
+  local copy = assert(apr.file_open(splicefile .. '.copy', 'wb'))
+  assert(apr.splice(output, copy) == #data - 6)
+  assert(copy:close())
+  assert(output:close())
+  assert(helpers.readfile(splicefile .. '.copy') == 'head' .. data:sub(11))
+  os.remove(splicefile)
+  os.remove(splicefile .. '.copy')
+  -- Direct I/O can't be combined with append mode.
+  local status, message, code = apr.file_open(directfile, 'abd')
+  assert(not status and code == 'EINVAL', message)
+end
+os.remove(directfile)
+
+-- Test file:allocate(), file:punch_hole() and file:seek('data'|'hole'). {{{1
+
+local sparsefile = helpers.tmpname()
+local handle = assert(apr.file_open(sparsefile, 'w+b'))
+local status, message, code = handle:allocate(0, 1024 * 1024, true)
+if not status then
+  helpers.warning("Skipping preallocation tests: %s\n", message)
+else
+  -- With keep_size the allocated space is beyond the end of the file.
+  assert(handle:stat 'size' == 0)
+  assert(handle:allocate(0, 65536))
+  assert(handle:stat 'size' == 65536)
+  assert(handle:write(string.rep('x', 100)))
+  assert(handle:truncate(100))
+  assert(handle:stat 'size' == 100)
+end
+assert(handle:close())
+
+-- Create a file with data, a hole and more data.
+local blocksize = 1024 * 1024
+handle = assert(apr.file_open(sparsefile, 'w+b'))
+assert(handle:write(string.rep('a', blocksize)))
+assert(handle:seek('set', blocksize * 3))
+assert(handle:write(string.rep('b', blocksize)))
+assert(handle:seek('set', 0))
+assert(handle:seek('data') == 0)
+local hole = assert(handle:seek 'hole')
+-- File systems that don't support holes report one at the end of the file.
+assert(hole == blocksize or hole == blocksize * 4)
+assert(handle:seek('data', hole) == (hole == blocksize and blocksize * 3 or nil))
+local status, message, code = handle:seek('data', blocksize * 4)
+assert(not status and code == 'EOF', message)
+local status, message, code = handle:seek('hole', blocksize * 4)
+assert(not status and code == 'EOF', message)
+
+-- Punch a hole in the data at the end and check that it reads as zeros.
+local status, message, code = handle:punch_hole(blocksize * 3, blocksize / 2)
+if not status then
+  helpers.warning("Skipping hole punching tests: %s\n", message)
+else
+  assert(handle:stat 'size' == blocksize * 4)
+  assert(handle:seek('set', blocksize * 3))
+  assert(handle:read(blocksize / 2) == string.rep('\0', blocksize / 2))
+  assert(handle:read(blocksize / 2) == string.rep('b', blocksize / 2))
+end
+assert(handle:close())
+assert(os.remove(sparsefile))
@@ -84,3 +84,52 @@ end))
 
 assert(server:join())
 assert(client:join())
+
+-- Test socket:response() and the HTTP response object. {{{1
+
+local http_port = math.random(10000, 50000)
+local http_server = assert(apr.socket_create())
+assert(http_server:bind('*', http_port))
+assert(http_server:listen(1))
+local large = string.rep('x', 10000)
+
+local server = assert(apr.thread(function()
+  local client = assert(http_server:accept())
+  local response = assert(client:response(404))
+  assert(tostring(response):find '^HTTP response %([x%x]+%)$')
+  assert(response:header('Content-Length', '5'):write('Oops!'):finish())
+  assert(not pcall(client.response, client, 200, 'OK\r\nX-Injected: a'))
+  response = assert(client:response(200, 'Fine'))
+  -- Header names and values can't be used to inject headers.
+  assert(not pcall(response.header, response, 'X-Injected', 'a\r\nb: c'))
+  assert(not pcall(response.header, response, 'X-Injected\n', 'a'))
+  assert(not pcall(response.header, response, 'X-Injected', 'a\0b'))
+  -- Chunked encoding is used when it's the last transfer coding.
+  response:header('Transfer-Encoding', 'gzip, chunked')
+  response:write('Hello ', 'world!')
+  assert(response:send())
+  response:write(large)
+  assert(response:finish())
+  assert(not pcall(response.write, response, 'too late'))
+  assert(client:close())
+end))
+
+local client = assert(apr.socket_create())
+assert(client:connect('localhost', http_port))
+assert(client:read() == 'HTTP/1.1 404 Not Found\r')
+assert(client:read() == 'Content-Length: 5\r')
+assert(client:read() == '\r')
+assert(client:read(5) == 'Oops!')
+assert(client:read() == 'HTTP/1.1 200 Fine\r')
+assert(client:read() == 'Transfer-Encoding: gzip, chunked\r')
+assert(client:read() == '\r')
+assert(client:read() == 'c\r')
+assert(client:read() == 'Hello world!\r')
+assert(client:read() == '2710\r')
+assert(client:read(#large) == large)
+assert(client:read() == '\r')
+assert(client:read() == '0\r')
+assert(client:read() == '\r')
+assert(server:join())
+assert(client:close())
+assert(http_server:close())
@@ -106,6 +106,56 @@ for option, typename in pairs {
   end
 end
 
+-- Test apr.ldap_pool(). {{{1
+local status, message = pcall(apr.ldap_pool, SERVER, { size = 'two' })
+assert(not status and message:find "option 'size' must be a number", message)
+assert(not pcall(apr.ldap_pool, SERVER, { idle_timeout = -1 }))
+local pool = assert(apr.ldap_pool(SERVER, { who = ACCOUNT, passwd = PASSWD, size = 2 }))
+assert(apr.type(pool) == 'LDAP connection pool')
+local conn1 = assert(pool:acquire())
+assert(apr.type(conn1) == 'LDAP connection')
+local conn2 = assert(pool:acquire())
+assert(not pool:acquire(), "Pool of size 2 handed out 3 connections?!")
+assert(select(2, pool:count()) == 0)
+assert(pool:release(conn1))
+assert(pool:release(conn2))
+local open, idle = pool:count()
+assert(open == 2 and idle == 2)
+-- Connections are reused.
+conn1 = assert(pool:acquire())
+assert(pool:count() == 2)
+assert(pool:release(conn1))
+-- Verification binds (empty passwords are never accepted).
+assert(not pool:verify(ACCOUNT or 'cn=nobody', ''))
+if ACCOUNT and PASSWD then
+  assert(pool:verify(ACCOUNT, PASSWD))
+  assert(not pool:verify(ACCOUNT, PASSWD .. '-invalid'))
+end
+-- Verification connections took the place of an idle bound connection.
+assert(pool:count() == 2)
+conn1 = assert(pool:acquire())
+assert(pool:release(conn1))
+-- Idle connections are evicted.
+local pool2 = assert(apr.ldap_pool(SERVER, { who = ACCOUNT, passwd = PASSWD, idle_timeout = 0.1 }))
+assert(pool2:release(assert(pool2:acquire())))
+apr.sleep(0.2)
+assert(pool2:evict() == 1)
+assert(pool2:count() == 0)
+-- The pool can be shared with other threads.
+if apr.thread then
+  local thread = assert(apr.thread(function(ref)
+    local status, apr = pcall(require, 'apr')
+    if not status then
+      pcall(require, 'luarocks.require')
+      apr = require 'apr'
+    end
+    local pool = assert(apr.deref(ref))
+    local conn = assert(pool:acquire())
+    assert(pool:release(conn))
+  end, apr.ref(pool)))
+  assert(thread:join())
+end
+
 -- Skip search tests when $LUA_APR_LDAP_BASE isn't set. {{{1
 if not BASE then
   helpers.warning "Please set $LUA_APR_LDAP_BASE to enable the LDAP search tests ..\n"
@@ -139,6 +189,50 @@ if next(attributes) then
   assert(attributes.givenName > 0, "No first names matched in LDAP directory?!")
 end
 
+-- Test paged, batched and asynchronous searches. {{{1
+local function count_entries(options)
+  local iterator, errmsg, code = ldap_conn:search(options)
+  if not iterator then
+    assert(code == 'ENOTIMPL', errmsg)
+    return
+  end
+  local count = 0
+  if options.batch then
+    for dns, entries in iterator do
+      assert(#dns == #entries)
+      count = count + #dns
+    end
+  else
+    for dn, attrs in iterator do count = count + 1 end
+  end
+  return count
+end
+local expected = count_entries { scope = 'sub', base = BASE }
+local paged = count_entries { scope = 'sub', base = BASE, pagesize = 2 }
+assert(paged == nil or paged == expected)
+assert(count_entries { scope = 'sub', base = BASE, batch = true } == expected)
+local paged = count_entries { scope = 'sub', base = BASE, pagesize = 2, batch = true }
+assert(paged == nil or paged == expected)
+
+-- Drive an asynchronous search from a pollset.
+local pollset = assert(apr.pollset(1))
+local next_entry = ldap_conn:search { scope = 'sub', base = BASE, async = true }
+assert(pollset:add(ldap_conn, 'input'))
+local count = 0
+while true do
+  local dn, attrs = next_entry()
+  if dn == nil then break end
+  if dn == false then
+    local readable = assert(pollset:poll(5 * 1000000))
+    assert(readable[1] == ldap_conn)
+  else
+    count = count + 1
+  end
+end
+assert(count == expected)
+assert(pollset:remove(ldap_conn))
+assert(pollset:destroy())
+
 -- Skip modification tests when $LUA_APR_LDAP_WRITE_ALLOWED isn't set. {{{1
 if not WRITE_ALLOWED then
   helpers.warning "Please set $LUA_APR_LDAP_WRITE_ALLOWED=yes to enable the LDAP modification tests ..\n"
@@ -32,6 +32,25 @@ assert(v.apreq == nil or v.apreq:find '^%d+%.%d+%.%d+$')
 -- Test status_to_name() (indirectly).
 assert(select(3, apr.stat("I assume this won't exist")) == 'ENOENT')
 
+-- Test apr.fast_errors() and apr.strerror()
+assert(apr.fast_errors() == false)
+local input, output = assert(apr.pipe_create())
+assert(input:timeout_set(0))
+local value, message, code = input:read(1)
+assert(value == nil and (code == 'EAGAIN' or code == 'TIMEUP'))
+assert(message ~= code)
+assert(apr.fast_errors(true) == false)
+local value, fastmessage, fastcode = input:read(1)
+assert(value == nil and fastcode == code and fastmessage == code)
+assert(apr.strerror(fastcode) == message)
+-- Other errors are still reported with a message.
+local value, message, code = apr.stat("I assume this won't exist")
+assert(code == 'ENOENT' and message ~= code)
+assert(apr.fast_errors(false) == true)
+assert(apr.fast_errors() == false)
+assert(input:close())
+assert(output:close())
+
 -- Test apr.os_default/locale_encoding()
 local default = apr.os_default_encoding()
 local locale = apr.os_locale_encoding()
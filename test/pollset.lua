@@ -80,4 +80,28 @@ end
 
 main()
 
+-- Test pollsets with pipes. {{{1
+
+local input, output = assert(apr.pipe_create())
+local pollset = assert(apr.pollset(1))
+assert(pollset:add(input, 'input'))
+local status, message, code = pollset:poll(0)
+assert(not status and code == 'TIMEUP', message)
+assert(output:write 'first line\nsecond line\n')
+assert(output:flush())
+local readable = assert(pollset:poll(1000000))
+assert(readable[1] == input)
+-- Reading the first line buffers the second line, which should still be
+-- reported as readable even though the pipe itself is now empty.
+assert(input:read() == 'first line')
+local readable = assert(pollset:poll(-1))
+assert(readable[1] == input)
+assert(input:read() == 'second line')
+local status, message, code = pollset:poll(0)
+assert(not status and code == 'TIMEUP', message)
+assert(pollset:remove(input))
+assert(pollset:destroy())
+assert(input:close())
+assert(output:close())
+
 -- vim: ts=2 sw=2 et tw=79 fen fdm=marker
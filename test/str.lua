@@ -29,6 +29,21 @@ assert(filenames[1] == 'RFC1.txt')
 assert(filenames[2] == 'rfc822.txt')
 assert(filenames[3] == 'RFC2086.txt')
 
+-- Test natural sorting of arrays.
+local filenames = { 'rfc2086.txt', 'rfc1.txt', 'rfc822.txt', 'RFC10.txt', 'img2.png', 'img10.png' }
+assert(apr.natsort(filenames) == filenames)
+assert(table.concat(filenames, ' ') == 'RFC10.txt img2.png img10.png rfc1.txt rfc822.txt rfc2086.txt')
+apr.natsort(filenames, true)
+assert(table.concat(filenames, ' ') == 'img2.png img10.png rfc1.txt RFC10.txt rfc822.txt rfc2086.txt')
+local records = { { name = 'b2' }, { name = 'a10' }, { name = 'a9' }, { name = 'b2', second = true } }
+apr.natsort(records, false, 'name')
+assert(records[1].name == 'a9' and records[2].name == 'a10')
+assert(records[3].name == 'b2' and not records[3].second and records[4].second) -- stable
+apr.natsort(records, false, function(r) return r.second and 'a' or r.name end)
+assert(records[1].second)
+assert(not pcall(apr.natsort, { 'a', {} }))
+assert(#apr.natsort {} == 0)
+
 -- Test binary size formatting.
 assert(apr.strfsize(1024^1) == '1.0K')
 assert(apr.strfsize(1024^2) == '1.0M')
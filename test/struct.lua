@@ -0,0 +1,79 @@
+--[[
+
+ Unit tests for the binary structures module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+local helpers = require 'apr.test.helpers'
+
+-- Test apr.struct(), struct:size(), struct:pack() and struct:unpack().
+local header = assert(apr.struct '>I4 H H s2')
+assert(apr.type(header) == 'struct')
+assert(header:size() == nil)
+local data = header:pack(0xCAFEBABE, 1, 2, 'name')
+assert(data == '\202\254\186\190\0\1\0\2\0\4name')
+helpers.checktuple({ 0xCAFEBABE, 1, 2, 'name', 15 }, header:unpack(data))
+
+local fixed = apr.struct '<b B h H i3 x c4 d'
+assert(fixed:size() == 1 + 1 + 2 + 2 + 3 + 1 + 4 + 8)
+data = fixed:pack(-1, 255, -2, 65535, -3, 'ab', 0.5)
+assert(data:sub(1, 6) == '\255\255\254\255\255\255')
+assert(data:sub(7, 9) == '\253\255\255')
+helpers.checktuple({ -1, 255, -2, 65535, -3, 'ab\0\0', 0.5, #data + 1 }, fixed:unpack(data))
+assert(apr.struct '>f':pack(1.5) == '\63\192\0\0')
+assert(apr.struct '<l':unpack(apr.struct '<l':pack(-123456789)) == -123456789)
+
+-- Invalid formats and values raise errors.
+assert(not pcall(apr.struct, 'q'))
+assert(not pcall(apr.struct, 'i9'))
+assert(not pcall(fixed.pack, fixed, 128, 0, 0, 0, 0, '', 0))
+assert(not pcall(fixed.pack, fixed, 0, 0, 0, 0, 0, 'too long', 0))
+assert(not pcall(header.unpack, header, 'short'))
+
+-- Test file:write_struct() and file:read_struct().
+local record = apr.struct '>H s1 d'
+local tempfile = helpers.tmpname()
+local handle = assert(apr.file_open(tempfile, 'wb'))
+for i = 1, 1000 do
+  assert(handle:write_struct(record, i, 'record ' .. i, i / 4))
+end
+assert(handle:write_struct('<I2', 42))
+assert(handle:close())
+handle = assert(apr.file_open(tempfile, 'rb'))
+for i = 1, 1000 do
+  helpers.checktuple({ i, 'record ' .. i, i / 4 }, handle:read_struct(record))
+end
+assert(handle:read_struct '<I2' == 42)
+assert(handle:read_struct '<I2' == nil)
+assert(handle:close())
+handle = assert(apr.file_open(tempfile, 'rb'))
+assert(handle:seek('end', -1))
+local value, message, code = handle:read_struct '<I2'
+assert(value == nil and code == 'EOF', message)
+assert(handle:close())
+
+-- Hostile length prefixes don't make file:read_struct() buffer without bound.
+handle = assert(apr.file_open(tempfile, 'wb'))
+assert(handle:write_struct('>s4', 'small'))
+assert(handle:write_struct('>I4', 1000000))
+assert(handle:write(string.rep('\255', 8)))
+assert(handle:close())
+handle = assert(apr.file_open(tempfile, 'rb'))
+assert(handle:read_struct('>s4', 1024) == 'small')
+local value, message, code = handle:read_struct('>s4', 1024)
+assert(value == nil and code == 'EOVERFLOW', message)
+assert(handle:seek('set', 13))
+local value, message, code = handle:read_struct '>s8'
+assert(value == nil and code == 'EOVERFLOW', message)
+assert(handle:close())
+assert(os.remove(tempfile))
@@ -46,6 +46,7 @@ local thread = assert(apr.thread(function()
     assert(queue:push(queue))
     assert(queue:push(apr.pipe_open_stdin()))
     assert(queue:push(apr.socket_create()))
+    assert(queue:push(apr.blob(string.rep('blob', 1000))))
   end, function(errmsg)
     helpers.message("Thread queue tests failed in child thread: %s\n", errmsg)
     assert(queue:terminate())
@@ -68,6 +69,7 @@ helpers.try(function()
   assert(assert(queue:pop()) == queue)
   assert(apr.type(queue:pop()) == 'file')
   assert(apr.type(queue:pop()) == 'socket')
+  assert(queue:pop():tostring() == string.rep('blob', 1000))
   -- Now make sure the queue is empty again.
   assert(not queue:trypop())
   -- Make sure trypush() works as expected.
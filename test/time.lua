@@ -47,3 +47,48 @@ local before = apr.time_now()
 apr.sleep(0.25)
 local after = apr.time_now()
 assert(string.format('%.1f', after - before):find '^0%.[123]$')
+
+-- Test that apr.clock_monotonic() never goes backwards and measures apr.sleep().
+local before = apr.clock_monotonic()
+apr.sleep(0.25)
+local after = apr.clock_monotonic()
+assert(after >= before)
+assert(string.format('%.1f', (after - before) / 1e9):find '^0%.[123]$')
+
+-- Test that apr.cycles() returns increasing numbers.
+local c1 = apr.cycles()
+local c2 = apr.cycles()
+assert(type(c1) == 'number' and c2 >= c1)
+
+-- Test interval timers (only available on Linux).
+local timer, message, code = apr.timerfd(0.1)
+if not timer then
+  assert(code == 'ENOTIMPL', message)
+else
+  assert(apr.type(timer) == 'timer')
+  assert(timer:interval_get() == 0.1)
+  -- Timers can be added to a pollset.
+  local pollset = assert(apr.pollset(1))
+  assert(pollset:add(timer, 'input'))
+  local readable = assert(pollset:poll(1000000))
+  assert(readable[1] == timer)
+  assert(timer:read() >= 1)
+  assert(pollset:remove(timer))
+  assert(pollset:destroy())
+  -- timer:wait() blocks until the timer expires.
+  assert(timer:wait() >= 1)
+  -- timer:set() changes the interval.
+  assert(timer:set(0.05))
+  assert(timer:interval_get() == 0.05)
+  assert(timer:close())
+  assert(tostring(timer):find 'closed')
+  -- A zero interval without an initial expiration creates a disarmed timer.
+  timer = assert(apr.timerfd(0))
+  assert(timer:interval_get() == 0)
+  apr.sleep(0.05)
+  assert(timer:read() == 0)
+  assert(timer:set(0, 0.01))
+  assert(timer:wait() == 1)
+  assert(not pcall(apr.timerfd, 0, 0))
+  assert(timer:close())
+end
@@ -36,3 +36,53 @@ assert(apr.uuid_format(('\255'):rep(16)) == 'ffffffff-ffff-ffff-ffff-fffffffffff
 -- Check that apr.uuid_parse() works.
 assert(apr.uuid_parse '00000000-0000-0000-0000-000000000000' == ('\0'):rep(16))
 assert(apr.uuid_parse 'ffffffff-ffff-ffff-ffff-ffffffffffff' == ('\255'):rep(16))
+
+-- Check that apr.uuid_batch() returns unique binary UUIDs.
+local set = {}
+local uuids = assert(apr.uuid_batch(1000))
+assert(#uuids == 1000)
+for _, uuid in ipairs(uuids) do
+  assert(#uuid == 16)
+  assert(not set[uuid], 'duplicate UUID!')
+  set[uuid] = true
+end
+
+-- Check that apr.uuid_batch() can return formatted UUIDs.
+local uuids = assert(apr.uuid_batch(10, 'string'))
+for _, uuid in ipairs(uuids) do
+  assert(uuid:find '^%x%x%x%x%x%x%x%x%-%x%x%x%x%-%x%x%x%x%-%x%x%x%x%-%x%x%x%x%x%x%x%x%x%x%x%x$')
+  assert(apr.uuid_format(apr.uuid_parse(uuid)) == uuid)
+  -- apr.uuid_batch() generates random (v4) UUIDs by default.
+  assert(uuid:find '^%x+%-%x+%-4%x+%-[89ab]%x+%-%x+$')
+end
+assert(#apr.uuid_batch(10, 'binary', 1) == 10)
+
+-- Check the version and variant bits of random (v4) UUIDs.
+for _, uuid in ipairs(apr.uuid_batch(100, 'string', 4)) do
+  assert(uuid:find '^%x+%-%x+%-4%x+%-[89ab]%x+%-%x+$')
+end
+
+-- Check that time ordered (v7) UUIDs sort in order of creation.
+local uuids = apr.uuid_batch(5000, 'string', 7)
+for i, uuid in ipairs(uuids) do
+  assert(uuid:find '^%x+%-%x+%-7%x+%-[89ab]%x+%-%x+$')
+  assert(i == 1 or uuids[i - 1] < uuid, 'v7 UUIDs not ordered!')
+end
+assert(apr.uuid_get(7) > uuids[#uuids])
+
+-- Check that a forked child doesn't repeat the random UUIDs of its parent.
+if apr.proc_fork then
+  local helpers = require 'apr.test.helpers'
+  local uuidfile = helpers.tmpname()
+  assert(apr.uuid_get(4)) -- make sure the generator is seeded before forking
+  local process, context = assert(apr.proc_fork())
+  if context == 'child' then
+    helpers.writefile(uuidfile, apr.uuid_format(apr.uuid_get(4)))
+    os.exit(0)
+  elseif context == 'parent' then
+    local uuid = apr.uuid_format(apr.uuid_get(4))
+    assert(helpers.wait_for(uuidfile, 10), "Forked child failed to create file?!")
+    assert(helpers.readfile(uuidfile) ~= uuid, "Forked child repeated UUID of parent!")
+    os.remove(uuidfile)
+  end
+end
@@ -0,0 +1,121 @@
+--[[
+
+ Unit tests for the write-ahead log module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+local helpers = require 'apr.test.helpers'
+
+if not apr.wal then
+  helpers.warning "Write-ahead logs not available! (APR was built without threads)\n"
+  return false
+end
+
+local function replay(wal, first)
+  local records = {}
+  local count = assert(wal:replay(function(seq, record)
+    records[#records + 1] = { seq, record }
+  end, first))
+  assert(count == #records)
+  return records
+end
+
+-- Test apr.wal(), wal:append() and wal:replay(). {{{1
+
+local path = helpers.tmpname()
+local wal = assert(apr.wal(path))
+assert(apr.type(wal) == 'write-ahead log')
+assert(tostring(wal):find '^write%-ahead log %(')
+assert(#replay(wal) == 0)
+assert(wal:append 'first' == 1)
+assert(wal:append('second', apr.blob 'third', apr.buffer 'fourth') == 4)
+assert(wal:append '' == 5)
+local records = replay(wal)
+assert(#records == 5)
+helpers.checktuple({ 1, 'first' }, unpack(records[1]))
+helpers.checktuple({ 3, 'third' }, unpack(records[3]))
+helpers.checktuple({ 5, '' }, unpack(records[5]))
+records = replay(wal, 4)
+assert(#records == 2 and records[1][1] == 4 and records[1][2] == 'fourth')
+assert(#replay(wal, 6) == 0)
+local stats = wal:stats()
+assert(stats.records == 5 and stats.commits == 3)
+assert(stats.size == #helpers.readfile(path))
+
+-- Errors raised by the callback are propagated.
+local status, message = pcall(wal.replay, wal, function() error 'oops' end)
+assert(not status and message:find 'oops')
+
+assert(wal:close())
+assert(tostring(wal) == 'write-ahead log (closed)')
+local status, message, code = wal:append 'closed'
+assert(not status and code == 'EOF', message)
+
+-- Test recovery of torn and corrupted records. {{{1
+
+-- Append half a record as if the system crashed during a commit.
+local data = helpers.readfile(path)
+helpers.writefile(path, data .. '\100\0\0\0\1\2\3\4partial')
+wal = assert(apr.wal(path, { sync = 'full' }))
+assert(wal:stats().records == 5)
+assert(#helpers.readfile(path) == #data)
+assert(wal:append 'sixth' == 6)
+assert(replay(wal)[6][2] == 'sixth')
+assert(wal:close())
+
+-- Corrupt the data of the third record: it's removed with everything after it.
+data = helpers.readfile(path)
+local offset = data:find 'third'
+helpers.writefile(path, data:sub(1, offset - 1) .. 'X' .. data:sub(offset + 1))
+wal = assert(apr.wal(path, { sync = 'none' }))
+assert(wal:stats().records == 2)
+assert(wal:append 'again' == 3)
+records = replay(wal)
+assert(#records == 3 and records[3][2] == 'again')
+assert(wal:close())
+
+-- Test group commit from multiple threads. {{{1
+
+if apr.thread then
+  assert(os.remove(path))
+  wal = assert(apr.wal(path))
+  local threads = {}
+  for i = 1, 4 do
+    threads[i] = assert(apr.thread(function()
+      local status, apr = pcall(require, 'apr')
+      if not status then
+        pcall(require, 'luarocks.require')
+        apr = require 'apr'
+      end
+      for j = 1, 100 do
+        assert(wal:append(i .. ':' .. j))
+      end
+    end))
+  end
+  for i = 1, #threads do assert(threads[i]:join()) end
+  stats = wal:stats()
+  assert(stats.records == 400)
+  assert(stats.commits <= 400)
+  -- The records of each thread appear in the order they were appended.
+  local last = {}
+  for _, record in ipairs(replay(wal)) do
+    local i, j = record[2]:match '^(%d+):(%d+)$'
+    i, j = tonumber(i), tonumber(j)
+    assert(j == (last[i] or 0) + 1)
+    last[i] = j
+  end
+  for i = 1, 4 do assert(last[i] == 100) end
+  assert(wal:close())
+end
+
+assert(os.remove(path))